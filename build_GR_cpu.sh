@@ -11,6 +11,8 @@ g++ -O3 -fopenmp \
     ext/gaussrecon_src/ANNAdapter.cpp \
     ext/wn_treecode/wn_treecode_cpu/wn_treecode_cpu_kernels.cpp \
     ext/wn_treecode/wn_treecode_cpu/wn_treecode_cpu_treeutils.cpp \
+    ext/wn_treecode/wn_treecode_cpu/wn_treecode_cpu_execution.cpp \
+    ext/wn_treecode/wn_treecode_cpu/wn_treecode_cpu_simd.cpp \
     -Iext/wn_treecode/wn_treecode_cpu/ \
     -Iext/gaussrecon_src/CLI11 -Iext/gaussrecon_src/ANN/include \
     -Lext/gaussrecon_src/ANN/lib \
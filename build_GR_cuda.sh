@@ -1,4 +1,4 @@
-nvcc -O3 \
+nvcc -O3 -Xcompiler -fopenmp -lgomp \
     ext/gaussrecon_src/Cube.cpp \
     ext/gaussrecon_src/MarchingCubes.cpp \
     ext/gaussrecon_src/Octree.cpp \
@@ -11,6 +11,7 @@ nvcc -O3 \
     ext/gaussrecon_src/ANNAdapter.cpp \
     ext/wn_treecode/wn_treecode_cuda/wn_treecode_cuda_kernels.cu \
     ext/wn_treecode/wn_treecode_cpu/wn_treecode_cpu_treeutils.cpp \
+    ext/wn_treecode/wn_treecode_cpu/wn_treecode_cpu_execution.cpp \
     -Iext/wn_treecode/wn_treecode_cpu/ \
     -Iext/wn_treecode/wn_treecode_cuda/ \
     -Iext/gaussrecon_src/CLI11 -Iext/gaussrecon_src/ANN/include \
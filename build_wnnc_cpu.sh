@@ -0,0 +1,10 @@
+g++ -O3 -fopenmp \
+    ext/wnnc_src/main_wnnc_cpu.cpp \
+    ext/wn_treecode/wn_treecode_cpu/wn_treecode_cpu_wnnc.cpp \
+    ext/wn_treecode/wn_treecode_cpu/wn_treecode_cpu_kernels.cpp \
+    ext/wn_treecode/wn_treecode_cpu/wn_treecode_cpu_treeutils.cpp \
+    ext/wn_treecode/wn_treecode_cpu/wn_treecode_cpu_execution.cpp \
+    ext/wn_treecode/wn_treecode_cpu/wn_treecode_cpu_simd.cpp \
+    -Iext/wn_treecode/wn_treecode_cpu/ \
+    -Iext/gaussrecon_src/CLI11 \
+    -o main_wnnc_cpu
@@ -48,6 +48,9 @@ struct SerializedTree {
     signedindex_t * const node2point_indexstart_ptr; // = std::vector<signedindex_t>(num_nodes, 0);
     used_dtype * const node_half_w_list_ptr; // = std::vector<used_dtype>(num_nodes, 0);
 
+	signedindex_t * const node_level_order_ptr; // = std::vector<signedindex_t>(num_nodes, 0);
+	signedindex_t * const node_level_offsets_ptr; // = std::vector<signedindex_t>(tree_depth + 2, 0);
+
 	SerializedTree(size_t in_num_nodes, signedindex_t in_tree_depth):
 		num_nodes(in_num_nodes),
 		tree_depth(in_tree_depth),
@@ -56,7 +59,9 @@ struct SerializedTree {
 		node_is_leaf_list_ptr(new bool[num_nodes]),
 		num_points_in_node_ptr(new signedindex_t[num_nodes]),
 		node2point_indexstart_ptr(new signedindex_t[num_nodes]),
-		node_half_w_list_ptr(new used_dtype[num_nodes])
+		node_half_w_list_ptr(new used_dtype[num_nodes]),
+		node_level_order_ptr(new signedindex_t[num_nodes]),
+		node_level_offsets_ptr(new signedindex_t[tree_depth + 2])
 	{
 		std::memset(node_parent_list_ptr, 		0, num_nodes * sizeof(signedindex_t));
 		std::memset(node_children_list_ptr, 	0, num_nodes * NUM_OCT_CHILDREN * sizeof(signedindex_t));
@@ -64,6 +69,8 @@ struct SerializedTree {
 		std::memset(num_points_in_node_ptr, 	0, num_nodes * sizeof(signedindex_t));
 		std::memset(node2point_indexstart_ptr, 	0, num_nodes * sizeof(signedindex_t));
 		std::memset(node_half_w_list_ptr, 		0, num_nodes * sizeof(used_dtype));
+		std::memset(node_level_order_ptr, 		0, num_nodes * sizeof(signedindex_t));
+		std::memset(node_level_offsets_ptr, 	0, (tree_depth + 2) * sizeof(signedindex_t));
 	}
 	SerializedTree(const SerializedTree & other):
 		num_nodes(other.num_nodes),
@@ -73,7 +80,9 @@ struct SerializedTree {
 		node_is_leaf_list_ptr(new bool[num_nodes]),
 		num_points_in_node_ptr(new signedindex_t[num_nodes]),
 		node2point_indexstart_ptr(new signedindex_t[num_nodes]),
-		node_half_w_list_ptr(new used_dtype[num_nodes])
+		node_half_w_list_ptr(new used_dtype[num_nodes]),
+		node_level_order_ptr(new signedindex_t[num_nodes]),
+		node_level_offsets_ptr(new signedindex_t[tree_depth + 2])
 	{
 		std::memcpy(node_parent_list_ptr, 		other.node_parent_list_ptr, 		num_nodes * sizeof(signedindex_t));
 		std::memcpy(node_children_list_ptr, 	other.node_children_list_ptr, 		num_nodes * NUM_OCT_CHILDREN * sizeof(signedindex_t));
@@ -81,6 +90,8 @@ struct SerializedTree {
 		std::memcpy(num_points_in_node_ptr, 	other.num_points_in_node_ptr, 		num_nodes * sizeof(signedindex_t));
 		std::memcpy(node2point_indexstart_ptr, 	other.node2point_indexstart_ptr, 	num_nodes * sizeof(signedindex_t));
 		std::memcpy(node_half_w_list_ptr, 		other.node_half_w_list_ptr, 		num_nodes * sizeof(used_dtype));
+		std::memcpy(node_level_order_ptr, 		other.node_level_order_ptr, 		num_nodes * sizeof(signedindex_t));
+		std::memcpy(node_level_offsets_ptr, 	other.node_level_offsets_ptr, 		(tree_depth + 2) * sizeof(signedindex_t));
 	}
 	~SerializedTree() {
 		delete [] node_parent_list_ptr;
@@ -89,6 +100,8 @@ struct SerializedTree {
 		delete [] num_points_in_node_ptr;
 		delete [] node2point_indexstart_ptr;
 		delete [] node_half_w_list_ptr;
+		delete [] node_level_order_ptr;
+		delete [] node_level_offsets_ptr;
 	}
 	// SerializedTree & operator=(const SerializedTree & other) {
 		
@@ -99,52 +112,42 @@ struct SerializedTree {
 /// @note @todo maybe Eigen is better, but I don't want to bother with it now.
 std::tuple<SerializedTree,				// the tree
 		   std::vector<signedindex_t>>	// node2point index
-build_tree(const std::vector<used_dtype> points_normalized, signedindex_t max_depth) {
+build_tree(const std::vector<used_dtype> points_normalized, signedindex_t max_depth, signedindex_t max_points_per_node) {
 
     const auto num_points = points_normalized.size() / 3;
 	cout << "[DEBUG] num_points: " << num_points << "\n";
-    std::vector<signedindex_t> point_indices(num_points);
-    for (signedindex_t i = 0; i < num_points; i++) {
-        point_indices[i] = i;
-    }
-
-    signedindex_t cur_node_index = 0;
-    auto root = build_tree_cpu_recursive<used_dtype>(
-        points_normalized.data(),
-        point_indices,
-        /*parent = */nullptr,
-        /*c_x, c_y, c_z = */0.0, 0.0, 0.0,
-        /*half_width = */1.0,
-        /*depth = */0,
-        /*cur_node_index = */cur_node_index,
-        /*max_depth = */max_depth,
-        /*max_points_per_node*/1
-    );
-
-    signedindex_t num_nodes = 0;
-    signedindex_t num_leaves = 0;
-    signedindex_t tree_depth = 0;
-    compute_tree_attributes<used_dtype>(root, num_nodes, num_leaves, tree_depth);
-    std::cout << "num_nodes: " << num_nodes << ", num_leaves: " << num_leaves << ", tree depth: " << tree_depth << "\n";
 
-    auto stdvec_node2point_index = std::vector<signedindex_t>();
-	SerializedTree serialized_tree(num_nodes, tree_depth);
-
-    serialize_tree_recursive(root,
-							 serialized_tree.node_parent_list_ptr,
-                             serialized_tree.node_children_list_ptr,
-                             serialized_tree.node_is_leaf_list_ptr,
-                             serialized_tree.node_half_w_list_ptr,
-                             serialized_tree.num_points_in_node_ptr,
-                             serialized_tree.node2point_indexstart_ptr,
-                             stdvec_node2point_index);
+	LinearOctree<used_dtype> tree;
+	build_tree_morton_cpu<used_dtype>(
+		points_normalized.data(),
+		num_points,
+		max_depth,
+		max_points_per_node,
+		tree
+	);
 
-    // auto node2point_index = torch::zeros({stdvec_node2point_index.size()}, long_tensor_options);
-    // std::memcpy(node2point_index.data<signedindex_t>(), stdvec_node2point_index.data(), stdvec_node2point_index.size()*sizeof(signedindex_t));
+    signedindex_t num_nodes = tree.num_nodes;
+    signedindex_t num_leaves = tree.num_leaves;
+    signedindex_t tree_depth = tree.tree_depth;
+    std::cout << "num_nodes: " << num_nodes << ", num_leaves: " << num_leaves << ", tree depth: " << tree_depth << "\n";
 
-    std::cout << "tree_depth*num_points: " << tree_depth*num_points << ", stdvec_node2point_index.size(): " << stdvec_node2point_index.size() << "\n";
+    auto stdvec_node2point_index = std::vector<signedindex_t>(num_points);
+	SerializedTree serialized_tree(num_nodes, tree_depth);
 
-    free_tree_recursive(root);
+	serialize_linear_octree<used_dtype>(tree,
+										serialized_tree.node_parent_list_ptr,
+										serialized_tree.node_children_list_ptr,
+										serialized_tree.node_is_leaf_list_ptr,
+										serialized_tree.node_half_w_list_ptr,
+										serialized_tree.num_points_in_node_ptr,
+										serialized_tree.node2point_indexstart_ptr,
+										stdvec_node2point_index.data());
+
+	compute_node_level_order(serialized_tree.node_parent_list_ptr,
+							 serialized_tree.node_level_order_ptr,
+							 serialized_tree.node_level_offsets_ptr,
+							 num_nodes,
+							 tree_depth);
 
     return {serialized_tree, stdvec_node2point_index};
 }
@@ -160,6 +163,11 @@ int main(int argc, char** argv) {
 	int minDepth = 1;
 	int maxDepth = 10;
 	int neighbors_area_est = 16;
+	int num_threads = -1;
+	bool tight_opening = false;
+	int query_packet_size = DEFAULT_QUERY_PACKET_SIZE;
+	used_dtype theta = TREECODE_THRESHOLD;
+	int leaf_size = 1;
 
 	used_dtype width = 0.01f;
     
@@ -170,8 +178,19 @@ int main(int argc, char** argv) {
 	app.add_option("-w", width, "smoothing width");
 	app.add_option("-m", minDepth, "min depth");
 	app.add_option("-d", maxDepth, "max depth");
+	app.add_option("-t", num_threads, "number of CPU threads, default: OpenMP default");
+	app.add_option("--theta", theta, "accuracy of the treecode, larger is more accurate and slower, relative error ~ 0.075/theta^2")
+		->check(CLI::PositiveNumber);
+	app.add_option("--leaf_size", leaf_size, "max number of points in a leaf of the treecode tree, 16-64 is faster (and more accurate) than the default 1")
+		->check(CLI::PositiveNumber);
+	app.add_flag("--tight_opening", tight_opening, "accept far-field tree nodes by the bounding box of their points about the reppoint, instead of the node cube");
+	app.add_option("--query_packet_size", query_packet_size, "walk the treecode tree once per run of up to N queries close to each other (default 32), 0 or 1 walks once per query")
+		->check(CLI::Range(0, MAX_QUERY_PACKET_SIZE));
 	
     CLI11_PARSE(app, argc, argv);
+	set_num_threads(num_threads);
+	set_opening_criterion(tight_opening ? OPENING_TIGHT : OPENING_CELL);
+	set_query_packet_size(query_packet_size);
 
 	if (maxDepth < minDepth) {
 		cout << "[In PGRExportQuery] WARNING: minDepth "
@@ -235,29 +254,22 @@ int main(int argc, char** argv) {
 	// octree for treecode winding number
 	// C++17 structured binding:
 	cout << "[DEBUG] wn_pts_input.size(): " << wn_pts_input.size() << "\n";
-    const auto [serialized_tree, node2point_index] = build_tree(wn_pts_input, /* max_depth = */15);
+    const auto [serialized_tree, node2point_index] = build_tree(wn_pts_input, /* max_depth = */15, leaf_size);
 
     signedindex_t num_nodes = serialized_tree.num_nodes;
     signedindex_t attr_dim = SPATIAL_DIM;	// normal dim
     assert(attr_dim == SPATIAL_DIM or attr_dim == 1);
 
-	/// why am I using new? because we have no std::vector<bool>
-	bool * const scattered_mask_ptr = new bool[num_nodes];
-    bool * const next_to_scatter_mask_ptr = new bool[num_nodes];
-    
     used_dtype * const out_node_attrs_ptr = new used_dtype[num_nodes * attr_dim];
     used_dtype * const out_node_reppoints_ptr = new used_dtype[num_nodes * SPATIAL_DIM];
     used_dtype * const out_node_weights_ptr = new used_dtype[num_nodes];
 
-	std::memset(scattered_mask_ptr, 0, num_nodes * sizeof(bool));
-	std::memset(next_to_scatter_mask_ptr, 0, num_nodes * sizeof(bool));
-
 	std::memset(out_node_attrs_ptr, 0, num_nodes * attr_dim * sizeof(used_dtype));
 	std::memset(out_node_reppoints_ptr, 0, num_nodes * SPATIAL_DIM * sizeof(used_dtype));
 	std::memset(out_node_weights_ptr, 0, num_nodes * sizeof(used_dtype));
 
-	scatter_point_attrs_to_nodes_leaf_cpu_kernel_launcher<used_dtype>(
-		serialized_tree.node_parent_list_ptr,
+	scatter_point_attrs_to_nodes_cpu_kernel_launcher<used_dtype>(
+		serialized_tree.node_children_list_ptr,
 		wn_pts_input.data(),
 		wn_pts_weights.data(),
 		wn_nml_input.data(),
@@ -265,43 +277,28 @@ int main(int argc, char** argv) {
 		serialized_tree.node2point_indexstart_ptr,
 		serialized_tree.num_points_in_node_ptr,
 		serialized_tree.node_is_leaf_list_ptr,
-		scattered_mask_ptr,
+		serialized_tree.node_level_order_ptr,
+		serialized_tree.node_level_offsets_ptr,
 		out_node_attrs_ptr,
 		out_node_reppoints_ptr,
 		out_node_weights_ptr,
 		attr_dim,
-		num_nodes
+		serialized_tree.tree_depth
 	);
 
-    for (signedindex_t depth = serialized_tree.tree_depth-1; depth >= 0; depth--) {
-		find_next_to_scatter_cpu_kernel_launcher<used_dtype>(
-			serialized_tree.node_children_list_ptr,
-			serialized_tree.node_is_leaf_list_ptr,
-			scattered_mask_ptr,
-			next_to_scatter_mask_ptr,
-			node2point_index.data(),
-			num_nodes
-		);
-
-		scatter_point_attrs_to_nodes_nonleaf_cpu_kernel_launcher<used_dtype>(
-			serialized_tree.node_parent_list_ptr,
-			serialized_tree.node_children_list_ptr,
-			wn_pts_input.data(),
-			wn_pts_weights.data(),
-			wn_nml_input.data(),
-			node2point_index.data(),
-			serialized_tree.node2point_indexstart_ptr,
-			serialized_tree.num_points_in_node_ptr,
-			serialized_tree.node_is_leaf_list_ptr,
-			scattered_mask_ptr,
-			next_to_scatter_mask_ptr,
-			out_node_attrs_ptr,
-			out_node_reppoints_ptr,
-			out_node_weights_ptr,
-			attr_dim,
-			num_nodes
-		);
-    }
+	// shared by both products, which use the same scatter
+	TreeTraversalCache<used_dtype> traversal_cache;
+	TraversalWorkspace<used_dtype> traversal_workspace;
+	prepare_tree_traversal_cache_cpu<used_dtype>(
+		wn_pts_input.data(),
+		serialized_tree.node_children_list_ptr,
+		serialized_tree.node_is_leaf_list_ptr,
+		node2point_index.data(),
+		serialized_tree.node2point_indexstart_ptr,
+		serialized_tree.num_points_in_node_ptr,
+		num_nodes,
+		traversal_cache
+	);
 
 	// kernel launch
 	std::vector<used_dtype> wn_queried(N_query_pts);
@@ -321,7 +318,11 @@ int main(int argc, char** argv) {
 		serialized_tree.num_points_in_node_ptr,
 		wn_queried.data(),           // [N, 3]
 		N_query_pts,
-		true
+		true,
+		0, nullptr, nullptr,
+		theta,
+		&traversal_cache,
+		&traversal_workspace
 	);
 
 	// for isovalue
@@ -341,7 +342,11 @@ int main(int argc, char** argv) {
 		serialized_tree.num_points_in_node_ptr,
 		wn_queried_at_input.data(),           // [N, 3]
 		N_sample_pts,
-		true
+		true,
+		0, nullptr, nullptr,
+		theta,
+		&traversal_cache,
+		&traversal_workspace
 	);
 
 	// cnpy::npy_save(outFileName + normalized_npy_suffix, &pts_normalized[0], {N_sample_pts, 3}, "w");
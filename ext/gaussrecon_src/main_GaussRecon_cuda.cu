@@ -53,6 +53,9 @@ struct SerializedTree {
     signedindex_t * const node2point_indexstart_ptr; // = std::vector<signedindex_t>(num_nodes, 0);
     used_dtype * const node_half_w_list_ptr; // = std::vector<used_dtype>(num_nodes, 0);
 
+	signedindex_t * const node_level_order_ptr; // = std::vector<signedindex_t>(num_nodes, 0);
+	signedindex_t * const node_level_offsets_ptr; // = std::vector<signedindex_t>(tree_depth + 2, 0);
+
 	SerializedTree(size_t in_num_nodes, signedindex_t in_tree_depth):
 		num_nodes(in_num_nodes),
 		tree_depth(in_tree_depth),
@@ -61,7 +64,9 @@ struct SerializedTree {
 		node_is_leaf_list_ptr(new bool[num_nodes]),
 		num_points_in_node_ptr(new signedindex_t[num_nodes]),
 		node2point_indexstart_ptr(new signedindex_t[num_nodes]),
-		node_half_w_list_ptr(new used_dtype[num_nodes])
+		node_half_w_list_ptr(new used_dtype[num_nodes]),
+		node_level_order_ptr(new signedindex_t[num_nodes]),
+		node_level_offsets_ptr(new signedindex_t[tree_depth + 2])
 	{
 		std::memset(node_parent_list_ptr, 		0, num_nodes * sizeof(signedindex_t));
 		std::memset(node_children_list_ptr, 	0, num_nodes * NUM_OCT_CHILDREN * sizeof(signedindex_t));
@@ -69,6 +74,8 @@ struct SerializedTree {
 		std::memset(num_points_in_node_ptr, 	0, num_nodes * sizeof(signedindex_t));
 		std::memset(node2point_indexstart_ptr, 	0, num_nodes * sizeof(signedindex_t));
 		std::memset(node_half_w_list_ptr, 		0, num_nodes * sizeof(used_dtype));
+		std::memset(node_level_order_ptr, 		0, num_nodes * sizeof(signedindex_t));
+		std::memset(node_level_offsets_ptr, 	0, (tree_depth + 2) * sizeof(signedindex_t));
 	}
 	SerializedTree(const SerializedTree & other):
 		num_nodes(other.num_nodes),
@@ -78,7 +85,9 @@ struct SerializedTree {
 		node_is_leaf_list_ptr(new bool[num_nodes]),
 		num_points_in_node_ptr(new signedindex_t[num_nodes]),
 		node2point_indexstart_ptr(new signedindex_t[num_nodes]),
-		node_half_w_list_ptr(new used_dtype[num_nodes])
+		node_half_w_list_ptr(new used_dtype[num_nodes]),
+		node_level_order_ptr(new signedindex_t[num_nodes]),
+		node_level_offsets_ptr(new signedindex_t[tree_depth + 2])
 	{
 		std::memcpy(node_parent_list_ptr, 		other.node_parent_list_ptr, 		num_nodes * sizeof(signedindex_t));
 		std::memcpy(node_children_list_ptr, 	other.node_children_list_ptr, 		num_nodes * NUM_OCT_CHILDREN * sizeof(signedindex_t));
@@ -86,6 +95,8 @@ struct SerializedTree {
 		std::memcpy(num_points_in_node_ptr, 	other.num_points_in_node_ptr, 		num_nodes * sizeof(signedindex_t));
 		std::memcpy(node2point_indexstart_ptr, 	other.node2point_indexstart_ptr, 	num_nodes * sizeof(signedindex_t));
 		std::memcpy(node_half_w_list_ptr, 		other.node_half_w_list_ptr, 		num_nodes * sizeof(used_dtype));
+		std::memcpy(node_level_order_ptr, 		other.node_level_order_ptr, 		num_nodes * sizeof(signedindex_t));
+		std::memcpy(node_level_offsets_ptr, 	other.node_level_offsets_ptr, 		(tree_depth + 2) * sizeof(signedindex_t));
 	}
 	~SerializedTree() {
 		delete [] node_parent_list_ptr;
@@ -94,6 +105,8 @@ struct SerializedTree {
 		delete [] num_points_in_node_ptr;
 		delete [] node2point_indexstart_ptr;
 		delete [] node_half_w_list_ptr;
+		delete [] node_level_order_ptr;
+		delete [] node_level_offsets_ptr;
 	}
 	// SerializedTree & operator=(const SerializedTree & other) {
 		
@@ -117,6 +130,9 @@ struct SerializedTreeCUDA {
 
     signedindex_t * node2point_index_ptr_d; // = std::vector<signedindex_t>(num_nodes, 0);
 
+	signedindex_t * node_level_order_ptr_d; // = std::vector<signedindex_t>(num_nodes, 0);
+	std::vector<signedindex_t> node_level_offsets;	// kept on the host, it sizes the per-level kernel launches
+
 	// SerializedTree(size_t in_num_nodes, signedindex_t in_tree_depth):
 	// 	num_nodes(in_num_nodes),
 	// 	tree_depth(in_tree_depth),
@@ -136,7 +152,8 @@ struct SerializedTreeCUDA {
 	// }
 	SerializedTreeCUDA(const SerializedTree & other, const std::vector<signedindex_t> node2point_index):
 		num_nodes(other.num_nodes),
-		tree_depth(other.tree_depth) {
+		tree_depth(other.tree_depth),
+		node_level_offsets(other.node_level_offsets_ptr, other.node_level_offsets_ptr + other.tree_depth + 2) {
 		
 		cudaMalloc(&node_parent_list_ptr_d, 		num_nodes * sizeof(signedindex_t));
 		cudaMalloc(&node_children_list_ptr_d, 		num_nodes * NUM_OCT_CHILDREN * sizeof(signedindex_t));
@@ -145,6 +162,7 @@ struct SerializedTreeCUDA {
 		cudaMalloc(&node2point_indexstart_ptr_d, 	num_nodes * sizeof(signedindex_t));
 		cudaMalloc(&node_half_w_list_ptr_d, 		num_nodes * sizeof(used_dtype));
 		cudaMalloc(&node2point_index_ptr_d, 		node2point_index.size() * sizeof(signedindex_t));
+		cudaMalloc(&node_level_order_ptr_d, 		num_nodes * sizeof(signedindex_t));
 
 		cudaMemcpy(node_parent_list_ptr_d, 			other.node_parent_list_ptr, 		num_nodes * sizeof(signedindex_t),	cudaMemcpyHostToDevice);
 		cudaMemcpy(node_children_list_ptr_d, 		other.node_children_list_ptr, 		num_nodes * NUM_OCT_CHILDREN * sizeof(signedindex_t),	cudaMemcpyHostToDevice);
@@ -153,6 +171,7 @@ struct SerializedTreeCUDA {
 		cudaMemcpy(node2point_indexstart_ptr_d, 	other.node2point_indexstart_ptr, 	num_nodes * sizeof(signedindex_t), 	cudaMemcpyHostToDevice);
 		cudaMemcpy(node_half_w_list_ptr_d, 			other.node_half_w_list_ptr, 		num_nodes * sizeof(used_dtype),		cudaMemcpyHostToDevice);		
 		cudaMemcpy(node2point_index_ptr_d, 			node2point_index.data(),	 		node2point_index.size() * sizeof(signedindex_t), 	cudaMemcpyHostToDevice);
+		cudaMemcpy(node_level_order_ptr_d, 			other.node_level_order_ptr, 		num_nodes * sizeof(signedindex_t),	cudaMemcpyHostToDevice);
 	}
 	~SerializedTreeCUDA() {
 		cudaFree(node_parent_list_ptr_d);
@@ -162,6 +181,7 @@ struct SerializedTreeCUDA {
 		cudaFree(node2point_indexstart_ptr_d);
 		cudaFree(node_half_w_list_ptr_d);
 		cudaFree(node2point_index_ptr_d);
+		cudaFree(node_level_order_ptr_d);
 	}
 	// SerializedTree & operator=(const SerializedTree & other) {
 		
@@ -172,52 +192,42 @@ struct SerializedTreeCUDA {
 /// @note @todo maybe Eigen is better, but I don't want to bother with it now.
 std::pair<SerializedTree,				// the tree
 		   std::vector<signedindex_t>>	// node2point index
-build_tree(const std::vector<used_dtype> points_normalized, signedindex_t max_depth) {
+build_tree(const std::vector<used_dtype> points_normalized, signedindex_t max_depth, signedindex_t max_points_per_node) {
 
     const auto num_points = points_normalized.size() / 3;
 	cout << "[DEBUG] num_points: " << num_points << "\n";
-    std::vector<signedindex_t> point_indices(num_points);
-    for (signedindex_t i = 0; i < num_points; i++) {
-        point_indices[i] = i;
-    }
 
-    signedindex_t cur_node_index = 0;
-    auto root = build_tree_cpu_recursive<used_dtype>(
-        points_normalized.data(),
-        point_indices,
-        /*parent = */nullptr,
-        /*c_x, c_y, c_z = */0.0, 0.0, 0.0,
-        /*half_width = */1.0,
-        /*depth = */0,
-        /*cur_node_index = */cur_node_index,
-        /*max_depth = */max_depth,
-        /*max_points_per_node*/1
-    );
-
-    signedindex_t num_nodes = 0;
-    signedindex_t num_leaves = 0;
-    signedindex_t tree_depth = 0;
-    compute_tree_attributes<used_dtype>(root, num_nodes, num_leaves, tree_depth);
+	LinearOctree<used_dtype> tree;
+	build_tree_morton_cpu<used_dtype>(
+		points_normalized.data(),
+		num_points,
+		max_depth,
+		max_points_per_node,
+		tree
+	);
+
+    signedindex_t num_nodes = tree.num_nodes;
+    signedindex_t num_leaves = tree.num_leaves;
+    signedindex_t tree_depth = tree.tree_depth;
     std::cout << "num_nodes: " << num_nodes << ", num_leaves: " << num_leaves << ", tree depth: " << tree_depth << "\n";
 
-    auto stdvec_node2point_index = std::vector<signedindex_t>();
+    auto stdvec_node2point_index = std::vector<signedindex_t>(num_points);
 	SerializedTree serialized_tree(num_nodes, tree_depth);
 
-    serialize_tree_recursive(root,
-							 serialized_tree.node_parent_list_ptr,
-                             serialized_tree.node_children_list_ptr,
-                             serialized_tree.node_is_leaf_list_ptr,
-                             serialized_tree.node_half_w_list_ptr,
-                             serialized_tree.num_points_in_node_ptr,
-                             serialized_tree.node2point_indexstart_ptr,
-                             stdvec_node2point_index);
-
-    // auto node2point_index = torch::zeros({stdvec_node2point_index.size()}, long_tensor_options);
-    // std::memcpy(node2point_index.data<signedindex_t>(), stdvec_node2point_index.data(), stdvec_node2point_index.size()*sizeof(signedindex_t));
-
-    std::cout << "tree_depth*num_points: " << tree_depth*num_points << ", stdvec_node2point_index.size(): " << stdvec_node2point_index.size() << "\n";
-
-    free_tree_recursive(root);
+	serialize_linear_octree<used_dtype>(tree,
+										serialized_tree.node_parent_list_ptr,
+										serialized_tree.node_children_list_ptr,
+										serialized_tree.node_is_leaf_list_ptr,
+										serialized_tree.node_half_w_list_ptr,
+										serialized_tree.num_points_in_node_ptr,
+										serialized_tree.node2point_indexstart_ptr,
+										stdvec_node2point_index.data());
+
+	compute_node_level_order(serialized_tree.node_parent_list_ptr,
+							 serialized_tree.node_level_order_ptr,
+							 serialized_tree.node_level_offsets_ptr,
+							 num_nodes,
+							 tree_depth);
 
     return {serialized_tree, stdvec_node2point_index};
 }
@@ -233,6 +243,9 @@ int main(int argc, char** argv) {
 	int minDepth = 1;
 	int maxDepth = 10;
 	int neighbors_area_est = 16;
+	int num_threads = -1;
+	used_dtype theta = TREECODE_THRESHOLD;
+	int leaf_size = 1;
 	used_dtype width = 0.01f;
     
     CLI::App app("GaussRecon_cuda");
@@ -242,8 +255,14 @@ int main(int argc, char** argv) {
 	app.add_option("-w", width, "smoothing width");
 	app.add_option("-m", minDepth, "min depth");
 	app.add_option("-d", maxDepth, "max depth");
+	app.add_option("-t", num_threads, "number of CPU threads, default: OpenMP default");
+	app.add_option("--theta", theta, "accuracy of the treecode, larger is more accurate and slower, relative error ~ 0.075/theta^2")
+		->check(CLI::PositiveNumber);
+	app.add_option("--leaf_size", leaf_size, "max number of points in a leaf of the treecode tree, 16-64 is faster (and more accurate) than the default 1")
+		->check(CLI::PositiveNumber);
 	
     CLI11_PARSE(app, argc, argv);
+	set_num_threads(num_threads);
 
 	if (maxDepth < minDepth) {
 		cout << "[In PGRExportQuery] WARNING: minDepth "
@@ -307,7 +326,7 @@ int main(int argc, char** argv) {
 	// octree for treecode winding number
 	// C++17 structured binding:
 	cout << "[DEBUG] wn_pts_input.size(): " << wn_pts_input.size() << "\n";
-    const auto serialized_tree_and_node2point_index = build_tree(wn_pts_input, /* max_depth = */15);
+    const auto serialized_tree_and_node2point_index = build_tree(wn_pts_input, /* max_depth = */15, leaf_size);
 
 	SerializedTreeCUDA serialized_tree_cuda(serialized_tree_and_node2point_index.first, serialized_tree_and_node2point_index.second);
 
@@ -315,9 +334,6 @@ int main(int argc, char** argv) {
     signedindex_t attr_dim = SPATIAL_DIM;	// normal dim
     assert(attr_dim == SPATIAL_DIM or attr_dim == 1);
 
-	/// why am I using new? because we have no std::vector<bool>
-	bool * scattered_mask_ptr_d; // = new bool[num_nodes];
-    bool * next_to_scatter_mask_ptr_d; // = new bool[num_nodes];
     used_dtype * out_node_attrs_ptr_d; // = new used_dtype[num_nodes * attr_dim];
     used_dtype * out_node_reppoints_ptr_d; // = new used_dtype[num_nodes * SPATIAL_DIM];
     used_dtype * out_node_weights_ptr_d; // = new used_dtype[num_nodes];
@@ -331,8 +347,6 @@ int main(int argc, char** argv) {
 	used_dtype * wn_queried_ptr_d; // for 
     used_dtype * wn_queried_input_ptr_d; // for 
 
-	cudaMalloc(&scattered_mask_ptr_d, 			num_nodes * sizeof(bool));
-	cudaMalloc(&next_to_scatter_mask_ptr_d, 	num_nodes * sizeof(bool));
 	cudaMalloc(&out_node_attrs_ptr_d, 			num_nodes * attr_dim * sizeof(used_dtype));
 	cudaMalloc(&out_node_reppoints_ptr_d, 		num_nodes * SPATIAL_DIM * sizeof(used_dtype));
 	cudaMalloc(&out_node_weights_ptr_d, 		num_nodes * sizeof(used_dtype));
@@ -346,8 +360,6 @@ int main(int argc, char** argv) {
 	cudaMalloc(&wn_queried_ptr_d, 				N_query_pts * sizeof(used_dtype));
 	cudaMalloc(&wn_queried_input_ptr_d,			N_sample_pts * sizeof(used_dtype));
 
-	cudaMemset(scattered_mask_ptr_d, 		0, 	num_nodes * sizeof(bool));
-	cudaMemset(next_to_scatter_mask_ptr_d, 	0, 	num_nodes * sizeof(bool));
 	cudaMemset(out_node_attrs_ptr_d, 		0, 	num_nodes * attr_dim * sizeof(used_dtype));
 	cudaMemset(out_node_reppoints_ptr_d, 	0, 	num_nodes * SPATIAL_DIM * sizeof(used_dtype));
 	cudaMemset(out_node_weights_ptr_d, 		0, 	num_nodes * sizeof(used_dtype));
@@ -361,52 +373,16 @@ int main(int argc, char** argv) {
 	cudaMemset(wn_queried_ptr_d, 			0, 	N_query_pts * sizeof(used_dtype));
 	cudaMemset(wn_queried_input_ptr_d, 		0, 	N_sample_pts * sizeof(used_dtype));
 
-	// scatter_point_attrs_to_nodes_leaf_cpu_kernel_launcher<used_dtype>(
-	// 	serialized_tree.node_parent_list_ptr,
-	// 	wn_pts_input.data(),
-	// 	wn_pts_weights.data(),
-	// 	wn_nml_input.data(),
-	// 	node2point_index.data(),
-	// 	serialized_tree.node2point_indexstart_ptr,
-	// 	serialized_tree.num_points_in_node_ptr,
-	// 	serialized_tree.node_is_leaf_list_ptr,
-	// 	scattered_mask_ptr,
-	// 	out_node_attrs_ptr,
-	// 	out_node_reppoints_ptr,
-	// 	out_node_weights_ptr,
-	// 	attr_dim,
-	// 	num_nodes
-	// );
-	signedindex_t num_blocks = (num_nodes + THREADS_PER_BLOCK - 1) / THREADS_PER_BLOCK;
-	scatter_point_attrs_to_nodes_leaf_cuda_kernel<used_dtype><<<num_blocks, THREADS_PER_BLOCK>>>(
-		serialized_tree_cuda.node_parent_list_ptr_d,
-		wn_pts_input_ptr_d,
-		wn_pts_weights_ptr_d,
-		wn_nml_input_ptr_d,
-		serialized_tree_cuda.node2point_index_ptr_d,
-		serialized_tree_cuda.node2point_indexstart_ptr_d,
-		serialized_tree_cuda.num_points_in_node_ptr_d,
-		serialized_tree_cuda.node_is_leaf_list_ptr_d,
-		scattered_mask_ptr_d,
-		out_node_attrs_ptr_d,
-		out_node_reppoints_ptr_d,
-		out_node_weights_ptr_d,
-		attr_dim,
-		num_nodes
-	);
-
-    for (signedindex_t depth = serialized_tree_cuda.tree_depth-1; depth >= 0; depth--) {
-		find_next_to_scatter_cuda_kernel<used_dtype><<<num_blocks, THREADS_PER_BLOCK>>>(
-			serialized_tree_cuda.node_children_list_ptr_d,
-			serialized_tree_cuda.node_is_leaf_list_ptr_d,
-			scattered_mask_ptr_d,
-			next_to_scatter_mask_ptr_d,
-			serialized_tree_cuda.node2point_index_ptr_d,
-			num_nodes
-		);
-
-		scatter_point_attrs_to_nodes_nonleaf_cuda_kernel<used_dtype><<<num_blocks, THREADS_PER_BLOCK>>>(
-			serialized_tree_cuda.node_parent_list_ptr_d,
+	// one launch per level, deepest first, so children are always aggregated before their parents
+	signedindex_t num_blocks = 0;
+    for (signedindex_t depth = serialized_tree_cuda.tree_depth; depth >= 0; depth--) {
+		signedindex_t level_start = serialized_tree_cuda.node_level_offsets[depth];
+		signedindex_t num_level_nodes = serialized_tree_cuda.node_level_offsets[depth+1] - level_start;
+		if (num_level_nodes == 0) {
+			continue;
+		}
+		num_blocks = (num_level_nodes + THREADS_PER_BLOCK - 1) / THREADS_PER_BLOCK;
+		scatter_point_attrs_to_nodes_level_cuda_kernel<used_dtype><<<num_blocks, THREADS_PER_BLOCK>>>(
 			serialized_tree_cuda.node_children_list_ptr_d,
 			wn_pts_input_ptr_d,
 			wn_pts_weights_ptr_d,
@@ -415,13 +391,12 @@ int main(int argc, char** argv) {
 			serialized_tree_cuda.node2point_indexstart_ptr_d,
 			serialized_tree_cuda.num_points_in_node_ptr_d,
 			serialized_tree_cuda.node_is_leaf_list_ptr_d,
-			scattered_mask_ptr_d,
-			next_to_scatter_mask_ptr_d,
+			serialized_tree_cuda.node_level_order_ptr_d + level_start,
 			out_node_attrs_ptr_d,
 			out_node_reppoints_ptr_d,
 			out_node_weights_ptr_d,
 			attr_dim,
-			num_nodes
+			num_level_nodes
 		);
     }
 
@@ -443,7 +418,8 @@ int main(int argc, char** argv) {
 		serialized_tree_cuda.num_points_in_node_ptr_d,
 		wn_queried_ptr_d,           // [N, 3]
 		N_query_pts,
-		true
+		true,
+		theta
 	);
 	cudaMemcpy(wn_queried.data(), wn_queried_ptr_d, N_query_pts * sizeof(used_dtype), cudaMemcpyDeviceToHost);
 
@@ -465,7 +441,8 @@ int main(int argc, char** argv) {
 		serialized_tree_cuda.num_points_in_node_ptr_d,
 		wn_queried_input_ptr_d,           // [N, 3]
 		N_sample_pts,
-		true
+		true,
+		theta
 	);
 	cudaMemcpy(wn_queried_at_input.data(), wn_queried_input_ptr_d, N_sample_pts * sizeof(used_dtype), cudaMemcpyDeviceToHost);
 
@@ -15,6 +15,8 @@ setup(
             'wn_treecode/wn_treecode_cpu/wn_treecode_cpu_torch_interface.cpp',
             'wn_treecode/wn_treecode_cpu/wn_treecode_cpu_treeutils.cpp',
             'wn_treecode/wn_treecode_cpu/wn_treecode_cpu_kernels.cpp',
+            'wn_treecode/wn_treecode_cpu/wn_treecode_cpu_execution.cpp',
+            'wn_treecode/wn_treecode_cpu/wn_treecode_cpu_simd.cpp',
         ],
         extra_compile_args={'cxx': ['-O3', '-fopenmp']}),
 
@@ -1,4 +1,5 @@
 import torch
 from .wn_treecode_func import WindingNumberTreecode
 from . import _cpu
+from ._cpu import set_num_threads, get_num_threads, set_schedule, get_schedule, set_thread_affinity, get_thread_affinity, set_opening_criterion, get_opening_criterion, set_query_packet_size, get_query_packet_size, get_near_field_isa
 from . import _cuda
\ No newline at end of file
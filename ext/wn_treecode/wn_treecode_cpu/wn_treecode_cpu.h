@@ -24,164 +24,948 @@ SOFTWARE.
 
 
 #include <vector>
+#include <cstdint>
 
 #define ALLOWED_MAX_DEPTH 15
 #define SPATIAL_DIM 3
 #define NUM_OCT_CHILDREN 8
 #define THREADS_PER_BLOCK 1024
-#define TREECODE_THRESHOLD 2.0f
+#define TREECODE_THRESHOLD 2.0f    // default theta of the launchers
+/// @note theta, the accuracy parameter of the treecode: a node is approximated from its attributes when its reppoint
+//        is farther than 2*theta*half_w from the query. Every point of the node is then within sqrt(3)/(2*theta) of that
+//        distance, which bounds the relative error of a far node at expansion order p by about (sqrt(3)/(2*theta))^(p+1).
+//        Over whole products the errors partly cancel, measured relative errors at order 0 fall about as 1/theta^2
+//        (A: 7.6e-2 at theta 1, 1.9e-2 at 2, 3.8e-3 at 4, see the README) while the cost grows about 2.5x per doubling.
+//        Each launcher takes its theta, so that e.g. the early WNNC iterations can run coarse and the last ones precise.
 
 typedef long signedindex_t;
 
+//////////////////// execution context ////////////////////
+/// @note process-wide settings honored by every CPU launcher and the tree build.
+//        num_threads <= 0 means the OpenMP default (OMP_NUM_THREADS, or all cores).
+//        schedule: OpenMP loop schedule of the per-query/per-node loops, chunk_size <= 0 for the OpenMP default.
+//                  SCHEDULE_BALANCED (the default) runs the query loops over Morton-ordered chunks of about equal
+//                  estimated cost (see build_query_schedule_cpu), handed out dynamically, and other loops as guided.
+//        thread affinity: pins the i-th OpenMP thread (including the calling thread) to the i-th allowed core, Linux only.
+//        opening criterion: the far-field test of the traversals. OPENING_CELL (the default) accepts a node when its reppoint
+//                  is farther than 2*theta*half_w, half_w that of its cubic cell. OPENING_TIGHT replaces half_w
+//                  with R/sqrt(3), R the distance from the reppoint to the farthest corner of the bounding box of the points
+//                  in the node, which is much smaller than the cell for surface samples (see compute_node_opening_half_w).
+//                  The far and near lists of cached interaction lists keep the cell criterion they were built with.
+//        query packet size: at expansion order 0, the per-query A, AT and G walk the tree once for each run of up to
+//                  this many queries that are consecutive in their schedule (see walk_query_packet_cpu), and evaluate a far
+//                  node for all the queries of the run that accept it at once (see QueryPacket); 0 or 1 walks once per query.
+//                  Every query makes the decisions of its own walk, higher expansion orders always walk once per query.
+enum ScheduleKind {
+    SCHEDULE_STATIC = 0,
+    SCHEDULE_DYNAMIC = 1,
+    SCHEDULE_GUIDED = 2,
+    SCHEDULE_BALANCED = 3
+};
+
+enum OpeningCriterion {
+    OPENING_CELL = 0,
+    OPENING_TIGHT = 1
+};
+
+#define MAX_QUERY_PACKET_SIZE 64
+#define DEFAULT_QUERY_PACKET_SIZE 32
+
+void set_num_threads(signedindex_t num_threads);
+signedindex_t get_num_threads();
+void set_schedule(signedindex_t schedule_kind, signedindex_t chunk_size);
+signedindex_t get_schedule_kind();
+signedindex_t get_schedule_chunk_size();
+void set_thread_affinity(bool pin_threads);
+bool get_thread_affinity();
+void set_opening_criterion(signedindex_t opening_criterion);
+signedindex_t get_opening_criterion();
+void set_query_packet_size(signedindex_t query_packet_size);
+signedindex_t get_query_packet_size();
+
+/// @brief applies the schedule and affinity to the calling thread, returns the number of threads to launch,
+//         for loops declared as #pragma omp parallel for num_threads(num_threads) schedule(runtime)
+signedindex_t prepare_parallel_launch();
+
+
 //////////////////// tree utils ////////////////////
+/// @note linear octree over the Morton-sorted points,
+//        every node covers the contiguous range sorted_point_indices[node2point_indexstart[i]:+num_points_in_node[i]],
+//        nodes are numbered in depth-first preorder, with child k (bit 0/1/2 = +x/+y/+z) of the root cell [-1, 1]^3
 template<typename scalar_t>
-struct OctNode;
+struct LinearOctree {
+    std::vector<signedindex_t> sorted_point_indices;     // [N,], used as node2point_index
+    std::vector<signedindex_t> node_parent_list;         // [num_nodes,]
+    std::vector<signedindex_t> node_children_list;       // [num_nodes, NUM_OCT_CHILDREN]
+    std::vector<char> node_is_leaf_list;                 // [num_nodes,], not std::vector<bool>: filled concurrently
+    std::vector<scalar_t> node_half_w_list;              // [num_nodes,]
+    std::vector<signedindex_t> num_points_in_node;       // [num_nodes,]
+    std::vector<signedindex_t> node2point_indexstart;    // [num_nodes,]
 
+    signedindex_t num_nodes = 0;
+    signedindex_t num_leaves = 0;
+    signedindex_t tree_depth = 0;
+};
+
+/// @note max_depth <= ALLOWED_MAX_DEPTH, O(N) memory, every point is stored once.
+//        num_threads <= 0 uses get_num_threads(), the tree is identical for any num_threads
 template<typename scalar_t>
-OctNode<scalar_t>* build_tree_cpu_recursive(
-    const scalar_t* point_coords,
-    const std::vector<signedindex_t>& point_indices,
-    OctNode<scalar_t>* const parent,
-    scalar_t c_x, scalar_t c_y, scalar_t c_z, scalar_t half_w,
-    signedindex_t cur_depth,
-    signedindex_t & cur_node_index,
-    const signedindex_t & max_depth,
-    const signedindex_t & max_points_per_node
+void build_tree_morton_cpu(
+    const scalar_t* point_coords,        // [N, 3]
+    signedindex_t num_points,
+    signedindex_t max_depth,
+    signedindex_t max_points_per_node,
+    LinearOctree<scalar_t>& tree,
+    signedindex_t num_threads = -1
 );
 
-template<typename scalar_t>
-void serialize_tree_recursive(
-    OctNode<scalar_t>* cur_node,
-    signedindex_t* ptr_node_parent_list,
-    signedindex_t* ptr_node_children_list,
+/// @note copies the tree into preallocated arrays, node2point_index has N entries.
+//        The serialized tree and every op below take their indices as index_t, signedindex_t or int32_t
+//        (explicitly instantiated), the latter when N and NUM_OCT_CHILDREN * num_nodes fit, for half the memory traffic
+template<typename scalar_t, typename index_t=signedindex_t>
+void serialize_linear_octree(
+    const LinearOctree<scalar_t>& tree,
+    index_t* ptr_node_parent_list,
+    index_t* ptr_node_children_list,
     bool* ptr_node_is_leaf_list,
     scalar_t* ptr_node_half_w_list,
-    signedindex_t* ptr_num_points_in_node,
-    signedindex_t* ptr_node2point_indexstart,
-    std::vector<signedindex_t>& stdvec_node2point_index
+    index_t* ptr_num_points_in_node,
+    index_t* ptr_node2point_indexstart,
+    index_t* ptr_node2point_index
 );
 
+/// @note nodes sorted by depth (index order within a level), level l is
+//        node_level_order[node_level_offsets[l]:node_level_offsets[l+1]], for l = 0...tree_depth
+template<typename index_t=signedindex_t>
+void compute_node_level_order(
+    const index_t* ptr_node_parent_list,
+    index_t* ptr_out_node_level_order,     // [num_nodes,]
+    index_t* ptr_out_node_level_offsets,   // [tree_depth+2,]
+    signedindex_t num_nodes,
+    signedindex_t tree_depth
+);
+
+/// @note query loops visit the queries in Morton order, so that consecutive queries traverse the same nodes,
+//        cut into chunks of decreasing estimated cost: each chunk takes 1/(2*num_threads) of the remaining cost,
+//        but at least 1/(QUERY_CHUNKS_PER_THREAD*num_threads) of the total, and threads grab chunks dynamically
+#define QUERY_CHUNKS_PER_THREAD 64
+struct QuerySchedule {
+    std::vector<signedindex_t> query_order;      // [N',] query indices in Morton order
+    std::vector<signedindex_t> chunk_offsets;    // [num_chunks+1,] chunk i is query_order[chunk_offsets[i]:chunk_offsets[i+1]]
+};
 
+/// @note query_costs: [N',] relative cost of every query, e.g. the sizes of its interaction lists,
+//        nullptr to estimate it from the tree: the depth the query's own cell reaches, and the points in its leaf
+//        (num_points_in_node may be nullptr for loops that never visit the points of a leaf)
+template<typename scalar_t, typename index_t=signedindex_t>
+void build_query_schedule_cpu(
+    const scalar_t* query_points,       // [N', 3]
+    const signedindex_t* query_costs,   // [N',] or nullptr
+    const index_t* node_children_list,
+    const bool* node_is_leaf_list,
+    const index_t* num_points_in_node,
+    signedindex_t num_queries,
+    signedindex_t num_threads,
+    QuerySchedule& schedule
+);
+
+template<typename scalar_t, typename index_t=signedindex_t>
+void compute_node_bboxes(
+    const scalar_t* ptr_points,
+    const index_t* ptr_node_children_list,
+    const bool* ptr_node_is_leaf_list,
+    const index_t* ptr_node2point_index,
+    const index_t* ptr_node2point_indexstart,
+    const index_t* ptr_num_points_in_node,
+    scalar_t* ptr_out_node_bboxes,     // [num_nodes, 2*SPATIAL_DIM], min corner then max corner
+    signedindex_t num_nodes
+);
+
+/// @brief the half widths of the far-field test under OPENING_TIGHT (see get_opening_criterion):
+//         R/sqrt(3), R the distance from the reppoint of the node to the farthest corner of its bbox (compute_node_bboxes)
 template<typename scalar_t>
-void compute_tree_attributes(
-    const OctNode<scalar_t> * cur_node,
-    signedindex_t & num_nodes,
-    signedindex_t & num_leaves,
-    signedindex_t & depth
+void compute_node_opening_half_w(
+    const scalar_t* ptr_node_reppoints,     // [num_nodes, 3]
+    const scalar_t* ptr_node_bboxes,        // [num_nodes, 2*SPATIAL_DIM]
+    scalar_t* ptr_out_node_opening_half_w,  // [num_nodes,]
+    signedindex_t num_nodes
 );
 
+/// @brief a tree node as the per-query traversals see it: what classifying the node and stepping past it reads,
+//         in one record of 32 bytes for float (64 for double) instead of a cache line in each of the tree arrays.
+//         The nodes are renumbered depth first, so that the subtree of a node is the packed range [its index, skip)
+//         and a traversal is one forward walk with no stack: it steps to index + 1 to open a nonleaf (its first child),
+//         to skip otherwise; node_index is the index in the tree arrays, for the attributes, moments and bboxes of far and culled nodes
 template<typename scalar_t>
-void free_tree_recursive(OctNode<scalar_t>* cur_node);
+struct alignas(8*sizeof(scalar_t)) PackedNode {
+    scalar_t reppoint[SPATIAL_DIM];
+    scalar_t far_dist2;     // see compute_node_far_dist2_cpu
+    int32_t first_point;    // leaf: its first point in tree order
+    int32_t num_points;     // leaf: its number of points, -1 for a nonleaf
+    int32_t node_index;
+    int32_t skip;           // the packed index past its subtree, the escape link of the walk
+};
+static_assert(sizeof(PackedNode<float>) == 32, "a packed float node is half a cache line");
+static_assert(sizeof(PackedNode<double>) == 64, "a packed double node is a cache line");
 
+/// @brief the packed nodes of a tree, root first, in depth-first preorder, with everything but reppoint and far_dist2,
+//         which depend on the attributes and theta of a launch and are left zero.
+//         The children are ordered the last child slot first, the visiting order of the former stack-based traversals
+/// @note the packed indices are int32: throws std::length_error for trees of more than INT32_MAX nodes or points
+template<typename scalar_t, typename index_t=signedindex_t>
+void pack_tree_skeleton_cpu(
+    const index_t* ptr_node_children_list,
+    const bool* ptr_node_is_leaf_list,
+    const index_t* ptr_node2point_indexstart,
+    const index_t* ptr_num_points_in_node,
+    signedindex_t num_nodes,
+    std::vector<PackedNode<scalar_t>>& out_packed_nodes
+);
 
-//////////////////// treecode op wrappers ////////////////////
+/// @brief what the traversals derive from a tree and its points alone, whatever the attributes, widths and theta of a call:
+//         prepared once per tree (e.g. by WindingNumberTreecodeCPU and wnnc_solve) and passed to the launchers below
+//         as their argument traversal_cache, which they derive again on every call when it is nullptr
 template<typename scalar_t>
-void scatter_point_attrs_to_nodes_leaf_cpu_kernel_launcher(
-    const signedindex_t* ptr_node_parent_list,
-    const scalar_t* ptr_points,
-    const scalar_t* ptr_point_weights,
-    const scalar_t* ptr_point_attrs,
-    const signedindex_t* ptr_node2point_index,
-    const signedindex_t* ptr_node2point_indexstart,
-    const signedindex_t* ptr_num_points_in_node,
+struct TreeTraversalCache {
+    signedindex_t num_nodes = 0;
+    std::vector<scalar_t> node_bboxes;               // [num_nodes, 2*SPATIAL_DIM], see compute_node_bboxes
+    std::vector<PackedNode<scalar_t>> packed_nodes;  // [num_nodes,], see pack_tree_skeleton_cpu
+};
+
+template<typename scalar_t, typename index_t=signedindex_t>
+void prepare_tree_traversal_cache_cpu(
+    const scalar_t* ptr_points,            // [N, 3], the points of the tree
+    const index_t* ptr_node_children_list,
     const bool* ptr_node_is_leaf_list,
-    bool* ptr_scattered_mask,
+    const index_t* ptr_node2point_index,
+    const index_t* ptr_node2point_indexstart,
+    const index_t* ptr_num_points_in_node,
+    signedindex_t num_nodes,
+    TreeTraversalCache<scalar_t>& cache
+);
 
-    scalar_t* ptr_out_node_attrs,
-    scalar_t* ptr_out_node_reppoints,
-    scalar_t* ptr_out_node_weights,
+//////////////////// near field ////////////////////
+/// @note points and their attributes gathered in tree order (node2point_index), one array per component,
+//        so the points of a leaf are a contiguous range of every array
+/// @note up to MAX_FUSED_OPERATORS operators evaluated together (see multiply_fused_cpu_kernel_launcher)
+#define MAX_FUSED_OPERATORS 4
+#define NEAR_FIELD_MAX_ATTR_DIM (SPATIAL_DIM*MAX_FUSED_OPERATORS)
+template<typename scalar_t>
+struct PointsSoA {
+    std::vector<scalar_t> coords[SPATIAL_DIM];   // x[], y[], z[], each [N,]
+    std::vector<scalar_t> attrs[NEAR_FIELD_MAX_ATTR_DIM];    // the first attr_dim are used, each [N,]
+    signedindex_t attr_dim = 0;
+};
 
+template<typename scalar_t, typename index_t=signedindex_t>
+void gather_points_soa_cpu(
+    const scalar_t* points,        // [N, 3]
+    const scalar_t* point_attrs,   // [N, C]
+    const index_t* node2point_index,
+    signedindex_t num_points,
     signedindex_t attr_dim,
-    signedindex_t num_nodes
+    PointsSoA<scalar_t>& points_soa,
+    bool gather_coords=true        // false: only the attributes, points_soa already holds the coordinates
 );
 
+/// @note near-field points of one query, copied from PointsSoA leaf by leaf
+//        and evaluated NEAR_FIELD_BLOCK_SIZE at a time, whatever the size of the leaves
+#define NEAR_FIELD_BLOCK_SIZE 64
+template<typename scalar_t>
+struct NearFieldBlock {
+    alignas(64) scalar_t coords[SPATIAL_DIM][NEAR_FIELD_BLOCK_SIZE];
+    alignas(64) scalar_t attrs[NEAR_FIELD_MAX_ATTR_DIM][NEAR_FIELD_BLOCK_SIZE];
+    signedindex_t num_points = 0;
+    signedindex_t attr_offset = 0;   // the block kernels read the attributes from attrs[attr_offset] on
+};
+
+/// @note add the leaf terms of eval_A_mu / eval_AT_s_add_ / eval_G_mu_add_ (diff = query - point)
+//        over the points of the block. For float, AVX-512 or AVX2 kernels are picked at runtime
+//        when the CPU has them, with 1/d from rsqrt and a Newton step; scalar otherwise, and for double
+template<typename scalar_t>
+void eval_A_mu_block_add_(
+    scalar_t& out_val,
+    const scalar_t* query_point,
+    scalar_t smooth_width,
+    bool continuous_kernel,
+    const NearFieldBlock<scalar_t>& block
+);
+
+template<typename scalar_t>
+void eval_AT_s_block_add_(
+    scalar_t* out_vec,
+    const scalar_t* query_point,
+    scalar_t smooth_width,
+    const NearFieldBlock<scalar_t>& block
+);
+
+template<typename scalar_t>
+void eval_G_mu_block_add_(
+    scalar_t* out_vec,
+    const scalar_t* query_point,
+    scalar_t smooth_width,
+    const NearFieldBlock<scalar_t>& block
+);
+
+/// @note queries walked together by walk_query_packet_cpu, one array per component, and their outputs
+//        (out[0] for A, out[0..2] for AT and G), so that the far field of a node is evaluated for the whole packet at once
+template<typename scalar_t>
+struct QueryPacket {
+    alignas(64) scalar_t coords[SPATIAL_DIM][MAX_QUERY_PACKET_SIZE];
+    alignas(64) scalar_t widths[MAX_QUERY_PACKET_SIZE];
+    alignas(64) scalar_t out[SPATIAL_DIM][MAX_QUERY_PACKET_SIZE];
+    signedindex_t num_queries = 0;
+};
+
+/// @note add the expansion order 0 far-field terms of a node, eval_A_mu / eval_AT_s_add_ / eval_G_mu_add_
+//        (diff = query - source_point, attrs the node attributes), to the outputs of the queries q of the packet with
+//        bit q of active set. Active queries must not coincide with source_point. Same instruction sets as the near field
+template<typename scalar_t>
+void eval_A_mu_packet_add_(
+    QueryPacket<scalar_t>& packet,
+    uint64_t active,
+    const scalar_t* source_point,
+    const scalar_t* mu,
+    bool continuous_kernel
+);
+
+template<typename scalar_t>
+void eval_AT_s_packet_add_(
+    QueryPacket<scalar_t>& packet,
+    uint64_t active,
+    const scalar_t* source_point,
+    const scalar_t* s
+);
+
+template<typename scalar_t>
+void eval_G_mu_packet_add_(
+    QueryPacket<scalar_t>& packet,
+    uint64_t active,
+    const scalar_t* source_point,
+    const scalar_t* mu
+);
+
+/// @brief instruction set of the float near-field (and query packet far-field) kernels on this CPU: "avx512", "avx2" or "scalar",
+//         WN_TREECODE_NEAR_FIELD_ISA=scalar|avx2 in the environment caps it
+const char* get_near_field_isa();
+
+
+/// @brief what the launchers below derive from the reppoints and attributes of a scatter and the theta of a call:
+//         the far-field distances and the packed nodes, the points and attributes in tree order, and the query schedule.
+//         Kept by the caller next to its node buffers (e.g. one per scatter by WindingNumberTreecodeCPU) and passed to
+//         the launchers as their last argument workspace, it is filled by the first call and reused by the next ones
+//         with the same inputs; nullptr derives everything again on every call. What comes from the points of the tree
+//         (their coordinates, the query schedule) is kept as long as the workspace; the caller must invalidate() it
+//         whenever it scatters new reppoints or attributes into the same buffers
 template<typename scalar_t>
-void scatter_point_attrs_to_nodes_nonleaf_cpu_kernel_launcher(
-    const signedindex_t* ptr_node_parent_list,
-    const signedindex_t* ptr_node_children_list,
+struct TraversalWorkspace {
+    std::vector<scalar_t> own_bboxes;                // [num_nodes, 2*SPATIAL_DIM], without a traversal cache, when needed
+    std::vector<scalar_t> opening_half_w;            // [num_nodes,], OPENING_TIGHT only, see compute_node_opening_half_w
+    std::vector<scalar_t> far_dist2;                 // [num_nodes,], see compute_node_far_dist2_cpu
+    std::vector<PackedNode<scalar_t>> packed_nodes;  // [num_nodes,], when packed
+    PointsSoA<scalar_t> points_soa;                  // see gather_points_soa_cpu
+    std::vector<scalar_t> sorted_points;             // [N, 3] in tree order, multirhs
+    std::vector<scalar_t> sorted_point_attrs;        // [N, C, K] in tree order, multirhs
+    std::vector<scalar_t> node_attrs_rhs_last;       // [num_nodes, C, K], multirhs
+    std::vector<signedindex_t> query_costs;          // [N',], cached interaction lists
+    QuerySchedule query_schedule;                    // see build_query_schedule_cpu
+    std::vector<NearFieldBlock<scalar_t>> packet_near_blocks;   // [num_threads, packet size], query packets
+    // what far_dist2 and packed_nodes were derived for
+    const scalar_t* node_reppoints = nullptr;
+    scalar_t theta = 0;
+    signedindex_t opening_criterion = -1;
+    bool packed = false;
+    // what points_soa, the multirhs copies and query_schedule were gathered or built from
+    const scalar_t* soa_points = nullptr;
+    const scalar_t* soa_point_attrs = nullptr;
+    const scalar_t* rhs_points = nullptr;
+    const scalar_t* rhs_point_attrs = nullptr;
+    signedindex_t rhs_num_rhs = 0;
+    const scalar_t* schedule_query_points = nullptr;
+    const signedindex_t* schedule_query_costs = nullptr;
+    signedindex_t schedule_num_queries = -1;
+    signedindex_t schedule_num_threads = -1;
+
+    void invalidate() {
+        node_reppoints = nullptr;
+        packed = false;
+        own_bboxes.clear();
+        soa_point_attrs = nullptr;
+        rhs_point_attrs = nullptr;
+    }
+};
+
+
+//////////////////// treecode op wrappers ////////////////////
+/// @note far-field nodes are approximated by a multipole expansion about their reppoints:
+//        expansion_order 0 only uses the aggregated attributes, 1 and 2 add the first and second moments
+//        of the attributes about the reppoint (see scatter_point_attrs_to_nodes_cpu_kernel_launcher),
+//        so that the same accuracy is reached with a looser opening criterion
+#define MAX_EXPANSION_ORDER 2
+
+/// @note processes the levels listed in node_level_order/node_level_offsets (see compute_node_level_order)
+//        from the deepest one up, so every node is aggregated exactly once, after its children
+template<typename scalar_t, typename index_t=signedindex_t>
+void scatter_point_attrs_to_nodes_cpu_kernel_launcher(
+    const index_t* ptr_node_children_list,
     const scalar_t* ptr_points,
     const scalar_t* ptr_point_weights,
     const scalar_t* ptr_point_attrs,
-    const signedindex_t* ptr_node2point_index,
-    const signedindex_t* ptr_node2point_indexstart,
-    const signedindex_t* ptr_num_points_in_node,
+    const index_t* ptr_node2point_index,
+    const index_t* ptr_node2point_indexstart,
+    const index_t* ptr_num_points_in_node,
     const bool* ptr_node_is_leaf_list,
-    bool* ptr_scattered_mask,
-    const bool* ptr_next_to_scatter_mask,
+    const index_t* ptr_node_level_order,
+    const index_t* ptr_node_level_offsets,
 
-    scalar_t* ptr_out_node_attrs,
+    scalar_t* ptr_out_node_attrs,       // zero-initialized by the caller
     scalar_t* ptr_out_node_reppoints,
     scalar_t* ptr_out_node_weights,
 
     signedindex_t attr_dim,
-    signedindex_t num_nodes
+    signedindex_t tree_depth,
+    scalar_t* ptr_out_node_moments1 = nullptr,  // [num_nodes, 3, C], zero-initialized, needed for expansion_order >= 1
+    scalar_t* ptr_out_node_moments2 = nullptr,  // [num_nodes, 3, 3, C], zero-initialized, needed for expansion_order >= 2
+    signedindex_t expansion_order = 0
 );
 
 
-template<typename scalar_t>
-void find_next_to_scatter_cpu_kernel_launcher(
-    const signedindex_t* ptr_node_children_list,
-    const bool* ptr_node_is_leaf_list,
-    bool* ptr_scattered_mask,
-    bool* ptr_next_to_scatter_mask,
-    const signedindex_t* node2point_index,
-    signedindex_t num_nodes
-);
-
-
-template<typename scalar_t>
+template<typename scalar_t, typename index_t=signedindex_t>
 void multiply_by_A_cpu_kernel_launcher(
     const scalar_t* query_points,  // [N', 3]
     const scalar_t* query_width,   // [N',]
     const scalar_t* points,        // [N, 3]
     const scalar_t* point_attrs,   // [N, C]
-    const signedindex_t* node2point_index,
-    const signedindex_t* node2point_indexstart,
-    const signedindex_t* node_children_list,
+    const index_t* node2point_index,
+    const index_t* node2point_indexstart,
+    const index_t* node_children_list,
     const scalar_t* node_attrs,
     const bool* node_is_leaf_list,
     const scalar_t* node_half_w_list,
     const scalar_t* node_reppoints,
-    const signedindex_t* num_points_in_node,
+    const index_t* num_points_in_node,
     scalar_t* out_attrs,           // [N,]
     signedindex_t num_queries,
-    bool continuous_kernel=false
+    bool continuous_kernel=false,
+    signedindex_t expansion_order=0,
+    const scalar_t* node_moments1=nullptr,
+    const scalar_t* node_moments2=nullptr,
+    scalar_t theta=TREECODE_THRESHOLD,
+    const TreeTraversalCache<scalar_t>* traversal_cache=nullptr,
+    TraversalWorkspace<scalar_t>* workspace=nullptr
 );
 
 
-template<typename scalar_t>
+template<typename scalar_t, typename index_t=signedindex_t>
 void multiply_by_AT_cpu_kernel_launcher(
     const scalar_t* query_points,  // [N', 3]
     const scalar_t* query_width,   // [N',]
     const scalar_t* points,        // [N, 3]
     const scalar_t* point_attrs,   // [N, C]
-    const signedindex_t* node2point_index,
-    const signedindex_t* node2point_indexstart,
-    const signedindex_t* node_children_list,
+    const index_t* node2point_index,
+    const index_t* node2point_indexstart,
+    const index_t* node_children_list,
     const scalar_t* node_attrs,
     const bool* node_is_leaf_list,
     const scalar_t* node_half_w_list,
     const scalar_t* node_reppoints,
-    const signedindex_t* num_points_in_node,
+    const index_t* num_points_in_node,
     scalar_t* out_attrs,           // [N, 3]
-    signedindex_t num_queries
+    signedindex_t num_queries,
+    signedindex_t expansion_order=0,
+    const scalar_t* node_moments1=nullptr,
+    const scalar_t* node_moments2=nullptr,
+    scalar_t theta=TREECODE_THRESHOLD,
+    const TreeTraversalCache<scalar_t>* traversal_cache=nullptr,
+    TraversalWorkspace<scalar_t>* workspace=nullptr
 );
 
-template<typename scalar_t>
+template<typename scalar_t, typename index_t=signedindex_t>
 void multiply_by_G_cpu_kernel_launcher(
     const scalar_t* query_points,  // [N', 3]
     const scalar_t* query_width,   // [N',]
     const scalar_t* points,        // [N, 3]
     const scalar_t* point_attrs,   // [N, C]
-    const signedindex_t* node2point_index,
-    const signedindex_t* node2point_indexstart,
-    const signedindex_t* node_children_list,
+    const index_t* node2point_index,
+    const index_t* node2point_indexstart,
+    const index_t* node_children_list,
+    const scalar_t* node_attrs,
+    const bool* node_is_leaf_list,
+    const scalar_t* node_half_w_list,
+    const scalar_t* node_reppoints,
+    const index_t* num_points_in_node,
+    scalar_t* out_attrs,           // [N, 3]
+    signedindex_t num_queries,
+    signedindex_t expansion_order=0,
+    const scalar_t* node_moments1=nullptr,
+    const scalar_t* node_moments2=nullptr,
+    scalar_t theta=TREECODE_THRESHOLD,
+    const TreeTraversalCache<scalar_t>* traversal_cache=nullptr,
+    TraversalWorkspace<scalar_t>* workspace=nullptr
+);
+
+
+
+//////////////////// cached interaction lists ////////////////////
+/// @note the opening test of the treecode uses the node reppoints, which move with the point weights,
+//        but a reppoint always stays inside the bounding box of its node's points.
+//        Against that box every node is classified once per query as
+//          far:  accepted whatever the reppoint is, evaluated from the node attributes
+//          near: a leaf opened whatever the reppoint is, evaluated over its points
+//          open: undecided, re-tested against the current reppoint at evaluation time
+//        so replaying the lists gives the same result as a fresh traversal, for any widths and weights.
+template<typename scalar_t, typename index_t=signedindex_t>
+void count_interaction_lists_cpu_kernel_launcher(
+    const scalar_t* query_points,  // [N', 3]
+    const index_t* node_children_list,
+    const bool* node_is_leaf_list,
+    const scalar_t* node_half_w_list,
+    const scalar_t* node_bboxes,
+    signedindex_t* out_num_far,    // [N',]
+    signedindex_t* out_num_near,   // [N',]
+    signedindex_t* out_num_open,   // [N',]
+    signedindex_t num_queries,
+    scalar_t theta=TREECODE_THRESHOLD
+);
+
+template<typename scalar_t, typename index_t=signedindex_t>
+void fill_interaction_lists_cpu_kernel_launcher(
+    const scalar_t* query_points,  // [N', 3]
+    const index_t* node_children_list,
+    const bool* node_is_leaf_list,
+    const scalar_t* node_half_w_list,
+    const scalar_t* node_bboxes,
+    const signedindex_t* far_offsets,   // [N'+1,]
+    const signedindex_t* near_offsets,  // [N'+1,]
+    const signedindex_t* open_offsets,  // [N'+1,]
+    index_t* out_far_nodes,
+    index_t* out_near_leaves,
+    index_t* out_open_nodes,
+    signedindex_t num_queries,
+    scalar_t theta=TREECODE_THRESHOLD
+);
+
+template<typename scalar_t, typename index_t=signedindex_t>
+void multiply_by_A_cached_cpu_kernel_launcher(
+    const scalar_t* query_points,  // [N', 3]
+    const scalar_t* query_width,   // [N',]
+    const scalar_t* points,        // [N, 3]
+    const scalar_t* point_attrs,   // [N, C]
+    const index_t* node2point_index,
+    const index_t* node2point_indexstart,
+    const index_t* node_children_list,
+    const scalar_t* node_attrs,
+    const bool* node_is_leaf_list,
+    const scalar_t* node_half_w_list,
+    const scalar_t* node_reppoints,
+    const index_t* num_points_in_node,
+    const signedindex_t* far_offsets,
+    const index_t* far_nodes,
+    const signedindex_t* near_offsets,
+    const index_t* near_leaves,
+    const signedindex_t* open_offsets,
+    const index_t* open_nodes,
+    scalar_t* out_attrs,           // [N,]
+    signedindex_t num_queries,
+    bool continuous_kernel=false,
+    signedindex_t expansion_order=0,
+    const scalar_t* node_moments1=nullptr,
+    const scalar_t* node_moments2=nullptr,
+    scalar_t theta=TREECODE_THRESHOLD,
+    const TreeTraversalCache<scalar_t>* traversal_cache=nullptr,
+    TraversalWorkspace<scalar_t>* workspace=nullptr
+);
+
+template<typename scalar_t, typename index_t=signedindex_t>
+void multiply_by_AT_cached_cpu_kernel_launcher(
+    const scalar_t* query_points,  // [N', 3]
+    const scalar_t* query_width,   // [N',]
+    const scalar_t* points,        // [N, 3]
+    const scalar_t* point_attrs,   // [N, C]
+    const index_t* node2point_index,
+    const index_t* node2point_indexstart,
+    const index_t* node_children_list,
+    const scalar_t* node_attrs,
+    const bool* node_is_leaf_list,
+    const scalar_t* node_half_w_list,
+    const scalar_t* node_reppoints,
+    const index_t* num_points_in_node,
+    const signedindex_t* far_offsets,
+    const index_t* far_nodes,
+    const signedindex_t* near_offsets,
+    const index_t* near_leaves,
+    const signedindex_t* open_offsets,
+    const index_t* open_nodes,
+    scalar_t* out_attrs,           // [N, 3]
+    signedindex_t num_queries,
+    signedindex_t expansion_order=0,
+    const scalar_t* node_moments1=nullptr,
+    const scalar_t* node_moments2=nullptr,
+    scalar_t theta=TREECODE_THRESHOLD,
+    const TreeTraversalCache<scalar_t>* traversal_cache=nullptr,
+    TraversalWorkspace<scalar_t>* workspace=nullptr
+);
+
+template<typename scalar_t, typename index_t=signedindex_t>
+void multiply_by_G_cached_cpu_kernel_launcher(
+    const scalar_t* query_points,  // [N', 3]
+    const scalar_t* query_width,   // [N',]
+    const scalar_t* points,        // [N, 3]
+    const scalar_t* point_attrs,   // [N, C]
+    const index_t* node2point_index,
+    const index_t* node2point_indexstart,
+    const index_t* node_children_list,
+    const scalar_t* node_attrs,
+    const bool* node_is_leaf_list,
+    const scalar_t* node_half_w_list,
+    const scalar_t* node_reppoints,
+    const index_t* num_points_in_node,
+    const signedindex_t* far_offsets,
+    const index_t* far_nodes,
+    const signedindex_t* near_offsets,
+    const index_t* near_leaves,
+    const signedindex_t* open_offsets,
+    const index_t* open_nodes,
+    scalar_t* out_attrs,           // [N, 3]
+    signedindex_t num_queries,
+    signedindex_t expansion_order=0,
+    const scalar_t* node_moments1=nullptr,
+    const scalar_t* node_moments2=nullptr,
+    scalar_t theta=TREECODE_THRESHOLD,
+    const TreeTraversalCache<scalar_t>* traversal_cache=nullptr,
+    TraversalWorkspace<scalar_t>* workspace=nullptr
+);
+
+
+//////////////////// dual tree ////////////////////
+/// @note for self-evaluation (queries == the points of the tree), pairs of target and source nodes are traversed together:
+//        a far pair adds to a second-order local expansion of the target node, which is passed down to its points afterwards,
+//        so the traversal decisions are shared by all the points of a target node. The pairs stop at target groups of up to 64 points,
+//        which list the sources they meet; every point of a group then walks the listed source subtrees as a single query would.
+//        Sources are approximated at order 0 (node attributes at the reppoint), as the per-query kernels at expansion_order 0;
+//        the near field is the same as theirs. workspace: as for the per-query launchers, see TraversalWorkspace
+
+template<typename scalar_t, typename index_t=signedindex_t>
+void multiply_by_A_dualtree_cpu_kernel_launcher(
+    const scalar_t* points,        // [N, 3], also the queries
+    const scalar_t* point_width,   // [N,]
+    const scalar_t* point_attrs,   // [N, C]
+    const index_t* node2point_index,
+    const index_t* node2point_indexstart,
+    const index_t* node_children_list,
+    const scalar_t* node_attrs,
+    const bool* node_is_leaf_list,
+    const scalar_t* node_half_w_list,
+    const scalar_t* node_reppoints,
+    const index_t* num_points_in_node,
+    scalar_t* out_attrs,           // [N,]
+    signedindex_t num_nodes,
+    bool continuous_kernel=false,
+    scalar_t theta=TREECODE_THRESHOLD,
+    const TreeTraversalCache<scalar_t>* traversal_cache=nullptr,
+    TraversalWorkspace<scalar_t>* workspace=nullptr
+);
+
+template<typename scalar_t, typename index_t=signedindex_t>
+void multiply_by_AT_dualtree_cpu_kernel_launcher(
+    const scalar_t* points,        // [N, 3], also the queries
+    const scalar_t* point_width,   // [N,]
+    const scalar_t* point_attrs,   // [N, C]
+    const index_t* node2point_index,
+    const index_t* node2point_indexstart,
+    const index_t* node_children_list,
+    const scalar_t* node_attrs,
+    const bool* node_is_leaf_list,
+    const scalar_t* node_half_w_list,
+    const scalar_t* node_reppoints,
+    const index_t* num_points_in_node,
+    scalar_t* out_attrs,           // [N, 3]
+    signedindex_t num_nodes,
+    scalar_t theta=TREECODE_THRESHOLD,
+    const TreeTraversalCache<scalar_t>* traversal_cache=nullptr,
+    TraversalWorkspace<scalar_t>* workspace=nullptr
+);
+
+template<typename scalar_t, typename index_t=signedindex_t>
+void multiply_by_G_dualtree_cpu_kernel_launcher(
+    const scalar_t* points,        // [N, 3], also the queries
+    const scalar_t* point_width,   // [N,]
+    const scalar_t* point_attrs,   // [N, C]
+    const index_t* node2point_index,
+    const index_t* node2point_indexstart,
+    const index_t* node_children_list,
     const scalar_t* node_attrs,
     const bool* node_is_leaf_list,
     const scalar_t* node_half_w_list,
     const scalar_t* node_reppoints,
-    const signedindex_t* num_points_in_node,
+    const index_t* num_points_in_node,
     scalar_t* out_attrs,           // [N, 3]
-    signedindex_t num_queries
+    signedindex_t num_nodes,
+    scalar_t theta=TREECODE_THRESHOLD,
+    const TreeTraversalCache<scalar_t>* traversal_cache=nullptr,
+    TraversalWorkspace<scalar_t>* workspace=nullptr
+);
+
+
+//////////////////// fused operators ////////////////////
+/// @note several of A, AT and G evaluated in one traversal per query: the attributes of all the operators are
+//        side by side in [N, C_total] (3 columns for A and G, 1 for AT), and scattered once with shared reppoints,
+//        the outputs side by side in [N', D_total] (1 column for A, 3 for AT and G).
+//        Far-field distances and near-field leaves are shared by the operators; far nodes are approximated at order 0
+
+enum FusedOperatorKind {
+    FUSED_OP_A = 0,
+    FUSED_OP_AT = 1,
+    FUSED_OP_G = 2
+};
+
+struct FusedOperators {
+    signedindex_t num_ops = 0;
+    signedindex_t kinds[MAX_FUSED_OPERATORS] = {};
+    signedindex_t attr_offsets[MAX_FUSED_OPERATORS] = {};   // first column of each operator in the attributes
+    signedindex_t out_offsets[MAX_FUSED_OPERATORS] = {};    // first column of each operator in the outputs
+    signedindex_t attr_dim = 0;                             // C_total
+    signedindex_t out_dim = 0;                              // D_total
+};
+
+/// @brief appends an operator after those already in fused_ops, returns false if there are MAX_FUSED_OPERATORS already
+bool add_fused_operator(FusedOperators& fused_ops, FusedOperatorKind kind);
+
+/// @brief true if fused_ops has an operator of this kind
+bool has_fused_operator(const FusedOperators& fused_ops, FusedOperatorKind kind);
+
+template<typename scalar_t, typename index_t=signedindex_t>
+void multiply_fused_cpu_kernel_launcher(
+    const FusedOperators& fused_ops,
+    const scalar_t* query_points,  // [N', 3]
+    const scalar_t* query_width,   // [N',]
+    const scalar_t* points,        // [N, 3]
+    const scalar_t* point_attrs,   // [N, C_total]
+    const index_t* node2point_index,
+    const index_t* node2point_indexstart,
+    const index_t* node_children_list,
+    const scalar_t* node_attrs,    // [num_nodes, C_total]
+    const bool* node_is_leaf_list,
+    const scalar_t* node_half_w_list,
+    const scalar_t* node_reppoints,
+    const index_t* num_points_in_node,
+    scalar_t* out_attrs,           // [N', D_total]
+    signedindex_t num_queries,
+    bool continuous_kernel=false,
+    scalar_t theta=TREECODE_THRESHOLD,
+    const TreeTraversalCache<scalar_t>* traversal_cache=nullptr,
+    TraversalWorkspace<scalar_t>* workspace=nullptr
+);
+
+/// @brief A and AT fused (exactly these two, in either order) at the points of the tree, with a symmetric dual tree:
+//         every unordered pair of nodes is visited once, and is far only if it is far in both directions (see the dual tree above),
+//         then both directions are approximated as the one-sided dual tree does; a near pair of leaves is summed once for
+//         A and AT of both leaves, sharing x_i - x_j and |x_i - x_j|^3 between the four terms.
+//         The traversal only splits into tasks the pairs of target subtrees it reaches from (root, root), and the near field
+//         is summed into one buffer of [4, N], by colors of tasks that share no subtree,
+//         so the result is deterministic for a given number of threads
+template<typename scalar_t, typename index_t=signedindex_t>
+void multiply_fused_A_AT_dualtree_cpu_kernel_launcher(
+    const FusedOperators& fused_ops,
+    const scalar_t* points,        // [N, 3], also the queries
+    const scalar_t* point_width,   // [N,]
+    const scalar_t* point_attrs,   // [N, C_total]
+    const index_t* node2point_index,
+    const index_t* node2point_indexstart,
+    const index_t* node_children_list,
+    const scalar_t* node_attrs,    // [num_nodes, C_total]
+    const bool* node_is_leaf_list,
+    const scalar_t* node_half_w_list,
+    const scalar_t* node_reppoints,
+    const index_t* num_points_in_node,
+    scalar_t* out_attrs,           // [N, D_total]
+    signedindex_t num_nodes,
+    bool continuous_kernel=false,
+    scalar_t theta=TREECODE_THRESHOLD,
+    const TreeTraversalCache<scalar_t>* traversal_cache=nullptr,
+    TraversalWorkspace<scalar_t>* workspace=nullptr
+);
+
+
+//////////////////// several widths ////////////////////
+/// @note A, AT or G of one set of attributes for K widths per query in a single traversal, e.g. a width sweep or the
+//        constant right hand side of the WNNC iterations for the whole width schedule. The width only enters the terms
+//        through the dist >= width cutoff (and the smoothed A kernel inside it), so every term is computed once and binned
+//        by the number of widths it passes (see WidthBins): the cost is about that of one product, plus O(log K) per term.
+//        The nodes are scattered as for the single-width launchers; far nodes are approximated at order 0
+template<typename scalar_t, typename index_t=signedindex_t>
+void multiply_by_A_multiwidth_cpu_kernel_launcher(
+    const scalar_t* query_points,  // [N', 3]
+    const scalar_t* query_widths,  // [N', K]
+    signedindex_t num_widths,
+    const scalar_t* points,        // [N, 3]
+    const scalar_t* point_attrs,   // [N, 3]
+    const index_t* node2point_index,
+    const index_t* node2point_indexstart,
+    const index_t* node_children_list,
+    const scalar_t* node_attrs,
+    const bool* node_is_leaf_list,
+    const scalar_t* node_half_w_list,
+    const scalar_t* node_reppoints,
+    const index_t* num_points_in_node,
+    scalar_t* out_attrs,           // [N', K, 1]
+    signedindex_t num_queries,
+    bool continuous_kernel=false,
+    scalar_t theta=TREECODE_THRESHOLD,
+    const TreeTraversalCache<scalar_t>* traversal_cache=nullptr,
+    TraversalWorkspace<scalar_t>* workspace=nullptr
+);
+
+template<typename scalar_t, typename index_t=signedindex_t>
+void multiply_by_AT_multiwidth_cpu_kernel_launcher(
+    const scalar_t* query_points,  // [N', 3]
+    const scalar_t* query_widths,  // [N', K]
+    signedindex_t num_widths,
+    const scalar_t* points,        // [N, 3]
+    const scalar_t* point_attrs,   // [N, 1]
+    const index_t* node2point_index,
+    const index_t* node2point_indexstart,
+    const index_t* node_children_list,
+    const scalar_t* node_attrs,
+    const bool* node_is_leaf_list,
+    const scalar_t* node_half_w_list,
+    const scalar_t* node_reppoints,
+    const index_t* num_points_in_node,
+    scalar_t* out_attrs,           // [N', K, 3]
+    signedindex_t num_queries,
+    scalar_t theta=TREECODE_THRESHOLD,
+    const TreeTraversalCache<scalar_t>* traversal_cache=nullptr,
+    TraversalWorkspace<scalar_t>* workspace=nullptr
+);
+
+template<typename scalar_t, typename index_t=signedindex_t>
+void multiply_by_G_multiwidth_cpu_kernel_launcher(
+    const scalar_t* query_points,  // [N', 3]
+    const scalar_t* query_widths,  // [N', K]
+    signedindex_t num_widths,
+    const scalar_t* points,        // [N, 3]
+    const scalar_t* point_attrs,   // [N, 3]
+    const index_t* node2point_index,
+    const index_t* node2point_indexstart,
+    const index_t* node_children_list,
+    const scalar_t* node_attrs,
+    const bool* node_is_leaf_list,
+    const scalar_t* node_half_w_list,
+    const scalar_t* node_reppoints,
+    const index_t* num_points_in_node,
+    scalar_t* out_attrs,           // [N', K, 3]
+    signedindex_t num_queries,
+    scalar_t theta=TREECODE_THRESHOLD,
+    const TreeTraversalCache<scalar_t>* traversal_cache=nullptr,
+    TraversalWorkspace<scalar_t>* workspace=nullptr
+);
+
+
+//////////////////// several right hand sides ////////////////////
+/// @note A, AT or G of K sets of attributes (e.g. candidate normal fields) side by side, [N, K, C], in one traversal:
+//        the nodes are scattered once from the [N, K*C] attributes, with weights shared by the right hand sides
+//        (e.g. the sum of their normalized magnitudes), and every far node or near point is evaluated for all of them
+//        with the right hand sides in the vectorized inner loop. Far nodes are approximated at order 0
+template<typename scalar_t, typename index_t=signedindex_t>
+void multiply_by_A_multirhs_cpu_kernel_launcher(
+    const scalar_t* query_points,  // [N', 3]
+    const scalar_t* query_width,   // [N',]
+    signedindex_t num_rhs,
+    const scalar_t* points,        // [N, 3]
+    const scalar_t* point_attrs,   // [N, K, 3]
+    const index_t* node2point_index,
+    const index_t* node2point_indexstart,
+    const index_t* node_children_list,
+    const scalar_t* node_attrs,    // [num_nodes, K, 3]
+    const bool* node_is_leaf_list,
+    const scalar_t* node_half_w_list,
+    const scalar_t* node_reppoints,
+    const index_t* num_points_in_node,
+    scalar_t* out_attrs,           // [N', K]
+    signedindex_t num_queries,
+    signedindex_t num_nodes,
+    bool continuous_kernel=false,
+    scalar_t theta=TREECODE_THRESHOLD,
+    const TreeTraversalCache<scalar_t>* traversal_cache=nullptr,
+    TraversalWorkspace<scalar_t>* workspace=nullptr
+);
+
+template<typename scalar_t, typename index_t=signedindex_t>
+void multiply_by_AT_multirhs_cpu_kernel_launcher(
+    const scalar_t* query_points,  // [N', 3]
+    const scalar_t* query_width,   // [N',]
+    signedindex_t num_rhs,
+    const scalar_t* points,        // [N, 3]
+    const scalar_t* point_attrs,   // [N, K]
+    const index_t* node2point_index,
+    const index_t* node2point_indexstart,
+    const index_t* node_children_list,
+    const scalar_t* node_attrs,    // [num_nodes, K]
+    const bool* node_is_leaf_list,
+    const scalar_t* node_half_w_list,
+    const scalar_t* node_reppoints,
+    const index_t* num_points_in_node,
+    scalar_t* out_attrs,           // [N', K, 3]
+    signedindex_t num_queries,
+    signedindex_t num_nodes,
+    scalar_t theta=TREECODE_THRESHOLD,
+    const TreeTraversalCache<scalar_t>* traversal_cache=nullptr,
+    TraversalWorkspace<scalar_t>* workspace=nullptr
 );
 
+template<typename scalar_t, typename index_t=signedindex_t>
+void multiply_by_G_multirhs_cpu_kernel_launcher(
+    const scalar_t* query_points,  // [N', 3]
+    const scalar_t* query_width,   // [N',]
+    signedindex_t num_rhs,
+    const scalar_t* points,        // [N, 3]
+    const scalar_t* point_attrs,   // [N, K, 3]
+    const index_t* node2point_index,
+    const index_t* node2point_indexstart,
+    const index_t* node_children_list,
+    const scalar_t* node_attrs,    // [num_nodes, K, 3]
+    const bool* node_is_leaf_list,
+    const scalar_t* node_half_w_list,
+    const scalar_t* node_reppoints,
+    const index_t* num_points_in_node,
+    scalar_t* out_attrs,           // [N', K, 3]
+    signedindex_t num_queries,
+    signedindex_t num_nodes,
+    scalar_t theta=TREECODE_THRESHOLD,
+    const TreeTraversalCache<scalar_t>* traversal_cache=nullptr,
+    TraversalWorkspace<scalar_t>* workspace=nullptr
+);
+
+
+//////////////////// wnnc solver ////////////////////
+/// @note the WNNC iterations of main_wnnc.py without torch: the points are normalized into [-1, 1]^3 (bbox scaled by 1.1),
+//        the normals start from 0, and every iteration takes a gradient step on |A mu - 0.5|^2 and a WNNC step
+//        (G mu, normalized, rescaled to the length of mu), with the width decreasing linearly from wsmax to wsmin
+//        and theta, if theta_start is set, increasing linearly from theta_start to theta (cheap early iterations).
+//        All buffers are allocated once, before the iterations
+struct WNNCOptions {
+    double wsmin = 0.01;
+    double wsmax = 0.04;
+    signedindex_t iters = 40;
+    signedindex_t max_tree_depth = ALLOWED_MAX_DEPTH;
+    signedindex_t leaf_size = 1;         // max points per tree leaf, 16-64 is faster and more accurate
+    signedindex_t expansion_order = 0;   // see the treecode op wrappers
+    bool precompute_AT_b = true;         // AT b of all the iterations in one pass before the first, N*iters*3 more scalars, expansion_order 0 only
+    double theta = TREECODE_THRESHOLD;   // accuracy of the treecode products, see TREECODE_THRESHOLD
+    double theta_start = 0;              // > 0: theta of the first iteration, going linearly to theta at the last
+    bool verbose = false;                // prints the iterations to stdout
+};
+
+/// @brief the widths of the presets of main_wnnc.py, "l0" (noise free) to "l5" (sparse points and sketches),
+//         returns false for an unknown name
+bool get_wnnc_width_preset(const char* width_config, double& wsmin, double& wsmax);
+
+/// @brief writes the oriented unit normals of the points,
+//         throws std::invalid_argument for invalid options (e.g. wsmin > wsmax, max_tree_depth > ALLOWED_MAX_DEPTH)
+template<typename scalar_t>
+void wnnc_solve(
+    const scalar_t* points,        // [N, 3], any scale
+    signedindex_t num_points,
+    const WNNCOptions& options,
+    scalar_t* out_normals          // [N, 3]
+);
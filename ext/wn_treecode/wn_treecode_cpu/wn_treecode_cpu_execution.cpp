@@ -0,0 +1,171 @@
+/*
+MIT License
+
+Copyright (c) 2024 Siyou Lin, Zuoqiang Shi, Yebin Liu
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+
+#include "wn_treecode_cpu.h"
+#include <omp.h>
+#include <cassert>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+
+/// @note process-wide, shared by all launchers; the affinity state is only touched under affinity_mutex
+static std::atomic<signedindex_t> context_num_threads(-1);
+static std::atomic<signedindex_t> context_schedule_kind(SCHEDULE_BALANCED);
+static std::atomic<signedindex_t> context_schedule_chunk_size(0);
+static std::atomic<bool> context_pin_threads(false);
+static std::atomic<signedindex_t> context_opening_criterion(OPENING_CELL);
+static std::atomic<signedindex_t> context_query_packet_size(DEFAULT_QUERY_PACKET_SIZE);
+
+static std::mutex affinity_mutex;
+static signedindex_t pinned_team_size = 0;
+#ifdef __linux__
+static bool has_original_affinity = false;
+static cpu_set_t original_affinity;
+#endif
+
+
+void set_num_threads(signedindex_t num_threads) {
+    context_num_threads = num_threads;
+}
+
+signedindex_t get_num_threads() {
+    signedindex_t num_threads = context_num_threads;
+    return num_threads > 0 ? num_threads : omp_get_max_threads();
+}
+
+void set_schedule(signedindex_t schedule_kind, signedindex_t chunk_size) {
+    assert(schedule_kind == SCHEDULE_STATIC || schedule_kind == SCHEDULE_DYNAMIC || schedule_kind == SCHEDULE_GUIDED || schedule_kind == SCHEDULE_BALANCED);
+    context_schedule_kind = schedule_kind;
+    context_schedule_chunk_size = chunk_size;
+}
+
+signedindex_t get_schedule_kind() {
+    return context_schedule_kind;
+}
+
+signedindex_t get_schedule_chunk_size() {
+    return context_schedule_chunk_size;
+}
+
+
+/// @note the OpenMP pool keeps its threads between parallel regions of the same size,
+//        so pinning them once per team size is enough
+static void pin_team_locked(signedindex_t num_threads) {
+#ifdef __linux__
+    if (!has_original_affinity) {
+        sched_getaffinity(0, sizeof(cpu_set_t), &original_affinity);
+        has_original_affinity = true;
+    }
+    std::vector<int> allowed_cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &original_affinity)) {
+            allowed_cpus.push_back(cpu);
+        }
+    }
+    if (allowed_cpus.empty()) {
+        return;
+    }
+
+    #pragma omp parallel num_threads(num_threads)
+    {
+        cpu_set_t thread_affinity;
+        CPU_ZERO(&thread_affinity);
+        CPU_SET(allowed_cpus[omp_get_thread_num() % allowed_cpus.size()], &thread_affinity);
+        sched_setaffinity(0, sizeof(cpu_set_t), &thread_affinity);
+    }
+#endif
+    pinned_team_size = num_threads;
+}
+
+static void unpin_team_locked() {
+#ifdef __linux__
+    if (has_original_affinity && pinned_team_size > 0) {
+        #pragma omp parallel num_threads(pinned_team_size)
+        {
+            sched_setaffinity(0, sizeof(cpu_set_t), &original_affinity);
+        }
+    }
+#endif
+    pinned_team_size = 0;
+}
+
+void set_thread_affinity(bool pin_threads) {
+    std::lock_guard<std::mutex> lock(affinity_mutex);
+    context_pin_threads = pin_threads;
+    if (pin_threads) {
+        pin_team_locked(get_num_threads());
+    } else {
+        unpin_team_locked();
+    }
+}
+
+bool get_thread_affinity() {
+    return context_pin_threads;
+}
+
+void set_opening_criterion(signedindex_t opening_criterion) {
+    assert(opening_criterion == OPENING_CELL || opening_criterion == OPENING_TIGHT);
+    context_opening_criterion = opening_criterion;
+}
+
+signedindex_t get_opening_criterion() {
+    return context_opening_criterion;
+}
+
+void set_query_packet_size(signedindex_t query_packet_size) {
+    assert(query_packet_size >= 0 && query_packet_size <= MAX_QUERY_PACKET_SIZE);
+    context_query_packet_size = query_packet_size;
+}
+
+signedindex_t get_query_packet_size() {
+    return context_query_packet_size;
+}
+
+
+signedindex_t prepare_parallel_launch() {
+    const signedindex_t num_threads = get_num_threads();
+
+    omp_sched_t omp_schedule_kind = omp_sched_static;
+    if (context_schedule_kind == SCHEDULE_DYNAMIC) {
+        omp_schedule_kind = omp_sched_dynamic;
+    } else if (context_schedule_kind == SCHEDULE_GUIDED || context_schedule_kind == SCHEDULE_BALANCED) {
+        // the query loops schedule themselves under SCHEDULE_BALANCED, the per-node loops left run guided
+        omp_schedule_kind = omp_sched_guided;
+    }
+    omp_set_schedule(omp_schedule_kind, int(context_schedule_chunk_size));
+
+    if (context_pin_threads) {
+        std::lock_guard<std::mutex> lock(affinity_mutex);
+        if (context_pin_threads && pinned_team_size != num_threads) {
+            pin_team_locked(num_threads);
+        }
+    }
+    return num_threads;
+}
@@ -28,6 +28,10 @@ SOFTWARE.
 #include <cmath>
 #include <vector>
 #include <iostream>
+#include <limits>
+#include <algorithm>
+#include <numeric>
+#include <cstdint>
 #include <omp.h>
 
 // inplace elementwise addition to a consective block of memory defined by SPATIAL_DIM
@@ -167,288 +171,854 @@ void eval_G_mu_add_(scalar_t* out, const scalar_t* diff, const scalar_t* mu, sca
 }
 
 
+/// @brief contractions of the second moment of a node, M2[a, b, c] = sum delta_a delta_b f_c, with r
+//         rrr = M2(r, r, r), trace_r = sum_ac M2[a, a, c] r_c, mixed_r = sum_ab M2[a, b, a] r_b,
+//         and per component (for 3-dim attributes): trace[c] = sum_a M2[a, a, c], mixed[b] = sum_a M2[a, b, a],
+//         first_rr[a] = sum_bc M2[a, b, c] r_b r_c, last_rr[c] = sum_ab M2[a, b, c] r_a r_b
+template<typename scalar_t>
+struct Moment2Contractions {
+    scalar_t trace[SPATIAL_DIM] = {};
+    scalar_t mixed[SPATIAL_DIM] = {};
+    scalar_t first_rr[SPATIAL_DIM] = {};
+    scalar_t last_rr[SPATIAL_DIM] = {};
+    scalar_t rrr = 0, trace_r = 0, mixed_r = 0;
+
+    Moment2Contractions(const scalar_t* moment2, const scalar_t* r) {
+        for (signedindex_t a = 0; a < SPATIAL_DIM; a++) {
+            for (signedindex_t b = 0; b < SPATIAL_DIM; b++) {
+                for (signedindex_t c = 0; c < SPATIAL_DIM; c++) {
+                    scalar_t m = moment2[(a*SPATIAL_DIM + b)*SPATIAL_DIM + c];
+                    first_rr[a] += m * r[b] * r[c];
+                    last_rr[c] += m * r[a] * r[b];
+                }
+            }
+            trace[0] += moment2[(a*SPATIAL_DIM + a)*SPATIAL_DIM + 0];
+            trace[1] += moment2[(a*SPATIAL_DIM + a)*SPATIAL_DIM + 1];
+            trace[2] += moment2[(a*SPATIAL_DIM + a)*SPATIAL_DIM + 2];
+            for (signedindex_t b = 0; b < SPATIAL_DIM; b++) {
+                mixed[b] += moment2[(a*SPATIAL_DIM + b)*SPATIAL_DIM + a];
+            }
+        }
+        rrr = inner_prod<scalar_t>(last_rr, r, SPATIAL_DIM);
+        trace_r = inner_prod<scalar_t>(trace, r, SPATIAL_DIM);
+        mixed_r = inner_prod<scalar_t>(mixed, r, SPATIAL_DIM);
+    }
+};
 
-/// @brief collect point attributes to nodes
 
+/// @brief far-field evaluation of a node with its multipole expansion about the reppoint
+//         with y = reppoint + delta, the moments of a node with C-dim attributes f are
+//         moment0[c] = sum f_c, moment1[a, c] = sum delta_a f_c, moment2[a, b, c] = sum delta_a delta_b f_c,
+//         stored as [num_nodes, C], [num_nodes, 3, C], [num_nodes, 3, 3, C];
+//         the Taylor terms in delta are contracted with the derivatives of 1/|r| in closed form;
+//         expansion_order == 0 (or a query inside the smoothing range) reduces to the plain reppoint approximation
 template<typename scalar_t>
-void scatter_point_attrs_to_nodes_leaf_cpu_kernel(
-        const signedindex_t* ptr_node_parent_list,
-        const scalar_t* ptr_points,
-        const scalar_t* ptr_point_weights,
-        const scalar_t* ptr_point_attrs,
-        const signedindex_t* ptr_node2point_index,
-        const signedindex_t* ptr_node2point_indexstart,
-        const signedindex_t* ptr_num_points_in_node,
-        const bool* ptr_node_is_leaf_list,
-        bool* ptr_scattered_mask,
+scalar_t eval_A_expansion(const scalar_t* diff,     // x - reppoint
+                          const scalar_t* node_attrs,
+                          const scalar_t* node_moments1,
+                          const scalar_t* node_moments2,
+                          signedindex_t node_index,
+                          signedindex_t expansion_order,
+                          scalar_t smooth_width,
+                          bool continuous_kernel) {
+    const scalar_t* moment0 = node_attrs + node_index*SPATIAL_DIM;
+    scalar_t dist2 = inner_prod<scalar_t>(diff, diff, SPATIAL_DIM);
+    if (expansion_order == 0 || dist2 < smooth_width*smooth_width) {
+        return eval_A_mu<scalar_t>(diff, moment0, smooth_width, continuous_kernel);
+    }
+    scalar_t inv_dist2 = scalar_t(1) / dist2;
+    scalar_t inv_dist3 = std::sqrt(inv_dist2) * inv_dist2;
+    scalar_t inv_dist5 = inv_dist3 * inv_dist2;
 
-        scalar_t* ptr_out_node_attrs,
-        scalar_t* ptr_out_node_reppoints,
-        scalar_t* ptr_out_node_weights,
+    // A(x) = sum_c mu_c d_c phi(x - y), phi = 1/|r|
+    //      = M0[c] d_c phi - M1[a, c] d_a d_c phi + 1/2 M2[a, b, c] d_a d_b d_c phi
+    scalar_t result = -inner_prod<scalar_t>(diff, moment0, SPATIAL_DIM) * inv_dist3;
 
-        signedindex_t attr_dim,
-        signedindex_t num_nodes,
-        signedindex_t node_index) {
-    
-    if (node_index < num_nodes) {
-        ptr_scattered_mask[node_index] = false;
+    const scalar_t* moment1 = node_moments1 + node_index*SPATIAL_DIM*SPATIAL_DIM;
+    scalar_t r_moment1_r = 0, moment1_trace = 0;
+    for (signedindex_t a = 0; a < SPATIAL_DIM; a++) {
+        moment1_trace += moment1[a*SPATIAL_DIM + a];
+        r_moment1_r += diff[a] * inner_prod<scalar_t>(moment1 + a*SPATIAL_DIM, diff, SPATIAL_DIM);
+    }
+    result -= (3 * r_moment1_r * inv_dist5 - moment1_trace * inv_dist3);
 
-        if (ptr_node_is_leaf_list[node_index]) {
-            ptr_scattered_mask[node_index] = true;
+    if (expansion_order >= 2) {
+        Moment2Contractions<scalar_t> m2(node_moments2 + node_index*SPATIAL_DIM*SPATIAL_DIM*SPATIAL_DIM, diff);
+        result += scalar_t(0.5) * (-15 * m2.rrr * inv_dist5 * inv_dist2 + 3 * (m2.trace_r + 2 * m2.mixed_r) * inv_dist5);
+    }
+    return result;
+}
 
-            // representative points
-            scalar_t reppoint[SPATIAL_DIM] = {};
-            scalar_t reppoint_zero[SPATIAL_DIM] = {};
 
-            scalar_t total_weight = 0;
-            for (signedindex_t j = 0; j < ptr_num_points_in_node[node_index]; j++) {
-                signedindex_t point_index = ptr_node2point_index[ptr_node2point_indexstart[node_index] + j];
+template<typename scalar_t>
+void eval_AT_expansion_add_(scalar_t* out,
+                            const scalar_t* diff,     // query - reppoint
+                            const scalar_t* node_attrs,
+                            const scalar_t* node_moments1,
+                            const scalar_t* node_moments2,
+                            signedindex_t node_index,
+                            signedindex_t expansion_order,
+                            scalar_t smooth_width) {
+    const scalar_t* moment0 = node_attrs + node_index;
+    scalar_t dist2 = inner_prod<scalar_t>(diff, diff, SPATIAL_DIM);
+    if (expansion_order == 0 || dist2 < smooth_width*smooth_width) {
+        eval_AT_s_add_<scalar_t>(out, diff, moment0, smooth_width);
+        return;
+    }
+    scalar_t inv_dist2 = scalar_t(1) / dist2;
+    scalar_t inv_dist3 = std::sqrt(inv_dist2) * inv_dist2;
+    scalar_t inv_dist5 = inv_dist3 * inv_dist2;
 
-                // the user is resposible for assuring point weights are all positive
-                total_weight += ptr_point_weights[point_index];
-                add_vec_<scalar_t>(ptr_out_node_attrs + node_index*attr_dim, ptr_point_attrs + point_index*attr_dim, attr_dim);
-                add_vec_<scalar_t>(reppoint, ptr_points + point_index*SPATIAL_DIM, ptr_point_weights[point_index], SPATIAL_DIM);
-                add_vec_<scalar_t>(reppoint_zero, ptr_points + point_index*SPATIAL_DIM, SPATIAL_DIM);
-            }
+    // AT(x)_e = -sum s d_e phi(x - y)
+    //         = -(M0 d_e phi - M1[a] d_a d_e phi + 1/2 M2[a, b] d_a d_b d_e phi)
+    const scalar_t* moment1 = node_moments1 + node_index*SPATIAL_DIM;
+    scalar_t r_moment1 = inner_prod<scalar_t>(diff, moment1, SPATIAL_DIM);
 
-            if (total_weight > 0) {
-                assign_vec<scalar_t>(reppoint, reppoint, scalar_t(1) / total_weight, SPATIAL_DIM);
-            } else {
-                assign_vec<scalar_t>(reppoint, reppoint_zero, scalar_t(1) / scalar_t(ptr_num_points_in_node[node_index]), SPATIAL_DIM);
-            }
-            ptr_out_node_weights[node_index] = total_weight;
-            assign_vec<scalar_t>(ptr_out_node_reppoints + node_index*SPATIAL_DIM, reppoint, SPATIAL_DIM);
+    scalar_t moment2_r[SPATIAL_DIM] = {};
+    scalar_t r_moment2_r = 0, moment2_trace = 0;
+    if (expansion_order >= 2) {
+        const scalar_t* moment2 = node_moments2 + node_index*SPATIAL_DIM*SPATIAL_DIM;
+        for (signedindex_t a = 0; a < SPATIAL_DIM; a++) {
+            moment2_trace += moment2[a*SPATIAL_DIM + a];
+            moment2_r[a] = inner_prod<scalar_t>(moment2 + a*SPATIAL_DIM, diff, SPATIAL_DIM);
+        }
+        r_moment2_r = inner_prod<scalar_t>(diff, moment2_r, SPATIAL_DIM);
+    }
+
+    for (signedindex_t e = 0; e < SPATIAL_DIM; e++) {
+        scalar_t term = -(*moment0) * diff[e] * inv_dist3;
+        term -= (3 * r_moment1 * diff[e] * inv_dist5 - moment1[e] * inv_dist3);
+        if (expansion_order >= 2) {
+            term += scalar_t(0.5) * (-15 * r_moment2_r * diff[e] * inv_dist5 * inv_dist2
+                                     + 3 * (moment2_trace * diff[e] + 2 * moment2_r[e]) * inv_dist5);
         }
+        out[e] -= term;
     }
 }
 
+
 template<typename scalar_t>
-void scatter_point_attrs_to_nodes_leaf_cpu_kernel_launcher(
-        const signedindex_t* ptr_node_parent_list,
+void eval_G_expansion_add_(scalar_t* out,
+                           const scalar_t* diff,     // x - reppoint
+                           const scalar_t* node_attrs,
+                           const scalar_t* node_moments1,
+                           const scalar_t* node_moments2,
+                           signedindex_t node_index,
+                           signedindex_t expansion_order,
+                           scalar_t smooth_width) {
+    const scalar_t* moment0 = node_attrs + node_index*SPATIAL_DIM;
+    scalar_t dist2 = inner_prod<scalar_t>(diff, diff, SPATIAL_DIM);
+    if (expansion_order == 0 || dist2 < smooth_width*smooth_width) {
+        eval_G_mu_add_<scalar_t>(out, diff, moment0, smooth_width);
+        return;
+    }
+    scalar_t inv_dist2 = scalar_t(1) / dist2;
+    scalar_t inv_dist3 = std::sqrt(inv_dist2) * inv_dist2;
+    scalar_t inv_dist5 = inv_dist3 * inv_dist2;
+    scalar_t inv_dist7 = inv_dist5 * inv_dist2;
+
+    // G(x)_e = -sum_c mu_c d_c d_e phi(x - y), one derivative more than A
+    //        = -(M0[c] d_c d_e phi - M1[a, c] d_a d_c d_e phi + 1/2 M2[a, b, c] d_a d_b d_c d_e phi)
+    scalar_t r_moment0 = inner_prod<scalar_t>(diff, moment0, SPATIAL_DIM);
+
+    const scalar_t* moment1 = node_moments1 + node_index*SPATIAL_DIM*SPATIAL_DIM;
+    scalar_t moment1_r[SPATIAL_DIM] = {};    // sum_c M1[a, c] r_c
+    scalar_t r_moment1[SPATIAL_DIM] = {};    // sum_a r_a M1[a, c]
+    scalar_t moment1_trace = 0;
+    for (signedindex_t a = 0; a < SPATIAL_DIM; a++) {
+        moment1_trace += moment1[a*SPATIAL_DIM + a];
+        moment1_r[a] = inner_prod<scalar_t>(moment1 + a*SPATIAL_DIM, diff, SPATIAL_DIM);
+        add_vec_<scalar_t>(r_moment1, moment1 + a*SPATIAL_DIM, diff[a], SPATIAL_DIM);
+    }
+    scalar_t r_moment1_r = inner_prod<scalar_t>(diff, moment1_r, SPATIAL_DIM);
+
+    for (signedindex_t e = 0; e < SPATIAL_DIM; e++) {
+        scalar_t term = 3 * r_moment0 * diff[e] * inv_dist5 - moment0[e] * inv_dist3;
+        term -= (-15 * r_moment1_r * diff[e] * inv_dist7
+                 + 3 * (moment1_trace * diff[e] + moment1_r[e] + r_moment1[e]) * inv_dist5);
+        out[e] -= term;
+    }
+
+    if (expansion_order >= 2) {
+        Moment2Contractions<scalar_t> m2(node_moments2 + node_index*SPATIAL_DIM*SPATIAL_DIM*SPATIAL_DIM, diff);
+        scalar_t inv_dist9 = inv_dist7 * inv_dist2;
+        for (signedindex_t e = 0; e < SPATIAL_DIM; e++) {
+            scalar_t term = 105 * m2.rrr * diff[e] * inv_dist9
+                          - 15 * (diff[e] * (m2.trace_r + 2 * m2.mixed_r) + 2 * m2.first_rr[e] + m2.last_rr[e]) * inv_dist7
+                          + 3 * (m2.trace[e] + 2 * m2.mixed[e]) * inv_dist5;
+            out[e] -= scalar_t(0.5) * term;
+        }
+    }
+}
+
+
+/// @brief copies the points of a leaf (tree-ordered [begin, end)) into the near-field block of a query,
+//         handing the block to eval_block whenever it fills up
+template<typename scalar_t, typename eval_block_t>
+void add_leaf_to_near_field_block(
+        const PointsSoA<scalar_t>& points_soa,
+        signedindex_t begin,
+        signedindex_t end,
+        NearFieldBlock<scalar_t>& block,
+        const eval_block_t& eval_block) {
+    while (begin < end) {
+        signedindex_t num_copied = std::min(end - begin, signedindex_t(NEAR_FIELD_BLOCK_SIZE) - block.num_points);
+        for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+            std::copy(points_soa.coords[d].data() + begin, points_soa.coords[d].data() + begin + num_copied, block.coords[d] + block.num_points);
+        }
+        for (signedindex_t c = 0; c < points_soa.attr_dim; c++) {
+            std::copy(points_soa.attrs[c].data() + begin, points_soa.attrs[c].data() + begin + num_copied, block.attrs[c] + block.num_points);
+        }
+        block.num_points += num_copied;
+        begin += num_copied;
+        if (block.num_points == NEAR_FIELD_BLOCK_SIZE) {
+            eval_block(block);
+            block.num_points = 0;
+        }
+    }
+}
+
+
+/// @brief collect point attributes to nodes
+
+template<typename scalar_t, typename index_t>
+void scatter_point_attrs_to_nodes_leaf_cpu_kernel(
         const scalar_t* ptr_points,
         const scalar_t* ptr_point_weights,
         const scalar_t* ptr_point_attrs,
-        const signedindex_t* ptr_node2point_index,
-        const signedindex_t* ptr_node2point_indexstart,
-        const signedindex_t* ptr_num_points_in_node,
-        const bool* ptr_node_is_leaf_list,
-        bool* ptr_scattered_mask,
+        const index_t* ptr_node2point_index,
+        const index_t* ptr_node2point_indexstart,
+        const index_t* ptr_num_points_in_node,
 
         scalar_t* ptr_out_node_attrs,
         scalar_t* ptr_out_node_reppoints,
         scalar_t* ptr_out_node_weights,
+        scalar_t* ptr_out_node_moments1,
+        scalar_t* ptr_out_node_moments2,
 
         signedindex_t attr_dim,
-        signedindex_t num_nodes) {
+        signedindex_t expansion_order,
+        signedindex_t node_index) {
 
-    omp_set_num_threads(20);
-    #pragma omp parallel for
-    for (signedindex_t node_index = 0; node_index < num_nodes; node_index++) {
-        scatter_point_attrs_to_nodes_leaf_cpu_kernel<scalar_t>(
-            ptr_node_parent_list,
-            ptr_points,
-            ptr_point_weights,
-            ptr_point_attrs,
-            ptr_node2point_index,
-            ptr_node2point_indexstart,
-            ptr_num_points_in_node,
-            ptr_node_is_leaf_list,
-            ptr_scattered_mask,
+    // representative points
+    scalar_t reppoint[SPATIAL_DIM] = {};
+    scalar_t reppoint_zero[SPATIAL_DIM] = {};
 
-            ptr_out_node_attrs,
-            ptr_out_node_reppoints,
-            ptr_out_node_weights,
+    scalar_t total_weight = 0;
+    for (signedindex_t j = 0; j < ptr_num_points_in_node[node_index]; j++) {
+        signedindex_t point_index = ptr_node2point_index[ptr_node2point_indexstart[node_index] + j];
 
-            attr_dim,
-            num_nodes,
-            node_index
-        );
+        // the user is resposible for assuring point weights are all positive
+        total_weight += ptr_point_weights[point_index];
+        add_vec_<scalar_t>(ptr_out_node_attrs + node_index*attr_dim, ptr_point_attrs + point_index*attr_dim, attr_dim);
+        add_vec_<scalar_t>(reppoint, ptr_points + point_index*SPATIAL_DIM, ptr_point_weights[point_index], SPATIAL_DIM);
+        add_vec_<scalar_t>(reppoint_zero, ptr_points + point_index*SPATIAL_DIM, SPATIAL_DIM);
     }
 
-}
-
+    if (total_weight > 0) {
+        assign_vec<scalar_t>(reppoint, reppoint, scalar_t(1) / total_weight, SPATIAL_DIM);
+    } else {
+        assign_vec<scalar_t>(reppoint, reppoint_zero, scalar_t(1) / scalar_t(ptr_num_points_in_node[node_index]), SPATIAL_DIM);
+    }
+    ptr_out_node_weights[node_index] = total_weight;
+    assign_vec<scalar_t>(ptr_out_node_reppoints + node_index*SPATIAL_DIM, reppoint, SPATIAL_DIM);
 
-/////////////////////////////////
+    // moments about the reppoint, only known once the reppoint is
+    if (expansion_order >= 1) {
+        scalar_t* moment1 = ptr_out_node_moments1 + node_index*SPATIAL_DIM*attr_dim;
+        scalar_t* moment2 = (expansion_order >= 2) ? ptr_out_node_moments2 + node_index*SPATIAL_DIM*SPATIAL_DIM*attr_dim : nullptr;
+        for (signedindex_t j = 0; j < ptr_num_points_in_node[node_index]; j++) {
+            signedindex_t point_index = ptr_node2point_index[ptr_node2point_indexstart[node_index] + j];
+            scalar_t delta[SPATIAL_DIM];
+            subtract_vec<scalar_t>(delta, ptr_points + point_index*SPATIAL_DIM, reppoint, SPATIAL_DIM);
+            for (signedindex_t a = 0; a < SPATIAL_DIM; a++) {
+                add_vec_<scalar_t>(moment1 + a*attr_dim, ptr_point_attrs + point_index*attr_dim, delta[a], attr_dim);
+                if (moment2 == nullptr) { continue; }
+                for (signedindex_t b = 0; b < SPATIAL_DIM; b++) {
+                    add_vec_<scalar_t>(moment2 + (a*SPATIAL_DIM+b)*attr_dim, ptr_point_attrs + point_index*attr_dim, delta[a]*delta[b], attr_dim);
+                }
+            }
+        }
+    }
+}
 
 
-template<typename scalar_t>
+template<typename scalar_t, typename index_t>
 void scatter_point_attrs_to_nodes_nonleaf_cpu_kernel(
-        const signedindex_t* ptr_node_parent_list,
-        const signedindex_t* ptr_node_children_list,
-        const scalar_t* ptr_points,
-        const scalar_t* ptr_point_weights,
-        const scalar_t* ptr_point_attrs,
-        const signedindex_t* ptr_node2point_index,
-        const signedindex_t* ptr_node2point_indexstart,
-        const signedindex_t* ptr_num_points_in_node,
-        const bool* ptr_node_is_leaf_list,
-        bool* ptr_scattered_mask,
-        const bool* ptr_next_to_scatter_mask,
+        const index_t* ptr_node_children_list,
+        const index_t* ptr_num_points_in_node,
 
         scalar_t* ptr_out_node_attrs,
         scalar_t* ptr_out_node_reppoints,
         scalar_t* ptr_out_node_weights,
+        scalar_t* ptr_out_node_moments1,
+        scalar_t* ptr_out_node_moments2,
 
         signedindex_t attr_dim,
-        signedindex_t num_nodes,
-        signedindex_t node_index 
+        signedindex_t expansion_order,
+        signedindex_t node_index
     ) {
-    // signedindex_t node_index = blockDim.x * blockIdx.x + threadIdx.x;
-    if (node_index < num_nodes) {
-        /// @note scatter only if it hasn't been scattered && it's not a leaf && all of its children have been scattered
-        if (ptr_next_to_scatter_mask[node_index]) {
+    /// @note all children are on the next level, and have been scattered already
+    scalar_t reppoint[SPATIAL_DIM] = {};
+    scalar_t reppoint_zero[SPATIAL_DIM] = {};
 
-            ptr_scattered_mask[node_index] = true;
+    scalar_t total_weight = 0;
+    for (signedindex_t k = 0; k < NUM_OCT_CHILDREN; k++) {
+        signedindex_t child_index = ptr_node_children_list[node_index*NUM_OCT_CHILDREN + k];
+        if (child_index != -1) {
+            
+            total_weight += ptr_out_node_weights[child_index];
+            add_vec_<scalar_t>(ptr_out_node_attrs + node_index*attr_dim, ptr_out_node_attrs + child_index*attr_dim, attr_dim);
+            add_vec_<scalar_t>(reppoint, ptr_out_node_reppoints + child_index*SPATIAL_DIM, ptr_out_node_weights[child_index], SPATIAL_DIM);
+            add_vec_<scalar_t>(reppoint_zero, ptr_out_node_reppoints + child_index*SPATIAL_DIM, SPATIAL_DIM);
+        }
+    }
 
-            scalar_t reppoint[SPATIAL_DIM] = {};
-            scalar_t reppoint_zero[SPATIAL_DIM] = {};
+    if (total_weight > 0) {
+        assign_vec<scalar_t>(reppoint, reppoint, scalar_t(1) / total_weight, SPATIAL_DIM);
+    } else {
+        assign_vec<scalar_t>(reppoint, reppoint_zero, scalar_t(1) / scalar_t(ptr_num_points_in_node[node_index]), SPATIAL_DIM);
+    }
 
-            scalar_t total_weight = 0;
-            for (signedindex_t k = 0; k < NUM_OCT_CHILDREN; k++) {
-                signedindex_t child_index = ptr_node_children_list[node_index*NUM_OCT_CHILDREN + k];
-                if (child_index != -1) {
-                    
-                    total_weight += ptr_out_node_weights[child_index];
-                    add_vec_<scalar_t>(ptr_out_node_attrs + node_index*attr_dim, ptr_out_node_attrs + child_index*attr_dim, attr_dim);
-                    add_vec_<scalar_t>(reppoint, ptr_out_node_reppoints + child_index*SPATIAL_DIM, ptr_out_node_weights[child_index], SPATIAL_DIM);
-                    add_vec_<scalar_t>(reppoint_zero, ptr_out_node_reppoints + child_index*SPATIAL_DIM, SPATIAL_DIM);
-                }
-            }
+    ptr_out_node_weights[node_index] = total_weight;
+    assign_vec<scalar_t>(ptr_out_node_reppoints + node_index*SPATIAL_DIM, reppoint, SPATIAL_DIM);
 
-            if (total_weight > 0) {
-                assign_vec<scalar_t>(reppoint, reppoint, scalar_t(1) / total_weight, SPATIAL_DIM);
-            } else {
-                assign_vec<scalar_t>(reppoint, reppoint_zero, scalar_t(1) / scalar_t(ptr_num_points_in_node[node_index]), SPATIAL_DIM);
-            }
+    // shift the children's moments to this reppoint, with t = child reppoint - reppoint:
+    // M1[a, c] += t_a M0[c], M2[a, b, c] += t_a M1[b, c] + t_b M1[a, c] + t_a t_b M0[c]
+    if (expansion_order >= 1) {
+        const signedindex_t moment1_size = SPATIAL_DIM*attr_dim;
+        const signedindex_t moment2_size = SPATIAL_DIM*SPATIAL_DIM*attr_dim;
+        scalar_t* moment1 = ptr_out_node_moments1 + node_index*moment1_size;
+        for (signedindex_t k = 0; k < NUM_OCT_CHILDREN; k++) {
+            signedindex_t child_index = ptr_node_children_list[node_index*NUM_OCT_CHILDREN + k];
+            if (child_index == -1) { continue; }
+            const scalar_t* child_moment0 = ptr_out_node_attrs + child_index*attr_dim;
+            const scalar_t* child_moment1 = ptr_out_node_moments1 + child_index*moment1_size;
+            scalar_t shift[SPATIAL_DIM];
+            subtract_vec<scalar_t>(shift, ptr_out_node_reppoints + child_index*SPATIAL_DIM, reppoint, SPATIAL_DIM);
 
-            ptr_out_node_weights[node_index] = total_weight;
-            assign_vec<scalar_t>(ptr_out_node_reppoints + node_index*SPATIAL_DIM, reppoint, SPATIAL_DIM);
+            add_vec_<scalar_t>(moment1, child_moment1, moment1_size);
+            for (signedindex_t a = 0; a < SPATIAL_DIM; a++) {
+                add_vec_<scalar_t>(moment1 + a*attr_dim, child_moment0, shift[a], attr_dim);
+            }
+            if (expansion_order >= 2) {
+                scalar_t* moment2 = ptr_out_node_moments2 + node_index*moment2_size;
+                add_vec_<scalar_t>(moment2, ptr_out_node_moments2 + child_index*moment2_size, moment2_size);
+                for (signedindex_t a = 0; a < SPATIAL_DIM; a++) {
+                    for (signedindex_t b = 0; b < SPATIAL_DIM; b++) {
+                        scalar_t* moment2_ab = moment2 + (a*SPATIAL_DIM+b)*attr_dim;
+                        add_vec_<scalar_t>(moment2_ab, child_moment1 + b*attr_dim, shift[a], attr_dim);
+                        add_vec_<scalar_t>(moment2_ab, child_moment1 + a*attr_dim, shift[b], attr_dim);
+                        add_vec_<scalar_t>(moment2_ab, child_moment0, shift[a]*shift[b], attr_dim);
+                    }
+                }
+            }
         }
     }
 }
 
-template<typename scalar_t>
-void scatter_point_attrs_to_nodes_nonleaf_cpu_kernel_launcher(
-        const signedindex_t* ptr_node_parent_list,
-        const signedindex_t* ptr_node_children_list,
+
+template<typename scalar_t, typename index_t>
+void scatter_point_attrs_to_nodes_cpu_kernel_launcher(
+        const index_t* ptr_node_children_list,
         const scalar_t* ptr_points,
         const scalar_t* ptr_point_weights,
         const scalar_t* ptr_point_attrs,
-        const signedindex_t* ptr_node2point_index,
-        const signedindex_t* ptr_node2point_indexstart,
-        const signedindex_t* ptr_num_points_in_node,
+        const index_t* ptr_node2point_index,
+        const index_t* ptr_node2point_indexstart,
+        const index_t* ptr_num_points_in_node,
         const bool* ptr_node_is_leaf_list,
-        bool* ptr_scattered_mask,
-        const bool* ptr_next_to_scatter_mask,
+        const index_t* ptr_node_level_order,
+        const index_t* ptr_node_level_offsets,
 
         scalar_t* ptr_out_node_attrs,
         scalar_t* ptr_out_node_reppoints,
         scalar_t* ptr_out_node_weights,
 
         signedindex_t attr_dim,
-        signedindex_t num_nodes) {
-    omp_set_num_threads(20);
-    #pragma omp parallel for
-    for (signedindex_t node_index = 0; node_index < num_nodes; node_index++) {
-        scatter_point_attrs_to_nodes_nonleaf_cpu_kernel<scalar_t>(
-            ptr_node_parent_list,
-            ptr_node_children_list,
-            ptr_points,
-            ptr_point_weights,
-            ptr_point_attrs,
-            ptr_node2point_index,
-            ptr_node2point_indexstart,
-            ptr_num_points_in_node,
-            ptr_node_is_leaf_list,
-            ptr_scattered_mask,
-            ptr_next_to_scatter_mask,
+        signedindex_t tree_depth,
+        scalar_t* ptr_out_node_moments1,
+        scalar_t* ptr_out_node_moments2,
+        signedindex_t expansion_order) {
+
+    // one bottom-up sweep, every node is visited exactly once, after all of its children
+    for (signedindex_t depth = tree_depth; depth >= 0; depth--) {
+        const signedindex_t num_threads = prepare_parallel_launch();
+        #pragma omp parallel for num_threads(num_threads) schedule(runtime)
+        for (signedindex_t i = ptr_node_level_offsets[depth]; i < ptr_node_level_offsets[depth+1]; i++) {
+            signedindex_t node_index = ptr_node_level_order[i];
+            if (ptr_node_is_leaf_list[node_index]) {
+                scatter_point_attrs_to_nodes_leaf_cpu_kernel<scalar_t>(
+                    ptr_points,
+                    ptr_point_weights,
+                    ptr_point_attrs,
+                    ptr_node2point_index,
+                    ptr_node2point_indexstart,
+                    ptr_num_points_in_node,
+
+                    ptr_out_node_attrs,
+                    ptr_out_node_reppoints,
+                    ptr_out_node_weights,
+                    ptr_out_node_moments1,
+                    ptr_out_node_moments2,
+
+                    attr_dim,
+                    expansion_order,
+                    node_index
+                );
+            } else {
+                scatter_point_attrs_to_nodes_nonleaf_cpu_kernel<scalar_t>(
+                    ptr_node_children_list,
+                    ptr_num_points_in_node,
 
-            ptr_out_node_attrs,
-            ptr_out_node_reppoints,
-            ptr_out_node_weights,
+                    ptr_out_node_attrs,
+                    ptr_out_node_reppoints,
+                    ptr_out_node_weights,
+                    ptr_out_node_moments1,
+                    ptr_out_node_moments2,
 
-            attr_dim,
-            num_nodes,
-            node_index); 
+                    attr_dim,
+                    expansion_order,
+                    node_index
+                );
+            }
+        }
     }
 }
 
 
-////////////////
+//////////////////////////////////
+/// @brief smoothing-width cull
 
 template<typename scalar_t>
-void find_next_to_scatter_cpu_kernel(
-        const signedindex_t* ptr_node_children_list,
-        const bool* ptr_node_is_leaf_list,
-        bool* ptr_scattered_mask,
-        bool* ptr_next_to_scatter_mask,
-        const signedindex_t* node2point_index,
-        signedindex_t num_nodes,
-        signedindex_t node_index
-    ) {
-    // signedindex_t node_index = blockDim.x * blockIdx.x + threadIdx.x;
-    if (node_index < num_nodes) {
-
-        ptr_next_to_scatter_mask[node_index] = false;
-        bool all_children_scattered = true;
+void get_point2bbox_dist2_range(const scalar_t* point, const scalar_t* bbox, scalar_t& min_dist2, scalar_t& max_dist2) {
+    // squared distances from a point to the nearest and the farthest point of an axis aligned box
+    // the box is padded by a few ulps, so that reppoints rounded slightly outside of it are still covered
+    min_dist2 = 0.0;
+    max_dist2 = 0.0;
+    for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+        scalar_t pad = scalar_t(16) * std::numeric_limits<scalar_t>::epsilon() * (scalar_t(1) + std::max(std::abs(bbox[d]), std::abs(bbox[SPATIAL_DIM+d])));
+        scalar_t lo = bbox[d] - pad;
+        scalar_t hi = bbox[SPATIAL_DIM+d] + pad;
+        scalar_t nearest = std::max(lo - point[d], std::max(point[d] - hi, scalar_t(0)));
+        scalar_t farthest = std::max(point[d] - lo, hi - point[d]);
+        min_dist2 += nearest * nearest;
+        max_dist2 += farthest * farthest;
+    }
+}
 
+// nodes are serialized in depth-first preorder, so the last one is found by following the largest child from the root
+template<typename index_t>
+signedindex_t get_num_nodes_cpu(const index_t* node_children_list, const bool* node_is_leaf_list) {
+    signedindex_t node_index = 0;
+    while (!node_is_leaf_list[node_index]) {
+        signedindex_t last_child = -1;
         for (signedindex_t k = 0; k < NUM_OCT_CHILDREN; k++) {
-            signedindex_t child_index = ptr_node_children_list[node_index*NUM_OCT_CHILDREN + k];
-            if (child_index != -1) {
-                if (!(ptr_scattered_mask[child_index])) {
-                    all_children_scattered = false;
-                }
-            }
+            last_child = std::max(last_child, (signedindex_t)node_children_list[node_index * NUM_OCT_CHILDREN + k]);
         }
+        if (last_child == -1) {
+            break;
+        }
+        node_index = last_child;
+    }
+    return node_index + 1;
+}
+
+/// @brief the far-field test of the traversals, a node is far from a query when the squared distance to its reppoint
+//         exceeds (2*theta*half_w)^2, theta the accuracy parameter of the launch (TREECODE_THRESHOLD by default)
+template<typename scalar_t>
+void compute_node_far_dist2_cpu(const scalar_t* node_half_w_list, scalar_t theta, signedindex_t num_nodes, std::vector<scalar_t>& out_node_far_dist2) {
+    out_node_far_dist2.resize(num_nodes);
+    const scalar_t far_scale = scalar_t(theta * 2.0f);
+    const signedindex_t num_threads = prepare_parallel_launch();
+    #pragma omp parallel for num_threads(num_threads) schedule(static)
+    for (signedindex_t node_index = 0; node_index < num_nodes; node_index++) {
+        const scalar_t far_dist = far_scale * node_half_w_list[node_index];
+        out_node_far_dist2[node_index] = far_dist * far_dist;
+    }
+}
 
-        if ((!(ptr_scattered_mask[node_index])) && (!ptr_node_is_leaf_list[node_index]) && all_children_scattered) {
-            ptr_next_to_scatter_mask[node_index] = true;
+/// @brief what a launcher derives from the tree before its traversal, into the workspace (see TraversalWorkspace):
+//         the tight bounding boxes of the nodes, for the smoothing-width cull (see node_inside_smoothing_width),
+//         and the far-field distances for theta, of the half widths given by the opening criterion (see get_opening_criterion).
+//         The bboxes only depend on the tree and its points, they are those of the traversal cache when there is one;
+//         the far-field distances are kept while the reppoints, theta and the opening criterion stay the same.
+//         Returns the bboxes for the cull, or nullptr without it
+template<typename scalar_t, typename index_t>
+const scalar_t* compute_node_bounds_cpu(
+        const scalar_t* points,        // [N, 3]
+        const index_t* node_children_list,
+        const bool* node_is_leaf_list,
+        const index_t* node2point_index,
+        const index_t* node2point_indexstart,
+        const index_t* num_points_in_node,
+        const scalar_t* node_half_w_list,
+        const scalar_t* node_reppoints,
+        bool cull,
+        scalar_t theta,
+        const TreeTraversalCache<scalar_t>* traversal_cache,
+        TraversalWorkspace<scalar_t>& workspace) {
+    const signedindex_t opening_criterion = get_opening_criterion();
+    const bool tight_opening = (opening_criterion == OPENING_TIGHT);
+    const signedindex_t num_nodes = traversal_cache ? traversal_cache->num_nodes : get_num_nodes_cpu(node_children_list, node_is_leaf_list);
+    const scalar_t* bboxes = nullptr;
+    if (traversal_cache) {
+        bboxes = traversal_cache->node_bboxes.data();
+    } else if (cull || tight_opening) {
+        if (workspace.own_bboxes.empty()) {
+            workspace.own_bboxes.resize(num_nodes*2*SPATIAL_DIM);
+            compute_node_bboxes<scalar_t>(points, node_children_list, node_is_leaf_list, node2point_index, node2point_indexstart, num_points_in_node, workspace.own_bboxes.data(), num_nodes);
         }
+        bboxes = workspace.own_bboxes.data();
+    }
+    if (workspace.node_reppoints != node_reppoints || workspace.theta != theta || workspace.opening_criterion != opening_criterion) {
+        const scalar_t* half_w = node_half_w_list;
+        if (tight_opening) {
+            workspace.opening_half_w.resize(num_nodes);
+            compute_node_opening_half_w<scalar_t>(node_reppoints, bboxes, workspace.opening_half_w.data(), num_nodes);
+            half_w = workspace.opening_half_w.data();
+        }
+        compute_node_far_dist2_cpu<scalar_t>(half_w, theta, num_nodes, workspace.far_dist2);
+        workspace.node_reppoints = node_reppoints;
+        workspace.theta = theta;
+        workspace.opening_criterion = opening_criterion;
+        workspace.packed = false;
+    }
+    return cull ? bboxes : nullptr;
+}
+
+/// @brief the packed nodes of a tree for the reppoints and far-field distances of the workspace (see pack_tree_skeleton_cpu):
+//         the skeleton of the traversal cache, or one packed for this launch without a cache, with reppoint and far_dist2 filled in,
+//         unless the workspace holds them already
+template<typename scalar_t, typename index_t>
+void pack_tree_nodes_cpu(
+        const index_t* node_children_list,
+        const bool* node_is_leaf_list,
+        const index_t* node2point_indexstart,
+        const index_t* num_points_in_node,
+        const scalar_t* node_reppoints,
+        const TreeTraversalCache<scalar_t>* traversal_cache,
+        TraversalWorkspace<scalar_t>& workspace) {
+    if (workspace.packed) {
+        return;
+    }
+    const signedindex_t num_nodes = workspace.far_dist2.size();
+    std::vector<PackedNode<scalar_t>>& packed_nodes = workspace.packed_nodes;
+    if (traversal_cache) {
+        packed_nodes.resize(num_nodes);
+    } else {
+        pack_tree_skeleton_cpu<scalar_t, index_t>(node_children_list, node_is_leaf_list, node2point_indexstart, num_points_in_node,
+                                                  num_nodes, packed_nodes);
     }
+    const PackedNode<scalar_t>* skeleton = traversal_cache ? traversal_cache->packed_nodes.data() : packed_nodes.data();
+    const scalar_t* node_far_dist2 = workspace.far_dist2.data();
+    const signedindex_t num_threads = prepare_parallel_launch();
+    #pragma omp parallel for num_threads(num_threads) schedule(static)
+    for (signedindex_t packed_index = 0; packed_index < num_nodes; packed_index++) {
+        PackedNode<scalar_t>& packed_node = packed_nodes[packed_index];
+        packed_node = skeleton[packed_index];
+        const signedindex_t node_index = packed_node.node_index;
+        assign_vec<scalar_t>(packed_node.reppoint, node_reppoints + node_index*SPATIAL_DIM, SPATIAL_DIM);
+        packed_node.far_dist2 = node_far_dist2[node_index];
+    }
+    workspace.packed = true;
 }
 
+/// @brief the points and attributes of a launch in tree order (see PointsSoA), in the workspace:
+//         the coordinates are gathered once for the points, the attributes again for others or another attr_dim
+template<typename scalar_t, typename index_t>
+const PointsSoA<scalar_t>& gather_workspace_points_cpu(
+        const scalar_t* points,        // [N, 3]
+        const scalar_t* point_attrs,   // [N, C]
+        const index_t* node2point_index,
+        signedindex_t num_points,
+        signedindex_t attr_dim,
+        TraversalWorkspace<scalar_t>& workspace) {
+    PointsSoA<scalar_t>& points_soa = workspace.points_soa;
+    const bool gather_coords = (workspace.soa_points != points || (signedindex_t)points_soa.coords[0].size() != num_points);
+    if (gather_coords || workspace.soa_point_attrs != point_attrs || points_soa.attr_dim != attr_dim) {
+        gather_points_soa_cpu<scalar_t, index_t>(points, point_attrs, node2point_index, num_points, attr_dim, points_soa, gather_coords);
+        workspace.soa_points = points;
+        workspace.soa_point_attrs = point_attrs;
+    }
+    return points_soa;
+}
 
+/// @brief true if every point under the node is closer to the query than smooth_width.
+//         AT, G, and A without continuous_kernel vanish there, for the points and for the reppoints of the node
+//         and of its descendants at any expansion order, so the whole subtree can be skipped.
+//         point2node_dist2 is the squared distance to the reppoint of the node, node_bboxes == nullptr disables the cull
 template<typename scalar_t>
-void find_next_to_scatter_cpu_kernel_launcher(
-        const signedindex_t* ptr_node_children_list,
-        const bool* ptr_node_is_leaf_list,
-        bool* ptr_scattered_mask,
-        bool* ptr_next_to_scatter_mask,
-        const signedindex_t* node2point_index,
-        signedindex_t num_nodes
-    ) {
-    omp_set_num_threads(20);
-    #pragma omp parallel for
-    for (signedindex_t node_index = 0; node_index < num_nodes; node_index++) {
-        find_next_to_scatter_cpu_kernel<scalar_t>(
-            ptr_node_children_list,
-            ptr_node_is_leaf_list,
-            ptr_scattered_mask,
-            ptr_next_to_scatter_mask,
-            node2point_index,
-            num_nodes,
-            node_index
-        );
+bool node_inside_smoothing_width(const scalar_t* query_point, scalar_t point2node_dist2, const scalar_t* node_bboxes, signedindex_t node_index, scalar_t smooth_width) {
+    // the reppoint is in the box, its distance is tested first: with small widths almost no node gets past this
+    if (node_bboxes == nullptr || point2node_dist2 >= smooth_width * smooth_width) {
+        return false;
     }
+    scalar_t min_dist2, max_dist2;
+    get_point2bbox_dist2_range<scalar_t>(query_point, node_bboxes + node_index*2*SPATIAL_DIM, min_dist2, max_dist2);
+    return max_dist2 < smooth_width * smooth_width;
 }
 
 
 //////////////////////////////////
+/// @brief the SCHEDULE_BALANCED schedule of a query loop: the one of the workspace, built again unless it was built
+//         for the same queries, costs and number of threads, or own_schedule built without a workspace
+template<typename scalar_t, typename index_t>
+const QuerySchedule& get_query_schedule_cpu(
+        const scalar_t* query_points,       // [N', 3]
+        const signedindex_t* query_costs,   // [N',] or nullptr, see build_query_schedule_cpu
+        const index_t* node_children_list,
+        const bool* node_is_leaf_list,
+        const index_t* num_points_in_node,
+        signedindex_t num_queries,
+        signedindex_t num_threads,
+        TraversalWorkspace<scalar_t>* workspace,
+        QuerySchedule& own_schedule) {
+    QuerySchedule& schedule = workspace ? workspace->query_schedule : own_schedule;
+    if (workspace == nullptr || workspace->schedule_query_points != query_points || workspace->schedule_query_costs != query_costs
+        || workspace->schedule_num_queries != num_queries || workspace->schedule_num_threads != num_threads) {
+        build_query_schedule_cpu<scalar_t>(
+            query_points,
+            query_costs,
+            node_children_list,
+            node_is_leaf_list,
+            num_points_in_node,
+            num_queries,
+            num_threads,
+            schedule);
+        if (workspace) {
+            workspace->schedule_query_points = query_points;
+            workspace->schedule_query_costs = query_costs;
+            workspace->schedule_num_queries = num_queries;
+            workspace->schedule_num_threads = num_threads;
+        }
+    }
+    return schedule;
+}
+
+/// @brief calls query_kernel(query_index) once for every query, from as many threads as the execution context says,
+//         in Morton-ordered chunks of about equal cost with SCHEDULE_BALANCED, in index order otherwise.
+//         The schedule is kept in the workspace, if any, for the next loops over the same queries and costs:
+//         whatever it was built from, it visits every query once, so only the balance of the threads depends on that
+template<typename scalar_t, typename index_t, typename query_kernel_t>
+void run_query_loop_cpu(
+        const scalar_t* query_points,       // [N', 3]
+        const signedindex_t* query_costs,   // [N',] or nullptr, see build_query_schedule_cpu
+        const index_t* node_children_list,
+        const bool* node_is_leaf_list,
+        const index_t* num_points_in_node,
+        signedindex_t num_queries,
+        TraversalWorkspace<scalar_t>* workspace,
+        const query_kernel_t& query_kernel) {
+
+    const signedindex_t num_threads = prepare_parallel_launch();
+    if (get_schedule_kind() != SCHEDULE_BALANCED) {
+        #pragma omp parallel for num_threads(num_threads) schedule(runtime)
+        for (signedindex_t query_index = 0; query_index < num_queries; query_index++) {
+            query_kernel(query_index);
+        }
+        return;
+    }
+
+    QuerySchedule own_schedule;   // without a workspace
+    const QuerySchedule& schedule = get_query_schedule_cpu<scalar_t>(query_points, query_costs, node_children_list, node_is_leaf_list, num_points_in_node,
+                                                                     num_queries, num_threads, workspace, own_schedule);
+    const signedindex_t num_chunks = schedule.chunk_offsets.size() - 1;
+    #pragma omp parallel for num_threads(num_threads) schedule(dynamic, 1)
+    for (signedindex_t chunk_index = 0; chunk_index < num_chunks; chunk_index++) {
+        for (signedindex_t i = schedule.chunk_offsets[chunk_index]; i < schedule.chunk_offsets[chunk_index+1]; i++) {
+            query_kernel(schedule.query_order[i]);
+        }
+    }
+}
+
+
+/// @brief calls packet_kernel(packet_queries, packet_size, near_blocks) for runs of up to packet_size queries that are
+//         consecutive in the order of run_query_loop_cpu, within its chunks: near each other with SCHEDULE_BALANCED
+//         (Morton order), or for tree-ordered queries. near_blocks: [packet_size,] empty blocks of the calling thread,
+//         kept in the workspace, to be left empty again
+template<typename scalar_t, typename index_t, typename packet_kernel_t>
+void run_query_packet_loop_cpu(
+        const scalar_t* query_points,       // [N', 3]
+        const index_t* node_children_list,
+        const bool* node_is_leaf_list,
+        const index_t* num_points_in_node,
+        signedindex_t num_queries,
+        signedindex_t packet_size,
+        TraversalWorkspace<scalar_t>& workspace,
+        const packet_kernel_t& packet_kernel) {
+    assert(packet_size >= 1 && packet_size <= MAX_QUERY_PACKET_SIZE);
+
+    const signedindex_t num_threads = prepare_parallel_launch();
+    if ((signedindex_t)workspace.packet_near_blocks.size() < num_threads * packet_size) {
+        workspace.packet_near_blocks.resize(num_threads * packet_size);
+    }
+    NearFieldBlock<scalar_t>* near_blocks = workspace.packet_near_blocks.data();
+
+    if (get_schedule_kind() != SCHEDULE_BALANCED) {
+        const signedindex_t num_packets = (num_queries + packet_size - 1) / packet_size;
+        #pragma omp parallel for num_threads(num_threads) schedule(runtime)
+        for (signedindex_t packet_index = 0; packet_index < num_packets; packet_index++) {
+            signedindex_t packet_queries[MAX_QUERY_PACKET_SIZE];
+            const signedindex_t begin = packet_index * packet_size;
+            const signedindex_t cur_packet_size = std::min(packet_size, num_queries - begin);
+            std::iota(packet_queries, packet_queries + cur_packet_size, begin);
+            packet_kernel(packet_queries, cur_packet_size, near_blocks + omp_get_thread_num() * packet_size);
+        }
+        return;
+    }
+
+    QuerySchedule own_schedule;   // unused, the schedule is kept in the workspace
+    const QuerySchedule& schedule = get_query_schedule_cpu<scalar_t>(query_points, nullptr, node_children_list, node_is_leaf_list, num_points_in_node,
+                                                                     num_queries, num_threads, &workspace, own_schedule);
+    const signedindex_t num_chunks = schedule.chunk_offsets.size() - 1;
+    #pragma omp parallel for num_threads(num_threads) schedule(dynamic, 1)
+    for (signedindex_t chunk_index = 0; chunk_index < num_chunks; chunk_index++) {
+        const signedindex_t chunk_end = schedule.chunk_offsets[chunk_index+1];
+        for (signedindex_t begin = schedule.chunk_offsets[chunk_index]; begin < chunk_end; begin += packet_size) {
+            packet_kernel(schedule.query_order.data() + begin, std::min(packet_size, chunk_end - begin),
+                          near_blocks + omp_get_thread_num() * packet_size);
+        }
+    }
+}
+
+/// @brief copies the queries packet_queries into the packet, with zero outputs,
+//         and zero queries up to a multiple of 16 for the vector kernels
+template<typename scalar_t>
+void fill_query_packet(
+        const scalar_t* query_points,  // [N', 3]
+        const scalar_t* query_width,   // [N',]
+        const signedindex_t* packet_queries,  // [packet_size,]
+        signedindex_t packet_size,
+        QueryPacket<scalar_t>& packet) {
+    for (signedindex_t slot = 0; slot < packet_size; slot++) {
+        const signedindex_t query_index = packet_queries[slot];
+        for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+            packet.coords[d][slot] = query_points[query_index*SPATIAL_DIM + d];
+            packet.out[d][slot] = 0;
+        }
+        packet.widths[slot] = query_width[query_index];
+    }
+    for (signedindex_t slot = packet_size; slot < std::min<signedindex_t>((packet_size + 15) / 16 * 16, MAX_QUERY_PACKET_SIZE); slot++) {
+        for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+            packet.coords[d][slot] = 0;
+            packet.out[d][slot] = 0;
+        }
+        packet.widths[slot] = 0;
+    }
+    packet.num_queries = packet_size;
+}
+
+/// @brief one forward walk over the packed nodes for a packet of queries, in which every query makes the decisions of its
+//         own walk (see multiply_by_A_cpu_kernel), in the same order: far_eval(far_slots, node) once per node for the queries
+//         that accept it as far, bit slot of far_slots set for each, leaf_eval(slot, leaf) for every near leaf of a query.
+//         A node is decided for the whole packet, from the range of distances between its reppoint and the bounding box
+//         of the queries, when it is far from all of them, or when it is a nonleaf near all of them and outside their
+//         smoothing widths; query by query otherwise
+template<typename scalar_t, typename far_eval_t, typename leaf_eval_t>
+void walk_query_packet_cpu(
+        const QueryPacket<scalar_t>& packet,
+        const PackedNode<scalar_t>* packed_nodes,  // see pack_tree_nodes_cpu
+        const scalar_t* node_bboxes,   // [num_nodes, 6] or nullptr, see node_inside_smoothing_width
+        const far_eval_t& far_eval,
+        const leaf_eval_t& leaf_eval) {
+    const signedindex_t packet_size = packet.num_queries;
+    assert(packet_size >= 1 && packet_size <= MAX_QUERY_PACKET_SIZE);
+
+    scalar_t packet_bbox[2*SPATIAL_DIM];
+    for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+        packet_bbox[d] = *std::min_element(packet.coords[d], packet.coords[d] + packet_size);
+        packet_bbox[SPATIAL_DIM+d] = *std::max_element(packet.coords[d], packet.coords[d] + packet_size);
+    }
+    scalar_t max_width2 = 0;
+    // a query takes part in the decision on the node at packed index i when resume_index <= i: it did not open
+    // the node whose subtree ends there, or it opened the node just before. The subtrees nest,
+    // so the packet goes on from the smallest resume_index, the next node of the walk of some query
+    signedindex_t resume_index[MAX_QUERY_PACKET_SIZE];
+    for (signedindex_t slot = 0; slot < packet_size; slot++) {
+        max_width2 = std::max(max_width2, packet.widths[slot] * packet.widths[slot]);
+        resume_index[slot] = 0;
+    }
+    // the distances of the queries and the range from the box are rounded differently, by a few ulps at most
+    const scalar_t lower_margin = scalar_t(1) - scalar_t(8) * std::numeric_limits<scalar_t>::epsilon();
+    const scalar_t upper_margin = scalar_t(1) + scalar_t(8) * std::numeric_limits<scalar_t>::epsilon();
+
+    const signedindex_t packed_end = packed_nodes[0].skip;
+    signedindex_t packed_index = 0;
+    while (packed_index < packed_end) {
+        const PackedNode<scalar_t>& cur_node = packed_nodes[packed_index];
+
+        scalar_t min_dist2 = 0, max_dist2 = 0;
+        for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+            scalar_t nearest = std::max(packet_bbox[d] - cur_node.reppoint[d], std::max(cur_node.reppoint[d] - packet_bbox[SPATIAL_DIM+d], scalar_t(0)));
+            scalar_t farthest = std::max(cur_node.reppoint[d] - packet_bbox[d], packet_bbox[SPATIAL_DIM+d] - cur_node.reppoint[d]);
+            min_dist2 += nearest * nearest;
+            max_dist2 += farthest * farthest;
+        }
+        uint64_t far_slots = 0;
+        if (min_dist2 * lower_margin > cur_node.far_dist2) {
+            /// @case 1 for the packet: far from every query, approximate the query values with the node center
+            for (signedindex_t slot = 0; slot < packet_size; slot++) {
+                if (resume_index[slot] <= packed_index) {
+                    far_slots |= uint64_t(1) << slot;
+                    resume_index[slot] = cur_node.skip;
+                }
+            }
+        } else if (cur_node.num_points < 0 && max_dist2 * upper_margin <= cur_node.far_dist2 &&
+                   (node_bboxes == nullptr || min_dist2 * lower_margin >= max_width2)) {
+            /// @case 3 for the packet: a nonleaf near every query, outside of their smoothing widths, step into its subtree
+            for (signedindex_t slot = 0; slot < packet_size; slot++) {
+                if (resume_index[slot] <= packed_index) {
+                    resume_index[slot] = packed_index + 1;
+                }
+            }
+        } else {
+            for (signedindex_t slot = 0; slot < packet_size; slot++) {
+                if (resume_index[slot] > packed_index) {
+                    continue;
+                }
+                const scalar_t query_point[SPATIAL_DIM] = {packet.coords[0][slot], packet.coords[1][slot], packet.coords[2][slot]};
+                // past its subtree, unless it is a nonleaf opened below
+                resume_index[slot] = cur_node.skip;
+                scalar_t point2node_dist2 = get_point2point_dist2(query_point, cur_node.reppoint);
+                if (point2node_dist2 > cur_node.far_dist2) {
+                    /// @case 1: far from this query
+                    far_slots |= uint64_t(1) << slot;
+                } else if (node_inside_smoothing_width<scalar_t>(query_point, point2node_dist2, node_bboxes, cur_node.node_index, packet.widths[slot])) {
+                    /// @case 2: within the smoothing width of this query, cull it
+                } else if (cur_node.num_points < 0) {
+                    /// @case 3: not that far, step into its subtree
+                    resume_index[slot] = packed_index + 1;
+                } else {
+                    /// @case 4: a near leaf
+                    leaf_eval(slot, cur_node);
+                }
+            }
+        }
+        if (far_slots != 0) {
+            far_eval(far_slots, cur_node);
+        }
+
+        signedindex_t next_packed_index = packed_end;
+        for (signedindex_t slot = 0; slot < packet_size; slot++) {
+            next_packed_index = std::min(next_packed_index, resume_index[slot]);
+        }
+        packed_index = next_packed_index;
+    }
+}
+
 
 template<typename scalar_t>
 void multiply_by_A_cpu_kernel(
         const scalar_t* query_points,  // [N', 3]
         const scalar_t* query_width,   // [N',]
-        const scalar_t* points,        // [N, 3]
-        const scalar_t* point_attrs,   // [N, C]
-        const signedindex_t* node2point_index,
-        const signedindex_t* node2point_indexstart,
-        const signedindex_t* node_children_list,
+        const PointsSoA<scalar_t>& points_soa,  // [N,] per component, in tree order
+        const PackedNode<scalar_t>* packed_nodes,  // see pack_tree_nodes_cpu
         const scalar_t* node_attrs,
-        const bool* node_is_leaf_list,
-        const scalar_t* node_half_w_list,
-        const scalar_t* node_reppoints,
-        const signedindex_t* num_points_in_node,
+        const scalar_t* node_bboxes,   // [num_nodes, 6] or nullptr, see node_inside_smoothing_width
+        const scalar_t* node_moments1,
+        const scalar_t* node_moments2,
+        signedindex_t expansion_order,
         scalar_t* out_attrs,           // [N,]
         signedindex_t num_queries,
         signedindex_t query_index,
@@ -458,89 +1028,174 @@ void multiply_by_A_cpu_kernel(
     
     if (query_index < num_queries) {
         scalar_t out_val = 0.0;
-        
-        constexpr signedindex_t search_stack_max_size = ALLOWED_MAX_DEPTH*(NUM_OCT_CHILDREN - 1) + 1;
-        signedindex_t search_stack[search_stack_max_size] = {};
-        signedindex_t search_stack_top = 0;
 
-        // a push
-        assert(search_stack_top < search_stack_max_size);
-        search_stack[search_stack_top++] = 0;
-        while (search_stack_top > 0) {
-            // a pop
-            signedindex_t cur_node_index = search_stack[--search_stack_top];
+        // near-field leaves are collected, and evaluated a block of points at a time
+        auto eval_near_block = [&](const NearFieldBlock<scalar_t>& block) {
+            eval_A_mu_block_add_<scalar_t>(out_val, query_points + query_index*SPATIAL_DIM, query_width[query_index], continuous_kernel, block);
+        };
+        NearFieldBlock<scalar_t> near_block;
+        
+        // a forward walk over the packed nodes, the root's subtree is all of them
+        const signedindex_t packed_end = packed_nodes[0].skip;
+        signedindex_t packed_index = 0;
+        while (packed_index < packed_end) {
+            const signedindex_t cur_packed_index = packed_index;
+            const PackedNode<scalar_t>& cur_node = packed_nodes[cur_packed_index];
+            // past its subtree, unless it is a nonleaf opened below
+            packed_index = cur_node.skip;
+            const signedindex_t cur_node_index = cur_node.node_index;
 
             scalar_t point2node_dist2 = get_point2point_dist2(query_points + query_index*SPATIAL_DIM,
-                                                              node_reppoints + cur_node_index*SPATIAL_DIM);
+                                                              cur_node.reppoint);
 
             /// @case 1: the query point is far from the sample, approximate the query value with the node center
-            if (point2node_dist2 > std::pow(scalar_t(TREECODE_THRESHOLD * 2.0f) * node_half_w_list[cur_node_index], scalar_t(2.0f))) {
+            if (point2node_dist2 > cur_node.far_dist2) {
                 scalar_t diff[SPATIAL_DIM];     // x - y
-                subtract_vec<scalar_t>(diff, query_points + query_index*SPATIAL_DIM, node_reppoints + cur_node_index*SPATIAL_DIM, SPATIAL_DIM);
-                out_val += eval_A_mu<scalar_t>(diff, node_attrs + cur_node_index * SPATIAL_DIM, query_width[query_index], continuous_kernel);
+                subtract_vec<scalar_t>(diff, query_points + query_index*SPATIAL_DIM, cur_node.reppoint, SPATIAL_DIM);
+                out_val += eval_A_expansion<scalar_t>(diff, node_attrs, node_moments1, node_moments2, cur_node_index, expansion_order, query_width[query_index], continuous_kernel);
+            } else if (node_inside_smoothing_width<scalar_t>(query_points + query_index*SPATIAL_DIM, point2node_dist2, node_bboxes, cur_node_index, query_width[query_index])) {
+                /// @case 2: every point of the node is within the smoothing width, where the kernel vanishes, cull it
             } else {
-                /// @case 2: the query point is not that far,
-                //           if nonleaf, push children to the search stack
-                if (!node_is_leaf_list[cur_node_index]) {
-                    for (signedindex_t k = 0; k < NUM_OCT_CHILDREN; k++) {
-                        if (node_children_list[cur_node_index * NUM_OCT_CHILDREN + k] != -1) {
-                            assert(search_stack_top < search_stack_max_size);
-                            search_stack[search_stack_top++] = node_children_list[cur_node_index * NUM_OCT_CHILDREN + k];
-                        }
-                    }
-                } else {  /// @case 3: this node is a leaf node, compute over samples
-                    for (signedindex_t k = 0; k < num_points_in_node[cur_node_index]; k++) {
-                        signedindex_t point_index = node2point_index[node2point_indexstart[cur_node_index] + k];
-                        scalar_t diff[SPATIAL_DIM];     // x - y
-                        subtract_vec<scalar_t>(diff, query_points + query_index*SPATIAL_DIM, points + point_index*SPATIAL_DIM, SPATIAL_DIM);
-                        out_val += eval_A_mu<scalar_t>(diff, point_attrs + point_index * SPATIAL_DIM, query_width[query_index], continuous_kernel);
-                    }
+                /// @case 3: the query point is not that far,
+                //           if nonleaf, step into its subtree, to its first child
+                if (cur_node.num_points < 0) {
+                    packed_index = cur_packed_index + 1;
+                } else {  /// @case 4: this node is a leaf node, compute over samples
+                    add_leaf_to_near_field_block<scalar_t>(points_soa, cur_node.first_point, cur_node.first_point + cur_node.num_points, near_block, eval_near_block);
                 }
             }
         }
+        if (near_block.num_points > 0) {
+            eval_near_block(near_block);
+        }
         out_attrs[query_index] = out_val;
     }
 }
 
 
+/// @brief multiply_by_A_cpu_kernel at expansion order 0 for a packet of queries, see walk_query_packet_cpu
 template<typename scalar_t>
+void multiply_by_A_packet_cpu_kernel(
+        const scalar_t* query_points,  // [N', 3]
+        const scalar_t* query_width,   // [N',]
+        const PointsSoA<scalar_t>& points_soa,  // [N,] per component, in tree order
+        const PackedNode<scalar_t>* packed_nodes,  // see pack_tree_nodes_cpu
+        const scalar_t* node_attrs,
+        const scalar_t* node_bboxes,   // [num_nodes, 6] or nullptr, see node_inside_smoothing_width
+        scalar_t* out_attrs,           // [N,]
+        const signedindex_t* packet_queries,  // [packet_size,]
+        signedindex_t packet_size,
+        NearFieldBlock<scalar_t>* near_blocks,   // [packet_size,] empty, one per query as in its own walk
+        bool continuous_kernel=false
+    ) {
+    QueryPacket<scalar_t> packet;
+    fill_query_packet<scalar_t>(query_points, query_width, packet_queries, packet_size, packet);
+    auto eval_near_block = [&](signedindex_t slot, const NearFieldBlock<scalar_t>& block) {
+        eval_A_mu_block_add_<scalar_t>(packet.out[0][slot], query_points + packet_queries[slot]*SPATIAL_DIM, packet.widths[slot], continuous_kernel, block);
+    };
+
+    walk_query_packet_cpu<scalar_t>(
+        packet,
+        packed_nodes,
+        node_bboxes,
+        [&](uint64_t far_slots, const PackedNode<scalar_t>& node) {
+            eval_A_mu_packet_add_<scalar_t>(packet, far_slots, node.reppoint, node_attrs + node.node_index*SPATIAL_DIM, continuous_kernel);
+        },
+        [&](signedindex_t slot, const PackedNode<scalar_t>& leaf) {
+            add_leaf_to_near_field_block<scalar_t>(points_soa, leaf.first_point, leaf.first_point + leaf.num_points, near_blocks[slot],
+                [&](const NearFieldBlock<scalar_t>& block) { eval_near_block(slot, block); });
+        });
+
+    for (signedindex_t slot = 0; slot < packet_size; slot++) {
+        if (near_blocks[slot].num_points > 0) {
+            eval_near_block(slot, near_blocks[slot]);
+            near_blocks[slot].num_points = 0;
+        }
+        out_attrs[packet_queries[slot]] = packet.out[0][slot];
+    }
+}
+
+
+template<typename scalar_t, typename index_t>
 void multiply_by_A_cpu_kernel_launcher(
         const scalar_t* query_points,  // [N', 3]
         const scalar_t* query_width,   // [N',]
         const scalar_t* points,        // [N, 3]
         const scalar_t* point_attrs,   // [N, C]
-        const signedindex_t* node2point_index,
-        const signedindex_t* node2point_indexstart,
-        const signedindex_t* node_children_list,
+        const index_t* node2point_index,
+        const index_t* node2point_indexstart,
+        const index_t* node_children_list,
         const scalar_t* node_attrs,
         const bool* node_is_leaf_list,
         const scalar_t* node_half_w_list,
         const scalar_t* node_reppoints,
-        const signedindex_t* num_points_in_node,
+        const index_t* num_points_in_node,
         scalar_t* out_attrs,           // [N,]
         signedindex_t num_queries,
-        bool continutous_kernel) {
+        bool continutous_kernel,
+        signedindex_t expansion_order,
+        const scalar_t* node_moments1,
+        const scalar_t* node_moments2,
+        scalar_t theta,
+        const TreeTraversalCache<scalar_t>* traversal_cache,
+        TraversalWorkspace<scalar_t>* workspace) {
 
-    omp_set_num_threads(20);
-    #pragma omp parallel for
-    for (signedindex_t query_index = 0; query_index < num_queries; query_index++) {
-        multiply_by_A_cpu_kernel<scalar_t>(
-            query_points,  // [N', 3]
-            query_width,   // [N',]
-            points,        // [N, 3]
-            point_attrs,   // [N, C]
-            node2point_index,
-            node2point_indexstart,
+    // the root holds every point
+    TraversalWorkspace<scalar_t> own_workspace;   // without one of the caller
+    TraversalWorkspace<scalar_t>& launch_workspace = workspace ? *workspace : own_workspace;
+    const PointsSoA<scalar_t>& points_soa = gather_workspace_points_cpu<scalar_t>(points, point_attrs, node2point_index, num_points_in_node[0], SPATIAL_DIM, launch_workspace);
+    const scalar_t* cull_bboxes = compute_node_bounds_cpu<scalar_t>(points, node_children_list, node_is_leaf_list, node2point_index, node2point_indexstart, num_points_in_node,
+                                                                    node_half_w_list, node_reppoints, !continutous_kernel, theta, traversal_cache, launch_workspace);
+    pack_tree_nodes_cpu<scalar_t>(node_children_list, node_is_leaf_list, node2point_indexstart, num_points_in_node, node_reppoints, traversal_cache, launch_workspace);
+    const signedindex_t packet_size = get_query_packet_size();
+    if (packet_size > 1 && expansion_order == 0) {
+        run_query_packet_loop_cpu<scalar_t>(
+            query_points,
+            node_children_list,
+            node_is_leaf_list,
+            num_points_in_node,
+            num_queries,
+            packet_size,
+            launch_workspace,
+            [&](const signedindex_t* packet_queries, signedindex_t cur_packet_size, NearFieldBlock<scalar_t>* near_blocks) {
+                multiply_by_A_packet_cpu_kernel<scalar_t>(
+                    query_points,  // [N', 3]
+                    query_width,   // [N',]
+                    points_soa,
+                    launch_workspace.packed_nodes.data(),
+                    node_attrs,
+                    cull_bboxes,
+                    out_attrs,           // [N,]
+                    packet_queries,
+                    cur_packet_size,
+                    near_blocks,
+                    continutous_kernel);
+            });
+    } else {
+        run_query_loop_cpu<scalar_t>(
+            query_points,
+            nullptr,
             node_children_list,
-            node_attrs,
             node_is_leaf_list,
-            node_half_w_list,
-            node_reppoints,
             num_points_in_node,
-            out_attrs,           // [N,]
             num_queries,
-            query_index,
-            continutous_kernel);
+            &launch_workspace,
+            [&](signedindex_t query_index) {
+                multiply_by_A_cpu_kernel<scalar_t>(
+                    query_points,  // [N', 3]
+                    query_width,   // [N',]
+                    points_soa,
+                    launch_workspace.packed_nodes.data(),
+                    node_attrs,
+                    cull_bboxes,
+                    node_moments1,
+                    node_moments2,
+                    expansion_order,
+                    out_attrs,           // [N,]
+                    num_queries,
+                    query_index,
+                    continutous_kernel);
+            });
     }
 }
 
@@ -551,16 +1206,13 @@ template<typename scalar_t>
 void multiply_by_AT_cpu_kernel(
         const scalar_t* query_points,  // [N', 3]
         const scalar_t* query_width,   // [N',]
-        const scalar_t* points,        // [N, 3]
-        const scalar_t* point_attrs,   // [N, C]
-        const signedindex_t* node2point_index,
-        const signedindex_t* node2point_indexstart,
-        const signedindex_t* node_children_list,
+        const PointsSoA<scalar_t>& points_soa,  // [N,] per component, in tree order
+        const PackedNode<scalar_t>* packed_nodes,  // see pack_tree_nodes_cpu
         const scalar_t* node_attrs,
-        const bool* node_is_leaf_list,
-        const scalar_t* node_half_w_list,
-        const scalar_t* node_reppoints,
-        const signedindex_t* num_points_in_node,
+        const scalar_t* node_bboxes,   // [num_nodes, 6] or nullptr, see node_inside_smoothing_width
+        const scalar_t* node_moments1,
+        const scalar_t* node_moments2,
+        signedindex_t expansion_order,
         scalar_t* out_attrs,           // [N, 3]
         signedindex_t num_queries,
         signedindex_t query_index
@@ -570,91 +1222,177 @@ void multiply_by_AT_cpu_kernel(
     // signedindex_t query_index = blockDim.x * blockIdx.x + threadIdx.x;
     if (query_index < num_queries) {
         scalar_t out_vec[SPATIAL_DIM] = {};
-        
-        constexpr signedindex_t search_stack_max_size = ALLOWED_MAX_DEPTH*(NUM_OCT_CHILDREN - 1) + 1;
-        signedindex_t search_stack[search_stack_max_size] = {};
-        signedindex_t search_stack_top = 0;
 
-        // a push
-        assert(search_stack_top < search_stack_max_size);
-        search_stack[search_stack_top++] = 0;
-        while (search_stack_top > 0) {
-            // a pop
-            signedindex_t cur_node_index = search_stack[--search_stack_top];
+        // near-field leaves are collected, and evaluated a block of points at a time
+        auto eval_near_block = [&](const NearFieldBlock<scalar_t>& block) {
+            eval_AT_s_block_add_<scalar_t>(out_vec, query_points + query_index*SPATIAL_DIM, query_width[query_index], block);
+        };
+        NearFieldBlock<scalar_t> near_block;
+        
+        // a forward walk over the packed nodes, the root's subtree is all of them
+        const signedindex_t packed_end = packed_nodes[0].skip;
+        signedindex_t packed_index = 0;
+        while (packed_index < packed_end) {
+            const signedindex_t cur_packed_index = packed_index;
+            const PackedNode<scalar_t>& cur_node = packed_nodes[cur_packed_index];
+            // past its subtree, unless it is a nonleaf opened below
+            packed_index = cur_node.skip;
+            const signedindex_t cur_node_index = cur_node.node_index;
             scalar_t point2node_dist2 = get_point2point_dist2(query_points + query_index*SPATIAL_DIM,
-                                                              node_reppoints + cur_node_index*SPATIAL_DIM);
+                                                              cur_node.reppoint);
 
             /// @case 1: the query point is far from the sample, approximate the query value with the node center
-            if (point2node_dist2 > std::pow(scalar_t(TREECODE_THRESHOLD * 2.0f) * node_half_w_list[cur_node_index], scalar_t(2.0f))) {
+            if (point2node_dist2 > cur_node.far_dist2) {
                 scalar_t diff[SPATIAL_DIM];     // x - y
-                subtract_vec<scalar_t>(diff, query_points + query_index*SPATIAL_DIM, node_reppoints + cur_node_index*SPATIAL_DIM, SPATIAL_DIM);
-                eval_AT_s_add_<scalar_t>(out_vec, diff, node_attrs + cur_node_index, query_width[query_index]);
+                subtract_vec<scalar_t>(diff, query_points + query_index*SPATIAL_DIM, cur_node.reppoint, SPATIAL_DIM);
+                eval_AT_expansion_add_<scalar_t>(out_vec, diff, node_attrs, node_moments1, node_moments2, cur_node_index, expansion_order, query_width[query_index]);
                 // printf("[DEBUG] got node contribution: %.4e from %d\n", *(node_attrs + cur_node_index), cur_node_index);
                 // printf("        current_vec: (%f, %f, %f)\n", out_vec[0], out_vec[1], out_vec[2]);
                 // printf("        diff: (%f, %f, %f), %f\n", diff[0], diff[1], diff[2], query_width[query_index]);
+            } else if (node_inside_smoothing_width<scalar_t>(query_points + query_index*SPATIAL_DIM, point2node_dist2, node_bboxes, cur_node_index, query_width[query_index])) {
+                /// @case 2: every point of the node is within the smoothing width, where the kernel vanishes, cull it
             } else {
-                /// @case 2: the query point is not that far,
-                //           if nonleaf, push children to the search stack
-                if (!node_is_leaf_list[cur_node_index]) {
-                    for (signedindex_t k = 0; k < NUM_OCT_CHILDREN; k++) {
-                        if (node_children_list[cur_node_index * NUM_OCT_CHILDREN + k] != -1) {
-                            assert(search_stack_top < search_stack_max_size);
-                            search_stack[search_stack_top++] = node_children_list[cur_node_index * NUM_OCT_CHILDREN + k];
-                        }
-                    }
-                } else {  /// @case 3: this node is a leaf node, compute over samples
-                    for (signedindex_t k = 0; k < num_points_in_node[cur_node_index]; k++) {
-                        signedindex_t point_index = node2point_index[node2point_indexstart[cur_node_index] + k];
-                        scalar_t diff[SPATIAL_DIM];     // x - y
-                        subtract_vec<scalar_t>(diff, query_points + query_index*SPATIAL_DIM, points + point_index*SPATIAL_DIM, SPATIAL_DIM);
-                        eval_AT_s_add_<scalar_t>(out_vec, diff, point_attrs + point_index, query_width[query_index]);
-                        // printf("[DEBUG] got point contribution: %.4e from %d\n", *(point_attrs + point_index), point_index);
-                        // printf("        current_vec: (%f, %f, %f)\n", out_vec[0], out_vec[1], out_vec[2]);
-                        // printf("        diff: (%f, %f, %f), %f\n", diff[0], diff[1], diff[2], query_width[query_index]);
-                    }
+                /// @case 3: the query point is not that far,
+                //           if nonleaf, step into its subtree, to its first child
+                if (cur_node.num_points < 0) {
+                    packed_index = cur_packed_index + 1;
+                } else {  /// @case 4: this node is a leaf node, compute over samples
+                    add_leaf_to_near_field_block<scalar_t>(points_soa, cur_node.first_point, cur_node.first_point + cur_node.num_points, near_block, eval_near_block);
                 }
             }
         }
+        if (near_block.num_points > 0) {
+            eval_near_block(near_block);
+        }
         assign_vec<scalar_t>(out_attrs + query_index*SPATIAL_DIM, out_vec, SPATIAL_DIM);
     }
 }
 
+/// @brief multiply_by_AT_cpu_kernel at expansion order 0 for a packet of queries, see walk_query_packet_cpu
 template<typename scalar_t>
+void multiply_by_AT_packet_cpu_kernel(
+        const scalar_t* query_points,  // [N', 3]
+        const scalar_t* query_width,   // [N',]
+        const PointsSoA<scalar_t>& points_soa,  // [N,] per component, in tree order
+        const PackedNode<scalar_t>* packed_nodes,  // see pack_tree_nodes_cpu
+        const scalar_t* node_attrs,
+        const scalar_t* node_bboxes,   // [num_nodes, 6] or nullptr, see node_inside_smoothing_width
+        scalar_t* out_attrs,           // [N, 3]
+        const signedindex_t* packet_queries,  // [packet_size,]
+        signedindex_t packet_size,
+        NearFieldBlock<scalar_t>* near_blocks   // [packet_size,] empty, one per query as in its own walk
+    ) {
+    QueryPacket<scalar_t> packet;
+    fill_query_packet<scalar_t>(query_points, query_width, packet_queries, packet_size, packet);
+    auto eval_near_block = [&](signedindex_t slot, const NearFieldBlock<scalar_t>& block) {
+        scalar_t out_vec[SPATIAL_DIM] = {packet.out[0][slot], packet.out[1][slot], packet.out[2][slot]};
+        eval_AT_s_block_add_<scalar_t>(out_vec, query_points + packet_queries[slot]*SPATIAL_DIM, packet.widths[slot], block);
+        for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+            packet.out[d][slot] = out_vec[d];
+        }
+    };
+
+    walk_query_packet_cpu<scalar_t>(
+        packet,
+        packed_nodes,
+        node_bboxes,
+        [&](uint64_t far_slots, const PackedNode<scalar_t>& node) {
+            eval_AT_s_packet_add_<scalar_t>(packet, far_slots, node.reppoint, node_attrs + node.node_index);
+        },
+        [&](signedindex_t slot, const PackedNode<scalar_t>& leaf) {
+            add_leaf_to_near_field_block<scalar_t>(points_soa, leaf.first_point, leaf.first_point + leaf.num_points, near_blocks[slot],
+                [&](const NearFieldBlock<scalar_t>& block) { eval_near_block(slot, block); });
+        });
+
+    for (signedindex_t slot = 0; slot < packet_size; slot++) {
+        if (near_blocks[slot].num_points > 0) {
+            eval_near_block(slot, near_blocks[slot]);
+            near_blocks[slot].num_points = 0;
+        }
+        for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+            out_attrs[packet_queries[slot]*SPATIAL_DIM + d] = packet.out[d][slot];
+        }
+    }
+}
+
+
+template<typename scalar_t, typename index_t>
 void multiply_by_AT_cpu_kernel_launcher(
         const scalar_t* query_points,  // [N', 3]
         const scalar_t* query_width,   // [N',]
         const scalar_t* points,        // [N, 3]
         const scalar_t* point_attrs,   // [N, C]
-        const signedindex_t* node2point_index,
-        const signedindex_t* node2point_indexstart,
-        const signedindex_t* node_children_list,
+        const index_t* node2point_index,
+        const index_t* node2point_indexstart,
+        const index_t* node_children_list,
         const scalar_t* node_attrs,
         const bool* node_is_leaf_list,
         const scalar_t* node_half_w_list,
         const scalar_t* node_reppoints,
-        const signedindex_t* num_points_in_node,
+        const index_t* num_points_in_node,
         scalar_t* out_attrs,           // [N, 3]
-        signedindex_t num_queries) {
+        signedindex_t num_queries,
+        signedindex_t expansion_order,
+        const scalar_t* node_moments1,
+        const scalar_t* node_moments2,
+        scalar_t theta,
+        const TreeTraversalCache<scalar_t>* traversal_cache,
+        TraversalWorkspace<scalar_t>* workspace) {
 
-    omp_set_num_threads(20);
-    #pragma omp parallel for
-    for (signedindex_t query_index = 0; query_index < num_queries; query_index++) {
-        multiply_by_AT_cpu_kernel<scalar_t>(
-            query_points,  // [N', 3]
-            query_width,   // [N',]
-            points,        // [N, 3]
-            point_attrs,   // [N, C]
-            node2point_index,
-            node2point_indexstart,
+    // the root holds every point
+    TraversalWorkspace<scalar_t> own_workspace;   // without one of the caller
+    TraversalWorkspace<scalar_t>& launch_workspace = workspace ? *workspace : own_workspace;
+    const PointsSoA<scalar_t>& points_soa = gather_workspace_points_cpu<scalar_t>(points, point_attrs, node2point_index, num_points_in_node[0], 1, launch_workspace);
+    const scalar_t* cull_bboxes = compute_node_bounds_cpu<scalar_t>(points, node_children_list, node_is_leaf_list, node2point_index, node2point_indexstart, num_points_in_node,
+                                                                    node_half_w_list, node_reppoints, true, theta, traversal_cache, launch_workspace);
+    pack_tree_nodes_cpu<scalar_t>(node_children_list, node_is_leaf_list, node2point_indexstart, num_points_in_node, node_reppoints, traversal_cache, launch_workspace);
+    const signedindex_t packet_size = get_query_packet_size();
+    if (packet_size > 1 && expansion_order == 0) {
+        run_query_packet_loop_cpu<scalar_t>(
+            query_points,
+            node_children_list,
+            node_is_leaf_list,
+            num_points_in_node,
+            num_queries,
+            packet_size,
+            launch_workspace,
+            [&](const signedindex_t* packet_queries, signedindex_t cur_packet_size, NearFieldBlock<scalar_t>* near_blocks) {
+                multiply_by_AT_packet_cpu_kernel<scalar_t>(
+                    query_points,  // [N', 3]
+                    query_width,   // [N',]
+                    points_soa,
+                    launch_workspace.packed_nodes.data(),
+                    node_attrs,
+                    cull_bboxes,
+                    out_attrs,           // [N, 3]
+                    packet_queries,
+                    cur_packet_size,
+                    near_blocks);
+            });
+    } else {
+        run_query_loop_cpu<scalar_t>(
+            query_points,
+            nullptr,
             node_children_list,
-            node_attrs,
             node_is_leaf_list,
-            node_half_w_list,
-            node_reppoints,
             num_points_in_node,
-            out_attrs,           // [N, 3]
             num_queries,
-            query_index);
+            &launch_workspace,
+            [&](signedindex_t query_index) {
+                multiply_by_AT_cpu_kernel<scalar_t>(
+                    query_points,  // [N', 3]
+                    query_width,   // [N',]
+                    points_soa,
+                    launch_workspace.packed_nodes.data(),
+                    node_attrs,
+                    cull_bboxes,
+                    node_moments1,
+                    node_moments2,
+                    expansion_order,
+                    out_attrs,           // [N, 3]
+                    num_queries,
+                    query_index);
+            });
     }
 }
 
@@ -665,16 +1403,13 @@ template<typename scalar_t>
 void multiply_by_G_cpu_kernel(
         const scalar_t* query_points,  // [N', 3]
         const scalar_t* query_width,   // [N',]
-        const scalar_t* points,        // [N, 3]
-        const scalar_t* point_attrs,   // [N, C]
-        const signedindex_t* node2point_index,
-        const signedindex_t* node2point_indexstart,
-        const signedindex_t* node_children_list,
+        const PointsSoA<scalar_t>& points_soa,  // [N,] per component, in tree order
+        const PackedNode<scalar_t>* packed_nodes,  // see pack_tree_nodes_cpu
         const scalar_t* node_attrs,
-        const bool* node_is_leaf_list,
-        const scalar_t* node_half_w_list,
-        const scalar_t* node_reppoints,
-        const signedindex_t* num_points_in_node,
+        const scalar_t* node_bboxes,   // [num_nodes, 6] or nullptr, see node_inside_smoothing_width
+        const scalar_t* node_moments1,
+        const scalar_t* node_moments2,
+        signedindex_t expansion_order,
         scalar_t* out_attrs,           // [N, 3]
         signedindex_t num_queries,
         signedindex_t query_index
@@ -686,7 +1421,220 @@ void multiply_by_G_cpu_kernel(
     
     
         scalar_t out_vec[SPATIAL_DIM] = {};
+
+        // near-field leaves are collected, and evaluated a block of points at a time
+        auto eval_near_block = [&](const NearFieldBlock<scalar_t>& block) {
+            eval_G_mu_block_add_<scalar_t>(out_vec, query_points + query_index*SPATIAL_DIM, query_width[query_index], block);
+        };
+        NearFieldBlock<scalar_t> near_block;
         
+        // a forward walk over the packed nodes, the root's subtree is all of them
+        const signedindex_t packed_end = packed_nodes[0].skip;
+        signedindex_t packed_index = 0;
+        while (packed_index < packed_end) {
+            const signedindex_t cur_packed_index = packed_index;
+            const PackedNode<scalar_t>& cur_node = packed_nodes[cur_packed_index];
+            // past its subtree, unless it is a nonleaf opened below
+            packed_index = cur_node.skip;
+            const signedindex_t cur_node_index = cur_node.node_index;
+            scalar_t point2node_dist2 = get_point2point_dist2(query_points + query_index*SPATIAL_DIM,
+                                                              cur_node.reppoint);
+
+            /// @case 1: the query point is far from the sample, approximate the query value with the node center
+            if (point2node_dist2 > cur_node.far_dist2) {
+                scalar_t diff[SPATIAL_DIM];     // x - y
+                subtract_vec<scalar_t>(diff, query_points + query_index*SPATIAL_DIM, cur_node.reppoint, SPATIAL_DIM);
+                eval_G_expansion_add_<scalar_t>(out_vec, diff, node_attrs, node_moments1, node_moments2, cur_node_index, expansion_order, query_width[query_index]);
+            } else if (node_inside_smoothing_width<scalar_t>(query_points + query_index*SPATIAL_DIM, point2node_dist2, node_bboxes, cur_node_index, query_width[query_index])) {
+                /// @case 2: every point of the node is within the smoothing width, where the kernel vanishes, cull it
+            } else {
+                /// @case 3: the query point is not that far,
+                //           if nonleaf, step into its subtree, to its first child
+                if (cur_node.num_points < 0) {
+                    packed_index = cur_packed_index + 1;
+                } else {  /// @case 4: this node is a leaf node, compute over samples
+                    add_leaf_to_near_field_block<scalar_t>(points_soa, cur_node.first_point, cur_node.first_point + cur_node.num_points, near_block, eval_near_block);
+                }
+            }
+        }
+        if (near_block.num_points > 0) {
+            eval_near_block(near_block);
+        }
+        assign_vec<scalar_t>(out_attrs + query_index*SPATIAL_DIM, out_vec, SPATIAL_DIM);
+    }
+}
+
+/// @brief multiply_by_G_cpu_kernel at expansion order 0 for a packet of queries, see walk_query_packet_cpu
+template<typename scalar_t>
+void multiply_by_G_packet_cpu_kernel(
+        const scalar_t* query_points,  // [N', 3]
+        const scalar_t* query_width,   // [N',]
+        const PointsSoA<scalar_t>& points_soa,  // [N,] per component, in tree order
+        const PackedNode<scalar_t>* packed_nodes,  // see pack_tree_nodes_cpu
+        const scalar_t* node_attrs,
+        const scalar_t* node_bboxes,   // [num_nodes, 6] or nullptr, see node_inside_smoothing_width
+        scalar_t* out_attrs,           // [N, 3]
+        const signedindex_t* packet_queries,  // [packet_size,]
+        signedindex_t packet_size,
+        NearFieldBlock<scalar_t>* near_blocks   // [packet_size,] empty, one per query as in its own walk
+    ) {
+    QueryPacket<scalar_t> packet;
+    fill_query_packet<scalar_t>(query_points, query_width, packet_queries, packet_size, packet);
+    auto eval_near_block = [&](signedindex_t slot, const NearFieldBlock<scalar_t>& block) {
+        scalar_t out_vec[SPATIAL_DIM] = {packet.out[0][slot], packet.out[1][slot], packet.out[2][slot]};
+        eval_G_mu_block_add_<scalar_t>(out_vec, query_points + packet_queries[slot]*SPATIAL_DIM, packet.widths[slot], block);
+        for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+            packet.out[d][slot] = out_vec[d];
+        }
+    };
+
+    walk_query_packet_cpu<scalar_t>(
+        packet,
+        packed_nodes,
+        node_bboxes,
+        [&](uint64_t far_slots, const PackedNode<scalar_t>& node) {
+            eval_G_mu_packet_add_<scalar_t>(packet, far_slots, node.reppoint, node_attrs + node.node_index*SPATIAL_DIM);
+        },
+        [&](signedindex_t slot, const PackedNode<scalar_t>& leaf) {
+            add_leaf_to_near_field_block<scalar_t>(points_soa, leaf.first_point, leaf.first_point + leaf.num_points, near_blocks[slot],
+                [&](const NearFieldBlock<scalar_t>& block) { eval_near_block(slot, block); });
+        });
+
+    for (signedindex_t slot = 0; slot < packet_size; slot++) {
+        if (near_blocks[slot].num_points > 0) {
+            eval_near_block(slot, near_blocks[slot]);
+            near_blocks[slot].num_points = 0;
+        }
+        for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+            out_attrs[packet_queries[slot]*SPATIAL_DIM + d] = packet.out[d][slot];
+        }
+    }
+}
+
+
+template<typename scalar_t, typename index_t>
+void multiply_by_G_cpu_kernel_launcher(
+        const scalar_t* query_points,  // [N', 3]
+        const scalar_t* query_width,   // [N',]
+        const scalar_t* points,        // [N, 3]
+        const scalar_t* point_attrs,   // [N, C]
+        const index_t* node2point_index,
+        const index_t* node2point_indexstart,
+        const index_t* node_children_list,
+        const scalar_t* node_attrs,
+        const bool* node_is_leaf_list,
+        const scalar_t* node_half_w_list,
+        const scalar_t* node_reppoints,
+        const index_t* num_points_in_node,
+        scalar_t* out_attrs,           // [N, 3]
+        signedindex_t num_queries,
+        signedindex_t expansion_order,
+        const scalar_t* node_moments1,
+        const scalar_t* node_moments2,
+        scalar_t theta,
+        const TreeTraversalCache<scalar_t>* traversal_cache,
+        TraversalWorkspace<scalar_t>* workspace) {
+    // the root holds every point
+    TraversalWorkspace<scalar_t> own_workspace;   // without one of the caller
+    TraversalWorkspace<scalar_t>& launch_workspace = workspace ? *workspace : own_workspace;
+    const PointsSoA<scalar_t>& points_soa = gather_workspace_points_cpu<scalar_t>(points, point_attrs, node2point_index, num_points_in_node[0], SPATIAL_DIM, launch_workspace);
+    const scalar_t* cull_bboxes = compute_node_bounds_cpu<scalar_t>(points, node_children_list, node_is_leaf_list, node2point_index, node2point_indexstart, num_points_in_node,
+                                                                    node_half_w_list, node_reppoints, true, theta, traversal_cache, launch_workspace);
+    pack_tree_nodes_cpu<scalar_t>(node_children_list, node_is_leaf_list, node2point_indexstart, num_points_in_node, node_reppoints, traversal_cache, launch_workspace);
+    const signedindex_t packet_size = get_query_packet_size();
+    if (packet_size > 1 && expansion_order == 0) {
+        run_query_packet_loop_cpu<scalar_t>(
+            query_points,
+            node_children_list,
+            node_is_leaf_list,
+            num_points_in_node,
+            num_queries,
+            packet_size,
+            launch_workspace,
+            [&](const signedindex_t* packet_queries, signedindex_t cur_packet_size, NearFieldBlock<scalar_t>* near_blocks) {
+                multiply_by_G_packet_cpu_kernel<scalar_t>(
+                    query_points,  // [N', 3]
+                    query_width,   // [N',]
+                    points_soa,
+                    launch_workspace.packed_nodes.data(),
+                    node_attrs,
+                    cull_bboxes,
+                    out_attrs,           // [N, 3]
+                    packet_queries,
+                    cur_packet_size,
+                    near_blocks);
+            });
+    } else {
+        run_query_loop_cpu<scalar_t>(
+            query_points,
+            nullptr,
+            node_children_list,
+            node_is_leaf_list,
+            num_points_in_node,
+            num_queries,
+            &launch_workspace,
+            [&](signedindex_t query_index) {
+                multiply_by_G_cpu_kernel<scalar_t>(
+                    query_points,  // [N', 3]
+                    query_width,   // [N',]
+                    points_soa,
+                    launch_workspace.packed_nodes.data(),
+                    node_attrs,
+                    cull_bboxes,
+                    node_moments1,
+                    node_moments2,
+                    expansion_order,
+                    out_attrs,           // [N, 3]
+                    num_queries,
+                    query_index);
+            });
+    }
+}
+
+
+//////////////////////////////////
+/// @brief cached interaction lists
+
+// the stored lists are what a traversal of the query visits, so their sizes are its cost.
+// Returns true if they differ from the costs out_query_costs held
+bool compute_interaction_list_costs(
+        const signedindex_t* far_offsets,   // [N'+1,]
+        const signedindex_t* near_offsets,  // [N'+1,]
+        const signedindex_t* open_offsets,  // [N'+1,]
+        std::vector<signedindex_t>& out_query_costs,
+        signedindex_t num_queries) {
+    bool changed = ((signedindex_t)out_query_costs.size() != num_queries);
+    out_query_costs.resize(num_queries);
+    for (signedindex_t query_index = 0; query_index < num_queries; query_index++) {
+        const signedindex_t query_cost = (far_offsets[query_index+1] - far_offsets[query_index])
+                                       + (near_offsets[query_index+1] - near_offsets[query_index])
+                                       + (open_offsets[query_index+1] - open_offsets[query_index]) * NUM_OCT_CHILDREN;
+        changed = changed || (out_query_costs[query_index] != query_cost);
+        out_query_costs[query_index] = query_cost;
+    }
+    return changed;
+}
+
+template<typename scalar_t, typename index_t>
+void build_interaction_lists_cpu_kernel(
+        const scalar_t* query_points,  // [N', 3]
+        const index_t* node_children_list,
+        const bool* node_is_leaf_list,
+        const scalar_t* node_far_dist2,      // [num_nodes,], see compute_node_far_dist2_cpu
+        const scalar_t* node_bboxes,
+        index_t* out_far_nodes,      // nullptr: only count
+        index_t* out_near_leaves,    // nullptr: only count
+        index_t* out_open_nodes,     // nullptr: only count
+        signedindex_t & num_far,
+        signedindex_t & num_near,
+        signedindex_t & num_open,
+        signedindex_t num_queries,
+        signedindex_t query_index
+    ) {
+    num_far = 0;
+    num_near = 0;
+    num_open = 0;
+    if (query_index < num_queries) {
         constexpr signedindex_t search_stack_max_size = ALLOWED_MAX_DEPTH*(NUM_OCT_CHILDREN - 1) + 1;
         signedindex_t search_stack[search_stack_max_size] = {};
         signedindex_t search_stack_top = 0;
@@ -697,17 +1645,17 @@ void multiply_by_G_cpu_kernel(
         while (search_stack_top > 0) {
             // a pop
             signedindex_t cur_node_index = search_stack[--search_stack_top];
-            scalar_t point2node_dist2 = get_point2point_dist2(query_points + query_index*SPATIAL_DIM,
-                                                              node_reppoints + cur_node_index*SPATIAL_DIM);
 
-            /// @case 1: the query point is far from the sample, approximate the query value with the node center
-            if (point2node_dist2 > std::pow(scalar_t(TREECODE_THRESHOLD * 2.0f) * node_half_w_list[cur_node_index], scalar_t(2.0f))) {
-                scalar_t diff[SPATIAL_DIM];     // x - y
-                subtract_vec<scalar_t>(diff, query_points + query_index*SPATIAL_DIM, node_reppoints + cur_node_index*SPATIAL_DIM, SPATIAL_DIM);
-                eval_G_mu_add_<scalar_t>(out_vec, diff, node_attrs + cur_node_index*SPATIAL_DIM, query_width[query_index]);
-            } else {
-                /// @case 2: the query point is not that far,
-                //           if nonleaf, push children to the search stack
+            scalar_t min_dist2, max_dist2;
+            get_point2bbox_dist2_range(query_points + query_index*SPATIAL_DIM, node_bboxes + cur_node_index*2*SPATIAL_DIM, min_dist2, max_dist2);
+            scalar_t threshold2 = node_far_dist2[cur_node_index];
+
+            if (min_dist2 > threshold2) {
+                /// @case 1: far from any reppoint the node can have
+                if (out_far_nodes != nullptr) out_far_nodes[num_far] = cur_node_index;
+                num_far++;
+            } else if (max_dist2 <= threshold2) {
+                /// @case 2: near to any reppoint the node can have
                 if (!node_is_leaf_list[cur_node_index]) {
                     for (signedindex_t k = 0; k < NUM_OCT_CHILDREN; k++) {
                         if (node_children_list[cur_node_index * NUM_OCT_CHILDREN + k] != -1) {
@@ -715,69 +1663,2550 @@ void multiply_by_G_cpu_kernel(
                             search_stack[search_stack_top++] = node_children_list[cur_node_index * NUM_OCT_CHILDREN + k];
                         }
                     }
-                } else {  /// @case 3: this node is a leaf node, compute over samples
-                    for (signedindex_t k = 0; k < num_points_in_node[cur_node_index]; k++) {
-                        signedindex_t point_index = node2point_index[node2point_indexstart[cur_node_index] + k];
-                        scalar_t diff[SPATIAL_DIM];     // x - y
-                        subtract_vec<scalar_t>(diff, query_points + query_index*SPATIAL_DIM, points + point_index*SPATIAL_DIM, SPATIAL_DIM);
-                        eval_G_mu_add_<scalar_t>(out_vec, diff, point_attrs + point_index*SPATIAL_DIM, query_width[query_index]);
+                } else {
+                    if (out_near_leaves != nullptr) out_near_leaves[num_near] = cur_node_index;
+                    num_near++;
+                }
+            } else {
+                /// @case 3: depends on where the reppoint is, decided at evaluation time
+                if (out_open_nodes != nullptr) out_open_nodes[num_open] = cur_node_index;
+                num_open++;
+            }
+        }
+    }
+}
+
+template<typename scalar_t, typename index_t>
+void count_interaction_lists_cpu_kernel_launcher(
+        const scalar_t* query_points,  // [N', 3]
+        const index_t* node_children_list,
+        const bool* node_is_leaf_list,
+        const scalar_t* node_half_w_list,
+        const scalar_t* node_bboxes,
+        signedindex_t* out_num_far,    // [N',]
+        signedindex_t* out_num_near,   // [N',]
+        signedindex_t* out_num_open,   // [N',]
+        signedindex_t num_queries,
+        scalar_t theta) {
+
+    std::vector<scalar_t> node_far_dist2;
+    compute_node_far_dist2_cpu<scalar_t>(node_half_w_list, theta, get_num_nodes_cpu(node_children_list, node_is_leaf_list), node_far_dist2);
+    run_query_loop_cpu<scalar_t, index_t>(
+        query_points,
+        nullptr,
+        node_children_list,
+        node_is_leaf_list,
+        nullptr,
+        num_queries,
+        nullptr,
+        [&](signedindex_t query_index) {
+            build_interaction_lists_cpu_kernel<scalar_t, index_t>(
+                query_points,
+                node_children_list,
+                node_is_leaf_list,
+                node_far_dist2.data(),
+                node_bboxes,
+                nullptr,
+                nullptr,
+                nullptr,
+                out_num_far[query_index],
+                out_num_near[query_index],
+                out_num_open[query_index],
+                num_queries,
+                query_index);
+        });
+}
+
+template<typename scalar_t, typename index_t>
+void fill_interaction_lists_cpu_kernel_launcher(
+        const scalar_t* query_points,  // [N', 3]
+        const index_t* node_children_list,
+        const bool* node_is_leaf_list,
+        const scalar_t* node_half_w_list,
+        const scalar_t* node_bboxes,
+        const signedindex_t* far_offsets,   // [N'+1,]
+        const signedindex_t* near_offsets,  // [N'+1,]
+        const signedindex_t* open_offsets,  // [N'+1,]
+        index_t* out_far_nodes,
+        index_t* out_near_leaves,
+        index_t* out_open_nodes,
+        signedindex_t num_queries,
+        scalar_t theta) {
+
+    std::vector<scalar_t> node_far_dist2;
+    compute_node_far_dist2_cpu<scalar_t>(node_half_w_list, theta, get_num_nodes_cpu(node_children_list, node_is_leaf_list), node_far_dist2);
+    std::vector<signedindex_t> query_costs;
+    compute_interaction_list_costs(far_offsets, near_offsets, open_offsets, query_costs, num_queries);
+    run_query_loop_cpu<scalar_t, index_t>(
+        query_points,
+        query_costs.data(),
+        node_children_list,
+        node_is_leaf_list,
+        nullptr,
+        num_queries,
+        nullptr,
+        [&](signedindex_t query_index) {
+            signedindex_t num_far, num_near, num_open;
+            build_interaction_lists_cpu_kernel<scalar_t>(
+                query_points,
+                node_children_list,
+                node_is_leaf_list,
+                node_far_dist2.data(),
+                node_bboxes,
+                out_far_nodes + far_offsets[query_index],
+                out_near_leaves + near_offsets[query_index],
+                out_open_nodes + open_offsets[query_index],
+                num_far,
+                num_near,
+                num_open,
+                num_queries,
+                query_index);
+            assert(num_far == far_offsets[query_index+1] - far_offsets[query_index]);
+            assert(num_near == near_offsets[query_index+1] - near_offsets[query_index]);
+            assert(num_open == open_offsets[query_index+1] - open_offsets[query_index]);
+        });
+}
+
+
+template<typename scalar_t, typename index_t>
+void multiply_by_A_cached_cpu_kernel(
+        const scalar_t* query_points,  // [N', 3]
+        const scalar_t* query_width,   // [N',]
+        const PointsSoA<scalar_t>& points_soa,  // [N,] per component, in tree order
+        const index_t* node2point_indexstart,
+        const index_t* node_children_list,
+        const scalar_t* node_attrs,
+        const bool* node_is_leaf_list,
+        const scalar_t* node_far_dist2,      // [num_nodes,], see compute_node_far_dist2_cpu
+        const scalar_t* node_reppoints,
+        const scalar_t* node_bboxes,   // [num_nodes, 6] or nullptr, see node_inside_smoothing_width
+        const scalar_t* node_moments1,
+        const scalar_t* node_moments2,
+        signedindex_t expansion_order,
+        const index_t* num_points_in_node,
+        const signedindex_t* far_offsets,
+        const index_t* far_nodes,
+        const signedindex_t* near_offsets,
+        const index_t* near_leaves,
+        const signedindex_t* open_offsets,
+        const index_t* open_nodes,
+        scalar_t* out_attrs,           // [N,]
+        signedindex_t num_queries,
+        signedindex_t query_index,
+        bool continuous_kernel=false
+    ) {
+    // the caller is responsible for making sure 'point_attrs' is [N, C=3]
+
+    if (query_index < num_queries) {
+        scalar_t out_val = 0.0;
+        const scalar_t* query_point = query_points + query_index*SPATIAL_DIM;
+
+        // near-field leaves are collected, and evaluated a block of points at a time
+        auto eval_near_block = [&](const NearFieldBlock<scalar_t>& block) {
+            eval_A_mu_block_add_<scalar_t>(out_val, query_point, query_width[query_index], continuous_kernel, block);
+        };
+        NearFieldBlock<scalar_t> near_block;
+
+        /// @case 1: far nodes, approximate the query value with the node reppoint
+        for (signedindex_t i = far_offsets[query_index]; i < far_offsets[query_index+1]; i++) {
+            signedindex_t node_index = far_nodes[i];
+            scalar_t diff[SPATIAL_DIM];     // x - y
+            subtract_vec<scalar_t>(diff, query_point, node_reppoints + node_index*SPATIAL_DIM, SPATIAL_DIM);
+            out_val += eval_A_expansion<scalar_t>(diff, node_attrs, node_moments1, node_moments2, node_index, expansion_order, query_width[query_index], continuous_kernel);
+        }
+
+        /// @case 2: near leaves, compute over samples
+        for (signedindex_t i = near_offsets[query_index]; i < near_offsets[query_index+1]; i++) {
+            signedindex_t node_index = near_leaves[i];
+            if (node_inside_smoothing_width<scalar_t>(query_point, get_point2point_dist2(query_point, node_reppoints + node_index*SPATIAL_DIM), node_bboxes, node_index, query_width[query_index])) {
+                continue;
+            }
+            add_leaf_to_near_field_block<scalar_t>(points_soa, node2point_indexstart[node_index], node2point_indexstart[node_index] + num_points_in_node[node_index], near_block, eval_near_block);
+        }
+
+        /// @case 3: undecided nodes, traverse from them as usual
+        constexpr signedindex_t search_stack_max_size = ALLOWED_MAX_DEPTH*(NUM_OCT_CHILDREN - 1) + 1;
+        signedindex_t search_stack[search_stack_max_size] = {};
+        for (signedindex_t i = open_offsets[query_index]; i < open_offsets[query_index+1]; i++) {
+            signedindex_t search_stack_top = 0;
+            search_stack[search_stack_top++] = open_nodes[i];
+            while (search_stack_top > 0) {
+                signedindex_t cur_node_index = search_stack[--search_stack_top];
+                scalar_t point2node_dist2 = get_point2point_dist2(query_point, node_reppoints + cur_node_index*SPATIAL_DIM);
+
+                if (point2node_dist2 > node_far_dist2[cur_node_index]) {
+                    scalar_t diff[SPATIAL_DIM];     // x - y
+                    subtract_vec<scalar_t>(diff, query_point, node_reppoints + cur_node_index*SPATIAL_DIM, SPATIAL_DIM);
+                    out_val += eval_A_expansion<scalar_t>(diff, node_attrs, node_moments1, node_moments2, cur_node_index, expansion_order, query_width[query_index], continuous_kernel);
+                } else if (node_inside_smoothing_width<scalar_t>(query_point, point2node_dist2, node_bboxes, cur_node_index, query_width[query_index])) {
+                    // within the smoothing width, culled
+                } else if (!node_is_leaf_list[cur_node_index]) {
+                    for (signedindex_t k = 0; k < NUM_OCT_CHILDREN; k++) {
+                        if (node_children_list[cur_node_index * NUM_OCT_CHILDREN + k] != -1) {
+                            assert(search_stack_top < search_stack_max_size);
+                            search_stack[search_stack_top++] = node_children_list[cur_node_index * NUM_OCT_CHILDREN + k];
+                        }
+                    }
+                } else {
+                    add_leaf_to_near_field_block<scalar_t>(points_soa, node2point_indexstart[cur_node_index], node2point_indexstart[cur_node_index] + num_points_in_node[cur_node_index], near_block, eval_near_block);
+                }
+            }
+        }
+        if (near_block.num_points > 0) {
+            eval_near_block(near_block);
+        }
+        out_attrs[query_index] = out_val;
+    }
+}
+
+template<typename scalar_t, typename index_t>
+void multiply_by_A_cached_cpu_kernel_launcher(
+        const scalar_t* query_points,  // [N', 3]
+        const scalar_t* query_width,   // [N',]
+        const scalar_t* points,        // [N, 3]
+        const scalar_t* point_attrs,   // [N, C]
+        const index_t* node2point_index,
+        const index_t* node2point_indexstart,
+        const index_t* node_children_list,
+        const scalar_t* node_attrs,
+        const bool* node_is_leaf_list,
+        const scalar_t* node_half_w_list,
+        const scalar_t* node_reppoints,
+        const index_t* num_points_in_node,
+        const signedindex_t* far_offsets,
+        const index_t* far_nodes,
+        const signedindex_t* near_offsets,
+        const index_t* near_leaves,
+        const signedindex_t* open_offsets,
+        const index_t* open_nodes,
+        scalar_t* out_attrs,           // [N,]
+        signedindex_t num_queries,
+        bool continuous_kernel,
+        signedindex_t expansion_order,
+        const scalar_t* node_moments1,
+        const scalar_t* node_moments2,
+        scalar_t theta,
+        const TreeTraversalCache<scalar_t>* traversal_cache,
+        TraversalWorkspace<scalar_t>* workspace) {
+
+    // the root holds every point
+    TraversalWorkspace<scalar_t> own_workspace;   // without one of the caller
+    TraversalWorkspace<scalar_t>& launch_workspace = workspace ? *workspace : own_workspace;
+    const PointsSoA<scalar_t>& points_soa = gather_workspace_points_cpu<scalar_t>(points, point_attrs, node2point_index, num_points_in_node[0], SPATIAL_DIM, launch_workspace);
+    if (compute_interaction_list_costs(far_offsets, near_offsets, open_offsets, launch_workspace.query_costs, num_queries)) {
+        launch_workspace.schedule_num_queries = -1;   // schedule the new costs
+    }
+    const scalar_t* cull_bboxes = compute_node_bounds_cpu<scalar_t>(points, node_children_list, node_is_leaf_list, node2point_index, node2point_indexstart, num_points_in_node,
+                                                                    node_half_w_list, node_reppoints, !continuous_kernel, theta, traversal_cache, launch_workspace);
+    run_query_loop_cpu<scalar_t>(
+        query_points,
+        launch_workspace.query_costs.data(),
+        node_children_list,
+        node_is_leaf_list,
+        num_points_in_node,
+        num_queries,
+        &launch_workspace,
+        [&](signedindex_t query_index) {
+            multiply_by_A_cached_cpu_kernel<scalar_t>(
+                query_points,  // [N', 3]
+                query_width,   // [N',]
+                points_soa,
+                node2point_indexstart,
+                node_children_list,
+                node_attrs,
+                node_is_leaf_list,
+                launch_workspace.far_dist2.data(),
+                node_reppoints,
+                cull_bboxes,
+                node_moments1,
+                node_moments2,
+                expansion_order,
+                num_points_in_node,
+                far_offsets,
+                far_nodes,
+                near_offsets,
+                near_leaves,
+                open_offsets,
+                open_nodes,
+                out_attrs,           // [N,]
+                num_queries,
+                query_index,
+                continuous_kernel);
+        });
+}
+
+
+template<typename scalar_t, typename index_t>
+void multiply_by_AT_cached_cpu_kernel(
+        const scalar_t* query_points,  // [N', 3]
+        const scalar_t* query_width,   // [N',]
+        const PointsSoA<scalar_t>& points_soa,  // [N,] per component, in tree order
+        const index_t* node2point_indexstart,
+        const index_t* node_children_list,
+        const scalar_t* node_attrs,
+        const bool* node_is_leaf_list,
+        const scalar_t* node_far_dist2,      // [num_nodes,], see compute_node_far_dist2_cpu
+        const scalar_t* node_reppoints,
+        const scalar_t* node_bboxes,   // [num_nodes, 6] or nullptr, see node_inside_smoothing_width
+        const scalar_t* node_moments1,
+        const scalar_t* node_moments2,
+        signedindex_t expansion_order,
+        const index_t* num_points_in_node,
+        const signedindex_t* far_offsets,
+        const index_t* far_nodes,
+        const signedindex_t* near_offsets,
+        const index_t* near_leaves,
+        const signedindex_t* open_offsets,
+        const index_t* open_nodes,
+        scalar_t* out_attrs,           // [N, 3]
+        signedindex_t num_queries,
+        signedindex_t query_index
+    ) {
+    // the caller is responsible for making sure 'point_attrs' is [N, C=1]
+
+    if (query_index < num_queries) {
+        scalar_t out_vec[SPATIAL_DIM] = {};
+        const scalar_t* query_point = query_points + query_index*SPATIAL_DIM;
+
+        // near-field leaves are collected, and evaluated a block of points at a time
+        auto eval_near_block = [&](const NearFieldBlock<scalar_t>& block) {
+            eval_AT_s_block_add_<scalar_t>(out_vec, query_point, query_width[query_index], block);
+        };
+        NearFieldBlock<scalar_t> near_block;
+
+        /// @case 1: far nodes, approximate the query value with the node reppoint
+        for (signedindex_t i = far_offsets[query_index]; i < far_offsets[query_index+1]; i++) {
+            signedindex_t node_index = far_nodes[i];
+            scalar_t diff[SPATIAL_DIM];     // x - y
+            subtract_vec<scalar_t>(diff, query_point, node_reppoints + node_index*SPATIAL_DIM, SPATIAL_DIM);
+            eval_AT_expansion_add_<scalar_t>(out_vec, diff, node_attrs, node_moments1, node_moments2, node_index, expansion_order, query_width[query_index]);
+        }
+
+        /// @case 2: near leaves, compute over samples
+        for (signedindex_t i = near_offsets[query_index]; i < near_offsets[query_index+1]; i++) {
+            signedindex_t node_index = near_leaves[i];
+            if (node_inside_smoothing_width<scalar_t>(query_point, get_point2point_dist2(query_point, node_reppoints + node_index*SPATIAL_DIM), node_bboxes, node_index, query_width[query_index])) {
+                continue;
+            }
+            add_leaf_to_near_field_block<scalar_t>(points_soa, node2point_indexstart[node_index], node2point_indexstart[node_index] + num_points_in_node[node_index], near_block, eval_near_block);
+        }
+
+        /// @case 3: undecided nodes, traverse from them as usual
+        constexpr signedindex_t search_stack_max_size = ALLOWED_MAX_DEPTH*(NUM_OCT_CHILDREN - 1) + 1;
+        signedindex_t search_stack[search_stack_max_size] = {};
+        for (signedindex_t i = open_offsets[query_index]; i < open_offsets[query_index+1]; i++) {
+            signedindex_t search_stack_top = 0;
+            search_stack[search_stack_top++] = open_nodes[i];
+            while (search_stack_top > 0) {
+                signedindex_t cur_node_index = search_stack[--search_stack_top];
+                scalar_t point2node_dist2 = get_point2point_dist2(query_point, node_reppoints + cur_node_index*SPATIAL_DIM);
+
+                if (point2node_dist2 > node_far_dist2[cur_node_index]) {
+                    scalar_t diff[SPATIAL_DIM];     // x - y
+                    subtract_vec<scalar_t>(diff, query_point, node_reppoints + cur_node_index*SPATIAL_DIM, SPATIAL_DIM);
+                    eval_AT_expansion_add_<scalar_t>(out_vec, diff, node_attrs, node_moments1, node_moments2, cur_node_index, expansion_order, query_width[query_index]);
+                } else if (node_inside_smoothing_width<scalar_t>(query_point, point2node_dist2, node_bboxes, cur_node_index, query_width[query_index])) {
+                    // within the smoothing width, culled
+                } else if (!node_is_leaf_list[cur_node_index]) {
+                    for (signedindex_t k = 0; k < NUM_OCT_CHILDREN; k++) {
+                        if (node_children_list[cur_node_index * NUM_OCT_CHILDREN + k] != -1) {
+                            assert(search_stack_top < search_stack_max_size);
+                            search_stack[search_stack_top++] = node_children_list[cur_node_index * NUM_OCT_CHILDREN + k];
+                        }
                     }
+                } else {
+                    add_leaf_to_near_field_block<scalar_t>(points_soa, node2point_indexstart[cur_node_index], node2point_indexstart[cur_node_index] + num_points_in_node[cur_node_index], near_block, eval_near_block);
                 }
             }
         }
+        if (near_block.num_points > 0) {
+            eval_near_block(near_block);
+        }
         assign_vec<scalar_t>(out_attrs + query_index*SPATIAL_DIM, out_vec, SPATIAL_DIM);
     }
 }
 
-template<typename scalar_t>
-void multiply_by_G_cpu_kernel_launcher(
+template<typename scalar_t, typename index_t>
+void multiply_by_AT_cached_cpu_kernel_launcher(
         const scalar_t* query_points,  // [N', 3]
         const scalar_t* query_width,   // [N',]
         const scalar_t* points,        // [N, 3]
         const scalar_t* point_attrs,   // [N, C]
-        const signedindex_t* node2point_index,
-        const signedindex_t* node2point_indexstart,
-        const signedindex_t* node_children_list,
+        const index_t* node2point_index,
+        const index_t* node2point_indexstart,
+        const index_t* node_children_list,
         const scalar_t* node_attrs,
         const bool* node_is_leaf_list,
         const scalar_t* node_half_w_list,
         const scalar_t* node_reppoints,
-        const signedindex_t* num_points_in_node,
+        const index_t* num_points_in_node,
+        const signedindex_t* far_offsets,
+        const index_t* far_nodes,
+        const signedindex_t* near_offsets,
+        const index_t* near_leaves,
+        const signedindex_t* open_offsets,
+        const index_t* open_nodes,
         scalar_t* out_attrs,           // [N, 3]
-        signedindex_t num_queries) {
-    omp_set_num_threads(20);
-    #pragma omp parallel for
-    for (signedindex_t query_index = 0; query_index < num_queries; query_index++) {
-        multiply_by_G_cpu_kernel<scalar_t>(
-            query_points,  // [N', 3]
-            query_width,   // [N',]
-            points,        // [N, 3]
-            point_attrs,   // [N, C]
-            node2point_index,
-            node2point_indexstart,
-            node_children_list,
-            node_attrs,
-            node_is_leaf_list,
-            node_half_w_list,
-            node_reppoints,
-            num_points_in_node,
-            out_attrs,           // [N, 3]
-            num_queries,
-            query_index);
+        signedindex_t num_queries,
+        signedindex_t expansion_order,
+        const scalar_t* node_moments1,
+        const scalar_t* node_moments2,
+        scalar_t theta,
+        const TreeTraversalCache<scalar_t>* traversal_cache,
+        TraversalWorkspace<scalar_t>* workspace) {
+
+    // the root holds every point
+    TraversalWorkspace<scalar_t> own_workspace;   // without one of the caller
+    TraversalWorkspace<scalar_t>& launch_workspace = workspace ? *workspace : own_workspace;
+    const PointsSoA<scalar_t>& points_soa = gather_workspace_points_cpu<scalar_t>(points, point_attrs, node2point_index, num_points_in_node[0], 1, launch_workspace);
+    if (compute_interaction_list_costs(far_offsets, near_offsets, open_offsets, launch_workspace.query_costs, num_queries)) {
+        launch_workspace.schedule_num_queries = -1;   // schedule the new costs
     }
+    const scalar_t* cull_bboxes = compute_node_bounds_cpu<scalar_t>(points, node_children_list, node_is_leaf_list, node2point_index, node2point_indexstart, num_points_in_node,
+                                                                    node_half_w_list, node_reppoints, true, theta, traversal_cache, launch_workspace);
+    run_query_loop_cpu<scalar_t>(
+        query_points,
+        launch_workspace.query_costs.data(),
+        node_children_list,
+        node_is_leaf_list,
+        num_points_in_node,
+        num_queries,
+        &launch_workspace,
+        [&](signedindex_t query_index) {
+            multiply_by_AT_cached_cpu_kernel<scalar_t>(
+                query_points,  // [N', 3]
+                query_width,   // [N',]
+                points_soa,
+                node2point_indexstart,
+                node_children_list,
+                node_attrs,
+                node_is_leaf_list,
+                launch_workspace.far_dist2.data(),
+                node_reppoints,
+                cull_bboxes,
+                node_moments1,
+                node_moments2,
+                expansion_order,
+                num_points_in_node,
+                far_offsets,
+                far_nodes,
+                near_offsets,
+                near_leaves,
+                open_offsets,
+                open_nodes,
+                out_attrs,           // [N, 3]
+                num_queries,
+                query_index);
+        });
+}
+
+
+/// @note getting negative gradient
+template<typename scalar_t, typename index_t>
+void multiply_by_G_cached_cpu_kernel(
+        const scalar_t* query_points,  // [N', 3]
+        const scalar_t* query_width,   // [N',]
+        const PointsSoA<scalar_t>& points_soa,  // [N,] per component, in tree order
+        const index_t* node2point_indexstart,
+        const index_t* node_children_list,
+        const scalar_t* node_attrs,
+        const bool* node_is_leaf_list,
+        const scalar_t* node_far_dist2,      // [num_nodes,], see compute_node_far_dist2_cpu
+        const scalar_t* node_reppoints,
+        const scalar_t* node_bboxes,   // [num_nodes, 6] or nullptr, see node_inside_smoothing_width
+        const scalar_t* node_moments1,
+        const scalar_t* node_moments2,
+        signedindex_t expansion_order,
+        const index_t* num_points_in_node,
+        const signedindex_t* far_offsets,
+        const index_t* far_nodes,
+        const signedindex_t* near_offsets,
+        const index_t* near_leaves,
+        const signedindex_t* open_offsets,
+        const index_t* open_nodes,
+        scalar_t* out_attrs,           // [N, 3]
+        signedindex_t num_queries,
+        signedindex_t query_index
+    ) {
+    // the caller is responsible for making sure 'point_attrs' is [N, C=3]
+
+    if (query_index < num_queries) {
+        scalar_t out_vec[SPATIAL_DIM] = {};
+        const scalar_t* query_point = query_points + query_index*SPATIAL_DIM;
+
+        // near-field leaves are collected, and evaluated a block of points at a time
+        auto eval_near_block = [&](const NearFieldBlock<scalar_t>& block) {
+            eval_G_mu_block_add_<scalar_t>(out_vec, query_point, query_width[query_index], block);
+        };
+        NearFieldBlock<scalar_t> near_block;
+
+        /// @case 1: far nodes, approximate the query value with the node reppoint
+        for (signedindex_t i = far_offsets[query_index]; i < far_offsets[query_index+1]; i++) {
+            signedindex_t node_index = far_nodes[i];
+            scalar_t diff[SPATIAL_DIM];     // x - y
+            subtract_vec<scalar_t>(diff, query_point, node_reppoints + node_index*SPATIAL_DIM, SPATIAL_DIM);
+            eval_G_expansion_add_<scalar_t>(out_vec, diff, node_attrs, node_moments1, node_moments2, node_index, expansion_order, query_width[query_index]);
+        }
+
+        /// @case 2: near leaves, compute over samples
+        for (signedindex_t i = near_offsets[query_index]; i < near_offsets[query_index+1]; i++) {
+            signedindex_t node_index = near_leaves[i];
+            if (node_inside_smoothing_width<scalar_t>(query_point, get_point2point_dist2(query_point, node_reppoints + node_index*SPATIAL_DIM), node_bboxes, node_index, query_width[query_index])) {
+                continue;
+            }
+            add_leaf_to_near_field_block<scalar_t>(points_soa, node2point_indexstart[node_index], node2point_indexstart[node_index] + num_points_in_node[node_index], near_block, eval_near_block);
+        }
+
+        /// @case 3: undecided nodes, traverse from them as usual
+        constexpr signedindex_t search_stack_max_size = ALLOWED_MAX_DEPTH*(NUM_OCT_CHILDREN - 1) + 1;
+        signedindex_t search_stack[search_stack_max_size] = {};
+        for (signedindex_t i = open_offsets[query_index]; i < open_offsets[query_index+1]; i++) {
+            signedindex_t search_stack_top = 0;
+            search_stack[search_stack_top++] = open_nodes[i];
+            while (search_stack_top > 0) {
+                signedindex_t cur_node_index = search_stack[--search_stack_top];
+                scalar_t point2node_dist2 = get_point2point_dist2(query_point, node_reppoints + cur_node_index*SPATIAL_DIM);
+
+                if (point2node_dist2 > node_far_dist2[cur_node_index]) {
+                    scalar_t diff[SPATIAL_DIM];     // x - y
+                    subtract_vec<scalar_t>(diff, query_point, node_reppoints + cur_node_index*SPATIAL_DIM, SPATIAL_DIM);
+                    eval_G_expansion_add_<scalar_t>(out_vec, diff, node_attrs, node_moments1, node_moments2, cur_node_index, expansion_order, query_width[query_index]);
+                } else if (node_inside_smoothing_width<scalar_t>(query_point, point2node_dist2, node_bboxes, cur_node_index, query_width[query_index])) {
+                    // within the smoothing width, culled
+                } else if (!node_is_leaf_list[cur_node_index]) {
+                    for (signedindex_t k = 0; k < NUM_OCT_CHILDREN; k++) {
+                        if (node_children_list[cur_node_index * NUM_OCT_CHILDREN + k] != -1) {
+                            assert(search_stack_top < search_stack_max_size);
+                            search_stack[search_stack_top++] = node_children_list[cur_node_index * NUM_OCT_CHILDREN + k];
+                        }
+                    }
+                } else {
+                    add_leaf_to_near_field_block<scalar_t>(points_soa, node2point_indexstart[cur_node_index], node2point_indexstart[cur_node_index] + num_points_in_node[cur_node_index], near_block, eval_near_block);
+                }
+            }
+        }
+        if (near_block.num_points > 0) {
+            eval_near_block(near_block);
+        }
+        assign_vec<scalar_t>(out_attrs + query_index*SPATIAL_DIM, out_vec, SPATIAL_DIM);
+    }
+}
+
+template<typename scalar_t, typename index_t>
+void multiply_by_G_cached_cpu_kernel_launcher(
+        const scalar_t* query_points,  // [N', 3]
+        const scalar_t* query_width,   // [N',]
+        const scalar_t* points,        // [N, 3]
+        const scalar_t* point_attrs,   // [N, C]
+        const index_t* node2point_index,
+        const index_t* node2point_indexstart,
+        const index_t* node_children_list,
+        const scalar_t* node_attrs,
+        const bool* node_is_leaf_list,
+        const scalar_t* node_half_w_list,
+        const scalar_t* node_reppoints,
+        const index_t* num_points_in_node,
+        const signedindex_t* far_offsets,
+        const index_t* far_nodes,
+        const signedindex_t* near_offsets,
+        const index_t* near_leaves,
+        const signedindex_t* open_offsets,
+        const index_t* open_nodes,
+        scalar_t* out_attrs,           // [N, 3]
+        signedindex_t num_queries,
+        signedindex_t expansion_order,
+        const scalar_t* node_moments1,
+        const scalar_t* node_moments2,
+        scalar_t theta,
+        const TreeTraversalCache<scalar_t>* traversal_cache,
+        TraversalWorkspace<scalar_t>* workspace) {
+
+    // the root holds every point
+    TraversalWorkspace<scalar_t> own_workspace;   // without one of the caller
+    TraversalWorkspace<scalar_t>& launch_workspace = workspace ? *workspace : own_workspace;
+    const PointsSoA<scalar_t>& points_soa = gather_workspace_points_cpu<scalar_t>(points, point_attrs, node2point_index, num_points_in_node[0], SPATIAL_DIM, launch_workspace);
+    if (compute_interaction_list_costs(far_offsets, near_offsets, open_offsets, launch_workspace.query_costs, num_queries)) {
+        launch_workspace.schedule_num_queries = -1;   // schedule the new costs
+    }
+    const scalar_t* cull_bboxes = compute_node_bounds_cpu<scalar_t>(points, node_children_list, node_is_leaf_list, node2point_index, node2point_indexstart, num_points_in_node,
+                                                                    node_half_w_list, node_reppoints, true, theta, traversal_cache, launch_workspace);
+    run_query_loop_cpu<scalar_t>(
+        query_points,
+        launch_workspace.query_costs.data(),
+        node_children_list,
+        node_is_leaf_list,
+        num_points_in_node,
+        num_queries,
+        &launch_workspace,
+        [&](signedindex_t query_index) {
+            multiply_by_G_cached_cpu_kernel<scalar_t>(
+                query_points,  // [N', 3]
+                query_width,   // [N',]
+                points_soa,
+                node2point_indexstart,
+                node_children_list,
+                node_attrs,
+                node_is_leaf_list,
+                launch_workspace.far_dist2.data(),
+                node_reppoints,
+                cull_bboxes,
+                node_moments1,
+                node_moments2,
+                expansion_order,
+                num_points_in_node,
+                far_offsets,
+                far_nodes,
+                near_offsets,
+                near_leaves,
+                open_offsets,
+                open_nodes,
+                out_attrs,           // [N, 3]
+                num_queries,
+                query_index);
+        });
+}
+
+
+//////////////////////////////////
+/// @brief dual-tree evaluation, when the queries are the points of the tree themselves
+//         (target node, source node) pairs are visited from the top, far pairs add to a second-order
+//         local expansion of the target node about its bbox center, which is pushed down to the points afterwards;
+//         the one-sided traversal hands the rest to the per-point walks of its target groups
+
+// a local expansion per output component: value, gradient [3], hessian [3, 3]
+#define LOCAL_EXPANSION_SIZE 13
+// the target tree is cut into at least this many subtrees per thread, every one is traversed by one thread
+#define DUAL_TREE_TASKS_PER_THREAD 16
+// target nodes with at most this many points are not expanded, their points see far sources one by one,
+// which is cheaper than a local expansion for a handful of points (symmetric traversal)
+#define DUAL_TREE_TARGET_GROUP_SIZE 16
+// the one-sided traversal stops at leaves and target nodes with at most this many points, and lists the sources
+// they meet: every point of such a group walks the listed source subtrees as a single query would (see dual_tree_cpu_kernel)
+#define DUAL_TREE_SOURCE_LIST_GROUP_SIZE 64
+// target nodes with fewer points see far sources point by point rather than through a local expansion
+#define DUAL_TREE_LOCAL_MIN_POINTS 8
+
+// out += L0 + L1.t + 1/2 t^T L2 t
+template<typename scalar_t>
+scalar_t eval_local_expansion(const scalar_t* local, const scalar_t* t) {
+    scalar_t result = local[0] + inner_prod<scalar_t>(local + 1, t, SPATIAL_DIM);
+    for (signedindex_t a = 0; a < SPATIAL_DIM; a++) {
+        result += scalar_t(0.5) * t[a] * inner_prod<scalar_t>(local + 4 + a*SPATIAL_DIM, t, SPATIAL_DIM);
+    }
+    return result;
+}
+
+// re-centers a local expansion at center + t, and adds it to dst
+template<typename scalar_t>
+void shift_local_expansion_add_(scalar_t* dst, const scalar_t* local, const scalar_t* t) {
+    dst[0] += eval_local_expansion<scalar_t>(local, t);
+    for (signedindex_t a = 0; a < SPATIAL_DIM; a++) {
+        dst[1+a] += local[1+a] + inner_prod<scalar_t>(local + 4 + a*SPATIAL_DIM, t, SPATIAL_DIM);
+    }
+    add_vec_<scalar_t>(dst + 4, local + 4, SPATIAL_DIM*SPATIAL_DIM);
+}
+
+
+/// @note every operator provides, for the aggregated attributes of a source node seen from r = x - reppoint,
+//        eval_local: the local expansion about r (value and first and second derivatives w.r.t. x),
+//        eval_far: the value at a single target point, exactly as the per-query kernels approximate far nodes,
+//        eval_near_block: the exact near-field sum over a block of source points
+template<typename scalar_t>
+struct DualTreeOpA {
+    static constexpr signedindex_t out_dim = 1;
+    static constexpr signedindex_t attr_dim = SPATIAL_DIM;
+    const scalar_t* node_attrs;
+    bool continuous_kernel;
+
+    void eval_local(scalar_t* local, const scalar_t* r, signedindex_t node_index) const {
+        // f = sum_c mu_c d_c phi(r)
+        const scalar_t* mu = node_attrs + node_index*SPATIAL_DIM;
+        scalar_t inv_dist2 = scalar_t(1) / inner_prod<scalar_t>(r, r, SPATIAL_DIM);
+        scalar_t inv_dist3 = std::sqrt(inv_dist2) * inv_dist2;
+        scalar_t inv_dist5 = inv_dist3 * inv_dist2;
+        scalar_t inv_dist7 = inv_dist5 * inv_dist2;
+        scalar_t r_mu = inner_prod<scalar_t>(r, mu, SPATIAL_DIM);
+        local[0] += -r_mu * inv_dist3;
+        for (signedindex_t a = 0; a < SPATIAL_DIM; a++) {
+            local[1+a] += 3 * r_mu * r[a] * inv_dist5 - mu[a] * inv_dist3;
+            for (signedindex_t b = 0; b < SPATIAL_DIM; b++) {
+                local[4 + a*SPATIAL_DIM + b] += -15 * r_mu * r[a] * r[b] * inv_dist7
+                                              + 3 * (r_mu * (a == b) + mu[a] * r[b] + mu[b] * r[a]) * inv_dist5;
+            }
+        }
+    }
+    void eval_far(scalar_t* out, const scalar_t* diff, signedindex_t node_index, scalar_t width) const {
+        out[0] += eval_A_mu<scalar_t>(diff, node_attrs + node_index*SPATIAL_DIM, width, continuous_kernel);
+    }
+    void eval_near_block(scalar_t* out, const scalar_t* query_point, scalar_t width, const NearFieldBlock<scalar_t>& block) const {
+        eval_A_mu_block_add_<scalar_t>(out[0], query_point, width, continuous_kernel, block);
+    }
+};
+
+template<typename scalar_t>
+struct DualTreeOpAT {
+    static constexpr signedindex_t out_dim = SPATIAL_DIM;
+    static constexpr signedindex_t attr_dim = 1;
+    const scalar_t* node_attrs;
+
+    void eval_local(scalar_t* local, const scalar_t* r, signedindex_t node_index) const {
+        // f_e = -s d_e phi(r)
+        scalar_t s = node_attrs[node_index];
+        scalar_t inv_dist2 = scalar_t(1) / inner_prod<scalar_t>(r, r, SPATIAL_DIM);
+        scalar_t inv_dist3 = std::sqrt(inv_dist2) * inv_dist2;
+        scalar_t inv_dist5 = inv_dist3 * inv_dist2;
+        scalar_t inv_dist7 = inv_dist5 * inv_dist2;
+        for (signedindex_t e = 0; e < SPATIAL_DIM; e++) {
+            scalar_t* local_e = local + e*LOCAL_EXPANSION_SIZE;
+            local_e[0] += s * r[e] * inv_dist3;
+            for (signedindex_t a = 0; a < SPATIAL_DIM; a++) {
+                local_e[1+a] += -s * (3 * r[a] * r[e] * inv_dist5 - (a == e) * inv_dist3);
+                for (signedindex_t b = 0; b < SPATIAL_DIM; b++) {
+                    local_e[4 + a*SPATIAL_DIM + b] += -s * (-15 * r[a] * r[b] * r[e] * inv_dist7
+                                                            + 3 * ((a == b) * r[e] + (a == e) * r[b] + (b == e) * r[a]) * inv_dist5);
+                }
+            }
+        }
+    }
+    void eval_far(scalar_t* out, const scalar_t* diff, signedindex_t node_index, scalar_t width) const {
+        eval_AT_s_add_<scalar_t>(out, diff, node_attrs + node_index, width);
+    }
+    void eval_near_block(scalar_t* out, const scalar_t* query_point, scalar_t width, const NearFieldBlock<scalar_t>& block) const {
+        eval_AT_s_block_add_<scalar_t>(out, query_point, width, block);
+    }
+};
+
+template<typename scalar_t>
+struct DualTreeOpG {
+    static constexpr signedindex_t out_dim = SPATIAL_DIM;
+    static constexpr signedindex_t attr_dim = SPATIAL_DIM;
+    const scalar_t* node_attrs;
+
+    void eval_local(scalar_t* local, const scalar_t* r, signedindex_t node_index) const {
+        // f_e = -sum_c mu_c d_c d_e phi(r)
+        const scalar_t* mu = node_attrs + node_index*SPATIAL_DIM;
+        scalar_t inv_dist2 = scalar_t(1) / inner_prod<scalar_t>(r, r, SPATIAL_DIM);
+        scalar_t inv_dist3 = std::sqrt(inv_dist2) * inv_dist2;
+        scalar_t inv_dist5 = inv_dist3 * inv_dist2;
+        scalar_t inv_dist7 = inv_dist5 * inv_dist2;
+        scalar_t inv_dist9 = inv_dist7 * inv_dist2;
+        scalar_t r_mu = inner_prod<scalar_t>(r, mu, SPATIAL_DIM);
+        for (signedindex_t e = 0; e < SPATIAL_DIM; e++) {
+            scalar_t* local_e = local + e*LOCAL_EXPANSION_SIZE;
+            local_e[0] -= 3 * r_mu * r[e] * inv_dist5 - mu[e] * inv_dist3;
+            for (signedindex_t a = 0; a < SPATIAL_DIM; a++) {
+                local_e[1+a] -= -15 * r_mu * r[a] * r[e] * inv_dist7
+                              + 3 * (r_mu * (a == e) + mu[a] * r[e] + mu[e] * r[a]) * inv_dist5;
+                for (signedindex_t b = 0; b < SPATIAL_DIM; b++) {
+                    local_e[4 + a*SPATIAL_DIM + b] -= 105 * r_mu * r[a] * r[b] * r[e] * inv_dist9
+                        - 15 * ((a == b) * r_mu * r[e] + (a == e) * r_mu * r[b] + (b == e) * r_mu * r[a]
+                                + mu[a] * r[b] * r[e] + mu[b] * r[a] * r[e] + mu[e] * r[a] * r[b]) * inv_dist7
+                        + 3 * ((a == b) * mu[e] + (a == e) * mu[b] + (b == e) * mu[a]) * inv_dist5;
+                }
+            }
+        }
+    }
+    void eval_far(scalar_t* out, const scalar_t* diff, signedindex_t node_index, scalar_t width) const {
+        eval_G_mu_add_<scalar_t>(out, diff, node_attrs + node_index*SPATIAL_DIM, width);
+    }
+    void eval_near_block(scalar_t* out, const scalar_t* query_point, scalar_t width, const NearFieldBlock<scalar_t>& block) const {
+        eval_G_mu_block_add_<scalar_t>(out, query_point, width, block);
+    }
+};
+
+
+/// @brief the node geometry of the dual-tree traversals
+template<typename scalar_t>
+struct DualTreeGeometry {
+    std::vector<scalar_t> own_bboxes;       // [num_nodes, 6], without a traversal cache
+    std::vector<scalar_t> opening_half_w;   // [num_nodes,], OPENING_TIGHT only
+    std::vector<scalar_t> centers;          // [num_nodes, 3], bbox centers of the target nodes
+    std::vector<scalar_t> radii;            // [num_nodes,], half bbox diagonals
+    std::vector<scalar_t> max_widths;       // [num_nodes,], largest width of the points in a node
+    const scalar_t* source_half_w = nullptr;    // half widths of the far-field test of the sources, see get_opening_criterion
+};
+
+template<typename scalar_t, typename index_t>
+void compute_dual_tree_geometry_cpu(
+        const scalar_t* points,        // [N, 3]
+        const scalar_t* point_width,   // [N,]
+        const index_t* node2point_index,
+        const index_t* node2point_indexstart,
+        const index_t* node_children_list,
+        const bool* node_is_leaf_list,
+        const scalar_t* node_half_w_list,
+        const scalar_t* node_reppoints,
+        const index_t* num_points_in_node,
+        signedindex_t num_nodes,
+        const TreeTraversalCache<scalar_t>* traversal_cache,
+        DualTreeGeometry<scalar_t>& geometry) {
+    // children come after their parents
+    const scalar_t* bboxes = nullptr;
+    if (traversal_cache) {
+        bboxes = traversal_cache->node_bboxes.data();
+    } else {
+        geometry.own_bboxes.resize(num_nodes*2*SPATIAL_DIM);
+        compute_node_bboxes<scalar_t>(points, node_children_list, node_is_leaf_list, node2point_index, node2point_indexstart, num_points_in_node, geometry.own_bboxes.data(), num_nodes);
+        bboxes = geometry.own_bboxes.data();
+    }
+    geometry.source_half_w = node_half_w_list;
+    if (get_opening_criterion() == OPENING_TIGHT) {
+        geometry.opening_half_w.resize(num_nodes);
+        compute_node_opening_half_w<scalar_t>(node_reppoints, bboxes, geometry.opening_half_w.data(), num_nodes);
+        geometry.source_half_w = geometry.opening_half_w.data();
+    }
+    geometry.centers.resize(num_nodes*SPATIAL_DIM);
+    geometry.radii.resize(num_nodes);
+    geometry.max_widths.assign(num_nodes, 0);
+    for (signedindex_t node_index = num_nodes-1; node_index >= 0; node_index--) {
+        const scalar_t* bbox = bboxes + node_index*2*SPATIAL_DIM;
+        scalar_t radius2 = 0;
+        for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+            geometry.centers[node_index*SPATIAL_DIM + d] = scalar_t(0.5) * (bbox[d] + bbox[SPATIAL_DIM+d]);
+            radius2 += scalar_t(0.25) * (bbox[SPATIAL_DIM+d] - bbox[d]) * (bbox[SPATIAL_DIM+d] - bbox[d]);
+        }
+        geometry.radii[node_index] = std::sqrt(radius2);
+        if (node_is_leaf_list[node_index]) {
+            for (signedindex_t j = 0; j < num_points_in_node[node_index]; j++) {
+                signedindex_t point_index = node2point_index[node2point_indexstart[node_index] + j];
+                geometry.max_widths[node_index] = std::max(geometry.max_widths[node_index], point_width[point_index]);
+            }
+        } else {
+            for (signedindex_t k = 0; k < NUM_OCT_CHILDREN; k++) {
+                signedindex_t child_index = node_children_list[node_index*NUM_OCT_CHILDREN + k];
+                if (child_index != -1) {
+                    geometry.max_widths[node_index] = std::max(geometry.max_widths[node_index], geometry.max_widths[child_index]);
+                }
+            }
+        }
+    }
+}
+
+/// @brief independent target subtrees: open nodes from the root, until there are enough of them for the threads
+template<typename index_t>
+void split_dual_tree_target_roots(
+        const index_t* node_children_list,
+        const bool* node_is_leaf_list,
+        signedindex_t num_threads,
+        std::vector<signedindex_t>& target_roots) {
+    target_roots.assign(1, 0);
+    while (signedindex_t(target_roots.size()) < DUAL_TREE_TASKS_PER_THREAD * num_threads) {
+        std::vector<signedindex_t> opened;
+        for (signedindex_t node_index : target_roots) {
+            if (node_is_leaf_list[node_index]) {
+                opened.push_back(node_index);
+                continue;
+            }
+            for (signedindex_t k = 0; k < NUM_OCT_CHILDREN; k++) {
+                if (node_children_list[node_index*NUM_OCT_CHILDREN + k] != -1) {
+                    opened.push_back(node_children_list[node_index*NUM_OCT_CHILDREN + k]);
+                }
+            }
+        }
+        if (opened.size() == target_roots.size()) {
+            break;
+        }
+        target_roots.swap(opened);
+    }
+}
+
+// how a source node is seen from a target node, see dual_tree_cpu_kernel
+enum DualTreeFarKind {
+    DUAL_TREE_NOT_FAR = 0,      // the pair is split, or summed exactly
+    DUAL_TREE_FAR_POINTS = 1,   // approximated at every target point
+    DUAL_TREE_FAR_LOCAL = 2     // added to the local expansion of the target node
+};
+
+template<typename scalar_t, typename index_t>
+DualTreeFarKind classify_dual_tree_pair(
+        const DualTreeGeometry<scalar_t>& geometry,
+        const bool* node_is_leaf_list,
+        const index_t* num_points_in_node,
+        const scalar_t* node_reppoints,
+        signedindex_t target,
+        signedindex_t source,
+        scalar_t theta,
+        scalar_t* r) {      // [3], out: target center - source reppoint
+    subtract_vec<scalar_t>(r, geometry.centers.data() + target*SPATIAL_DIM, node_reppoints + source*SPATIAL_DIM, SPATIAL_DIM);
+    scalar_t dist = std::sqrt(inner_prod<scalar_t>(r, r, SPATIAL_DIM));
+    // every target point passes the opening criterion of the per-query kernels
+    bool targets_far = (dist - geometry.radii[target]) > scalar_t(theta * 2.0f) * geometry.source_half_w[source];
+    if (!targets_far) {
+        return DUAL_TREE_NOT_FAR;
+    }
+    /// @case 1: a small target node, its points see the source one by one
+    if (node_is_leaf_list[target] || num_points_in_node[target] <= DUAL_TREE_TARGET_GROUP_SIZE) {
+        return DUAL_TREE_FAR_POINTS;
+    }
+    /// @case 2: a target node small compared to the distance, and all targets outside the smoothing range
+    if (dist > scalar_t(theta * 2.0f) * geometry.radii[target] && dist - geometry.radii[target] >= geometry.max_widths[target]) {
+        return DUAL_TREE_FAR_LOCAL;
+    }
+    return DUAL_TREE_NOT_FAR;
+}
+
+/// @brief downward pass of a target subtree, local expansions are shifted to the children, and evaluated at the points of the leaves
+template<typename scalar_t, typename index_t>
+void eval_dual_tree_locals_cpu(
+        const scalar_t* points,         // [N, 3]
+        const index_t* node2point_index,
+        const index_t* node2point_indexstart,
+        const index_t* node_children_list,
+        const bool* node_is_leaf_list,
+        const index_t* num_points_in_node,
+        const scalar_t* node_centers,   // [num_nodes, 3]
+        scalar_t* node_locals,          // [num_nodes, out_dim, LOCAL_EXPANSION_SIZE]
+        scalar_t* out_attrs,            // [N, out_dim]
+        signedindex_t out_dim,
+        signedindex_t target_root) {
+    std::vector<signedindex_t> node_stack = {target_root};
+    while (!node_stack.empty()) {
+        signedindex_t node_index = node_stack.back();
+        node_stack.pop_back();
+        const scalar_t* local = node_locals + node_index*out_dim*LOCAL_EXPANSION_SIZE;
+        if (node_is_leaf_list[node_index]) {
+            for (signedindex_t j = 0; j < num_points_in_node[node_index]; j++) {
+                signedindex_t point_index = node2point_index[node2point_indexstart[node_index] + j];
+                scalar_t t[SPATIAL_DIM];
+                subtract_vec<scalar_t>(t, points + point_index*SPATIAL_DIM, node_centers + node_index*SPATIAL_DIM, SPATIAL_DIM);
+                for (signedindex_t e = 0; e < out_dim; e++) {
+                    out_attrs[point_index*out_dim + e] += eval_local_expansion<scalar_t>(local + e*LOCAL_EXPANSION_SIZE, t);
+                }
+            }
+            continue;
+        }
+        for (signedindex_t k = 0; k < NUM_OCT_CHILDREN; k++) {
+            signedindex_t child_index = node_children_list[node_index*NUM_OCT_CHILDREN + k];
+            if (child_index != -1) {
+                scalar_t t[SPATIAL_DIM];
+                subtract_vec<scalar_t>(t, node_centers + child_index*SPATIAL_DIM, node_centers + node_index*SPATIAL_DIM, SPATIAL_DIM);
+                for (signedindex_t e = 0; e < out_dim; e++) {
+                    shift_local_expansion_add_<scalar_t>(node_locals + (child_index*out_dim + e)*LOCAL_EXPANSION_SIZE, local + e*LOCAL_EXPANSION_SIZE, t);
+                }
+                node_stack.push_back(child_index);
+            }
+        }
+    }
+}
+
+
+/// @brief the sources listed for the target group of a point (see dual_tree_cpu_kernel): the point walks the packed subtree
+//         of every listed source node as the per-query kernels walk the whole tree, its near leaves summed in shared blocks
+template<typename scalar_t, typename dual_tree_op_t>
+void eval_dual_tree_listed_sources(
+        const dual_tree_op_t& op,
+        const scalar_t* query_point,
+        scalar_t query_width,
+        const PointsSoA<scalar_t>& points_soa,     // [N,] per component, in tree order
+        const PackedNode<scalar_t>* packed_nodes,  // see pack_tree_nodes_cpu
+        const scalar_t* node_bboxes,               // [num_nodes, 6] or nullptr, see node_inside_smoothing_width
+        const std::pair<signedindex_t, signedindex_t>* listed_pairs,  // (target group, packed source node)
+        signedindex_t num_listed_pairs,
+        scalar_t* out) {                           // [out_dim,]
+    auto eval_near_block = [&](const NearFieldBlock<scalar_t>& block) {
+        op.eval_near_block(out, query_point, query_width, block);
+    };
+    NearFieldBlock<scalar_t> near_block;
+
+    for (signedindex_t i = 0; i < num_listed_pairs; i++) {
+        // a forward walk over the packed subtree of the source
+        const signedindex_t packed_end = packed_nodes[listed_pairs[i].second].skip;
+        signedindex_t packed_index = listed_pairs[i].second;
+        while (packed_index < packed_end) {
+            const signedindex_t cur_packed_index = packed_index;
+            const PackedNode<scalar_t>& cur_node = packed_nodes[cur_packed_index];
+            // past its subtree, unless it is a nonleaf opened below
+            packed_index = cur_node.skip;
+            const signedindex_t cur_node_index = cur_node.node_index;
+
+            scalar_t point2node_dist2 = get_point2point_dist2(query_point, cur_node.reppoint);
+
+            /// @case 1: the query point is far from the node, approximate it at its reppoint
+            if (point2node_dist2 > cur_node.far_dist2) {
+                scalar_t diff[SPATIAL_DIM];     // x - y
+                subtract_vec<scalar_t>(diff, query_point, cur_node.reppoint, SPATIAL_DIM);
+                op.eval_far(out, diff, cur_node_index, query_width);
+            } else if (node_inside_smoothing_width<scalar_t>(query_point, point2node_dist2, node_bboxes, cur_node_index, query_width)) {
+                /// @case 2: every point of the node is within the smoothing width, where the kernel vanishes, cull it
+            } else if (cur_node.num_points < 0) {
+                /// @case 3: a nonleaf that is not that far, step into its subtree, to its first child
+                packed_index = cur_packed_index + 1;
+            } else {
+                /// @case 4: a near leaf, compute over its samples
+                add_leaf_to_near_field_block<scalar_t>(points_soa, cur_node.first_point, cur_node.first_point + cur_node.num_points, near_block, eval_near_block);
+            }
+        }
+    }
+    if (near_block.num_points > 0) {
+        eval_near_block(near_block);
+    }
+}
+
+
+/// @brief interactions of the points of one target subtree with the whole tree.
+//         (target node, source node) pairs are visited from (target_root, root), the sources as packed nodes:
+//         a far source whose targets are all outside the smoothing range adds to the local expansion of a target node
+//         that is small compared to the distance, otherwise the larger of the two nodes is split, until the target
+//         is a group (a leaf, or at most DUAL_TREE_SOURCE_LIST_GROUP_SIZE points); the group then lists the source,
+//         and each of its points walks the listed subtrees on its own (see eval_dual_tree_listed_sources)
+template<typename scalar_t, typename dual_tree_op_t, typename index_t>
+void dual_tree_cpu_kernel(
+        const dual_tree_op_t& op,
+        const scalar_t* points,         // [N, 3]
+        const scalar_t* point_width,    // [N,]
+        const PointsSoA<scalar_t>& points_soa,  // [N,] per component, in tree order
+        const index_t* node2point_index,
+        const index_t* node2point_indexstart,
+        const index_t* node_children_list,
+        const bool* node_is_leaf_list,
+        const index_t* num_points_in_node,
+        const DualTreeGeometry<scalar_t>& geometry,
+        const PackedNode<scalar_t>* packed_nodes,   // see pack_tree_nodes_cpu
+        const scalar_t* node_bboxes,        // [num_nodes, 6] or nullptr, see node_inside_smoothing_width
+        scalar_t* node_locals,              // [num_nodes, out_dim, LOCAL_EXPANSION_SIZE], zero-initialized
+        scalar_t* out_attrs,                // [N, out_dim], zero-initialized
+        signedindex_t target_root,
+        scalar_t theta) {
+
+    constexpr signedindex_t out_dim = dual_tree_op_t::out_dim;
+    const scalar_t sqrt3 = std::sqrt(scalar_t(3));
+    std::vector<std::pair<signedindex_t, signedindex_t>> pair_stack = {{target_root, 0}};   // (target node, packed source node)
+    std::vector<std::pair<signedindex_t, signedindex_t>> listed_pairs;   // (target group, packed source node)
+
+    while (!pair_stack.empty()) {
+        const signedindex_t target = pair_stack.back().first;
+        const signedindex_t source = pair_stack.back().second;
+        pair_stack.pop_back();
+        const PackedNode<scalar_t>& source_node = packed_nodes[source];
+        const signedindex_t source_index = source_node.node_index;
+        const scalar_t target_radius = geometry.radii[target];
+
+        scalar_t r[SPATIAL_DIM];     // target center - source reppoint
+        subtract_vec<scalar_t>(r, geometry.centers.data() + target*SPATIAL_DIM, source_node.reppoint, SPATIAL_DIM);
+        const scalar_t dist = std::sqrt(inner_prod<scalar_t>(r, r, SPATIAL_DIM));
+
+        /// @case 1: every target point passes the opening criterion of the per-query kernels, the target node is small
+        //           compared to the distance, and all targets are outside the smoothing range: local expansion of the target node
+        if (num_points_in_node[target] >= DUAL_TREE_LOCAL_MIN_POINTS
+            && dist - target_radius > scalar_t(theta * 2.0f) * geometry.source_half_w[source_index]
+            && dist > scalar_t(theta * 2.0f) * target_radius
+            && dist - target_radius >= geometry.max_widths[target]) {
+            op.eval_local(node_locals + target*out_dim*LOCAL_EXPANSION_SIZE, r, source_index);
+            continue;
+        }
+        /// @case 2: a target group, its points walk the source subtree afterwards
+        if (node_is_leaf_list[target] || num_points_in_node[target] <= DUAL_TREE_SOURCE_LIST_GROUP_SIZE) {
+            listed_pairs.emplace_back(target, source);
+            continue;
+        }
+        /// @case 3: split the larger node
+        if (source_node.num_points >= 0 || target_radius > sqrt3 * geometry.source_half_w[source_index]) {
+            for (signedindex_t k = 0; k < NUM_OCT_CHILDREN; k++) {
+                signedindex_t child_index = node_children_list[target*NUM_OCT_CHILDREN + k];
+                if (child_index != -1) {
+                    pair_stack.emplace_back(child_index, source);
+                }
+            }
+        } else {
+            // the children of a packed nonleaf follow it, each one past the subtree of the previous
+            for (signedindex_t child = source + 1; child < source_node.skip; child = packed_nodes[child].skip) {
+                pair_stack.emplace_back(target, child);
+            }
+        }
+    }
+
+    // every point of a target group over all the sources listed for it
+    std::stable_sort(listed_pairs.begin(), listed_pairs.end(),
+        [](const std::pair<signedindex_t, signedindex_t>& p, const std::pair<signedindex_t, signedindex_t>& q) { return p.first < q.first; });
+    for (size_t begin = 0, end = 0; begin < listed_pairs.size(); begin = end) {
+        signedindex_t target = listed_pairs[begin].first;
+        for (end = begin; end < listed_pairs.size() && listed_pairs[end].first == target; end++) {}
+        for (signedindex_t j = 0; j < num_points_in_node[target]; j++) {
+            signedindex_t point_index = node2point_index[node2point_indexstart[target] + j];
+            eval_dual_tree_listed_sources<scalar_t>(op, points + point_index*SPATIAL_DIM, point_width[point_index], points_soa, packed_nodes, node_bboxes,
+                                                    listed_pairs.data() + begin, end - begin, out_attrs + point_index*out_dim);
+        }
+    }
+
+    eval_dual_tree_locals_cpu<scalar_t>(points, node2point_index, node2point_indexstart, node_children_list, node_is_leaf_list, num_points_in_node,
+                                        geometry.centers.data(), node_locals, out_attrs, out_dim, target_root);
+}
+
+
+template<typename scalar_t, typename dual_tree_op_t, typename index_t>
+void dual_tree_cpu_kernel_launcher(
+        const dual_tree_op_t& op,
+        const scalar_t* points,        // [N, 3]
+        const scalar_t* point_width,   // [N,]
+        const scalar_t* point_attrs,   // [N, C]
+        const index_t* node2point_index,
+        const index_t* node2point_indexstart,
+        const index_t* node_children_list,
+        const bool* node_is_leaf_list,
+        const scalar_t* node_half_w_list,
+        const scalar_t* node_reppoints,
+        const index_t* num_points_in_node,
+        scalar_t* out_attrs,           // [N, out_dim]
+        signedindex_t num_nodes,
+        bool cull,                     // see node_inside_smoothing_width
+        scalar_t theta,
+        const TreeTraversalCache<scalar_t>* traversal_cache,
+        TraversalWorkspace<scalar_t>* workspace) {
+
+    constexpr signedindex_t out_dim = dual_tree_op_t::out_dim;
+    const signedindex_t num_points = num_points_in_node[0];   // the root holds every point
+    TraversalWorkspace<scalar_t> own_workspace;   // without one of the caller
+    TraversalWorkspace<scalar_t>& launch_workspace = workspace ? *workspace : own_workspace;
+    const PointsSoA<scalar_t>& points_soa = gather_workspace_points_cpu<scalar_t>(points, point_attrs, node2point_index, num_points, dual_tree_op_t::attr_dim, launch_workspace);
+    const scalar_t* cull_bboxes = compute_node_bounds_cpu<scalar_t>(points, node_children_list, node_is_leaf_list, node2point_index, node2point_indexstart, num_points_in_node,
+                                                                    node_half_w_list, node_reppoints, cull, theta, traversal_cache, launch_workspace);
+    pack_tree_nodes_cpu<scalar_t>(node_children_list, node_is_leaf_list, node2point_indexstart, num_points_in_node, node_reppoints, traversal_cache, launch_workspace);
+
+    DualTreeGeometry<scalar_t> geometry;
+    compute_dual_tree_geometry_cpu<scalar_t>(points, point_width, node2point_index, node2point_indexstart, node_children_list, node_is_leaf_list,
+                                             node_half_w_list, node_reppoints, num_points_in_node, num_nodes, traversal_cache, geometry);
+    const signedindex_t num_threads = prepare_parallel_launch();
+    std::vector<signedindex_t> target_roots;
+    split_dual_tree_target_roots(node_children_list, node_is_leaf_list, num_threads, target_roots);
+
+    std::fill(out_attrs, out_attrs + num_points*out_dim, scalar_t(0));
+    std::vector<scalar_t> node_locals(num_nodes*out_dim*LOCAL_EXPANSION_SIZE, scalar_t(0));
+    const signedindex_t num_target_roots = target_roots.size();
+    #pragma omp parallel for num_threads(num_threads) schedule(dynamic, 1)
+    for (signedindex_t i = 0; i < num_target_roots; i++) {
+        dual_tree_cpu_kernel<scalar_t, dual_tree_op_t>(
+            op,
+            points,
+            point_width,
+            points_soa,
+            node2point_index,
+            node2point_indexstart,
+            node_children_list,
+            node_is_leaf_list,
+            num_points_in_node,
+            geometry,
+            launch_workspace.packed_nodes.data(),
+            cull_bboxes,
+            node_locals.data(),
+            out_attrs,
+            target_roots[i],
+            theta);
+    }
+}
+
+
+template<typename scalar_t, typename index_t>
+void multiply_by_A_dualtree_cpu_kernel_launcher(
+        const scalar_t* points,        // [N, 3]
+        const scalar_t* point_width,   // [N,]
+        const scalar_t* point_attrs,   // [N, C]
+        const index_t* node2point_index,
+        const index_t* node2point_indexstart,
+        const index_t* node_children_list,
+        const scalar_t* node_attrs,
+        const bool* node_is_leaf_list,
+        const scalar_t* node_half_w_list,
+        const scalar_t* node_reppoints,
+        const index_t* num_points_in_node,
+        scalar_t* out_attrs,           // [N,]
+        signedindex_t num_nodes,
+        bool continuous_kernel,
+        scalar_t theta,
+        const TreeTraversalCache<scalar_t>* traversal_cache,
+        TraversalWorkspace<scalar_t>* workspace) {
+    DualTreeOpA<scalar_t> op{node_attrs, continuous_kernel};
+    dual_tree_cpu_kernel_launcher<scalar_t>(op, points, point_width, point_attrs, node2point_index, node2point_indexstart,
+        node_children_list, node_is_leaf_list, node_half_w_list, node_reppoints, num_points_in_node, out_attrs, num_nodes, !continuous_kernel, theta, traversal_cache, workspace);
+}
+
+template<typename scalar_t, typename index_t>
+void multiply_by_AT_dualtree_cpu_kernel_launcher(
+        const scalar_t* points,        // [N, 3]
+        const scalar_t* point_width,   // [N,]
+        const scalar_t* point_attrs,   // [N, C]
+        const index_t* node2point_index,
+        const index_t* node2point_indexstart,
+        const index_t* node_children_list,
+        const scalar_t* node_attrs,
+        const bool* node_is_leaf_list,
+        const scalar_t* node_half_w_list,
+        const scalar_t* node_reppoints,
+        const index_t* num_points_in_node,
+        scalar_t* out_attrs,           // [N, 3]
+        signedindex_t num_nodes,
+        scalar_t theta,
+        const TreeTraversalCache<scalar_t>* traversal_cache,
+        TraversalWorkspace<scalar_t>* workspace) {
+    DualTreeOpAT<scalar_t> op{node_attrs};
+    dual_tree_cpu_kernel_launcher<scalar_t>(op, points, point_width, point_attrs, node2point_index, node2point_indexstart,
+        node_children_list, node_is_leaf_list, node_half_w_list, node_reppoints, num_points_in_node, out_attrs, num_nodes, true, theta, traversal_cache, workspace);
+}
+
+template<typename scalar_t, typename index_t>
+void multiply_by_G_dualtree_cpu_kernel_launcher(
+        const scalar_t* points,        // [N, 3]
+        const scalar_t* point_width,   // [N,]
+        const scalar_t* point_attrs,   // [N, C]
+        const index_t* node2point_index,
+        const index_t* node2point_indexstart,
+        const index_t* node_children_list,
+        const scalar_t* node_attrs,
+        const bool* node_is_leaf_list,
+        const scalar_t* node_half_w_list,
+        const scalar_t* node_reppoints,
+        const index_t* num_points_in_node,
+        scalar_t* out_attrs,           // [N, 3]
+        signedindex_t num_nodes,
+        scalar_t theta,
+        const TreeTraversalCache<scalar_t>* traversal_cache,
+        TraversalWorkspace<scalar_t>* workspace) {
+    DualTreeOpG<scalar_t> op{node_attrs};
+    dual_tree_cpu_kernel_launcher<scalar_t>(op, points, point_width, point_attrs, node2point_index, node2point_indexstart,
+        node_children_list, node_is_leaf_list, node_half_w_list, node_reppoints, num_points_in_node, out_attrs, num_nodes, true, theta, traversal_cache, workspace);
+}
+
+
+//////////////////////////////////
+/// @brief fused operators
+
+bool add_fused_operator(FusedOperators& fused_ops, FusedOperatorKind kind) {
+    if (fused_ops.num_ops >= MAX_FUSED_OPERATORS) {
+        return false;
+    }
+    fused_ops.kinds[fused_ops.num_ops] = kind;
+    fused_ops.attr_offsets[fused_ops.num_ops] = fused_ops.attr_dim;
+    fused_ops.out_offsets[fused_ops.num_ops] = fused_ops.out_dim;
+    fused_ops.attr_dim += (kind == FUSED_OP_AT) ? 1 : SPATIAL_DIM;
+    fused_ops.out_dim += (kind == FUSED_OP_A) ? 1 : SPATIAL_DIM;
+    fused_ops.num_ops++;
+    return true;
+}
+
+bool has_fused_operator(const FusedOperators& fused_ops, FusedOperatorKind kind) {
+    for (signedindex_t k = 0; k < fused_ops.num_ops; k++) {
+        if (fused_ops.kinds[k] == kind) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/// @brief the far-field terms of every operator for one node, sharing the distance computation,
+//         same arithmetic as eval_A_mu / eval_AT_s_add_ / eval_G_mu_add_ (diff = x - y)
+template<typename scalar_t>
+void eval_fused_add_(scalar_t* out, const scalar_t* diff, const scalar_t* attrs, const FusedOperators& fused_ops, scalar_t smooth_width, bool continuous_kernel) {
+    scalar_t dist2 = 0.0;
+    for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+        dist2 += (diff[d] * diff[d]); // d^2
+    }
+    scalar_t dist = sqrt(dist2);  // d
+    scalar_t dist3 = dist * dist2;
+    scalar_t dist5 = dist2 * dist3;
+    bool outside_smoothing = (dist >= smooth_width);
+    if (!outside_smoothing && !continuous_kernel) {
+        return;
+    }
+
+    for (signedindex_t k = 0; k < fused_ops.num_ops; k++) {
+        const scalar_t* op_attrs = attrs + fused_ops.attr_offsets[k];
+        scalar_t* op_out = out + fused_ops.out_offsets[k];
+        if (fused_ops.kinds[k] == FUSED_OP_A) {
+            scalar_t denominator = outside_smoothing ? dist3 : smooth_width * smooth_width * smooth_width;
+            scalar_t result = 0.0;
+            for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+                result += (-1 * diff[d] * op_attrs[d]) / denominator;
+            }
+            *op_out += result;
+        } else if (!outside_smoothing) {
+            // AT and G have no smoothed kernel
+            continue;
+        } else if (fused_ops.kinds[k] == FUSED_OP_AT) {
+            for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+                op_out[d] += (diff[d] * op_attrs[0]) / dist3;
+            }
+        } else {
+            scalar_t diff_dot_mu = inner_prod<scalar_t>(diff, op_attrs, SPATIAL_DIM);
+            for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+                op_out[d] += (op_attrs[d] / dist3 - 3 * diff[d] * diff_dot_mu / dist5);
+            }
+        }
+    }
+}
+
+
+template<typename scalar_t>
+void multiply_fused_cpu_kernel(
+        const FusedOperators& fused_ops,
+        const scalar_t* query_points,  // [N', 3]
+        const scalar_t* query_width,   // [N',]
+        const PointsSoA<scalar_t>& points_soa,  // [N,] per column, in tree order
+        const PackedNode<scalar_t>* packed_nodes,  // see pack_tree_nodes_cpu
+        const scalar_t* node_attrs,    // [num_nodes, C_total]
+        const scalar_t* node_bboxes,   // [num_nodes, 6] or nullptr, see node_inside_smoothing_width
+        scalar_t* out_attrs,           // [N', D_total]
+        signedindex_t num_queries,
+        signedindex_t query_index,
+        bool continuous_kernel
+    ) {
+    if (query_index < num_queries) {
+        const scalar_t* query_point = query_points + query_index*SPATIAL_DIM;
+        scalar_t out_vals[SPATIAL_DIM*MAX_FUSED_OPERATORS] = {};
+
+        // near-field leaves are collected once, and every operator reads its columns of the block
+        auto eval_near_block = [&](NearFieldBlock<scalar_t>& block) {
+            for (signedindex_t k = 0; k < fused_ops.num_ops; k++) {
+                block.attr_offset = fused_ops.attr_offsets[k];
+                scalar_t* op_out = out_vals + fused_ops.out_offsets[k];
+                if (fused_ops.kinds[k] == FUSED_OP_A) {
+                    eval_A_mu_block_add_<scalar_t>(*op_out, query_point, query_width[query_index], continuous_kernel, block);
+                } else if (fused_ops.kinds[k] == FUSED_OP_AT) {
+                    eval_AT_s_block_add_<scalar_t>(op_out, query_point, query_width[query_index], block);
+                } else {
+                    eval_G_mu_block_add_<scalar_t>(op_out, query_point, query_width[query_index], block);
+                }
+            }
+            block.attr_offset = 0;
+        };
+        NearFieldBlock<scalar_t> near_block;
+
+        // a forward walk over the packed nodes, the root's subtree is all of them
+        const signedindex_t packed_end = packed_nodes[0].skip;
+        signedindex_t packed_index = 0;
+        while (packed_index < packed_end) {
+            const signedindex_t cur_packed_index = packed_index;
+            const PackedNode<scalar_t>& cur_node = packed_nodes[cur_packed_index];
+            // past its subtree, unless it is a nonleaf opened below
+            packed_index = cur_node.skip;
+            const signedindex_t cur_node_index = cur_node.node_index;
+
+            scalar_t point2node_dist2 = get_point2point_dist2(query_point, cur_node.reppoint);
+
+            /// @case 1: the query point is far from the sample, approximate the query value with the node center
+            if (point2node_dist2 > cur_node.far_dist2) {
+                scalar_t diff[SPATIAL_DIM];     // x - y
+                subtract_vec<scalar_t>(diff, query_point, cur_node.reppoint, SPATIAL_DIM);
+                eval_fused_add_<scalar_t>(out_vals, diff, node_attrs + cur_node_index*fused_ops.attr_dim, fused_ops, query_width[query_index], continuous_kernel);
+            } else if (node_inside_smoothing_width<scalar_t>(query_point, point2node_dist2, node_bboxes, cur_node_index, query_width[query_index])) {
+                /// @case 2: every point of the node is within the smoothing width, where the kernel vanishes, cull it
+            } else {
+                /// @case 3: the query point is not that far,
+                //           if nonleaf, step into its subtree, to its first child
+                if (cur_node.num_points < 0) {
+                    packed_index = cur_packed_index + 1;
+                } else {  /// @case 4: this node is a leaf node, compute over samples
+                    add_leaf_to_near_field_block<scalar_t>(points_soa, cur_node.first_point, cur_node.first_point + cur_node.num_points, near_block, eval_near_block);
+                }
+            }
+        }
+        if (near_block.num_points > 0) {
+            eval_near_block(near_block);
+        }
+        assign_vec<scalar_t>(out_attrs + query_index*fused_ops.out_dim, out_vals, fused_ops.out_dim);
+    }
+}
+
+
+template<typename scalar_t, typename index_t>
+void multiply_fused_cpu_kernel_launcher(
+        const FusedOperators& fused_ops,
+        const scalar_t* query_points,  // [N', 3]
+        const scalar_t* query_width,   // [N',]
+        const scalar_t* points,        // [N, 3]
+        const scalar_t* point_attrs,   // [N, C_total]
+        const index_t* node2point_index,
+        const index_t* node2point_indexstart,
+        const index_t* node_children_list,
+        const scalar_t* node_attrs,    // [num_nodes, C_total]
+        const bool* node_is_leaf_list,
+        const scalar_t* node_half_w_list,
+        const scalar_t* node_reppoints,
+        const index_t* num_points_in_node,
+        scalar_t* out_attrs,           // [N', D_total]
+        signedindex_t num_queries,
+        bool continuous_kernel,
+        scalar_t theta,
+        const TreeTraversalCache<scalar_t>* traversal_cache,
+        TraversalWorkspace<scalar_t>* workspace) {
+
+    // the root holds every point
+    TraversalWorkspace<scalar_t> own_workspace;   // without one of the caller
+    TraversalWorkspace<scalar_t>& launch_workspace = workspace ? *workspace : own_workspace;
+    const PointsSoA<scalar_t>& points_soa = gather_workspace_points_cpu<scalar_t>(points, point_attrs, node2point_index, num_points_in_node[0], fused_ops.attr_dim, launch_workspace);
+    const scalar_t* cull_bboxes = compute_node_bounds_cpu<scalar_t>(points, node_children_list, node_is_leaf_list, node2point_index, node2point_indexstart, num_points_in_node,
+                                                                    node_half_w_list, node_reppoints, !(continuous_kernel && has_fused_operator(fused_ops, FUSED_OP_A)), theta, traversal_cache, launch_workspace);
+    pack_tree_nodes_cpu<scalar_t>(node_children_list, node_is_leaf_list, node2point_indexstart, num_points_in_node, node_reppoints, traversal_cache, launch_workspace);
+    run_query_loop_cpu<scalar_t>(
+        query_points,
+        nullptr,
+        node_children_list,
+        node_is_leaf_list,
+        num_points_in_node,
+        num_queries,
+        &launch_workspace,
+        [&](signedindex_t query_index) {
+            multiply_fused_cpu_kernel<scalar_t>(
+                fused_ops,
+                query_points,
+                query_width,
+                points_soa,
+                launch_workspace.packed_nodes.data(),
+                node_attrs,
+                cull_bboxes,
+                out_attrs,
+                num_queries,
+                query_index,
+                continuous_kernel);
+        });
+}
+
+
+/// @brief symmetric dual-tree evaluation of A and AT at the points of the tree, see multiply_fused_A_AT_dualtree_cpu_kernel_launcher
+
+// a far (target, source) pair of the symmetric traversal
+struct DualTreeFarPair {
+    signedindex_t target;
+    signedindex_t source;
+    DualTreeFarKind kind;
+};
+
+/// @brief one unordered pair {root_a, root_b} of target subtrees: every pair of nodes is tested in both directions,
+//         it is far if both directions are, and a pair of leaves that is not far is summed exactly afterwards, once for both directions
+template<typename scalar_t, typename index_t>
+void symmetric_dual_tree_cpu_kernel(
+        const index_t* node_children_list,
+        const bool* node_is_leaf_list,
+        const scalar_t* node_reppoints,
+        const index_t* num_points_in_node,
+        const DualTreeGeometry<scalar_t>& geometry,
+        signedindex_t root_a,
+        signedindex_t root_b,
+        scalar_t theta,
+        std::vector<DualTreeFarPair>* far_pairs,    // [2], the far pairs with a target under root_a, and under root_b
+        std::vector<std::pair<signedindex_t, signedindex_t>>& near_pairs) {     // leaf pairs, (leaf, leaf) within a leaf
+
+    // node_a stays under root_a and node_b under root_b
+
+    std::vector<std::pair<signedindex_t, signedindex_t>> pair_stack = {{root_a, root_b}};
+    while (!pair_stack.empty()) {
+        signedindex_t node_a = pair_stack.back().first;
+        signedindex_t node_b = pair_stack.back().second;
+        pair_stack.pop_back();
+
+        /// @case 1: the interactions within a node, those of the pairs of its children
+        if (node_a == node_b) {
+            if (node_is_leaf_list[node_a]) {
+                near_pairs.emplace_back(node_a, node_a);
+                continue;
+            }
+            for (signedindex_t k = 0; k < NUM_OCT_CHILDREN; k++) {
+                signedindex_t child_k = node_children_list[node_a*NUM_OCT_CHILDREN + k];
+                if (child_k == -1) {
+                    continue;
+                }
+                for (signedindex_t l = k; l < NUM_OCT_CHILDREN; l++) {
+                    signedindex_t child_l = node_children_list[node_a*NUM_OCT_CHILDREN + l];
+                    if (child_l != -1) {
+                        pair_stack.emplace_back(child_k, child_l);
+                    }
+                }
+            }
+            continue;
+        }
+        /// @case 2: far in both directions
+        scalar_t r[SPATIAL_DIM];
+        DualTreeFarKind kind_ab = classify_dual_tree_pair<scalar_t>(geometry, node_is_leaf_list, num_points_in_node, node_reppoints, node_a, node_b, theta, r);
+        DualTreeFarKind kind_ba = (kind_ab == DUAL_TREE_NOT_FAR) ? DUAL_TREE_NOT_FAR :
+                                  classify_dual_tree_pair<scalar_t>(geometry, node_is_leaf_list, num_points_in_node, node_reppoints, node_b, node_a, theta, r);
+        if (kind_ba != DUAL_TREE_NOT_FAR) {
+            far_pairs[0].push_back({node_a, node_b, kind_ab});
+            far_pairs[root_a == root_b ? 0 : 1].push_back({node_b, node_a, kind_ba});
+            continue;
+        }
+        /// @case 3: two near leaves
+        if (node_is_leaf_list[node_a] && node_is_leaf_list[node_b]) {
+            near_pairs.emplace_back(node_a, node_b);
+            continue;
+        }
+        /// @case 4: split the larger node
+        bool split_a = !node_is_leaf_list[node_a] && (node_is_leaf_list[node_b] || geometry.radii[node_a] >= geometry.radii[node_b]);
+        signedindex_t split_node = split_a ? node_a : node_b;
+        for (signedindex_t k = 0; k < NUM_OCT_CHILDREN; k++) {
+            signedindex_t child_index = node_children_list[split_node*NUM_OCT_CHILDREN + k];
+            if (child_index != -1) {
+                pair_stack.emplace_back(split_a ? child_index : node_a, split_a ? node_b : child_index);
+            }
+        }
+    }
+}
+
+/// @brief the top of the symmetric traversal: the pairs of nodes are tested as in symmetric_dual_tree_cpu_kernel from (root, root),
+//         but only the nodes above the target roots are split, so that it stops at the pairs of target roots it reaches,
+//         the tasks of symmetric_dual_tree_cpu_kernel. A far pair found on the way is kept with its target,
+//         by target root, or in top_far_pairs for a target above the target roots
+template<typename scalar_t, typename index_t>
+void split_symmetric_dual_tree_tasks(
+        const index_t* node_children_list,
+        const bool* node_is_leaf_list,
+        const scalar_t* node_reppoints,
+        const index_t* num_points_in_node,
+        const DualTreeGeometry<scalar_t>& geometry,
+        const signedindex_t* target_root_index,     // [num_nodes,], index in the target roots, -1 for the other nodes
+        scalar_t theta,
+        std::vector<std::pair<signedindex_t, signedindex_t>>& task_roots,    // unordered pairs of target roots
+        std::vector<std::vector<DualTreeFarPair>>& root_far_pairs,         // [num_target_roots], far pairs with a target root as target
+        std::vector<DualTreeFarPair>& top_far_pairs) {
+
+    // the nodes met here are target roots, or above them (-1): nonleaves, whose children are met next
+    std::vector<std::pair<signedindex_t, signedindex_t>> pair_stack = {{0, 0}};
+    while (!pair_stack.empty()) {
+        signedindex_t node_a = pair_stack.back().first;
+        signedindex_t node_b = pair_stack.back().second;
+        pair_stack.pop_back();
+        const bool top_a = (target_root_index[node_a] == -1);
+        const bool top_b = (target_root_index[node_b] == -1);
+
+        /// @case 1: two target roots, or one with itself
+        if (!top_a && !top_b) {
+            task_roots.emplace_back(node_a, node_b);
+            continue;
+        }
+        /// @case 2: the interactions within a node above the target roots
+        if (node_a == node_b) {
+            for (signedindex_t k = 0; k < NUM_OCT_CHILDREN; k++) {
+                signedindex_t child_k = node_children_list[node_a*NUM_OCT_CHILDREN + k];
+                if (child_k == -1) {
+                    continue;
+                }
+                for (signedindex_t l = k; l < NUM_OCT_CHILDREN; l++) {
+                    signedindex_t child_l = node_children_list[node_a*NUM_OCT_CHILDREN + l];
+                    if (child_l != -1) {
+                        pair_stack.emplace_back(child_k, child_l);
+                    }
+                }
+            }
+            continue;
+        }
+        /// @case 3: far in both directions
+        scalar_t r[SPATIAL_DIM];
+        DualTreeFarKind kind_ab = classify_dual_tree_pair<scalar_t>(geometry, node_is_leaf_list, num_points_in_node, node_reppoints, node_a, node_b, theta, r);
+        DualTreeFarKind kind_ba = (kind_ab == DUAL_TREE_NOT_FAR) ? DUAL_TREE_NOT_FAR :
+                                  classify_dual_tree_pair<scalar_t>(geometry, node_is_leaf_list, num_points_in_node, node_reppoints, node_b, node_a, theta, r);
+        if (kind_ba != DUAL_TREE_NOT_FAR) {
+            (top_a ? top_far_pairs : root_far_pairs[target_root_index[node_a]]).push_back({node_a, node_b, kind_ab});
+            (top_b ? top_far_pairs : root_far_pairs[target_root_index[node_b]]).push_back({node_b, node_a, kind_ba});
+            continue;
+        }
+        /// @case 4: split the larger node above the target roots
+        bool split_a = top_a && (!top_b || geometry.radii[node_a] >= geometry.radii[node_b]);
+        signedindex_t split_node = split_a ? node_a : node_b;
+        for (signedindex_t k = 0; k < NUM_OCT_CHILDREN; k++) {
+            signedindex_t child_index = node_children_list[split_node*NUM_OCT_CHILDREN + k];
+            if (child_index != -1) {
+                pair_stack.emplace_back(split_a ? child_index : node_a, split_a ? node_b : child_index);
+            }
+        }
+    }
+}
+
+/// @brief greedy coloring of pairs of items (e.g. the pairs of target roots of the symmetric traversal tasks):
+//         no two pairs of a color share an item, so the pairs of a color can write to their items in parallel.
+//         The pairs are listed by color, in their order within a color
+void color_item_pairs_cpu(
+        const std::vector<std::pair<signedindex_t, signedindex_t>>& item_pairs,   // items in [0, num_items)
+        signedindex_t num_items,
+        std::vector<signedindex_t>& out_colored_pairs,      // [num_pairs,], the pair indices, by color
+        std::vector<signedindex_t>& out_color_offsets) {    // [num_colors+1,], color c is out_colored_pairs[offsets[c]:offsets[c+1]]
+    const signedindex_t num_pairs = item_pairs.size();
+    // the colors of the pairs of every item so far, a bit per color, 64 colors per word; more words only for items with more pairs
+    signedindex_t num_words = 1;
+    std::vector<uint64_t> used_colors(num_items, 0);
+    std::vector<signedindex_t> pair_colors(num_pairs);
+    signedindex_t num_colors = 0;
+    for (signedindex_t i = 0; i < num_pairs; i++) {
+        const signedindex_t item_a = item_pairs[i].first;
+        const signedindex_t item_b = item_pairs[i].second;
+        signedindex_t word = 0;
+        uint64_t free_colors = 0;
+        while (true) {
+            if (word == num_words) {
+                std::vector<uint64_t> widened(num_items*(num_words + 1), 0);
+                for (signedindex_t item = 0; item < num_items; item++) {
+                    std::copy(used_colors.begin() + item*num_words, used_colors.begin() + (item + 1)*num_words, widened.begin() + item*(num_words + 1));
+                }
+                used_colors.swap(widened);
+                num_words++;
+            }
+            free_colors = ~(used_colors[item_a*num_words + word] | used_colors[item_b*num_words + word]);
+            if (free_colors != 0) {
+                break;
+            }
+            word++;
+        }
+        signedindex_t bit = 0;
+        while (((free_colors >> bit) & 1) == 0) {
+            bit++;
+        }
+        used_colors[item_a*num_words + word] |= uint64_t(1) << bit;
+        used_colors[item_b*num_words + word] |= uint64_t(1) << bit;
+        pair_colors[i] = word*64 + bit;
+        num_colors = std::max(num_colors, pair_colors[i] + 1);
+    }
+
+    out_color_offsets.assign(num_colors + 1, 0);
+    for (signedindex_t i = 0; i < num_pairs; i++) {
+        out_color_offsets[pair_colors[i] + 1]++;
+    }
+    for (signedindex_t color = 0; color < num_colors; color++) {
+        out_color_offsets[color + 1] += out_color_offsets[color];
+    }
+    std::vector<signedindex_t> next_slot(out_color_offsets.begin(), out_color_offsets.end() - 1);
+    out_colored_pairs.resize(num_pairs);
+    for (signedindex_t i = 0; i < num_pairs; i++) {
+        out_colored_pairs[next_slot[pair_colors[i]]++] = i;
+    }
+}
+
+/// @brief A and AT of two leaves on each other, or of the points of one leaf on each other (first_a == first_b),
+//         every point pair shares its distance and is visited once for the four terms;
+//         same terms as eval_A_mu_block_add_ / eval_AT_s_block_add_ (diff = x - y, nothing within the width of the query but the smoothed A)
+template<typename scalar_t>
+void eval_A_AT_leaf_pair_cpu(
+        const PointsSoA<scalar_t>& points_soa,  // [N,] per column, in tree order
+        const scalar_t* sorted_widths,          // [N,], in tree order
+        signedindex_t mu_offset,                // the columns of mu and s in points_soa.attrs
+        signedindex_t s_offset,
+        signedindex_t first_a,
+        signedindex_t num_a,
+        signedindex_t first_b,
+        signedindex_t num_b,
+        bool continuous_kernel,
+        scalar_t* out_A,                        // [N,], in tree order
+        scalar_t* out_AT) {                     // [3, N], in tree order
+    const signedindex_t num_points = points_soa.coords[0].size();
+    const scalar_t* x = points_soa.coords[0].data();
+    const scalar_t* y = points_soa.coords[1].data();
+    const scalar_t* z = points_soa.coords[2].data();
+    const scalar_t* mu_x = points_soa.attrs[mu_offset].data();
+    const scalar_t* mu_y = points_soa.attrs[mu_offset + 1].data();
+    const scalar_t* mu_z = points_soa.attrs[mu_offset + 2].data();
+    const scalar_t* s = points_soa.attrs[s_offset].data();
+    scalar_t* out_AT_x = out_AT;
+    scalar_t* out_AT_y = out_AT + num_points;
+    scalar_t* out_AT_z = out_AT + 2*num_points;
+    // the smoothed A kernel inside the width, 0 if not continuous_kernel
+    const scalar_t inside_scale = continuous_kernel ? scalar_t(1) : scalar_t(0);
+
+    for (signedindex_t i = first_a; i < first_a + num_a; i++) {
+        const scalar_t width_i = sorted_widths[i];
+        const scalar_t inv_width3_i = inside_scale / (width_i * width_i * width_i);
+        scalar_t A_i = 0, AT_x_i = 0, AT_y_i = 0, AT_z_i = 0;
+        // without branches, the terms within the widths are selected away
+        #pragma omp simd reduction(+:A_i, AT_x_i, AT_y_i, AT_z_i)
+        for (signedindex_t j = (first_a == first_b) ? i + 1 : first_b; j < first_b + num_b; j++) {
+            scalar_t diff_x = x[i] - x[j], diff_y = y[i] - y[j], diff_z = z[i] - z[j];     // x_i - x_j
+            scalar_t dist2 = diff_x * diff_x + diff_y * diff_y + diff_z * diff_z;
+            scalar_t dist = std::sqrt(dist2);
+            scalar_t inv_dist3 = scalar_t(1) / (dist * dist2);
+            const scalar_t width_j = sorted_widths[j];
+            scalar_t outside_i = (dist >= width_i) ? inv_dist3 : scalar_t(0);
+            scalar_t outside_j = (dist >= width_j) ? inv_dist3 : scalar_t(0);
+            scalar_t A_scale_i = (dist >= width_i) ? inv_dist3 : inv_width3_i;
+            scalar_t A_scale_j = (dist >= width_j) ? inv_dist3 : inside_scale / (width_j * width_j * width_j);
+
+            // i from j
+            A_i -= (diff_x * mu_x[j] + diff_y * mu_y[j] + diff_z * mu_z[j]) * A_scale_i;
+            AT_x_i += diff_x * s[j] * outside_i;
+            AT_y_i += diff_y * s[j] * outside_i;
+            AT_z_i += diff_z * s[j] * outside_i;
+            // j from i, with x_j - x_i = -diff
+            out_A[j] += (diff_x * mu_x[i] + diff_y * mu_y[i] + diff_z * mu_z[i]) * A_scale_j;
+            out_AT_x[j] -= diff_x * s[i] * outside_j;
+            out_AT_y[j] -= diff_y * s[i] * outside_j;
+            out_AT_z[j] -= diff_z * s[i] * outside_j;
+        }
+        out_A[i] += A_i;
+        out_AT_x[i] += AT_x_i;
+        out_AT_y[i] += AT_y_i;
+        out_AT_z[i] += AT_z_i;
+    }
+}
+
+
+template<typename scalar_t, typename index_t>
+void multiply_fused_A_AT_dualtree_cpu_kernel_launcher(
+        const FusedOperators& fused_ops,
+        const scalar_t* points,        // [N, 3]
+        const scalar_t* point_width,   // [N,]
+        const scalar_t* point_attrs,   // [N, C_total]
+        const index_t* node2point_index,
+        const index_t* node2point_indexstart,
+        const index_t* node_children_list,
+        const scalar_t* node_attrs,    // [num_nodes, C_total]
+        const bool* node_is_leaf_list,
+        const scalar_t* node_half_w_list,
+        const scalar_t* node_reppoints,
+        const index_t* num_points_in_node,
+        scalar_t* out_attrs,           // [N, D_total]
+        signedindex_t num_nodes,
+        bool continuous_kernel,
+        scalar_t theta,
+        const TreeTraversalCache<scalar_t>* traversal_cache,
+        TraversalWorkspace<scalar_t>* workspace) {
+
+    const signedindex_t op_A = (fused_ops.kinds[0] == FUSED_OP_A) ? 0 : 1;
+    const signedindex_t op_AT = 1 - op_A;
+    assert(fused_ops.num_ops == 2 && fused_ops.kinds[op_A] == FUSED_OP_A && fused_ops.kinds[op_AT] == FUSED_OP_AT);
+    const signedindex_t num_points = num_points_in_node[0];   // the root holds every point
+
+    // the node attributes of each operator, for the local expansions
+    std::vector<scalar_t> node_mu(num_nodes*SPATIAL_DIM), node_s(num_nodes);
+    for (signedindex_t node_index = 0; node_index < num_nodes; node_index++) {
+        assign_vec<scalar_t>(node_mu.data() + node_index*SPATIAL_DIM, node_attrs + node_index*fused_ops.attr_dim + fused_ops.attr_offsets[op_A], SPATIAL_DIM);
+        node_s[node_index] = node_attrs[node_index*fused_ops.attr_dim + fused_ops.attr_offsets[op_AT]];
+    }
+    DualTreeOpA<scalar_t> op_a{node_mu.data(), continuous_kernel};
+    DualTreeOpAT<scalar_t> op_at{node_s.data()};
+
+    TraversalWorkspace<scalar_t> own_workspace;   // without one of the caller
+    const PointsSoA<scalar_t>& points_soa = gather_workspace_points_cpu<scalar_t>(points, point_attrs, node2point_index, num_points, fused_ops.attr_dim,
+                                                                                  workspace ? *workspace : own_workspace);
+    std::vector<scalar_t> sorted_widths(num_points);
+    for (signedindex_t i = 0; i < num_points; i++) {
+        sorted_widths[i] = point_width[node2point_index[i]];
+    }
+
+    DualTreeGeometry<scalar_t> geometry;
+    compute_dual_tree_geometry_cpu<scalar_t>(points, point_width, node2point_index, node2point_indexstart, node_children_list, node_is_leaf_list,
+                                             node_half_w_list, node_reppoints, num_points_in_node, num_nodes, traversal_cache, geometry);
+    const signedindex_t num_threads = prepare_parallel_launch();
+    std::vector<signedindex_t> target_roots;
+    split_dual_tree_target_roots(node_children_list, node_is_leaf_list, num_threads, target_roots);
+    const signedindex_t num_target_roots = target_roots.size();
+    std::vector<signedindex_t> target_root_index(num_nodes, -1);
+    for (signedindex_t i = 0; i < num_target_roots; i++) {
+        target_root_index[target_roots[i]] = i;
+    }
+
+    // traversal, from (root, root) down to the pairs of target subtrees it reaches, then one task per such pair;
+    // the far pairs found are kept by target root, in task order
+    std::vector<std::pair<signedindex_t, signedindex_t>> task_roots;
+    std::vector<std::vector<DualTreeFarPair>> root_far_pairs(num_target_roots);
+    std::vector<DualTreeFarPair> top_far_pairs;
+    split_symmetric_dual_tree_tasks<scalar_t>(node_children_list, node_is_leaf_list, node_reppoints, num_points_in_node, geometry,
+                                              target_root_index.data(), theta, task_roots, root_far_pairs, top_far_pairs);
+    const signedindex_t num_tasks = task_roots.size();
+    std::vector<std::vector<DualTreeFarPair>> task_far_pairs(2*num_tasks);
+    std::vector<std::vector<std::pair<signedindex_t, signedindex_t>>> task_near_pairs(num_tasks);
+    #pragma omp parallel for num_threads(num_threads) schedule(dynamic, 1)
+    for (signedindex_t i = 0; i < num_tasks; i++) {
+        symmetric_dual_tree_cpu_kernel<scalar_t>(node_children_list, node_is_leaf_list, node_reppoints, num_points_in_node, geometry,
+                                                 task_roots[i].first, task_roots[i].second, theta,
+                                                 task_far_pairs.data() + 2*i, task_near_pairs[i]);
+    }
+    std::vector<std::vector<const std::vector<DualTreeFarPair>*>> root_far_lists(num_target_roots);
+    for (signedindex_t i = 0; i < num_target_roots; i++) {
+        root_far_lists[i].push_back(&root_far_pairs[i]);
+    }
+    for (signedindex_t i = 0; i < num_tasks; i++) {
+        root_far_lists[target_root_index[task_roots[i].first]].push_back(&task_far_pairs[2*i]);
+        if (task_roots[i].first != task_roots[i].second) {
+            root_far_lists[target_root_index[task_roots[i].second]].push_back(&task_far_pairs[2*i + 1]);
+        }
+    }
+
+    // far field. Both operators share the distances (eval_fused_add_ with the fused node attributes), and the local expansions,
+    // which are laid out as the outputs [num_nodes, D_total, LOCAL_EXPANSION_SIZE] and passed down to out_attrs directly
+    std::fill(out_attrs, out_attrs + num_points*fused_ops.out_dim, scalar_t(0));
+    std::vector<scalar_t> node_locals(num_nodes*fused_ops.out_dim*LOCAL_EXPANSION_SIZE, scalar_t(0));
+    auto eval_far_pair = [&](const DualTreeFarPair& far_pair) {
+        const scalar_t* source_attrs = node_attrs + far_pair.source*fused_ops.attr_dim;
+        if (far_pair.kind == DUAL_TREE_FAR_POINTS) {
+            for (signedindex_t k = 0; k < num_points_in_node[far_pair.target]; k++) {
+                signedindex_t point_index = node2point_index[node2point_indexstart[far_pair.target] + k];
+                scalar_t diff[SPATIAL_DIM];     // x - y
+                subtract_vec<scalar_t>(diff, points + point_index*SPATIAL_DIM, node_reppoints + far_pair.source*SPATIAL_DIM, SPATIAL_DIM);
+                eval_fused_add_<scalar_t>(out_attrs + point_index*fused_ops.out_dim, diff, source_attrs, fused_ops, point_width[point_index], continuous_kernel);
+            }
+        } else {
+            scalar_t r[SPATIAL_DIM];     // target center - source reppoint
+            subtract_vec<scalar_t>(r, geometry.centers.data() + far_pair.target*SPATIAL_DIM, node_reppoints + far_pair.source*SPATIAL_DIM, SPATIAL_DIM);
+            scalar_t* local = node_locals.data() + far_pair.target*fused_ops.out_dim*LOCAL_EXPANSION_SIZE;
+            op_a.eval_local(local + fused_ops.out_offsets[op_A]*LOCAL_EXPANSION_SIZE, r, far_pair.source);
+            op_at.eval_local(local + fused_ops.out_offsets[op_AT]*LOCAL_EXPANSION_SIZE, r, far_pair.source);
+        }
+    };
+    // the targets above the target roots, their local expansions shifted down to the target roots
+    for (const DualTreeFarPair& far_pair : top_far_pairs) {
+        eval_far_pair(far_pair);
+    }
+    std::vector<signedindex_t> node_stack = {0};
+    while (!node_stack.empty()) {
+        signedindex_t node_index = node_stack.back();
+        node_stack.pop_back();
+        if (target_root_index[node_index] != -1) {
+            continue;
+        }
+        for (signedindex_t k = 0; k < NUM_OCT_CHILDREN; k++) {
+            signedindex_t child_index = node_children_list[node_index*NUM_OCT_CHILDREN + k];
+            if (child_index != -1) {
+                scalar_t t[SPATIAL_DIM];
+                subtract_vec<scalar_t>(t, geometry.centers.data() + child_index*SPATIAL_DIM, geometry.centers.data() + node_index*SPATIAL_DIM, SPATIAL_DIM);
+                for (signedindex_t e = 0; e < fused_ops.out_dim; e++) {
+                    shift_local_expansion_add_<scalar_t>(node_locals.data() + (child_index*fused_ops.out_dim + e)*LOCAL_EXPANSION_SIZE,
+                                                         node_locals.data() + (node_index*fused_ops.out_dim + e)*LOCAL_EXPANSION_SIZE, t);
+                }
+                node_stack.push_back(child_index);
+            }
+        }
+    }
+    // by target subtree: every target node and point below is written by the thread of its subtree only
+    #pragma omp parallel for num_threads(num_threads) schedule(dynamic, 1)
+    for (signedindex_t i = 0; i < num_target_roots; i++) {
+        for (const std::vector<DualTreeFarPair>* far_pairs : root_far_lists[i]) {
+            for (const DualTreeFarPair& far_pair : *far_pairs) {
+                eval_far_pair(far_pair);
+            }
+        }
+        eval_dual_tree_locals_cpu<scalar_t>(points, node2point_index, node2point_indexstart, node_children_list, node_is_leaf_list, num_points_in_node,
+                                            geometry.centers.data(), node_locals.data(), out_attrs, fused_ops.out_dim, target_roots[i]);
+    }
+    std::vector<std::vector<DualTreeFarPair>>().swap(task_far_pairs);
+    std::vector<std::vector<DualTreeFarPair>>().swap(root_far_pairs);
+
+    // near field, both leaves of a pair write, to the points of the two target subtrees of its task: the tasks are colored
+    // so that no two tasks of a color share a target root, and those of a color sum into one [4, N] buffer in tree order in parallel,
+    // the colors one after the other. Every point gets its terms in the same order whatever the schedule,
+    // so the result is deterministic for a given number of threads
+    std::vector<std::pair<signedindex_t, signedindex_t>> task_root_indices(num_tasks);
+    for (signedindex_t i = 0; i < num_tasks; i++) {
+        task_root_indices[i] = {target_root_index[task_roots[i].first], target_root_index[task_roots[i].second]};
+    }
+    std::vector<signedindex_t> colored_tasks, color_offsets;
+    color_item_pairs_cpu(task_root_indices, num_target_roots, colored_tasks, color_offsets);
+    const signedindex_t num_colors = color_offsets.size() - 1;
+    std::vector<scalar_t> near_sums((1 + SPATIAL_DIM) * num_points, scalar_t(0));
+    #pragma omp parallel num_threads(num_threads)
+    for (signedindex_t color = 0; color < num_colors; color++) {
+        #pragma omp for schedule(dynamic, 1)
+        for (signedindex_t i = color_offsets[color]; i < color_offsets[color+1]; i++) {
+            for (const std::pair<signedindex_t, signedindex_t>& near_pair : task_near_pairs[colored_tasks[i]]) {
+                signedindex_t leaf_a = near_pair.first;
+                signedindex_t leaf_b = near_pair.second;
+                eval_A_AT_leaf_pair_cpu<scalar_t>(points_soa, sorted_widths.data(), fused_ops.attr_offsets[op_A], fused_ops.attr_offsets[op_AT],
+                                                  node2point_indexstart[leaf_a], num_points_in_node[leaf_a], node2point_indexstart[leaf_b], num_points_in_node[leaf_b],
+                                                  continuous_kernel, near_sums.data(), near_sums.data() + num_points);
+            }
+        }
+    }
+
+    #pragma omp parallel for num_threads(num_threads) schedule(static)
+    for (signedindex_t i = 0; i < num_points; i++) {
+        signedindex_t point_index = node2point_index[i];
+        out_attrs[point_index*fused_ops.out_dim + fused_ops.out_offsets[op_A]] += near_sums[i];
+        for (signedindex_t c = 0; c < SPATIAL_DIM; c++) {
+            out_attrs[point_index*fused_ops.out_dim + fused_ops.out_offsets[op_AT] + c] += near_sums[(1 + c)*num_points + i];
+        }
+    }
+}
+
+
+//////////////////////////////////
+/// @brief several widths per query
+
+/// @brief the widths of a query sorted in increasing order, and the terms binned by how many of them they pass:
+//         a term at distance dist contributes to the widths <= dist, i.e. to the first m sorted widths,
+//         so it is added to bin m-1 and the bins are summed from the largest width down at the end.
+//         The smoothed A term inside the widths (continuous_kernel) only depends on the width through 1/width^3,
+//         its numerators are binned the other way round, to the widths > dist
+template<typename scalar_t>
+struct WidthBins {
+    std::vector<signedindex_t> order;   // [K,] sorted position -> column
+    std::vector<scalar_t> widths;       // [K,] sorted
+    std::vector<scalar_t> bins;         // [K, out_dim]
+    std::vector<scalar_t> inside_bins;  // [K,], A with continuous_kernel only
+    signedindex_t out_dim = 0;
+
+    void reset(const scalar_t* query_widths, signedindex_t num_widths, signedindex_t out_dim_) {
+        out_dim = out_dim_;
+        order.resize(num_widths);
+        widths.resize(num_widths);
+        bins.assign(num_widths*out_dim, scalar_t(0));
+        inside_bins.assign(num_widths, scalar_t(0));
+        for (signedindex_t k = 0; k < num_widths; k++) {
+            order[k] = k;
+        }
+        std::sort(order.begin(), order.end(), [&](signedindex_t a, signedindex_t b) {
+            return query_widths[a] < query_widths[b];
+        });
+        for (signedindex_t k = 0; k < num_widths; k++) {
+            widths[k] = query_widths[order[k]];
+        }
+    }
+
+    // number of widths <= dist, for which dist >= smooth_width
+    signedindex_t count_passed(scalar_t dist) const {
+        return std::upper_bound(widths.begin(), widths.end(), dist) - widths.begin();
+    }
+
+    // same arithmetic as eval_A_mu (diff = x - y)
+    void add_A_term(const scalar_t* diff, const scalar_t* mu, bool continuous_kernel) {
+        scalar_t dist2 = 0.0;
+        for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+            dist2 += (diff[d] * diff[d]); // d^2
+        }
+        scalar_t dist = sqrt(dist2);  // d
+        scalar_t numerator = 0.0;
+        for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+            numerator += (-1 * diff[d] * mu[d]);
+        }
+        signedindex_t num_passed = count_passed(dist);
+        if (num_passed > 0) {
+            bins[num_passed - 1] += numerator / (dist * dist2);
+        }
+        if (continuous_kernel && num_passed < signedindex_t(widths.size())) {
+            inside_bins[num_passed] += numerator;
+        }
+    }
+
+    // same arithmetic as eval_AT_s_add_ (diff = x - y)
+    void add_AT_term(const scalar_t* diff, scalar_t s) {
+        scalar_t dist2 = 0.0;
+        for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+            dist2 += (diff[d] * diff[d]); // d^2
+        }
+        scalar_t dist = sqrt(dist2);  // d
+        signedindex_t num_passed = count_passed(dist);
+        if (num_passed == 0) {
+            return;
+        }
+        scalar_t denominator = dist * dist2;
+        scalar_t* bin = bins.data() + (num_passed - 1)*SPATIAL_DIM;
+        for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+            bin[d] += (diff[d] * s) / denominator;
+        }
+    }
+
+    // same arithmetic as eval_G_mu_add_ (diff = x - y)
+    void add_G_term(const scalar_t* diff, const scalar_t* mu) {
+        scalar_t dist2 = 0.0;
+        for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+            dist2 += (diff[d] * diff[d]); // d^2
+        }
+        scalar_t dist = sqrt(dist2);  // d
+        signedindex_t num_passed = count_passed(dist);
+        if (num_passed == 0) {
+            return;
+        }
+        scalar_t dist3 = dist * dist2;
+        scalar_t dist5 = dist2 * dist3;
+        scalar_t diff_dot_mu = inner_prod<scalar_t>(diff, mu, SPATIAL_DIM);
+        scalar_t* bin = bins.data() + (num_passed - 1)*SPATIAL_DIM;
+        for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+            bin[d] += (mu[d] / dist3 - 3 * diff[d] * diff_dot_mu / dist5);
+        }
+    }
+
+    void write(scalar_t* out) {   // [K, out_dim]
+        signedindex_t num_widths = widths.size();
+        for (signedindex_t k = num_widths - 2; k >= 0; k--) {
+            for (signedindex_t c = 0; c < out_dim; c++) {
+                bins[k*out_dim + c] += bins[(k+1)*out_dim + c];
+            }
+        }
+        for (signedindex_t k = 1; k < num_widths; k++) {
+            inside_bins[k] += inside_bins[k-1];
+        }
+        for (signedindex_t k = 0; k < num_widths; k++) {
+            for (signedindex_t c = 0; c < out_dim; c++) {
+                out[order[k]*out_dim + c] = bins[k*out_dim + c];
+            }
+            if (inside_bins[k] != 0) {
+                out[order[k]*out_dim] += inside_bins[k] / (widths[k] * widths[k] * widths[k]);
+            }
+        }
+    }
+};
+
+
+template<typename scalar_t, FusedOperatorKind kind>
+void multiply_multiwidth_cpu_kernel(
+        const scalar_t* query_points,  // [N', 3]
+        const scalar_t* query_widths,  // [N', K]
+        signedindex_t num_widths,
+        const PointsSoA<scalar_t>& points_soa,  // [N,] per component, in tree order
+        const PackedNode<scalar_t>* packed_nodes,  // see pack_tree_nodes_cpu
+        const scalar_t* node_attrs,    // [num_nodes, C]
+        const scalar_t* node_bboxes,   // [num_nodes, 6] or nullptr, see node_inside_smoothing_width
+        scalar_t* out_attrs,           // [N', K, D]
+        signedindex_t num_queries,
+        signedindex_t query_index,
+        bool continuous_kernel,
+        WidthBins<scalar_t>& width_bins
+    ) {
+    constexpr signedindex_t attr_dim = (kind == FUSED_OP_AT) ? 1 : SPATIAL_DIM;
+    constexpr signedindex_t out_dim = (kind == FUSED_OP_A) ? 1 : SPATIAL_DIM;
+    if (query_index < num_queries) {
+        const scalar_t* query_point = query_points + query_index*SPATIAL_DIM;
+        width_bins.reset(query_widths + query_index*num_widths, num_widths, out_dim);
+        auto add_term = [&](const scalar_t* diff, const scalar_t* attrs) {
+            if (kind == FUSED_OP_A) {
+                width_bins.add_A_term(diff, attrs, continuous_kernel);
+            } else if (kind == FUSED_OP_AT) {
+                width_bins.add_AT_term(diff, attrs[0]);
+            } else {
+                width_bins.add_G_term(diff, attrs);
+            }
+        };
+
+        // a forward walk over the packed nodes, the root's subtree is all of them
+        const signedindex_t packed_end = packed_nodes[0].skip;
+        signedindex_t packed_index = 0;
+        while (packed_index < packed_end) {
+            const signedindex_t cur_packed_index = packed_index;
+            const PackedNode<scalar_t>& cur_node = packed_nodes[cur_packed_index];
+            // past its subtree, unless it is a nonleaf opened below
+            packed_index = cur_node.skip;
+            const signedindex_t cur_node_index = cur_node.node_index;
+            scalar_t point2node_dist2 = get_point2point_dist2(query_point, cur_node.reppoint);
+
+            scalar_t diff[SPATIAL_DIM];     // x - y
+            /// @case 1: the query point is far from the sample, approximate the query value with the node center
+            if (point2node_dist2 > cur_node.far_dist2) {
+                subtract_vec<scalar_t>(diff, query_point, cur_node.reppoint, SPATIAL_DIM);
+                add_term(diff, node_attrs + cur_node_index*attr_dim);
+            } else if (node_inside_smoothing_width<scalar_t>(query_point, point2node_dist2, node_bboxes, cur_node_index, width_bins.widths[0])) {
+                /// @case 2: every point of the node is within the smoothing width, where the kernel vanishes, cull it
+            } else {
+                /// @case 3: the query point is not that far,
+                //           if nonleaf, step into its subtree, to its first child
+                if (cur_node.num_points < 0) {
+                    packed_index = cur_packed_index + 1;
+                } else {  /// @case 4: this node is a leaf node, compute over samples
+                    signedindex_t begin = cur_node.first_point;
+                    signedindex_t end = begin + cur_node.num_points;
+                    for (signedindex_t i = begin; i < end; i++) {
+                        scalar_t point_attrs[attr_dim];
+                        for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+                            diff[d] = query_point[d] - points_soa.coords[d][i];
+                        }
+                        for (signedindex_t c = 0; c < attr_dim; c++) {
+                            point_attrs[c] = points_soa.attrs[c][i];
+                        }
+                        add_term(diff, point_attrs);
+                    }
+                }
+            }
+        }
+        width_bins.write(out_attrs + query_index*num_widths*out_dim);
+    }
+}
+
+
+template<typename scalar_t, FusedOperatorKind kind, typename index_t>
+void multiply_multiwidth_cpu_kernel_launcher(
+        const scalar_t* query_points,  // [N', 3]
+        const scalar_t* query_widths,  // [N', K]
+        signedindex_t num_widths,
+        const scalar_t* points,        // [N, 3]
+        const scalar_t* point_attrs,   // [N, C]
+        const index_t* node2point_index,
+        const index_t* node2point_indexstart,
+        const index_t* node_children_list,
+        const scalar_t* node_attrs,
+        const bool* node_is_leaf_list,
+        const scalar_t* node_half_w_list,
+        const scalar_t* node_reppoints,
+        const index_t* num_points_in_node,
+        scalar_t* out_attrs,           // [N', K, D]
+        signedindex_t num_queries,
+        bool continuous_kernel,
+        scalar_t theta,
+        const TreeTraversalCache<scalar_t>* traversal_cache,
+        TraversalWorkspace<scalar_t>* workspace) {
+
+    // the root holds every point
+    TraversalWorkspace<scalar_t> own_workspace;   // without one of the caller
+    TraversalWorkspace<scalar_t>& launch_workspace = workspace ? *workspace : own_workspace;
+    const PointsSoA<scalar_t>& points_soa = gather_workspace_points_cpu<scalar_t>(points, point_attrs, node2point_index, num_points_in_node[0], (kind == FUSED_OP_AT) ? 1 : SPATIAL_DIM, launch_workspace);
+
+    // one set of bins per thread, reused by all its queries
+    std::vector<WidthBins<scalar_t>> thread_width_bins(get_num_threads());
+    const scalar_t* cull_bboxes = compute_node_bounds_cpu<scalar_t>(points, node_children_list, node_is_leaf_list, node2point_index, node2point_indexstart, num_points_in_node,
+                                                                    node_half_w_list, node_reppoints, !(kind == FUSED_OP_A && continuous_kernel), theta, traversal_cache, launch_workspace);
+    pack_tree_nodes_cpu<scalar_t>(node_children_list, node_is_leaf_list, node2point_indexstart, num_points_in_node, node_reppoints, traversal_cache, launch_workspace);
+    run_query_loop_cpu<scalar_t>(
+        query_points,
+        nullptr,
+        node_children_list,
+        node_is_leaf_list,
+        num_points_in_node,
+        num_queries,
+        &launch_workspace,
+        [&](signedindex_t query_index) {
+            multiply_multiwidth_cpu_kernel<scalar_t, kind>(
+                query_points,
+                query_widths,
+                num_widths,
+                points_soa,
+                launch_workspace.packed_nodes.data(),
+                node_attrs,
+                cull_bboxes,
+                out_attrs,
+                num_queries,
+                query_index,
+                continuous_kernel,
+                thread_width_bins[omp_get_thread_num()]);
+        });
+}
+
+
+template<typename scalar_t, typename index_t>
+void multiply_by_A_multiwidth_cpu_kernel_launcher(
+        const scalar_t* query_points,  // [N', 3]
+        const scalar_t* query_widths,  // [N', K]
+        signedindex_t num_widths,
+        const scalar_t* points,        // [N, 3]
+        const scalar_t* point_attrs,   // [N, 3]
+        const index_t* node2point_index,
+        const index_t* node2point_indexstart,
+        const index_t* node_children_list,
+        const scalar_t* node_attrs,
+        const bool* node_is_leaf_list,
+        const scalar_t* node_half_w_list,
+        const scalar_t* node_reppoints,
+        const index_t* num_points_in_node,
+        scalar_t* out_attrs,           // [N', K, 1]
+        signedindex_t num_queries,
+        bool continuous_kernel,
+        scalar_t theta,
+        const TreeTraversalCache<scalar_t>* traversal_cache,
+        TraversalWorkspace<scalar_t>* workspace) {
+    multiply_multiwidth_cpu_kernel_launcher<scalar_t, FUSED_OP_A>(query_points, query_widths, num_widths, points, point_attrs, node2point_index, node2point_indexstart,
+        node_children_list, node_attrs, node_is_leaf_list, node_half_w_list, node_reppoints, num_points_in_node, out_attrs, num_queries, continuous_kernel, theta, traversal_cache, workspace);
+}
+
+template<typename scalar_t, typename index_t>
+void multiply_by_AT_multiwidth_cpu_kernel_launcher(
+        const scalar_t* query_points,  // [N', 3]
+        const scalar_t* query_widths,  // [N', K]
+        signedindex_t num_widths,
+        const scalar_t* points,        // [N, 3]
+        const scalar_t* point_attrs,   // [N, 1]
+        const index_t* node2point_index,
+        const index_t* node2point_indexstart,
+        const index_t* node_children_list,
+        const scalar_t* node_attrs,
+        const bool* node_is_leaf_list,
+        const scalar_t* node_half_w_list,
+        const scalar_t* node_reppoints,
+        const index_t* num_points_in_node,
+        scalar_t* out_attrs,           // [N', K, 3]
+        signedindex_t num_queries,
+        scalar_t theta,
+        const TreeTraversalCache<scalar_t>* traversal_cache,
+        TraversalWorkspace<scalar_t>* workspace) {
+    multiply_multiwidth_cpu_kernel_launcher<scalar_t, FUSED_OP_AT>(query_points, query_widths, num_widths, points, point_attrs, node2point_index, node2point_indexstart,
+        node_children_list, node_attrs, node_is_leaf_list, node_half_w_list, node_reppoints, num_points_in_node, out_attrs, num_queries, false, theta, traversal_cache, workspace);
+}
+
+template<typename scalar_t, typename index_t>
+void multiply_by_G_multiwidth_cpu_kernel_launcher(
+        const scalar_t* query_points,  // [N', 3]
+        const scalar_t* query_widths,  // [N', K]
+        signedindex_t num_widths,
+        const scalar_t* points,        // [N, 3]
+        const scalar_t* point_attrs,   // [N, 3]
+        const index_t* node2point_index,
+        const index_t* node2point_indexstart,
+        const index_t* node_children_list,
+        const scalar_t* node_attrs,
+        const bool* node_is_leaf_list,
+        const scalar_t* node_half_w_list,
+        const scalar_t* node_reppoints,
+        const index_t* num_points_in_node,
+        scalar_t* out_attrs,           // [N', K, 3]
+        signedindex_t num_queries,
+        scalar_t theta,
+        const TreeTraversalCache<scalar_t>* traversal_cache,
+        TraversalWorkspace<scalar_t>* workspace) {
+    multiply_multiwidth_cpu_kernel_launcher<scalar_t, FUSED_OP_G>(query_points, query_widths, num_widths, points, point_attrs, node2point_index, node2point_indexstart,
+        node_children_list, node_attrs, node_is_leaf_list, node_half_w_list, node_reppoints, num_points_in_node, out_attrs, num_queries, false, theta, traversal_cache, workspace);
+}
+
+
+//////////////////////////////////
+/// @brief several right hand sides per traversal
+
+/// @brief the terms of one source (a point or a far node) for all the right hand sides, same kernels as
+//         eval_A_mu / eval_AT_s_add_ / eval_G_mu_add_ (diff = x - y). attrs are [C, K] and acc [D, K],
+//         so that the loops over the right hand sides are contiguous and vectorized
+template<typename scalar_t, FusedOperatorKind kind>
+void eval_multirhs_add_(scalar_t* acc, const scalar_t* diff, const scalar_t* attrs, signedindex_t num_rhs, scalar_t smooth_width, bool continuous_kernel) {
+    scalar_t dist2 = 0.0;
+    for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+        dist2 += (diff[d] * diff[d]); // d^2
+    }
+    scalar_t dist = sqrt(dist2);  // d
+    scalar_t dist3 = dist * dist2;
+    bool outside_smoothing = (dist >= smooth_width);
+    if (!outside_smoothing && !(kind == FUSED_OP_A && continuous_kernel)) {
+        return;
+    }
+
+    const scalar_t* attrs_x = attrs;
+    const scalar_t* attrs_y = attrs + num_rhs;
+    const scalar_t* attrs_z = attrs + 2*num_rhs;
+    if (kind == FUSED_OP_A) {
+        scalar_t inv_denominator = scalar_t(1) / (outside_smoothing ? dist3 : smooth_width * smooth_width * smooth_width);
+        #pragma omp simd
+        for (signedindex_t k = 0; k < num_rhs; k++) {
+            acc[k] -= (diff[0] * attrs_x[k] + diff[1] * attrs_y[k] + diff[2] * attrs_z[k]) * inv_denominator;
+        }
+    } else if (kind == FUSED_OP_AT) {
+        for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+            scalar_t coef = diff[d] / dist3;
+            scalar_t* acc_d = acc + d*num_rhs;
+            #pragma omp simd
+            for (signedindex_t k = 0; k < num_rhs; k++) {
+                acc_d[k] += coef * attrs[k];
+            }
+        }
+    } else {
+        scalar_t inv_dist3 = scalar_t(1) / dist3;
+        scalar_t inv_dist5 = inv_dist3 / dist2;
+        scalar_t* acc_x = acc;
+        scalar_t* acc_y = acc + num_rhs;
+        scalar_t* acc_z = acc + 2*num_rhs;
+        #pragma omp simd
+        for (signedindex_t k = 0; k < num_rhs; k++) {
+            scalar_t diff_dot_mu = diff[0] * attrs_x[k] + diff[1] * attrs_y[k] + diff[2] * attrs_z[k];
+            acc_x[k] += attrs_x[k] * inv_dist3 - 3 * diff[0] * diff_dot_mu * inv_dist5;
+            acc_y[k] += attrs_y[k] * inv_dist3 - 3 * diff[1] * diff_dot_mu * inv_dist5;
+            acc_z[k] += attrs_z[k] * inv_dist3 - 3 * diff[2] * diff_dot_mu * inv_dist5;
+        }
+    }
+}
+
+
+template<typename scalar_t, FusedOperatorKind kind>
+void multiply_multirhs_cpu_kernel(
+        const scalar_t* query_points,  // [N', 3]
+        const scalar_t* query_width,   // [N',]
+        signedindex_t num_rhs,
+        const scalar_t* sorted_points,        // [N, 3], in tree order
+        const scalar_t* sorted_point_attrs,   // [N, C, K], in tree order
+        const PackedNode<scalar_t>* packed_nodes,  // see pack_tree_nodes_cpu
+        const scalar_t* node_attrs,    // [num_nodes, C, K]
+        const scalar_t* node_bboxes,   // [num_nodes, 6] or nullptr, see node_inside_smoothing_width
+        scalar_t* out_attrs,           // [N', K, D]
+        signedindex_t num_queries,
+        signedindex_t query_index,
+        bool continuous_kernel,
+        std::vector<scalar_t>& acc     // [D, K]
+    ) {
+    constexpr signedindex_t attr_dim = (kind == FUSED_OP_AT) ? 1 : SPATIAL_DIM;
+    constexpr signedindex_t out_dim = (kind == FUSED_OP_A) ? 1 : SPATIAL_DIM;
+    if (query_index < num_queries) {
+        const scalar_t* query_point = query_points + query_index*SPATIAL_DIM;
+        acc.assign(out_dim*num_rhs, scalar_t(0));
+
+        // a forward walk over the packed nodes, the root's subtree is all of them
+        const signedindex_t packed_end = packed_nodes[0].skip;
+        signedindex_t packed_index = 0;
+        while (packed_index < packed_end) {
+            const signedindex_t cur_packed_index = packed_index;
+            const PackedNode<scalar_t>& cur_node = packed_nodes[cur_packed_index];
+            // past its subtree, unless it is a nonleaf opened below
+            packed_index = cur_node.skip;
+            const signedindex_t cur_node_index = cur_node.node_index;
+            scalar_t point2node_dist2 = get_point2point_dist2(query_point, cur_node.reppoint);
+
+            scalar_t diff[SPATIAL_DIM];     // x - y
+            /// @case 1: the query point is far from the sample, approximate the query value with the node center
+            if (point2node_dist2 > cur_node.far_dist2) {
+                subtract_vec<scalar_t>(diff, query_point, cur_node.reppoint, SPATIAL_DIM);
+                eval_multirhs_add_<scalar_t, kind>(acc.data(), diff, node_attrs + cur_node_index*attr_dim*num_rhs, num_rhs, query_width[query_index], continuous_kernel);
+            } else if (node_inside_smoothing_width<scalar_t>(query_point, point2node_dist2, node_bboxes, cur_node_index, query_width[query_index])) {
+                /// @case 2: every point of the node is within the smoothing width, where the kernel vanishes, cull it
+            } else {
+                /// @case 3: the query point is not that far,
+                //           if nonleaf, step into its subtree, to its first child
+                if (cur_node.num_points < 0) {
+                    packed_index = cur_packed_index + 1;
+                } else {  /// @case 4: this node is a leaf node, compute over samples
+                    signedindex_t begin = cur_node.first_point;
+                    signedindex_t end = begin + cur_node.num_points;
+                    for (signedindex_t i = begin; i < end; i++) {
+                        subtract_vec<scalar_t>(diff, query_point, sorted_points + i*SPATIAL_DIM, SPATIAL_DIM);
+                        eval_multirhs_add_<scalar_t, kind>(acc.data(), diff, sorted_point_attrs + i*attr_dim*num_rhs, num_rhs, query_width[query_index], continuous_kernel);
+                    }
+                }
+            }
+        }
+
+        scalar_t* out = out_attrs + query_index*num_rhs*out_dim;
+        for (signedindex_t k = 0; k < num_rhs; k++) {
+            for (signedindex_t d = 0; d < out_dim; d++) {
+                out[k*out_dim + d] = acc[d*num_rhs + k];
+            }
+        }
+    }
+}
+
+
+/// @brief [rows, K, C] -> [rows, C, K], rows taken in the order of row_index (all rows in order if nullptr)
+template<typename scalar_t, typename index_t>
+void transpose_rhs_cpu(const scalar_t* src, const index_t* row_index, signedindex_t num_rows, signedindex_t num_rhs, signedindex_t attr_dim, scalar_t* dst) {
+    const signedindex_t num_threads = prepare_parallel_launch();
+    #pragma omp parallel for num_threads(num_threads) schedule(static)
+    for (signedindex_t i = 0; i < num_rows; i++) {
+        const scalar_t* src_row = src + (row_index != nullptr ? row_index[i] : i)*num_rhs*attr_dim;
+        scalar_t* dst_row = dst + i*attr_dim*num_rhs;
+        for (signedindex_t k = 0; k < num_rhs; k++) {
+            for (signedindex_t c = 0; c < attr_dim; c++) {
+                dst_row[c*num_rhs + k] = src_row[k*attr_dim + c];
+            }
+        }
+    }
+}
+
+
+template<typename scalar_t, FusedOperatorKind kind, typename index_t>
+void multiply_multirhs_cpu_kernel_launcher(
+        const scalar_t* query_points,  // [N', 3]
+        const scalar_t* query_width,   // [N',]
+        signedindex_t num_rhs,
+        const scalar_t* points,        // [N, 3]
+        const scalar_t* point_attrs,   // [N, K, C]
+        const index_t* node2point_index,
+        const index_t* node2point_indexstart,
+        const index_t* node_children_list,
+        const scalar_t* node_attrs,    // [num_nodes, K, C]
+        const bool* node_is_leaf_list,
+        const scalar_t* node_half_w_list,
+        const scalar_t* node_reppoints,
+        const index_t* num_points_in_node,
+        scalar_t* out_attrs,           // [N', K, D]
+        signedindex_t num_queries,
+        signedindex_t num_nodes,
+        bool continuous_kernel,
+        scalar_t theta,
+        const TreeTraversalCache<scalar_t>* traversal_cache,
+        TraversalWorkspace<scalar_t>* workspace) {
+    constexpr signedindex_t attr_dim = (kind == FUSED_OP_AT) ? 1 : SPATIAL_DIM;
+
+    TraversalWorkspace<scalar_t> own_workspace;   // without one of the caller
+    TraversalWorkspace<scalar_t>& launch_workspace = workspace ? *workspace : own_workspace;
+
+    // the points in tree order, and the attributes of the points and nodes with the right hand sides innermost,
+    // in the workspace: the points once, the attributes again for others or another num_rhs
+    const signedindex_t num_points = num_points_in_node[0];   // the root holds every point
+    std::vector<scalar_t>& sorted_points = launch_workspace.sorted_points;
+    std::vector<scalar_t>& sorted_point_attrs = launch_workspace.sorted_point_attrs;
+    std::vector<scalar_t>& node_attrs_rhs_last = launch_workspace.node_attrs_rhs_last;
+    if (launch_workspace.rhs_points != points || (signedindex_t)sorted_points.size() != num_points*SPATIAL_DIM) {
+        sorted_points.resize(num_points*SPATIAL_DIM);
+        transpose_rhs_cpu<scalar_t>(points, node2point_index, num_points, 1, SPATIAL_DIM, sorted_points.data());
+        launch_workspace.rhs_points = points;
+    }
+    if (launch_workspace.rhs_point_attrs != point_attrs || launch_workspace.rhs_num_rhs != num_rhs
+        || (signedindex_t)node_attrs_rhs_last.size() != num_nodes*attr_dim*num_rhs) {
+        sorted_point_attrs.resize(num_points*attr_dim*num_rhs);
+        node_attrs_rhs_last.resize(num_nodes*attr_dim*num_rhs);
+        transpose_rhs_cpu<scalar_t>(point_attrs, node2point_index, num_points, num_rhs, attr_dim, sorted_point_attrs.data());
+        transpose_rhs_cpu<scalar_t, index_t>(node_attrs, nullptr, num_nodes, num_rhs, attr_dim, node_attrs_rhs_last.data());
+        launch_workspace.rhs_point_attrs = point_attrs;
+        launch_workspace.rhs_num_rhs = num_rhs;
+    }
+
+    // one accumulator per thread, reused by all its queries
+    std::vector<std::vector<scalar_t>> thread_accs(get_num_threads());
+    const scalar_t* cull_bboxes = compute_node_bounds_cpu<scalar_t>(points, node_children_list, node_is_leaf_list, node2point_index, node2point_indexstart, num_points_in_node,
+                                                                    node_half_w_list, node_reppoints, !(kind == FUSED_OP_A && continuous_kernel), theta, traversal_cache, launch_workspace);
+    pack_tree_nodes_cpu<scalar_t>(node_children_list, node_is_leaf_list, node2point_indexstart, num_points_in_node, node_reppoints, traversal_cache, launch_workspace);
+    run_query_loop_cpu<scalar_t>(
+        query_points,
+        nullptr,
+        node_children_list,
+        node_is_leaf_list,
+        num_points_in_node,
+        num_queries,
+        &launch_workspace,
+        [&](signedindex_t query_index) {
+            multiply_multirhs_cpu_kernel<scalar_t, kind>(
+                query_points,
+                query_width,
+                num_rhs,
+                sorted_points.data(),
+                sorted_point_attrs.data(),
+                launch_workspace.packed_nodes.data(),
+                node_attrs_rhs_last.data(),
+                cull_bboxes,
+                out_attrs,
+                num_queries,
+                query_index,
+                continuous_kernel,
+                thread_accs[omp_get_thread_num()]);
+        });
+}
+
+
+template<typename scalar_t, typename index_t>
+void multiply_by_A_multirhs_cpu_kernel_launcher(
+        const scalar_t* query_points,  // [N', 3]
+        const scalar_t* query_width,   // [N',]
+        signedindex_t num_rhs,
+        const scalar_t* points,        // [N, 3]
+        const scalar_t* point_attrs,   // [N, K, 3]
+        const index_t* node2point_index,
+        const index_t* node2point_indexstart,
+        const index_t* node_children_list,
+        const scalar_t* node_attrs,
+        const bool* node_is_leaf_list,
+        const scalar_t* node_half_w_list,
+        const scalar_t* node_reppoints,
+        const index_t* num_points_in_node,
+        scalar_t* out_attrs,           // [N', K]
+        signedindex_t num_queries,
+        signedindex_t num_nodes,
+        bool continuous_kernel,
+        scalar_t theta,
+        const TreeTraversalCache<scalar_t>* traversal_cache,
+        TraversalWorkspace<scalar_t>* workspace) {
+    multiply_multirhs_cpu_kernel_launcher<scalar_t, FUSED_OP_A>(query_points, query_width, num_rhs, points, point_attrs, node2point_index, node2point_indexstart,
+        node_children_list, node_attrs, node_is_leaf_list, node_half_w_list, node_reppoints, num_points_in_node, out_attrs, num_queries, num_nodes, continuous_kernel, theta, traversal_cache, workspace);
+}
+
+template<typename scalar_t, typename index_t>
+void multiply_by_AT_multirhs_cpu_kernel_launcher(
+        const scalar_t* query_points,  // [N', 3]
+        const scalar_t* query_width,   // [N',]
+        signedindex_t num_rhs,
+        const scalar_t* points,        // [N, 3]
+        const scalar_t* point_attrs,   // [N, K]
+        const index_t* node2point_index,
+        const index_t* node2point_indexstart,
+        const index_t* node_children_list,
+        const scalar_t* node_attrs,
+        const bool* node_is_leaf_list,
+        const scalar_t* node_half_w_list,
+        const scalar_t* node_reppoints,
+        const index_t* num_points_in_node,
+        scalar_t* out_attrs,           // [N', K, 3]
+        signedindex_t num_queries,
+        signedindex_t num_nodes,
+        scalar_t theta,
+        const TreeTraversalCache<scalar_t>* traversal_cache,
+        TraversalWorkspace<scalar_t>* workspace) {
+    multiply_multirhs_cpu_kernel_launcher<scalar_t, FUSED_OP_AT>(query_points, query_width, num_rhs, points, point_attrs, node2point_index, node2point_indexstart,
+        node_children_list, node_attrs, node_is_leaf_list, node_half_w_list, node_reppoints, num_points_in_node, out_attrs, num_queries, num_nodes, false, theta, traversal_cache, workspace);
+}
+
+template<typename scalar_t, typename index_t>
+void multiply_by_G_multirhs_cpu_kernel_launcher(
+        const scalar_t* query_points,  // [N', 3]
+        const scalar_t* query_width,   // [N',]
+        signedindex_t num_rhs,
+        const scalar_t* points,        // [N, 3]
+        const scalar_t* point_attrs,   // [N, K, 3]
+        const index_t* node2point_index,
+        const index_t* node2point_indexstart,
+        const index_t* node_children_list,
+        const scalar_t* node_attrs,
+        const bool* node_is_leaf_list,
+        const scalar_t* node_half_w_list,
+        const scalar_t* node_reppoints,
+        const index_t* num_points_in_node,
+        scalar_t* out_attrs,           // [N', K, 3]
+        signedindex_t num_queries,
+        signedindex_t num_nodes,
+        scalar_t theta,
+        const TreeTraversalCache<scalar_t>* traversal_cache,
+        TraversalWorkspace<scalar_t>* workspace) {
+    multiply_multirhs_cpu_kernel_launcher<scalar_t, FUSED_OP_G>(query_points, query_width, num_rhs, points, point_attrs, node2point_index, node2point_indexstart,
+        node_children_list, node_attrs, node_is_leaf_list, node_half_w_list, node_reppoints, num_points_in_node, out_attrs, num_queries, num_nodes, false, theta, traversal_cache, workspace);
 }
 
 
 //////////// instantiation ////////////
-auto ptr_scatter_point_attrs_to_nodes_leaf_cpu_kernel_launcher_float  = scatter_point_attrs_to_nodes_leaf_cpu_kernel_launcher<float>;
-auto ptr_scatter_point_attrs_to_nodes_leaf_cpu_kernel_launcher_double = scatter_point_attrs_to_nodes_leaf_cpu_kernel_launcher<double>;
-auto ptr_scatter_point_attrs_to_nodes_nonleaf_cpu_kernel_launcher_float  = scatter_point_attrs_to_nodes_nonleaf_cpu_kernel_launcher<float>;
-auto ptr_scatter_point_attrs_to_nodes_nonleaf_cpu_kernel_launcher_double = scatter_point_attrs_to_nodes_nonleaf_cpu_kernel_launcher<double>;
-auto ptr_find_next_to_scatter_cpu_kernel_launcher_float  = find_next_to_scatter_cpu_kernel_launcher<float>;
-auto ptr_find_next_to_scatter_cpu_kernel_launcher_double = find_next_to_scatter_cpu_kernel_launcher<double>;
+auto ptr_scatter_point_attrs_to_nodes_cpu_kernel_launcher_float  = scatter_point_attrs_to_nodes_cpu_kernel_launcher<float>;
+auto ptr_scatter_point_attrs_to_nodes_cpu_kernel_launcher_double = scatter_point_attrs_to_nodes_cpu_kernel_launcher<double>;
 auto ptr_multiply_by_A_cpu_kernel_launcher_float  = multiply_by_A_cpu_kernel_launcher<float>;
 auto ptr_multiply_by_A_cpu_kernel_launcher_double = multiply_by_A_cpu_kernel_launcher<double>;
 auto ptr_multiply_by_AT_cpu_kernel_launcher_float  = multiply_by_AT_cpu_kernel_launcher<float>;
 auto ptr_multiply_by_AT_cpu_kernel_launcher_double = multiply_by_AT_cpu_kernel_launcher<double>;
 auto ptr_multiply_by_G_cpu_kernel_launcher_float  = multiply_by_G_cpu_kernel_launcher<float>;
-auto ptr_multiply_by_G_cpu_kernel_launcher_double = multiply_by_G_cpu_kernel_launcher<double>;
\ No newline at end of file
+auto ptr_multiply_by_G_cpu_kernel_launcher_double = multiply_by_G_cpu_kernel_launcher<double>;
+auto ptr_count_interaction_lists_cpu_kernel_launcher_float  = count_interaction_lists_cpu_kernel_launcher<float>;
+auto ptr_count_interaction_lists_cpu_kernel_launcher_double = count_interaction_lists_cpu_kernel_launcher<double>;
+auto ptr_fill_interaction_lists_cpu_kernel_launcher_float  = fill_interaction_lists_cpu_kernel_launcher<float>;
+auto ptr_fill_interaction_lists_cpu_kernel_launcher_double = fill_interaction_lists_cpu_kernel_launcher<double>;
+auto ptr_multiply_by_A_cached_cpu_kernel_launcher_float  = multiply_by_A_cached_cpu_kernel_launcher<float>;
+auto ptr_multiply_by_A_cached_cpu_kernel_launcher_double = multiply_by_A_cached_cpu_kernel_launcher<double>;
+auto ptr_multiply_by_AT_cached_cpu_kernel_launcher_float  = multiply_by_AT_cached_cpu_kernel_launcher<float>;
+auto ptr_multiply_by_AT_cached_cpu_kernel_launcher_double = multiply_by_AT_cached_cpu_kernel_launcher<double>;
+auto ptr_multiply_by_G_cached_cpu_kernel_launcher_float  = multiply_by_G_cached_cpu_kernel_launcher<float>;
+auto ptr_multiply_by_G_cached_cpu_kernel_launcher_double = multiply_by_G_cached_cpu_kernel_launcher<double>;
+auto ptr_multiply_by_A_dualtree_cpu_kernel_launcher_float  = multiply_by_A_dualtree_cpu_kernel_launcher<float>;
+auto ptr_multiply_by_A_dualtree_cpu_kernel_launcher_double = multiply_by_A_dualtree_cpu_kernel_launcher<double>;
+auto ptr_multiply_by_AT_dualtree_cpu_kernel_launcher_float  = multiply_by_AT_dualtree_cpu_kernel_launcher<float>;
+auto ptr_multiply_by_AT_dualtree_cpu_kernel_launcher_double = multiply_by_AT_dualtree_cpu_kernel_launcher<double>;
+auto ptr_multiply_by_G_dualtree_cpu_kernel_launcher_float  = multiply_by_G_dualtree_cpu_kernel_launcher<float>;
+auto ptr_multiply_by_G_dualtree_cpu_kernel_launcher_double = multiply_by_G_dualtree_cpu_kernel_launcher<double>;
+auto ptr_multiply_fused_cpu_kernel_launcher_float  = multiply_fused_cpu_kernel_launcher<float>;
+auto ptr_multiply_fused_cpu_kernel_launcher_double = multiply_fused_cpu_kernel_launcher<double>;
+auto ptr_multiply_fused_A_AT_dualtree_cpu_kernel_launcher_float  = multiply_fused_A_AT_dualtree_cpu_kernel_launcher<float>;
+auto ptr_multiply_fused_A_AT_dualtree_cpu_kernel_launcher_double = multiply_fused_A_AT_dualtree_cpu_kernel_launcher<double>;
+auto ptr_multiply_by_A_multiwidth_cpu_kernel_launcher_float  = multiply_by_A_multiwidth_cpu_kernel_launcher<float>;
+auto ptr_multiply_by_A_multiwidth_cpu_kernel_launcher_double = multiply_by_A_multiwidth_cpu_kernel_launcher<double>;
+auto ptr_multiply_by_AT_multiwidth_cpu_kernel_launcher_float  = multiply_by_AT_multiwidth_cpu_kernel_launcher<float>;
+auto ptr_multiply_by_AT_multiwidth_cpu_kernel_launcher_double = multiply_by_AT_multiwidth_cpu_kernel_launcher<double>;
+auto ptr_multiply_by_G_multiwidth_cpu_kernel_launcher_float  = multiply_by_G_multiwidth_cpu_kernel_launcher<float>;
+auto ptr_multiply_by_G_multiwidth_cpu_kernel_launcher_double = multiply_by_G_multiwidth_cpu_kernel_launcher<double>;
+auto ptr_multiply_by_A_multirhs_cpu_kernel_launcher_float  = multiply_by_A_multirhs_cpu_kernel_launcher<float>;
+auto ptr_multiply_by_A_multirhs_cpu_kernel_launcher_double = multiply_by_A_multirhs_cpu_kernel_launcher<double>;
+auto ptr_multiply_by_AT_multirhs_cpu_kernel_launcher_float  = multiply_by_AT_multirhs_cpu_kernel_launcher<float>;
+auto ptr_multiply_by_AT_multirhs_cpu_kernel_launcher_double = multiply_by_AT_multirhs_cpu_kernel_launcher<double>;
+auto ptr_multiply_by_G_multirhs_cpu_kernel_launcher_float  = multiply_by_G_multirhs_cpu_kernel_launcher<float>;
+auto ptr_multiply_by_G_multirhs_cpu_kernel_launcher_double = multiply_by_G_multirhs_cpu_kernel_launcher<double>;
+auto ptr_scatter_point_attrs_to_nodes_cpu_kernel_launcher_float_int32  = scatter_point_attrs_to_nodes_cpu_kernel_launcher<float, int32_t>;
+auto ptr_scatter_point_attrs_to_nodes_cpu_kernel_launcher_double_int32 = scatter_point_attrs_to_nodes_cpu_kernel_launcher<double, int32_t>;
+auto ptr_multiply_by_A_cpu_kernel_launcher_float_int32  = multiply_by_A_cpu_kernel_launcher<float, int32_t>;
+auto ptr_multiply_by_A_cpu_kernel_launcher_double_int32 = multiply_by_A_cpu_kernel_launcher<double, int32_t>;
+auto ptr_multiply_by_AT_cpu_kernel_launcher_float_int32  = multiply_by_AT_cpu_kernel_launcher<float, int32_t>;
+auto ptr_multiply_by_AT_cpu_kernel_launcher_double_int32 = multiply_by_AT_cpu_kernel_launcher<double, int32_t>;
+auto ptr_multiply_by_G_cpu_kernel_launcher_float_int32  = multiply_by_G_cpu_kernel_launcher<float, int32_t>;
+auto ptr_multiply_by_G_cpu_kernel_launcher_double_int32 = multiply_by_G_cpu_kernel_launcher<double, int32_t>;
+auto ptr_count_interaction_lists_cpu_kernel_launcher_float_int32  = count_interaction_lists_cpu_kernel_launcher<float, int32_t>;
+auto ptr_count_interaction_lists_cpu_kernel_launcher_double_int32 = count_interaction_lists_cpu_kernel_launcher<double, int32_t>;
+auto ptr_fill_interaction_lists_cpu_kernel_launcher_float_int32  = fill_interaction_lists_cpu_kernel_launcher<float, int32_t>;
+auto ptr_fill_interaction_lists_cpu_kernel_launcher_double_int32 = fill_interaction_lists_cpu_kernel_launcher<double, int32_t>;
+auto ptr_multiply_by_A_cached_cpu_kernel_launcher_float_int32  = multiply_by_A_cached_cpu_kernel_launcher<float, int32_t>;
+auto ptr_multiply_by_A_cached_cpu_kernel_launcher_double_int32 = multiply_by_A_cached_cpu_kernel_launcher<double, int32_t>;
+auto ptr_multiply_by_AT_cached_cpu_kernel_launcher_float_int32  = multiply_by_AT_cached_cpu_kernel_launcher<float, int32_t>;
+auto ptr_multiply_by_AT_cached_cpu_kernel_launcher_double_int32 = multiply_by_AT_cached_cpu_kernel_launcher<double, int32_t>;
+auto ptr_multiply_by_G_cached_cpu_kernel_launcher_float_int32  = multiply_by_G_cached_cpu_kernel_launcher<float, int32_t>;
+auto ptr_multiply_by_G_cached_cpu_kernel_launcher_double_int32 = multiply_by_G_cached_cpu_kernel_launcher<double, int32_t>;
+auto ptr_multiply_by_A_dualtree_cpu_kernel_launcher_float_int32  = multiply_by_A_dualtree_cpu_kernel_launcher<float, int32_t>;
+auto ptr_multiply_by_A_dualtree_cpu_kernel_launcher_double_int32 = multiply_by_A_dualtree_cpu_kernel_launcher<double, int32_t>;
+auto ptr_multiply_by_AT_dualtree_cpu_kernel_launcher_float_int32  = multiply_by_AT_dualtree_cpu_kernel_launcher<float, int32_t>;
+auto ptr_multiply_by_AT_dualtree_cpu_kernel_launcher_double_int32 = multiply_by_AT_dualtree_cpu_kernel_launcher<double, int32_t>;
+auto ptr_multiply_by_G_dualtree_cpu_kernel_launcher_float_int32  = multiply_by_G_dualtree_cpu_kernel_launcher<float, int32_t>;
+auto ptr_multiply_by_G_dualtree_cpu_kernel_launcher_double_int32 = multiply_by_G_dualtree_cpu_kernel_launcher<double, int32_t>;
+auto ptr_multiply_fused_cpu_kernel_launcher_float_int32  = multiply_fused_cpu_kernel_launcher<float, int32_t>;
+auto ptr_multiply_fused_cpu_kernel_launcher_double_int32 = multiply_fused_cpu_kernel_launcher<double, int32_t>;
+auto ptr_multiply_fused_A_AT_dualtree_cpu_kernel_launcher_float_int32  = multiply_fused_A_AT_dualtree_cpu_kernel_launcher<float, int32_t>;
+auto ptr_multiply_fused_A_AT_dualtree_cpu_kernel_launcher_double_int32 = multiply_fused_A_AT_dualtree_cpu_kernel_launcher<double, int32_t>;
+auto ptr_multiply_by_A_multiwidth_cpu_kernel_launcher_float_int32  = multiply_by_A_multiwidth_cpu_kernel_launcher<float, int32_t>;
+auto ptr_multiply_by_A_multiwidth_cpu_kernel_launcher_double_int32 = multiply_by_A_multiwidth_cpu_kernel_launcher<double, int32_t>;
+auto ptr_multiply_by_AT_multiwidth_cpu_kernel_launcher_float_int32  = multiply_by_AT_multiwidth_cpu_kernel_launcher<float, int32_t>;
+auto ptr_multiply_by_AT_multiwidth_cpu_kernel_launcher_double_int32 = multiply_by_AT_multiwidth_cpu_kernel_launcher<double, int32_t>;
+auto ptr_multiply_by_G_multiwidth_cpu_kernel_launcher_float_int32  = multiply_by_G_multiwidth_cpu_kernel_launcher<float, int32_t>;
+auto ptr_multiply_by_G_multiwidth_cpu_kernel_launcher_double_int32 = multiply_by_G_multiwidth_cpu_kernel_launcher<double, int32_t>;
+auto ptr_multiply_by_A_multirhs_cpu_kernel_launcher_float_int32  = multiply_by_A_multirhs_cpu_kernel_launcher<float, int32_t>;
+auto ptr_multiply_by_A_multirhs_cpu_kernel_launcher_double_int32 = multiply_by_A_multirhs_cpu_kernel_launcher<double, int32_t>;
+auto ptr_multiply_by_AT_multirhs_cpu_kernel_launcher_float_int32  = multiply_by_AT_multirhs_cpu_kernel_launcher<float, int32_t>;
+auto ptr_multiply_by_AT_multirhs_cpu_kernel_launcher_double_int32 = multiply_by_AT_multirhs_cpu_kernel_launcher<double, int32_t>;
+auto ptr_multiply_by_G_multirhs_cpu_kernel_launcher_float_int32  = multiply_by_G_multirhs_cpu_kernel_launcher<float, int32_t>;
+auto ptr_multiply_by_G_multirhs_cpu_kernel_launcher_double_int32 = multiply_by_G_multirhs_cpu_kernel_launcher<double, int32_t>;
@@ -0,0 +1,933 @@
+/*
+MIT License
+
+Copyright (c) 2024 Siyou Lin, Zuoqiang Shi, Yebin Liu
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "wn_treecode_cpu.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+#include <omp.h>
+
+// the vector kernels are compiled with target attributes and only called after a runtime check,
+// so the rest of the extension keeps the default instruction set
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WN_TREECODE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+
+template<typename scalar_t, typename index_t>
+void gather_points_soa_cpu(
+        const scalar_t* points,
+        const scalar_t* point_attrs,
+        const index_t* node2point_index,
+        signedindex_t num_points,
+        signedindex_t attr_dim,
+        PointsSoA<scalar_t>& points_soa,
+        bool gather_coords
+    ) {
+    points_soa.attr_dim = attr_dim;
+    for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+        points_soa.coords[d].resize(num_points);
+    }
+    for (signedindex_t c = 0; c < NEAR_FIELD_MAX_ATTR_DIM; c++) {
+        points_soa.attrs[c].resize(c < attr_dim ? num_points : 0);
+    }
+
+    const signedindex_t num_threads = prepare_parallel_launch();
+    #pragma omp parallel for num_threads(num_threads) schedule(static)
+    for (signedindex_t i = 0; i < num_points; i++) {
+        signedindex_t point_index = node2point_index[i];
+        if (gather_coords) {
+            for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+                points_soa.coords[d][i] = points[point_index*SPATIAL_DIM + d];
+            }
+        }
+        for (signedindex_t c = 0; c < attr_dim; c++) {
+            points_soa.attrs[c][i] = point_attrs[point_index*attr_dim + c];
+        }
+    }
+}
+
+
+//////////////////// scalar ////////////////////
+/// @note same arithmetic as eval_A_mu / eval_AT_s_add_ / eval_G_mu_add_, point by point
+
+template<typename scalar_t>
+void eval_A_mu_block_scalar_add_(
+        scalar_t& out_val, const scalar_t* query_point, scalar_t smooth_width, bool continuous_kernel,
+        const NearFieldBlock<scalar_t>& block) {
+    for (signedindex_t i = 0; i < block.num_points; i++) {
+        scalar_t diff[SPATIAL_DIM], mu[SPATIAL_DIM];
+        scalar_t dist2 = 0.0;
+        for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+            diff[d] = query_point[d] - block.coords[d][i];
+            mu[d] = block.attrs[block.attr_offset + d][i];
+            dist2 += (diff[d] * diff[d]);
+        }
+        scalar_t dist = std::sqrt(dist2);
+
+        scalar_t denominator = 0.0;
+        if (dist >= smooth_width) {
+            denominator = dist * dist2;
+        } else if (continuous_kernel) {
+            denominator = smooth_width * smooth_width * smooth_width;
+        } else {
+            continue;
+        }
+        scalar_t result = 0.0;
+        for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+            result += (-1 * diff[d] * mu[d]) / denominator;
+        }
+        out_val += result;
+    }
+}
+
+template<typename scalar_t>
+void eval_AT_s_block_scalar_add_(
+        scalar_t* out_vec, const scalar_t* query_point, scalar_t smooth_width,
+        const NearFieldBlock<scalar_t>& block) {
+    for (signedindex_t i = 0; i < block.num_points; i++) {
+        scalar_t diff[SPATIAL_DIM];
+        scalar_t dist2 = 0.0;
+        for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+            diff[d] = query_point[d] - block.coords[d][i];
+            dist2 += (diff[d] * diff[d]);
+        }
+        scalar_t dist = std::sqrt(dist2);
+
+        if (dist >= smooth_width) {
+            scalar_t denominator = dist * dist2;
+            for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+                out_vec[d] += (diff[d] * block.attrs[block.attr_offset][i]) / denominator;
+            }
+        }
+    }
+}
+
+template<typename scalar_t>
+void eval_G_mu_block_scalar_add_(
+        scalar_t* out_vec, const scalar_t* query_point, scalar_t smooth_width,
+        const NearFieldBlock<scalar_t>& block) {
+    for (signedindex_t i = 0; i < block.num_points; i++) {
+        scalar_t diff[SPATIAL_DIM], mu[SPATIAL_DIM];
+        scalar_t dist2 = 0.0, diff_dot_mu = 0.0;
+        for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+            diff[d] = query_point[d] - block.coords[d][i];
+            mu[d] = block.attrs[block.attr_offset + d][i];
+            dist2 += (diff[d] * diff[d]);
+        }
+        for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+            diff_dot_mu += diff[d] * mu[d];
+        }
+        scalar_t dist = std::sqrt(dist2);
+        scalar_t dist3 = dist * dist2;
+        scalar_t dist5 = dist2 * dist3;
+
+        if (dist >= smooth_width) {
+            for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+                out_vec[d] += (mu[d] / dist3 - 3 * diff[d] * diff_dot_mu / dist5);
+            }
+        }
+    }
+}
+
+/// @note same arithmetic again, query by query of the packet, with the node as the only point
+template<typename scalar_t>
+void eval_A_mu_packet_scalar_add_(
+        QueryPacket<scalar_t>& packet, uint64_t active, const scalar_t* source_point, const scalar_t* mu, bool continuous_kernel) {
+    for (signedindex_t q = 0; q < packet.num_queries; q++) {
+        if (((active >> q) & 1) == 0) {
+            continue;
+        }
+        scalar_t diff[SPATIAL_DIM];
+        scalar_t dist2 = 0.0;
+        for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+            diff[d] = packet.coords[d][q] - source_point[d];
+            dist2 += (diff[d] * diff[d]);
+        }
+        scalar_t dist = std::sqrt(dist2);
+
+        const scalar_t smooth_width = packet.widths[q];
+        scalar_t denominator = 0.0;
+        if (dist >= smooth_width) {
+            denominator = dist * dist2;
+        } else if (continuous_kernel) {
+            denominator = smooth_width * smooth_width * smooth_width;
+        } else {
+            continue;
+        }
+        scalar_t result = 0.0;
+        for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+            result += (-1 * diff[d] * mu[d]) / denominator;
+        }
+        packet.out[0][q] += result;
+    }
+}
+
+template<typename scalar_t>
+void eval_AT_s_packet_scalar_add_(
+        QueryPacket<scalar_t>& packet, uint64_t active, const scalar_t* source_point, const scalar_t* s) {
+    for (signedindex_t q = 0; q < packet.num_queries; q++) {
+        if (((active >> q) & 1) == 0) {
+            continue;
+        }
+        scalar_t diff[SPATIAL_DIM];
+        scalar_t dist2 = 0.0;
+        for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+            diff[d] = packet.coords[d][q] - source_point[d];
+            dist2 += (diff[d] * diff[d]);
+        }
+        scalar_t dist = std::sqrt(dist2);
+
+        if (dist >= packet.widths[q]) {
+            scalar_t denominator = dist * dist2;
+            for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+                packet.out[d][q] += (diff[d] * (*s)) / denominator;
+            }
+        }
+    }
+}
+
+template<typename scalar_t>
+void eval_G_mu_packet_scalar_add_(
+        QueryPacket<scalar_t>& packet, uint64_t active, const scalar_t* source_point, const scalar_t* mu) {
+    for (signedindex_t q = 0; q < packet.num_queries; q++) {
+        if (((active >> q) & 1) == 0) {
+            continue;
+        }
+        scalar_t diff[SPATIAL_DIM];
+        scalar_t dist2 = 0.0, diff_dot_mu = 0.0;
+        for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+            diff[d] = packet.coords[d][q] - source_point[d];
+            dist2 += (diff[d] * diff[d]);
+        }
+        for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+            diff_dot_mu += diff[d] * mu[d];
+        }
+        scalar_t dist = std::sqrt(dist2);
+        scalar_t dist3 = dist * dist2;
+        scalar_t dist5 = dist2 * dist3;
+
+        if (dist >= packet.widths[q]) {
+            for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+                packet.out[d][q] += (mu[d] / dist3 - 3 * diff[d] * diff_dot_mu / dist5);
+            }
+        }
+    }
+}
+
+
+#ifdef WN_TREECODE_X86_SIMD
+//////////////////// AVX2 ////////////////////
+/// @note 8 points per step, the last step masked; lanes of masked-out points and of points inside
+//        the smoothing width contribute exact zeros, whatever 1/d evaluates to there
+
+__attribute__((target("avx2,fma")))
+static inline __m256 inv_dist_avx2(__m256 dist2) {
+    // rsqrt is good to ~12 bits, one Newton step r * (1.5 - 0.5 * d^2 * r^2) brings it to ~23
+    __m256 r = _mm256_rsqrt_ps(dist2);
+    __m256 half_dist2_r = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), dist2), r);
+    return _mm256_mul_ps(r, _mm256_fnmadd_ps(half_dist2_r, r, _mm256_set1_ps(1.5f)));
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256i tail_mask_avx2(signedindex_t num_left) {
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const int n = num_left < 8 ? int(num_left) : 8;
+    return _mm256_cmpgt_epi32(_mm256_set1_epi32(n), lane);
+}
+
+__attribute__((target("avx2,fma")))
+static inline float reduce_add_avx2(__m256 v) {
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_movehdup_ps(s));
+    return _mm_cvtss_f32(s);
+}
+
+__attribute__((target("avx2,fma")))
+static void eval_A_mu_block_avx2_add_(
+        float& out_val, const float* query_point, float smooth_width, bool continuous_kernel,
+        const NearFieldBlock<float>& block) {
+    const __m256 qx = _mm256_set1_ps(query_point[0]);
+    const __m256 qy = _mm256_set1_ps(query_point[1]);
+    const __m256 qz = _mm256_set1_ps(query_point[2]);
+    const __m256 width2 = _mm256_set1_ps(smooth_width * smooth_width);
+    const __m256 inv_width3 = _mm256_set1_ps(continuous_kernel ? 1.0f / (smooth_width * smooth_width * smooth_width) : 0.0f);
+    const float* xs = block.coords[0];
+    const float* ys = block.coords[1];
+    const float* zs = block.coords[2];
+    const float* mxs = block.attrs[block.attr_offset];
+    const float* mys = block.attrs[block.attr_offset + 1];
+    const float* mzs = block.attrs[block.attr_offset + 2];
+
+    __m256 acc = _mm256_setzero_ps();
+    for (signedindex_t i = 0; i < block.num_points; i += 8) {
+        const __m256i mask = tail_mask_avx2(block.num_points - i);
+        __m256 dx = _mm256_sub_ps(qx, _mm256_maskload_ps(xs + i, mask));
+        __m256 dy = _mm256_sub_ps(qy, _mm256_maskload_ps(ys + i, mask));
+        __m256 dz = _mm256_sub_ps(qz, _mm256_maskload_ps(zs + i, mask));
+        __m256 dist2 = _mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx)));
+        __m256 dot = _mm256_fmadd_ps(dz, _mm256_maskload_ps(mzs + i, mask),
+                     _mm256_fmadd_ps(dy, _mm256_maskload_ps(mys + i, mask),
+                     _mm256_mul_ps(dx, _mm256_maskload_ps(mxs + i, mask))));
+
+        __m256 inv_dist = inv_dist_avx2(dist2);
+        __m256 inv_dist3 = _mm256_mul_ps(_mm256_mul_ps(inv_dist, inv_dist), inv_dist);
+        __m256 outside = _mm256_cmp_ps(dist2, width2, _CMP_GE_OQ);
+        __m256 scale = _mm256_blendv_ps(inv_width3, inv_dist3, outside);
+        scale = _mm256_and_ps(scale, _mm256_castsi256_ps(mask));
+        acc = _mm256_fnmadd_ps(dot, scale, acc);
+    }
+    out_val += reduce_add_avx2(acc);
+}
+
+__attribute__((target("avx2,fma")))
+static void eval_AT_s_block_avx2_add_(
+        float* out_vec, const float* query_point, float smooth_width,
+        const NearFieldBlock<float>& block) {
+    const __m256 qx = _mm256_set1_ps(query_point[0]);
+    const __m256 qy = _mm256_set1_ps(query_point[1]);
+    const __m256 qz = _mm256_set1_ps(query_point[2]);
+    const __m256 width2 = _mm256_set1_ps(smooth_width * smooth_width);
+    const float* xs = block.coords[0];
+    const float* ys = block.coords[1];
+    const float* zs = block.coords[2];
+    const float* ss = block.attrs[block.attr_offset];
+
+    __m256 acc_x = _mm256_setzero_ps(), acc_y = _mm256_setzero_ps(), acc_z = _mm256_setzero_ps();
+    for (signedindex_t i = 0; i < block.num_points; i += 8) {
+        const __m256i mask = tail_mask_avx2(block.num_points - i);
+        __m256 dx = _mm256_sub_ps(qx, _mm256_maskload_ps(xs + i, mask));
+        __m256 dy = _mm256_sub_ps(qy, _mm256_maskload_ps(ys + i, mask));
+        __m256 dz = _mm256_sub_ps(qz, _mm256_maskload_ps(zs + i, mask));
+        __m256 dist2 = _mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx)));
+
+        __m256 inv_dist = inv_dist_avx2(dist2);
+        __m256 inv_dist3 = _mm256_mul_ps(_mm256_mul_ps(inv_dist, inv_dist), inv_dist);
+        __m256 outside = _mm256_and_ps(_mm256_cmp_ps(dist2, width2, _CMP_GE_OQ), _mm256_castsi256_ps(mask));
+        __m256 coef = _mm256_and_ps(_mm256_mul_ps(_mm256_maskload_ps(ss + i, mask), inv_dist3), outside);
+        acc_x = _mm256_fmadd_ps(dx, coef, acc_x);
+        acc_y = _mm256_fmadd_ps(dy, coef, acc_y);
+        acc_z = _mm256_fmadd_ps(dz, coef, acc_z);
+    }
+    out_vec[0] += reduce_add_avx2(acc_x);
+    out_vec[1] += reduce_add_avx2(acc_y);
+    out_vec[2] += reduce_add_avx2(acc_z);
+}
+
+__attribute__((target("avx2,fma")))
+static void eval_G_mu_block_avx2_add_(
+        float* out_vec, const float* query_point, float smooth_width,
+        const NearFieldBlock<float>& block) {
+    const __m256 qx = _mm256_set1_ps(query_point[0]);
+    const __m256 qy = _mm256_set1_ps(query_point[1]);
+    const __m256 qz = _mm256_set1_ps(query_point[2]);
+    const __m256 width2 = _mm256_set1_ps(smooth_width * smooth_width);
+    const __m256 three = _mm256_set1_ps(3.0f);
+    const float* xs = block.coords[0];
+    const float* ys = block.coords[1];
+    const float* zs = block.coords[2];
+    const float* mxs = block.attrs[block.attr_offset];
+    const float* mys = block.attrs[block.attr_offset + 1];
+    const float* mzs = block.attrs[block.attr_offset + 2];
+
+    __m256 acc_x = _mm256_setzero_ps(), acc_y = _mm256_setzero_ps(), acc_z = _mm256_setzero_ps();
+    for (signedindex_t i = 0; i < block.num_points; i += 8) {
+        const __m256i mask = tail_mask_avx2(block.num_points - i);
+        __m256 dx = _mm256_sub_ps(qx, _mm256_maskload_ps(xs + i, mask));
+        __m256 dy = _mm256_sub_ps(qy, _mm256_maskload_ps(ys + i, mask));
+        __m256 dz = _mm256_sub_ps(qz, _mm256_maskload_ps(zs + i, mask));
+        __m256 mx = _mm256_maskload_ps(mxs + i, mask);
+        __m256 my = _mm256_maskload_ps(mys + i, mask);
+        __m256 mz = _mm256_maskload_ps(mzs + i, mask);
+        __m256 dist2 = _mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx)));
+        __m256 dot = _mm256_fmadd_ps(dz, mz, _mm256_fmadd_ps(dy, my, _mm256_mul_ps(dx, mx)));
+
+        __m256 inv_dist = inv_dist_avx2(dist2);
+        __m256 inv_dist2 = _mm256_mul_ps(inv_dist, inv_dist);
+        __m256 outside = _mm256_and_ps(_mm256_cmp_ps(dist2, width2, _CMP_GE_OQ), _mm256_castsi256_ps(mask));
+        __m256 inv_dist3 = _mm256_and_ps(_mm256_mul_ps(inv_dist2, inv_dist), outside);
+        // mu / d^3 - 3 (x - y) (x - y).mu / d^5
+        __m256 coef = _mm256_mul_ps(_mm256_mul_ps(three, dot), _mm256_mul_ps(inv_dist3, inv_dist2));
+        coef = _mm256_and_ps(coef, outside);
+        acc_x = _mm256_fnmadd_ps(dx, coef, _mm256_fmadd_ps(mx, inv_dist3, acc_x));
+        acc_y = _mm256_fnmadd_ps(dy, coef, _mm256_fmadd_ps(my, inv_dist3, acc_y));
+        acc_z = _mm256_fnmadd_ps(dz, coef, _mm256_fmadd_ps(mz, inv_dist3, acc_z));
+    }
+    out_vec[0] += reduce_add_avx2(acc_x);
+    out_vec[1] += reduce_add_avx2(acc_y);
+    out_vec[2] += reduce_add_avx2(acc_z);
+}
+
+/// @note 8 queries of the packet per step, steps without active queries skipped; the outputs of the queries
+//        that are not active are blended back unchanged, so their lanes may hold anything
+__attribute__((target("avx2,fma")))
+static inline __m256 active_mask_avx2(uint64_t active, signedindex_t first) {
+    const __m256i lane_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    const __m256i bits = _mm256_set1_epi32(int((active >> first) & 0xff));
+    return _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(bits, lane_bits), lane_bits));
+}
+
+__attribute__((target("avx2,fma")))
+static void eval_A_mu_packet_avx2_add_(
+        QueryPacket<float>& packet, uint64_t active, const float* source_point, const float* mu, bool continuous_kernel) {
+    const __m256 px = _mm256_set1_ps(source_point[0]);
+    const __m256 py = _mm256_set1_ps(source_point[1]);
+    const __m256 pz = _mm256_set1_ps(source_point[2]);
+    const __m256 mx = _mm256_set1_ps(mu[0]);
+    const __m256 my = _mm256_set1_ps(mu[1]);
+    const __m256 mz = _mm256_set1_ps(mu[2]);
+    const __m256 one = _mm256_set1_ps(1.0f);
+
+    for (signedindex_t i = 0; i < packet.num_queries; i += 8) {
+        if (((active >> i) & 0xff) == 0) {
+            continue;
+        }
+        const __m256 mask = active_mask_avx2(active, i);
+        __m256 dx = _mm256_sub_ps(_mm256_load_ps(packet.coords[0] + i), px);
+        __m256 dy = _mm256_sub_ps(_mm256_load_ps(packet.coords[1] + i), py);
+        __m256 dz = _mm256_sub_ps(_mm256_load_ps(packet.coords[2] + i), pz);
+        __m256 dist2 = _mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx)));
+        __m256 dot = _mm256_fmadd_ps(dz, mz, _mm256_fmadd_ps(dy, my, _mm256_mul_ps(dx, mx)));
+        __m256 width = _mm256_load_ps(packet.widths + i);
+        __m256 width2 = _mm256_mul_ps(width, width);
+
+        __m256 inv_dist = inv_dist_avx2(dist2);
+        __m256 inv_dist3 = _mm256_mul_ps(_mm256_mul_ps(inv_dist, inv_dist), inv_dist);
+        __m256 inv_width3 = continuous_kernel ? _mm256_div_ps(one, _mm256_mul_ps(width2, width)) : _mm256_setzero_ps();
+        __m256 outside = _mm256_cmp_ps(dist2, width2, _CMP_GE_OQ);
+        __m256 scale = _mm256_blendv_ps(inv_width3, inv_dist3, outside);
+        __m256 out = _mm256_load_ps(packet.out[0] + i);
+        _mm256_store_ps(packet.out[0] + i, _mm256_blendv_ps(out, _mm256_fnmadd_ps(dot, scale, out), mask));
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void eval_AT_s_packet_avx2_add_(
+        QueryPacket<float>& packet, uint64_t active, const float* source_point, const float* s) {
+    const __m256 px = _mm256_set1_ps(source_point[0]);
+    const __m256 py = _mm256_set1_ps(source_point[1]);
+    const __m256 pz = _mm256_set1_ps(source_point[2]);
+    const __m256 ss = _mm256_set1_ps(*s);
+
+    for (signedindex_t i = 0; i < packet.num_queries; i += 8) {
+        if (((active >> i) & 0xff) == 0) {
+            continue;
+        }
+        const __m256 mask = active_mask_avx2(active, i);
+        __m256 dx = _mm256_sub_ps(_mm256_load_ps(packet.coords[0] + i), px);
+        __m256 dy = _mm256_sub_ps(_mm256_load_ps(packet.coords[1] + i), py);
+        __m256 dz = _mm256_sub_ps(_mm256_load_ps(packet.coords[2] + i), pz);
+        __m256 dist2 = _mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx)));
+        __m256 width = _mm256_load_ps(packet.widths + i);
+
+        __m256 inv_dist = inv_dist_avx2(dist2);
+        __m256 inv_dist3 = _mm256_mul_ps(_mm256_mul_ps(inv_dist, inv_dist), inv_dist);
+        __m256 outside = _mm256_and_ps(_mm256_cmp_ps(dist2, _mm256_mul_ps(width, width), _CMP_GE_OQ), mask);
+        __m256 coef = _mm256_mul_ps(ss, inv_dist3);
+        __m256 out_x = _mm256_load_ps(packet.out[0] + i);
+        __m256 out_y = _mm256_load_ps(packet.out[1] + i);
+        __m256 out_z = _mm256_load_ps(packet.out[2] + i);
+        _mm256_store_ps(packet.out[0] + i, _mm256_blendv_ps(out_x, _mm256_fmadd_ps(dx, coef, out_x), outside));
+        _mm256_store_ps(packet.out[1] + i, _mm256_blendv_ps(out_y, _mm256_fmadd_ps(dy, coef, out_y), outside));
+        _mm256_store_ps(packet.out[2] + i, _mm256_blendv_ps(out_z, _mm256_fmadd_ps(dz, coef, out_z), outside));
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void eval_G_mu_packet_avx2_add_(
+        QueryPacket<float>& packet, uint64_t active, const float* source_point, const float* mu) {
+    const __m256 px = _mm256_set1_ps(source_point[0]);
+    const __m256 py = _mm256_set1_ps(source_point[1]);
+    const __m256 pz = _mm256_set1_ps(source_point[2]);
+    const __m256 mx = _mm256_set1_ps(mu[0]);
+    const __m256 my = _mm256_set1_ps(mu[1]);
+    const __m256 mz = _mm256_set1_ps(mu[2]);
+    const __m256 three = _mm256_set1_ps(3.0f);
+
+    for (signedindex_t i = 0; i < packet.num_queries; i += 8) {
+        if (((active >> i) & 0xff) == 0) {
+            continue;
+        }
+        const __m256 mask = active_mask_avx2(active, i);
+        __m256 dx = _mm256_sub_ps(_mm256_load_ps(packet.coords[0] + i), px);
+        __m256 dy = _mm256_sub_ps(_mm256_load_ps(packet.coords[1] + i), py);
+        __m256 dz = _mm256_sub_ps(_mm256_load_ps(packet.coords[2] + i), pz);
+        __m256 dist2 = _mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx)));
+        __m256 dot = _mm256_fmadd_ps(dz, mz, _mm256_fmadd_ps(dy, my, _mm256_mul_ps(dx, mx)));
+        __m256 width = _mm256_load_ps(packet.widths + i);
+
+        __m256 inv_dist = inv_dist_avx2(dist2);
+        __m256 inv_dist2 = _mm256_mul_ps(inv_dist, inv_dist);
+        __m256 outside = _mm256_and_ps(_mm256_cmp_ps(dist2, _mm256_mul_ps(width, width), _CMP_GE_OQ), mask);
+        __m256 inv_dist3 = _mm256_mul_ps(inv_dist2, inv_dist);
+        // mu / d^3 - 3 (x - y) (x - y).mu / d^5
+        __m256 coef = _mm256_mul_ps(_mm256_mul_ps(three, dot), _mm256_mul_ps(inv_dist3, inv_dist2));
+        __m256 out_x = _mm256_load_ps(packet.out[0] + i);
+        __m256 out_y = _mm256_load_ps(packet.out[1] + i);
+        __m256 out_z = _mm256_load_ps(packet.out[2] + i);
+        _mm256_store_ps(packet.out[0] + i, _mm256_blendv_ps(out_x, _mm256_fnmadd_ps(dx, coef, _mm256_fmadd_ps(mx, inv_dist3, out_x)), outside));
+        _mm256_store_ps(packet.out[1] + i, _mm256_blendv_ps(out_y, _mm256_fnmadd_ps(dy, coef, _mm256_fmadd_ps(my, inv_dist3, out_y)), outside));
+        _mm256_store_ps(packet.out[2] + i, _mm256_blendv_ps(out_z, _mm256_fnmadd_ps(dz, coef, _mm256_fmadd_ps(mz, inv_dist3, out_z)), outside));
+    }
+}
+
+
+//////////////////// AVX-512 ////////////////////
+/// @note same as AVX2 with 16 points per step
+// some GCC versions warn about _mm512_undefined_ps() inside their own intrinsics
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+__attribute__((target("avx512f")))
+static inline __m512 inv_dist_avx512(__m512 dist2) {
+    // rsqrt14 is good to ~14 bits, one Newton step brings it to full float precision
+    __m512 r = _mm512_rsqrt14_ps(dist2);
+    __m512 half_dist2_r = _mm512_mul_ps(_mm512_mul_ps(_mm512_set1_ps(0.5f), dist2), r);
+    return _mm512_mul_ps(r, _mm512_fnmadd_ps(half_dist2_r, r, _mm512_set1_ps(1.5f)));
+}
+
+__attribute__((target("avx512f")))
+static inline __mmask16 tail_mask_avx512(signedindex_t num_left) {
+    return num_left >= 16 ? __mmask16(0xffff) : __mmask16((1u << num_left) - 1);
+}
+
+__attribute__((target("avx512f")))
+static inline float reduce_add_avx512(__m512 v) {
+    v = _mm512_add_ps(v, _mm512_shuffle_f32x4(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm512_add_ps(v, _mm512_shuffle_f32x4(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+    __m128 s = _mm512_castps512_ps128(v);
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_movehdup_ps(s));
+    return _mm_cvtss_f32(s);
+}
+
+__attribute__((target("avx512f")))
+static void eval_A_mu_block_avx512_add_(
+        float& out_val, const float* query_point, float smooth_width, bool continuous_kernel,
+        const NearFieldBlock<float>& block) {
+    const __m512 qx = _mm512_set1_ps(query_point[0]);
+    const __m512 qy = _mm512_set1_ps(query_point[1]);
+    const __m512 qz = _mm512_set1_ps(query_point[2]);
+    const __m512 width2 = _mm512_set1_ps(smooth_width * smooth_width);
+    const __m512 inv_width3 = _mm512_set1_ps(continuous_kernel ? 1.0f / (smooth_width * smooth_width * smooth_width) : 0.0f);
+    const float* xs = block.coords[0];
+    const float* ys = block.coords[1];
+    const float* zs = block.coords[2];
+    const float* mxs = block.attrs[block.attr_offset];
+    const float* mys = block.attrs[block.attr_offset + 1];
+    const float* mzs = block.attrs[block.attr_offset + 2];
+
+    __m512 acc = _mm512_setzero_ps();
+    for (signedindex_t i = 0; i < block.num_points; i += 16) {
+        const __mmask16 mask = tail_mask_avx512(block.num_points - i);
+        __m512 dx = _mm512_sub_ps(qx, _mm512_maskz_loadu_ps(mask, xs + i));
+        __m512 dy = _mm512_sub_ps(qy, _mm512_maskz_loadu_ps(mask, ys + i));
+        __m512 dz = _mm512_sub_ps(qz, _mm512_maskz_loadu_ps(mask, zs + i));
+        __m512 dist2 = _mm512_fmadd_ps(dz, dz, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dx, dx)));
+        __m512 dot = _mm512_fmadd_ps(dz, _mm512_maskz_loadu_ps(mask, mzs + i),
+                     _mm512_fmadd_ps(dy, _mm512_maskz_loadu_ps(mask, mys + i),
+                     _mm512_mul_ps(dx, _mm512_maskz_loadu_ps(mask, mxs + i))));
+
+        __m512 inv_dist = inv_dist_avx512(dist2);
+        __m512 inv_dist3 = _mm512_mul_ps(_mm512_mul_ps(inv_dist, inv_dist), inv_dist);
+        __mmask16 outside = _mm512_cmp_ps_mask(dist2, width2, _CMP_GE_OQ);
+        __m512 scale = _mm512_maskz_mov_ps(mask, _mm512_mask_blend_ps(outside, inv_width3, inv_dist3));
+        acc = _mm512_fnmadd_ps(dot, scale, acc);
+    }
+    out_val += reduce_add_avx512(acc);
+}
+
+__attribute__((target("avx512f")))
+static void eval_AT_s_block_avx512_add_(
+        float* out_vec, const float* query_point, float smooth_width,
+        const NearFieldBlock<float>& block) {
+    const __m512 qx = _mm512_set1_ps(query_point[0]);
+    const __m512 qy = _mm512_set1_ps(query_point[1]);
+    const __m512 qz = _mm512_set1_ps(query_point[2]);
+    const __m512 width2 = _mm512_set1_ps(smooth_width * smooth_width);
+    const float* xs = block.coords[0];
+    const float* ys = block.coords[1];
+    const float* zs = block.coords[2];
+    const float* ss = block.attrs[block.attr_offset];
+
+    __m512 acc_x = _mm512_setzero_ps(), acc_y = _mm512_setzero_ps(), acc_z = _mm512_setzero_ps();
+    for (signedindex_t i = 0; i < block.num_points; i += 16) {
+        const __mmask16 mask = tail_mask_avx512(block.num_points - i);
+        __m512 dx = _mm512_sub_ps(qx, _mm512_maskz_loadu_ps(mask, xs + i));
+        __m512 dy = _mm512_sub_ps(qy, _mm512_maskz_loadu_ps(mask, ys + i));
+        __m512 dz = _mm512_sub_ps(qz, _mm512_maskz_loadu_ps(mask, zs + i));
+        __m512 dist2 = _mm512_fmadd_ps(dz, dz, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dx, dx)));
+
+        __m512 inv_dist = inv_dist_avx512(dist2);
+        __m512 inv_dist3 = _mm512_mul_ps(_mm512_mul_ps(inv_dist, inv_dist), inv_dist);
+        __mmask16 outside = _mm512_cmp_ps_mask(dist2, width2, _CMP_GE_OQ) & mask;
+        __m512 coef = _mm512_maskz_mul_ps(outside, _mm512_maskz_loadu_ps(mask, ss + i), inv_dist3);
+        acc_x = _mm512_fmadd_ps(dx, coef, acc_x);
+        acc_y = _mm512_fmadd_ps(dy, coef, acc_y);
+        acc_z = _mm512_fmadd_ps(dz, coef, acc_z);
+    }
+    out_vec[0] += reduce_add_avx512(acc_x);
+    out_vec[1] += reduce_add_avx512(acc_y);
+    out_vec[2] += reduce_add_avx512(acc_z);
+}
+
+__attribute__((target("avx512f")))
+static void eval_G_mu_block_avx512_add_(
+        float* out_vec, const float* query_point, float smooth_width,
+        const NearFieldBlock<float>& block) {
+    const __m512 qx = _mm512_set1_ps(query_point[0]);
+    const __m512 qy = _mm512_set1_ps(query_point[1]);
+    const __m512 qz = _mm512_set1_ps(query_point[2]);
+    const __m512 width2 = _mm512_set1_ps(smooth_width * smooth_width);
+    const __m512 three = _mm512_set1_ps(3.0f);
+    const float* xs = block.coords[0];
+    const float* ys = block.coords[1];
+    const float* zs = block.coords[2];
+    const float* mxs = block.attrs[block.attr_offset];
+    const float* mys = block.attrs[block.attr_offset + 1];
+    const float* mzs = block.attrs[block.attr_offset + 2];
+
+    __m512 acc_x = _mm512_setzero_ps(), acc_y = _mm512_setzero_ps(), acc_z = _mm512_setzero_ps();
+    for (signedindex_t i = 0; i < block.num_points; i += 16) {
+        const __mmask16 mask = tail_mask_avx512(block.num_points - i);
+        __m512 dx = _mm512_sub_ps(qx, _mm512_maskz_loadu_ps(mask, xs + i));
+        __m512 dy = _mm512_sub_ps(qy, _mm512_maskz_loadu_ps(mask, ys + i));
+        __m512 dz = _mm512_sub_ps(qz, _mm512_maskz_loadu_ps(mask, zs + i));
+        __m512 mx = _mm512_maskz_loadu_ps(mask, mxs + i);
+        __m512 my = _mm512_maskz_loadu_ps(mask, mys + i);
+        __m512 mz = _mm512_maskz_loadu_ps(mask, mzs + i);
+        __m512 dist2 = _mm512_fmadd_ps(dz, dz, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dx, dx)));
+        __m512 dot = _mm512_fmadd_ps(dz, mz, _mm512_fmadd_ps(dy, my, _mm512_mul_ps(dx, mx)));
+
+        __m512 inv_dist = inv_dist_avx512(dist2);
+        __m512 inv_dist2 = _mm512_mul_ps(inv_dist, inv_dist);
+        __mmask16 outside = _mm512_cmp_ps_mask(dist2, width2, _CMP_GE_OQ) & mask;
+        __m512 inv_dist3 = _mm512_maskz_mul_ps(outside, inv_dist2, inv_dist);
+        // mu / d^3 - 3 (x - y) (x - y).mu / d^5
+        __m512 coef = _mm512_maskz_mul_ps(outside, _mm512_mul_ps(three, dot), _mm512_mul_ps(inv_dist3, inv_dist2));
+        acc_x = _mm512_fnmadd_ps(dx, coef, _mm512_fmadd_ps(mx, inv_dist3, acc_x));
+        acc_y = _mm512_fnmadd_ps(dy, coef, _mm512_fmadd_ps(my, inv_dist3, acc_y));
+        acc_z = _mm512_fnmadd_ps(dz, coef, _mm512_fmadd_ps(mz, inv_dist3, acc_z));
+    }
+    out_vec[0] += reduce_add_avx512(acc_x);
+    out_vec[1] += reduce_add_avx512(acc_y);
+    out_vec[2] += reduce_add_avx512(acc_z);
+}
+
+__attribute__((target("avx512f")))
+static void eval_A_mu_packet_avx512_add_(
+        QueryPacket<float>& packet, uint64_t active, const float* source_point, const float* mu, bool continuous_kernel) {
+    const __m512 px = _mm512_set1_ps(source_point[0]);
+    const __m512 py = _mm512_set1_ps(source_point[1]);
+    const __m512 pz = _mm512_set1_ps(source_point[2]);
+    const __m512 mx = _mm512_set1_ps(mu[0]);
+    const __m512 my = _mm512_set1_ps(mu[1]);
+    const __m512 mz = _mm512_set1_ps(mu[2]);
+    const __m512 one = _mm512_set1_ps(1.0f);
+
+    for (signedindex_t i = 0; i < packet.num_queries; i += 16) {
+        const __mmask16 mask = __mmask16((active >> i) & 0xffff);
+        if (mask == 0) {
+            continue;
+        }
+        __m512 dx = _mm512_sub_ps(_mm512_load_ps(packet.coords[0] + i), px);
+        __m512 dy = _mm512_sub_ps(_mm512_load_ps(packet.coords[1] + i), py);
+        __m512 dz = _mm512_sub_ps(_mm512_load_ps(packet.coords[2] + i), pz);
+        __m512 dist2 = _mm512_fmadd_ps(dz, dz, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dx, dx)));
+        __m512 dot = _mm512_fmadd_ps(dz, mz, _mm512_fmadd_ps(dy, my, _mm512_mul_ps(dx, mx)));
+        __m512 width = _mm512_load_ps(packet.widths + i);
+        __m512 width2 = _mm512_mul_ps(width, width);
+
+        __m512 inv_dist = inv_dist_avx512(dist2);
+        __m512 inv_dist3 = _mm512_mul_ps(_mm512_mul_ps(inv_dist, inv_dist), inv_dist);
+        __m512 inv_width3 = continuous_kernel ? _mm512_div_ps(one, _mm512_mul_ps(width2, width)) : _mm512_setzero_ps();
+        __mmask16 outside = _mm512_cmp_ps_mask(dist2, width2, _CMP_GE_OQ);
+        __m512 scale = _mm512_mask_blend_ps(outside, inv_width3, inv_dist3);
+        __m512 out = _mm512_load_ps(packet.out[0] + i);
+        _mm512_store_ps(packet.out[0] + i, _mm512_mask_mov_ps(out, mask, _mm512_fnmadd_ps(dot, scale, out)));
+    }
+}
+
+__attribute__((target("avx512f")))
+static void eval_AT_s_packet_avx512_add_(
+        QueryPacket<float>& packet, uint64_t active, const float* source_point, const float* s) {
+    const __m512 px = _mm512_set1_ps(source_point[0]);
+    const __m512 py = _mm512_set1_ps(source_point[1]);
+    const __m512 pz = _mm512_set1_ps(source_point[2]);
+    const __m512 ss = _mm512_set1_ps(*s);
+
+    for (signedindex_t i = 0; i < packet.num_queries; i += 16) {
+        const __mmask16 mask = __mmask16((active >> i) & 0xffff);
+        if (mask == 0) {
+            continue;
+        }
+        __m512 dx = _mm512_sub_ps(_mm512_load_ps(packet.coords[0] + i), px);
+        __m512 dy = _mm512_sub_ps(_mm512_load_ps(packet.coords[1] + i), py);
+        __m512 dz = _mm512_sub_ps(_mm512_load_ps(packet.coords[2] + i), pz);
+        __m512 dist2 = _mm512_fmadd_ps(dz, dz, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dx, dx)));
+        __m512 width = _mm512_load_ps(packet.widths + i);
+
+        __m512 inv_dist = inv_dist_avx512(dist2);
+        __m512 inv_dist3 = _mm512_mul_ps(_mm512_mul_ps(inv_dist, inv_dist), inv_dist);
+        __mmask16 outside = _mm512_cmp_ps_mask(dist2, _mm512_mul_ps(width, width), _CMP_GE_OQ) & mask;
+        __m512 coef = _mm512_mul_ps(ss, inv_dist3);
+        __m512 out_x = _mm512_load_ps(packet.out[0] + i);
+        __m512 out_y = _mm512_load_ps(packet.out[1] + i);
+        __m512 out_z = _mm512_load_ps(packet.out[2] + i);
+        _mm512_store_ps(packet.out[0] + i, _mm512_mask_mov_ps(out_x, outside, _mm512_fmadd_ps(dx, coef, out_x)));
+        _mm512_store_ps(packet.out[1] + i, _mm512_mask_mov_ps(out_y, outside, _mm512_fmadd_ps(dy, coef, out_y)));
+        _mm512_store_ps(packet.out[2] + i, _mm512_mask_mov_ps(out_z, outside, _mm512_fmadd_ps(dz, coef, out_z)));
+    }
+}
+
+__attribute__((target("avx512f")))
+static void eval_G_mu_packet_avx512_add_(
+        QueryPacket<float>& packet, uint64_t active, const float* source_point, const float* mu) {
+    const __m512 px = _mm512_set1_ps(source_point[0]);
+    const __m512 py = _mm512_set1_ps(source_point[1]);
+    const __m512 pz = _mm512_set1_ps(source_point[2]);
+    const __m512 mx = _mm512_set1_ps(mu[0]);
+    const __m512 my = _mm512_set1_ps(mu[1]);
+    const __m512 mz = _mm512_set1_ps(mu[2]);
+    const __m512 three = _mm512_set1_ps(3.0f);
+
+    for (signedindex_t i = 0; i < packet.num_queries; i += 16) {
+        const __mmask16 mask = __mmask16((active >> i) & 0xffff);
+        if (mask == 0) {
+            continue;
+        }
+        __m512 dx = _mm512_sub_ps(_mm512_load_ps(packet.coords[0] + i), px);
+        __m512 dy = _mm512_sub_ps(_mm512_load_ps(packet.coords[1] + i), py);
+        __m512 dz = _mm512_sub_ps(_mm512_load_ps(packet.coords[2] + i), pz);
+        __m512 dist2 = _mm512_fmadd_ps(dz, dz, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dx, dx)));
+        __m512 dot = _mm512_fmadd_ps(dz, mz, _mm512_fmadd_ps(dy, my, _mm512_mul_ps(dx, mx)));
+        __m512 width = _mm512_load_ps(packet.widths + i);
+
+        __m512 inv_dist = inv_dist_avx512(dist2);
+        __m512 inv_dist2 = _mm512_mul_ps(inv_dist, inv_dist);
+        __mmask16 outside = _mm512_cmp_ps_mask(dist2, _mm512_mul_ps(width, width), _CMP_GE_OQ) & mask;
+        __m512 inv_dist3 = _mm512_mul_ps(inv_dist2, inv_dist);
+        // mu / d^3 - 3 (x - y) (x - y).mu / d^5
+        __m512 coef = _mm512_mul_ps(_mm512_mul_ps(three, dot), _mm512_mul_ps(inv_dist3, inv_dist2));
+        __m512 out_x = _mm512_load_ps(packet.out[0] + i);
+        __m512 out_y = _mm512_load_ps(packet.out[1] + i);
+        __m512 out_z = _mm512_load_ps(packet.out[2] + i);
+        _mm512_store_ps(packet.out[0] + i, _mm512_mask_mov_ps(out_x, outside, _mm512_fnmadd_ps(dx, coef, _mm512_fmadd_ps(mx, inv_dist3, out_x))));
+        _mm512_store_ps(packet.out[1] + i, _mm512_mask_mov_ps(out_y, outside, _mm512_fnmadd_ps(dy, coef, _mm512_fmadd_ps(my, inv_dist3, out_y))));
+        _mm512_store_ps(packet.out[2] + i, _mm512_mask_mov_ps(out_z, outside, _mm512_fnmadd_ps(dz, coef, _mm512_fmadd_ps(mz, inv_dist3, out_z))));
+    }
+}
+#pragma GCC diagnostic pop
+#endif
+
+
+//////////////////// dispatch ////////////////////
+enum NearFieldISA {
+    NEAR_FIELD_SCALAR = 0,
+    NEAR_FIELD_AVX2 = 1,
+    NEAR_FIELD_AVX512 = 2
+};
+
+/// @note the best the CPU supports, capped by the environment variable WN_TREECODE_NEAR_FIELD_ISA
+//        ("scalar", "avx2" or "avx512") if set
+static NearFieldISA detect_near_field_isa() {
+    NearFieldISA isa = NEAR_FIELD_SCALAR;
+#ifdef WN_TREECODE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        isa = NEAR_FIELD_AVX512;
+    } else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        isa = NEAR_FIELD_AVX2;
+    }
+#endif
+    const char* requested_isa = std::getenv("WN_TREECODE_NEAR_FIELD_ISA");
+    if (requested_isa != nullptr) {
+        if (std::strcmp(requested_isa, "scalar") == 0) {
+            isa = NEAR_FIELD_SCALAR;
+        } else if (std::strcmp(requested_isa, "avx2") == 0 && isa > NEAR_FIELD_AVX2) {
+            isa = NEAR_FIELD_AVX2;
+        }
+    }
+    return isa;
+}
+
+static const NearFieldISA near_field_isa = detect_near_field_isa();
+
+const char* get_near_field_isa() {
+    const char* isa_names[] = {"scalar", "avx2", "avx512"};
+    return isa_names[near_field_isa];
+}
+
+
+template<typename scalar_t>
+void eval_A_mu_block_add_(
+        scalar_t& out_val,
+        const scalar_t* query_point,
+        scalar_t smooth_width,
+        bool continuous_kernel,
+        const NearFieldBlock<scalar_t>& block
+    ) {
+#ifdef WN_TREECODE_X86_SIMD
+    if constexpr (std::is_same<scalar_t, float>::value) {
+        if (near_field_isa == NEAR_FIELD_AVX512) {
+            eval_A_mu_block_avx512_add_(out_val, query_point, smooth_width, continuous_kernel, block);
+            return;
+        } else if (near_field_isa == NEAR_FIELD_AVX2) {
+            eval_A_mu_block_avx2_add_(out_val, query_point, smooth_width, continuous_kernel, block);
+            return;
+        }
+    }
+#endif
+    eval_A_mu_block_scalar_add_<scalar_t>(out_val, query_point, smooth_width, continuous_kernel, block);
+}
+
+template<typename scalar_t>
+void eval_AT_s_block_add_(
+        scalar_t* out_vec,
+        const scalar_t* query_point,
+        scalar_t smooth_width,
+        const NearFieldBlock<scalar_t>& block
+    ) {
+#ifdef WN_TREECODE_X86_SIMD
+    if constexpr (std::is_same<scalar_t, float>::value) {
+        if (near_field_isa == NEAR_FIELD_AVX512) {
+            eval_AT_s_block_avx512_add_(out_vec, query_point, smooth_width, block);
+            return;
+        } else if (near_field_isa == NEAR_FIELD_AVX2) {
+            eval_AT_s_block_avx2_add_(out_vec, query_point, smooth_width, block);
+            return;
+        }
+    }
+#endif
+    eval_AT_s_block_scalar_add_<scalar_t>(out_vec, query_point, smooth_width, block);
+}
+
+template<typename scalar_t>
+void eval_G_mu_block_add_(
+        scalar_t* out_vec,
+        const scalar_t* query_point,
+        scalar_t smooth_width,
+        const NearFieldBlock<scalar_t>& block
+    ) {
+#ifdef WN_TREECODE_X86_SIMD
+    if constexpr (std::is_same<scalar_t, float>::value) {
+        if (near_field_isa == NEAR_FIELD_AVX512) {
+            eval_G_mu_block_avx512_add_(out_vec, query_point, smooth_width, block);
+            return;
+        } else if (near_field_isa == NEAR_FIELD_AVX2) {
+            eval_G_mu_block_avx2_add_(out_vec, query_point, smooth_width, block);
+            return;
+        }
+    }
+#endif
+    eval_G_mu_block_scalar_add_<scalar_t>(out_vec, query_point, smooth_width, block);
+}
+
+template<typename scalar_t>
+void eval_A_mu_packet_add_(
+        QueryPacket<scalar_t>& packet,
+        uint64_t active,
+        const scalar_t* source_point,
+        const scalar_t* mu,
+        bool continuous_kernel
+    ) {
+#ifdef WN_TREECODE_X86_SIMD
+    if constexpr (std::is_same<scalar_t, float>::value) {
+        if (near_field_isa == NEAR_FIELD_AVX512) {
+            eval_A_mu_packet_avx512_add_(packet, active, source_point, mu, continuous_kernel);
+            return;
+        } else if (near_field_isa == NEAR_FIELD_AVX2) {
+            eval_A_mu_packet_avx2_add_(packet, active, source_point, mu, continuous_kernel);
+            return;
+        }
+    }
+#endif
+    eval_A_mu_packet_scalar_add_<scalar_t>(packet, active, source_point, mu, continuous_kernel);
+}
+
+template<typename scalar_t>
+void eval_AT_s_packet_add_(
+        QueryPacket<scalar_t>& packet,
+        uint64_t active,
+        const scalar_t* source_point,
+        const scalar_t* s
+    ) {
+#ifdef WN_TREECODE_X86_SIMD
+    if constexpr (std::is_same<scalar_t, float>::value) {
+        if (near_field_isa == NEAR_FIELD_AVX512) {
+            eval_AT_s_packet_avx512_add_(packet, active, source_point, s);
+            return;
+        } else if (near_field_isa == NEAR_FIELD_AVX2) {
+            eval_AT_s_packet_avx2_add_(packet, active, source_point, s);
+            return;
+        }
+    }
+#endif
+    eval_AT_s_packet_scalar_add_<scalar_t>(packet, active, source_point, s);
+}
+
+template<typename scalar_t>
+void eval_G_mu_packet_add_(
+        QueryPacket<scalar_t>& packet,
+        uint64_t active,
+        const scalar_t* source_point,
+        const scalar_t* mu
+    ) {
+#ifdef WN_TREECODE_X86_SIMD
+    if constexpr (std::is_same<scalar_t, float>::value) {
+        if (near_field_isa == NEAR_FIELD_AVX512) {
+            eval_G_mu_packet_avx512_add_(packet, active, source_point, mu);
+            return;
+        } else if (near_field_isa == NEAR_FIELD_AVX2) {
+            eval_G_mu_packet_avx2_add_(packet, active, source_point, mu);
+            return;
+        }
+    }
+#endif
+    eval_G_mu_packet_scalar_add_<scalar_t>(packet, active, source_point, mu);
+}
+
+
+//////////// instantiation ////////////
+auto ptr_gather_points_soa_cpu_float  = gather_points_soa_cpu<float>;
+auto ptr_gather_points_soa_cpu_double = gather_points_soa_cpu<double>;
+auto ptr_eval_A_mu_block_add_float  = eval_A_mu_block_add_<float>;
+auto ptr_eval_A_mu_block_add_double = eval_A_mu_block_add_<double>;
+auto ptr_eval_AT_s_block_add_float  = eval_AT_s_block_add_<float>;
+auto ptr_eval_AT_s_block_add_double = eval_AT_s_block_add_<double>;
+auto ptr_eval_G_mu_block_add_float  = eval_G_mu_block_add_<float>;
+auto ptr_eval_G_mu_block_add_double = eval_G_mu_block_add_<double>;
+auto ptr_eval_A_mu_packet_add_float  = eval_A_mu_packet_add_<float>;
+auto ptr_eval_A_mu_packet_add_double = eval_A_mu_packet_add_<double>;
+auto ptr_eval_AT_s_packet_add_float  = eval_AT_s_packet_add_<float>;
+auto ptr_eval_AT_s_packet_add_double = eval_AT_s_packet_add_<double>;
+auto ptr_eval_G_mu_packet_add_float  = eval_G_mu_packet_add_<float>;
+auto ptr_eval_G_mu_packet_add_double = eval_G_mu_packet_add_<double>;
+auto ptr_gather_points_soa_cpu_float_int32  = gather_points_soa_cpu<float, int32_t>;
+auto ptr_gather_points_soa_cpu_double_int32 = gather_points_soa_cpu<double, int32_t>;
@@ -30,78 +30,135 @@ SOFTWARE.
 #define CHECK_CONTIGUOUS(x) TORCH_CHECK(x.is_contiguous(), #x " must be contiguous")
 #define CHECK_INPUT_FOR_CUDA(x) CHECK_CUDA(x); CHECK_CONTIGUOUS(x)
 #define CHECK_INPUT_FOR_CPU(x) CHECK_CPU(x); CHECK_CONTIGUOUS(x)
+// the packed nodes of the per-query traversals hold int32 node and point indices, see PackedNode
+#define CHECK_PACKED_TREE_SIZE(points, node_is_leaf_list) \
+    TORCH_CHECK(points.size(0) <= std::numeric_limits<int32_t>::max() && node_is_leaf_list.size(0) <= std::numeric_limits<int32_t>::max(), \
+                "the per-query traversals support at most INT32_MAX points and nodes")
 
 #include "wn_treecode_cpu.h"
 #include <vector>
+#include <limits>
 #include <fstream>
+#include <string>
+#include <tuple>
+#include <cmath>
+#include <algorithm>
+#include <limits>
 
 #define NUM_OCT_CHILDREN 8
 typedef long signedindex_t;
 
+// similar to AT_DISPATCH_FLOATING_TYPES, also defines index_t from the dtype of the tree tensors, int32 or int64 (see build_tree)
+#define DISPATCH_FLOATING_AND_INDEX_TYPES(TYPE, INDEX_TYPE, NAME, ...)                                  \
+    [&] {                                                                                              \
+        if ((INDEX_TYPE) == torch::kInt) {                                                             \
+            using index_t = int32_t;                                                                   \
+            AT_DISPATCH_FLOATING_TYPES(TYPE, NAME, __VA_ARGS__);                                       \
+        } else {                                                                                       \
+            TORCH_CHECK((INDEX_TYPE) == torch::kLong, NAME, ": the tree tensors must be int32 or int64"); \
+            using index_t = signedindex_t;                                                             \
+            AT_DISPATCH_FLOATING_TYPES(TYPE, NAME, __VA_ARGS__);                                       \
+        }                                                                                              \
+    }()
+
+// the traversal caches of a tree (see prepare_tree_traversal_cache_cpu), one for each dtype its points may have
+typedef std::tuple<TreeTraversalCache<float>, TreeTraversalCache<double>> TraversalCaches;
+
 template<typename scalar_t>
-std::vector<torch::Tensor> build_tree_cpu(torch::Tensor points_tensor, signedindex_t max_depth) {
+const TreeTraversalCache<scalar_t>* get_traversal_cache(const TraversalCaches* traversal_caches) {
+    return traversal_caches ? &std::get<TreeTraversalCache<scalar_t>>(*traversal_caches) : nullptr;
+}
 
-    const auto num_points = points_tensor.size(0);
-    std::vector<signedindex_t> point_indices(num_points);
-    for (signedindex_t i = 0; i < num_points; i++) {
-        point_indices[i] = i;
-    }
+// the launcher workspaces of a scatter (see TraversalWorkspace), one for each dtype
+typedef std::tuple<TraversalWorkspace<float>, TraversalWorkspace<double>> TraversalWorkspaces;
 
-    signedindex_t cur_node_index = 0;
-    auto root = build_tree_cpu_recursive<scalar_t>(
-        points_tensor.data<scalar_t>(),
-        point_indices,
-        /*parent = */nullptr,
-        /*c_x, c_y, c_z = */0.0, 0.0, 0.0,
-        /*half_width = */1.0,
-        /*depth = */0,
-        /*cur_node_index = */cur_node_index,
-        /*max_depth = */max_depth,
-        /*max_points_per_node*/1
-    );
+template<typename scalar_t>
+TraversalWorkspace<scalar_t>* get_traversal_workspace(TraversalWorkspaces* traversal_workspaces) {
+    return traversal_workspaces ? &std::get<TraversalWorkspace<scalar_t>>(*traversal_workspaces) : nullptr;
+}
 
-    signedindex_t num_nodes = 0;
-    signedindex_t num_leaves = 0;
-    signedindex_t tree_depth = 0;
-    compute_tree_attributes<scalar_t>(root, num_nodes, num_leaves, tree_depth);
-    std::cout << "num_nodes: " << num_nodes << ", num_leaves: " << num_leaves << ", tree depth: " << tree_depth << "\n";
+void invalidate_traversal_workspaces(TraversalWorkspaces& traversal_workspaces) {
+    std::get<TraversalWorkspace<float>>(traversal_workspaces).invalidate();
+    std::get<TraversalWorkspace<double>>(traversal_workspaces).invalidate();
+}
 
-    // debug_output_grid_corners("debug_grid.obj", root);
+template<typename scalar_t, typename index_t>
+std::vector<torch::Tensor> serialize_tree_cpu(const LinearOctree<scalar_t>& tree, torch::Tensor points_tensor, torch::ScalarType index_dtype) {
 
-    auto long_tensor_options = torch::TensorOptions().dtype(torch::kLong);
-    auto node_parent_list = torch::zeros({num_nodes}, long_tensor_options);
-    auto node_children_list = torch::zeros({num_nodes, NUM_OCT_CHILDREN}, long_tensor_options);
+    const auto num_points = points_tensor.size(0);
+    signedindex_t num_nodes = tree.num_nodes;
+    signedindex_t tree_depth = tree.tree_depth;
+
+    auto index_tensor_options = torch::TensorOptions().dtype(index_dtype);
+    auto node_parent_list = torch::zeros({num_nodes}, index_tensor_options);
+    auto node_children_list = torch::zeros({num_nodes, NUM_OCT_CHILDREN}, index_tensor_options);
     
     auto bool_tensor_options = torch::TensorOptions().dtype(torch::kBool);
     auto node_is_leaf_list = torch::zeros({num_nodes}, bool_tensor_options);
 
-    auto num_points_in_node = torch::zeros({num_nodes}, long_tensor_options);
-    auto node2point_indexstart = torch::zeros({num_nodes}, long_tensor_options);
-    std::vector<signedindex_t> stdvec_node2point_index;
+    auto num_points_in_node = torch::zeros({num_nodes}, index_tensor_options);
+    auto node2point_indexstart = torch::zeros({num_nodes}, index_tensor_options);
+    auto node2point_index = torch::zeros({num_points}, index_tensor_options);
 
     auto float_tensor_options = torch::TensorOptions().dtype(points_tensor.dtype());
     auto node_half_w_list = torch::zeros({num_nodes}, float_tensor_options);
 
-    serialize_tree_recursive(root,
-                             node_parent_list.data<signedindex_t>(),
-                             node_children_list.data<signedindex_t>(),
-                             node_is_leaf_list.data<bool>(),
-                             node_half_w_list.data<scalar_t>(),
-                             num_points_in_node.data<signedindex_t>(),
-                             node2point_indexstart.data<signedindex_t>(),
-                             stdvec_node2point_index);
+    serialize_linear_octree<scalar_t, index_t>(tree,
+                                               node_parent_list.data<index_t>(),
+                                               node_children_list.data<index_t>(),
+                                               node_is_leaf_list.data<bool>(),
+                                               node_half_w_list.data<scalar_t>(),
+                                               num_points_in_node.data<index_t>(),
+                                               node2point_indexstart.data<index_t>(),
+                                               node2point_index.data<index_t>());
+
+    // per-level node ranges, used by the bottom-up sweep in scatter_point_attrs_to_nodes
+    auto node_level_order = torch::zeros({num_nodes}, index_tensor_options);
+    auto node_level_offsets = torch::zeros({tree_depth+2}, index_tensor_options);
+    compute_node_level_order<index_t>(node_parent_list.data<index_t>(),
+                                      node_level_order.data<index_t>(),
+                                      node_level_offsets.data<index_t>(),
+                                      num_nodes,
+                                      tree_depth);
+
+    return {node_parent_list, node_children_list, node_is_leaf_list, node_half_w_list, num_points_in_node, node2point_index, node2point_indexstart, node_level_order, node_level_offsets};
+}
+
+template<typename scalar_t>
+std::vector<torch::Tensor> build_tree_cpu(torch::Tensor points_tensor, signedindex_t max_depth, signedindex_t num_threads, signedindex_t leaf_size, bool int32_indices) {
 
-    auto node2point_index = torch::zeros({stdvec_node2point_index.size()}, long_tensor_options);
-    std::memcpy(node2point_index.data<signedindex_t>(), stdvec_node2point_index.data(), stdvec_node2point_index.size()*sizeof(signedindex_t));
+    const auto num_points = points_tensor.size(0);
+    TORCH_CHECK(max_depth >= 0 && max_depth <= ALLOWED_MAX_DEPTH, "max_depth must be in [0, ", ALLOWED_MAX_DEPTH, "]");
+    TORCH_CHECK(leaf_size >= 1, "leaf_size must be positive");
 
-    std::cout << "tree_depth*num_points: " << tree_depth*num_points << ", stdvec_node2point_index.size(): " << stdvec_node2point_index.size() << "\n";
+    LinearOctree<scalar_t> tree;
+    build_tree_morton_cpu<scalar_t>(
+        points_tensor.data<scalar_t>(),
+        num_points,
+        max_depth,
+        leaf_size,
+        tree,
+        num_threads
+    );
 
-    free_tree_recursive(root);
+    signedindex_t num_nodes = tree.num_nodes;
+    signedindex_t num_leaves = tree.num_leaves;
+    signedindex_t tree_depth = tree.tree_depth;
+    std::cout << "num_nodes: " << num_nodes << ", num_leaves: " << num_leaves << ", tree depth: " << tree_depth << "\n";
 
-    return {node_parent_list, node_children_list, node_is_leaf_list, node_half_w_list, num_points_in_node, node2point_index, node2point_indexstart};
+    // int32 tree tensors whenever the point and node indices fit, half the memory traffic of the traversals
+    const signedindex_t max_int32 = std::numeric_limits<int32_t>::max();
+    if (int32_indices && num_points <= max_int32 && num_nodes * NUM_OCT_CHILDREN <= max_int32) {
+        return serialize_tree_cpu<scalar_t, int32_t>(tree, points_tensor, torch::kInt);
+    }
+    return serialize_tree_cpu<scalar_t, signedindex_t>(tree, points_tensor, torch::kLong);
 }
 
-std::vector<torch::Tensor> build_tree(torch::Tensor points_tensor, signedindex_t max_depth) {
+/// @note leaves hold up to leaf_size points (more only at max_depth), which the near field of the products sums exactly:
+//        16-64 makes the tree several times smaller, and the products faster and more accurate than the default 1
+/// @note the index tensors (all but node_is_leaf_list and node_half_w_list) are int32 when the points and the nodes fit
+//        and int32_indices, int64 otherwise; every op of this module takes either, the CUDA ops need int64
+std::vector<torch::Tensor> build_tree(torch::Tensor points_tensor, signedindex_t max_depth, signedindex_t num_threads, signedindex_t leaf_size, bool int32_indices) {
     CHECK_INPUT_FOR_CPU(points_tensor);
 
     // similar to  AT_DISPATCH_FLOATING_TYPES
@@ -109,15 +166,18 @@ std::vector<torch::Tensor> build_tree(torch::Tensor points_tensor, signedindex_t
     // RECORD_KERNEL_FUNCTION_DTYPE("build_tree", _st);     // what does this do?
     switch (_st) {
         case torch::ScalarType::Double:
-            return build_tree_cpu<double>(points_tensor, max_depth);
+            return build_tree_cpu<double>(points_tensor, max_depth, num_threads, leaf_size, int32_indices);
         case torch::ScalarType::Float:
-            return build_tree_cpu<float>(points_tensor, max_depth);
+            return build_tree_cpu<float>(points_tensor, max_depth, num_threads, leaf_size, int32_indices);
         default:
             AT_ERROR("build_tree", " not implemented for dtype '", toString(_st), "'");
     }
 }
 
-std::vector<torch::Tensor> scatter_point_attrs_to_nodes(
+/// @note also aggregates the first (expansion_order >= 1) and second (expansion_order >= 2) moments
+//        of the attributes about the node reppoints, returned as [num_nodes, 3, C] and [num_nodes, 3, 3, C]
+//        (empty when not needed), for the multiply_by_* ops with a multipole expansion
+std::vector<torch::Tensor> scatter_point_attrs_to_nodes_with_moments(
         torch::Tensor node_parent_list,
         torch::Tensor node_children_list,
         torch::Tensor points,
@@ -127,7 +187,9 @@ std::vector<torch::Tensor> scatter_point_attrs_to_nodes(
         torch::Tensor node2point_indexstart,
         torch::Tensor num_points_in_node,
         torch::Tensor node_is_leaf_list,
-        signedindex_t tree_depth
+        torch::Tensor node_level_order,
+        torch::Tensor node_level_offsets,
+        signedindex_t expansion_order
         ) {
     
     CHECK_INPUT_FOR_CPU(node_parent_list);
@@ -139,78 +201,79 @@ std::vector<torch::Tensor> scatter_point_attrs_to_nodes(
     CHECK_INPUT_FOR_CPU(node2point_indexstart);
     CHECK_INPUT_FOR_CPU(num_points_in_node);
     CHECK_INPUT_FOR_CPU(node_is_leaf_list);
+    CHECK_INPUT_FOR_CPU(node_level_order);
+    CHECK_INPUT_FOR_CPU(node_level_offsets);
+    TORCH_CHECK(expansion_order >= 0 && expansion_order <= MAX_EXPANSION_ORDER, "expansion_order must be 0, 1 or 2");
 
     signedindex_t num_nodes = node_parent_list.size(0);
-    signedindex_t attr_dim = point_attrs.size(1);
-    assert(attr_dim == SPATIAL_DIM or attr_dim == 1);
-
-    auto bool_tensor_options = torch::TensorOptions().dtype(torch::kBool).device(points.device());
-    auto scattered_mask = torch::zeros({num_nodes}, bool_tensor_options);
-    auto next_to_scatter_mask = torch::zeros({num_nodes}, bool_tensor_options);
+    signedindex_t attr_dim = point_attrs.size(1);   // any C, e.g. K*3 for K right hand sides
+    signedindex_t tree_depth = node_level_offsets.size(0) - 2;
     
     auto float_tensor_options = torch::TensorOptions().dtype(points.dtype()).device(points.device());
     auto out_node_attrs = torch::zeros({num_nodes, point_attrs.size(1)}, float_tensor_options);
     auto out_node_reppoints = torch::zeros({num_nodes, SPATIAL_DIM}, float_tensor_options);
     auto out_node_weights = torch::zeros({num_nodes}, float_tensor_options);
+    auto out_node_moments1 = torch::zeros({expansion_order >= 1 ? num_nodes : 0, SPATIAL_DIM, attr_dim}, float_tensor_options);
+    auto out_node_moments2 = torch::zeros({expansion_order >= 2 ? num_nodes : 0, SPATIAL_DIM, SPATIAL_DIM, attr_dim}, float_tensor_options);
 
-    AT_DISPATCH_FLOATING_TYPES(points.type(), "scatter_point_attrs_to_nodes_leaf_cpu_kernel_launcher", ([&] {
-        scatter_point_attrs_to_nodes_leaf_cpu_kernel_launcher<scalar_t>(
-            node_parent_list.data<signedindex_t>(),
+    DISPATCH_FLOATING_AND_INDEX_TYPES(points.type(), node_children_list.scalar_type(), "scatter_point_attrs_to_nodes_cpu_kernel_launcher", ([&] {
+        scatter_point_attrs_to_nodes_cpu_kernel_launcher<scalar_t, index_t>(
+            node_children_list.data<index_t>(),
             points.data<scalar_t>(),
             point_weights.data<scalar_t>(),
             point_attrs.data<scalar_t>(),
-            node2point_index.data<signedindex_t>(),
-            node2point_indexstart.data<signedindex_t>(),
-            num_points_in_node.data<signedindex_t>(),
+            node2point_index.data<index_t>(),
+            node2point_indexstart.data<index_t>(),
+            num_points_in_node.data<index_t>(),
             node_is_leaf_list.data<bool>(),
-            scattered_mask.data<bool>(),
+            node_level_order.data<index_t>(),
+            node_level_offsets.data<index_t>(),
             out_node_attrs.data<scalar_t>(),
             out_node_reppoints.data<scalar_t>(),
             out_node_weights.data<scalar_t>(),
             attr_dim,
-            num_nodes
+            tree_depth,
+            expansion_order >= 1 ? out_node_moments1.data<scalar_t>() : nullptr,
+            expansion_order >= 2 ? out_node_moments2.data<scalar_t>() : nullptr,
+            expansion_order
             );
     }));
 
-    for (signedindex_t depth = tree_depth-1; depth >= 0; depth--) {
-        AT_DISPATCH_FLOATING_TYPES(points.type(), "find_next_to_scatter_cpu_kernel_launcher", ([&] {
-            find_next_to_scatter_cpu_kernel_launcher<scalar_t>(
-                node_children_list.data<signedindex_t>(),
-                node_is_leaf_list.data<bool>(),
-                scattered_mask.data<bool>(),
-                next_to_scatter_mask.data<bool>(),
-                node2point_index.data<signedindex_t>(),
-                num_nodes
-            );
-        }));
+    return {out_node_attrs, out_node_reppoints, out_node_weights, out_node_moments1, out_node_moments2};
+}
 
-        AT_DISPATCH_FLOATING_TYPES(points.type(), "scatter_point_attrs_to_nodes_nonleaf_cpu_kernel_launcher", ([&] {
-            scatter_point_attrs_to_nodes_nonleaf_cpu_kernel_launcher<scalar_t>(
-                node_parent_list.data<signedindex_t>(),
-                node_children_list.data<signedindex_t>(),
-                points.data<scalar_t>(),
-                point_weights.data<scalar_t>(),
-                point_attrs.data<scalar_t>(),
-                node2point_index.data<signedindex_t>(),
-                node2point_indexstart.data<signedindex_t>(),
-                num_points_in_node.data<signedindex_t>(),
-                node_is_leaf_list.data<bool>(),
-                scattered_mask.data<bool>(),
-                next_to_scatter_mask.data<bool>(),
-                out_node_attrs.data<scalar_t>(),
-                out_node_reppoints.data<scalar_t>(),
-                out_node_weights.data<scalar_t>(),
-                attr_dim,
-                num_nodes
-            );
-        }));
-    }
 
-    return {out_node_attrs, out_node_reppoints, out_node_weights};
+std::vector<torch::Tensor> scatter_point_attrs_to_nodes(
+        torch::Tensor node_parent_list,
+        torch::Tensor node_children_list,
+        torch::Tensor points,
+        torch::Tensor point_weights,
+        torch::Tensor point_attrs,
+        torch::Tensor node2point_index,
+        torch::Tensor node2point_indexstart,
+        torch::Tensor num_points_in_node,
+        torch::Tensor node_is_leaf_list,
+        torch::Tensor node_level_order,
+        torch::Tensor node_level_offsets
+        ) {
+    auto outs = scatter_point_attrs_to_nodes_with_moments(
+        node_parent_list,
+        node_children_list,
+        points,
+        point_weights,
+        point_attrs,
+        node2point_index,
+        node2point_indexstart,
+        num_points_in_node,
+        node_is_leaf_list,
+        node_level_order,
+        node_level_offsets,
+        0);
+    return {outs[0], outs[1], outs[2]};
 }
 
 
-torch::Tensor multiply_by_A(
+torch::Tensor multiply_by_A_with_moments(
         torch::Tensor query_points,  // [N', 3]
         torch::Tensor query_width,   // [N',]
         torch::Tensor points,        // [N, 3]
@@ -222,7 +285,11 @@ torch::Tensor multiply_by_A(
         torch::Tensor node_is_leaf_list,
         torch::Tensor node_half_w_list,
         torch::Tensor node_reppoints,
-        torch::Tensor num_points_in_node
+        torch::Tensor num_points_in_node,
+        torch::Tensor node_moments1,   // [num_nodes, 3, C], see scatter_point_attrs_to_nodes
+        torch::Tensor node_moments2,   // [num_nodes, 3, 3, C]
+        signedindex_t expansion_order,
+        double theta
         ) {
 
     CHECK_INPUT_FOR_CPU(query_points);
@@ -237,28 +304,38 @@ torch::Tensor multiply_by_A(
     CHECK_INPUT_FOR_CPU(node_half_w_list);
     CHECK_INPUT_FOR_CPU(node_reppoints);
     CHECK_INPUT_FOR_CPU(num_points_in_node);
+    TORCH_CHECK(expansion_order >= 0 && expansion_order <= MAX_EXPANSION_ORDER, "expansion_order must be 0, 1 or 2");
+    if (expansion_order >= 1) { CHECK_INPUT_FOR_CPU(node_moments1); }
+    if (expansion_order >= 2) { CHECK_INPUT_FOR_CPU(node_moments2); }
+    TORCH_CHECK(theta > 0, "theta must be positive");
+    CHECK_PACKED_TREE_SIZE(points, node_is_leaf_list);
 
     signedindex_t num_queries = query_points.size(0);
 
     auto float_tensor_options = torch::TensorOptions().dtype(points.dtype()).device(points.device());
     auto out_attrs = torch::zeros({query_points.size(0), 1}, float_tensor_options);
 
-    AT_DISPATCH_FLOATING_TYPES(points.type(), "multiply_by_A_cpu_kernel_launcher", ([&] {
-        multiply_by_A_cpu_kernel_launcher<scalar_t>(
+    DISPATCH_FLOATING_AND_INDEX_TYPES(points.type(), node_children_list.scalar_type(), "multiply_by_A_cpu_kernel_launcher", ([&] {
+        multiply_by_A_cpu_kernel_launcher<scalar_t, index_t>(
             query_points.data<scalar_t>(),  // [N', 3]
             query_width.data<scalar_t>(),   // [N',]
             points.data<scalar_t>(),        // [N, 3]
             point_attrs.data<scalar_t>(),   // [N, C]
-            node2point_index.data<signedindex_t>(),
-            node2point_indexstart.data<signedindex_t>(),
-            node_children_list.data<signedindex_t>(),
+            node2point_index.data<index_t>(),
+            node2point_indexstart.data<index_t>(),
+            node_children_list.data<index_t>(),
             node_attrs.data<scalar_t>(),
             node_is_leaf_list.data<bool>(),
             node_half_w_list.data<scalar_t>(),
             node_reppoints.data<scalar_t>(),
-            num_points_in_node.data<signedindex_t>(),
+            num_points_in_node.data<index_t>(),
             out_attrs.data<scalar_t>(),           // [N, 3]
-            num_queries
+            num_queries,
+            false,
+            expansion_order,
+            expansion_order >= 1 ? node_moments1.data<scalar_t>() : nullptr,
+            expansion_order >= 2 ? node_moments2.data<scalar_t>() : nullptr,
+            scalar_t(theta)
         );
     }));
 
@@ -266,7 +343,39 @@ torch::Tensor multiply_by_A(
 }
 
 
-torch::Tensor multiply_by_AT(
+torch::Tensor multiply_by_A(
+        torch::Tensor query_points,  // [N', 3]
+        torch::Tensor query_width,   // [N',]
+        torch::Tensor points,        // [N, 3]
+        torch::Tensor point_attrs,   // [N, C]
+        torch::Tensor node2point_index,
+        torch::Tensor node2point_indexstart,
+        torch::Tensor node_children_list,
+        torch::Tensor node_attrs,
+        torch::Tensor node_is_leaf_list,
+        torch::Tensor node_half_w_list,
+        torch::Tensor node_reppoints,
+        torch::Tensor num_points_in_node,
+        double theta
+        ) {
+    return multiply_by_A_with_moments(
+        query_points,
+        query_width,
+        points,
+        point_attrs,
+        node2point_index,
+        node2point_indexstart,
+        node_children_list,
+        node_attrs,
+        node_is_leaf_list,
+        node_half_w_list,
+        node_reppoints,
+        num_points_in_node,
+        torch::Tensor(), torch::Tensor(), 0, theta);
+}
+
+
+torch::Tensor multiply_by_AT_with_moments(
         torch::Tensor query_points,  // [N', 3]
         torch::Tensor query_width,   // [N',]
         torch::Tensor points,        // [N, 3]
@@ -278,7 +387,11 @@ torch::Tensor multiply_by_AT(
         torch::Tensor node_is_leaf_list,
         torch::Tensor node_half_w_list,
         torch::Tensor node_reppoints,
-        torch::Tensor num_points_in_node
+        torch::Tensor num_points_in_node,
+        torch::Tensor node_moments1,   // [num_nodes, 3, C], see scatter_point_attrs_to_nodes
+        torch::Tensor node_moments2,   // [num_nodes, 3, 3, C]
+        signedindex_t expansion_order,
+        double theta
         ) {
     
     CHECK_INPUT_FOR_CPU(query_points);
@@ -293,6 +406,11 @@ torch::Tensor multiply_by_AT(
     CHECK_INPUT_FOR_CPU(node_half_w_list);
     CHECK_INPUT_FOR_CPU(node_reppoints);
     CHECK_INPUT_FOR_CPU(num_points_in_node);
+    TORCH_CHECK(expansion_order >= 0 && expansion_order <= MAX_EXPANSION_ORDER, "expansion_order must be 0, 1 or 2");
+    if (expansion_order >= 1) { CHECK_INPUT_FOR_CPU(node_moments1); }
+    if (expansion_order >= 2) { CHECK_INPUT_FOR_CPU(node_moments2); }
+    TORCH_CHECK(theta > 0, "theta must be positive");
+    CHECK_PACKED_TREE_SIZE(points, node_is_leaf_list);
 
     signedindex_t num_queries = query_points.size(0);
 
@@ -303,31 +421,67 @@ torch::Tensor multiply_by_AT(
 
     // std::cout << "[DEBUG] created AT result\n";
 
-    AT_DISPATCH_FLOATING_TYPES(points.type(), "multiply_by_AT_cpu_kernel_launcher", ([&] {
-        multiply_by_AT_cpu_kernel_launcher<scalar_t>(
+    DISPATCH_FLOATING_AND_INDEX_TYPES(points.type(), node_children_list.scalar_type(), "multiply_by_AT_cpu_kernel_launcher", ([&] {
+        multiply_by_AT_cpu_kernel_launcher<scalar_t, index_t>(
             query_points.data<scalar_t>(),  // [N', 3]
             query_width.data<scalar_t>(),   // [N',]
             points.data<scalar_t>(),        // [N, 3]
             point_attrs.data<scalar_t>(),   // [N, C]
-            node2point_index.data<signedindex_t>(),
-            node2point_indexstart.data<signedindex_t>(),
-            node_children_list.data<signedindex_t>(),
+            node2point_index.data<index_t>(),
+            node2point_indexstart.data<index_t>(),
+            node_children_list.data<index_t>(),
             node_attrs.data<scalar_t>(),
             node_is_leaf_list.data<bool>(),
             node_half_w_list.data<scalar_t>(),
             node_reppoints.data<scalar_t>(),
-            num_points_in_node.data<signedindex_t>(),
+            num_points_in_node.data<index_t>(),
             out_attrs.data<scalar_t>(),           // [N, 3]
-            num_queries
+            num_queries,
+            expansion_order,
+            expansion_order >= 1 ? node_moments1.data<scalar_t>() : nullptr,
+            expansion_order >= 2 ? node_moments2.data<scalar_t>() : nullptr,
+            scalar_t(theta)
         );
     }));
 
     return out_attrs;
 }
+
+
+torch::Tensor multiply_by_AT(
+        torch::Tensor query_points,  // [N', 3]
+        torch::Tensor query_width,   // [N',]
+        torch::Tensor points,        // [N, 3]
+        torch::Tensor point_attrs,   // [N, C]
+        torch::Tensor node2point_index,
+        torch::Tensor node2point_indexstart,
+        torch::Tensor node_children_list,
+        torch::Tensor node_attrs,
+        torch::Tensor node_is_leaf_list,
+        torch::Tensor node_half_w_list,
+        torch::Tensor node_reppoints,
+        torch::Tensor num_points_in_node,
+        double theta
+        ) {
+    return multiply_by_AT_with_moments(
+        query_points,
+        query_width,
+        points,
+        point_attrs,
+        node2point_index,
+        node2point_indexstart,
+        node_children_list,
+        node_attrs,
+        node_is_leaf_list,
+        node_half_w_list,
+        node_reppoints,
+        num_points_in_node,
+        torch::Tensor(), torch::Tensor(), 0, theta);
+}
 //////////////////////////////
 
 
-torch::Tensor multiply_by_G(
+torch::Tensor multiply_by_G_with_moments(
         torch::Tensor query_points,  // [N', 3]
         torch::Tensor query_width,   // [N',]
         torch::Tensor points,        // [N, 3]
@@ -339,7 +493,11 @@ torch::Tensor multiply_by_G(
         torch::Tensor node_is_leaf_list,
         torch::Tensor node_half_w_list,
         torch::Tensor node_reppoints,
-        torch::Tensor num_points_in_node
+        torch::Tensor num_points_in_node,
+        torch::Tensor node_moments1,   // [num_nodes, 3, C], see scatter_point_attrs_to_nodes
+        torch::Tensor node_moments2,   // [num_nodes, 3, 3, C]
+        signedindex_t expansion_order,
+        double theta
         ) {
 
     CHECK_INPUT_FOR_CPU(query_points);
@@ -354,39 +512,1680 @@ torch::Tensor multiply_by_G(
     CHECK_INPUT_FOR_CPU(node_half_w_list);
     CHECK_INPUT_FOR_CPU(node_reppoints);
     CHECK_INPUT_FOR_CPU(num_points_in_node);
+    TORCH_CHECK(expansion_order >= 0 && expansion_order <= MAX_EXPANSION_ORDER, "expansion_order must be 0, 1 or 2");
+    if (expansion_order >= 1) { CHECK_INPUT_FOR_CPU(node_moments1); }
+    if (expansion_order >= 2) { CHECK_INPUT_FOR_CPU(node_moments2); }
+    TORCH_CHECK(theta > 0, "theta must be positive");
+    CHECK_PACKED_TREE_SIZE(points, node_is_leaf_list);
 
     signedindex_t num_queries = query_points.size(0);
 
     auto float_tensor_options = torch::TensorOptions().dtype(points.dtype()).device(points.device());
     auto out_attrs = torch::zeros({query_points.size(0), SPATIAL_DIM}, float_tensor_options);
 
-    AT_DISPATCH_FLOATING_TYPES(points.type(), "multiply_by_A_cpu_kernel_launcher", ([&] {
-        multiply_by_G_cpu_kernel_launcher<scalar_t>(
+    DISPATCH_FLOATING_AND_INDEX_TYPES(points.type(), node_children_list.scalar_type(), "multiply_by_A_cpu_kernel_launcher", ([&] {
+        multiply_by_G_cpu_kernel_launcher<scalar_t, index_t>(
             query_points.data<scalar_t>(),  // [N', 3]
             query_width.data<scalar_t>(),   // [N',]
             points.data<scalar_t>(),        // [N, 3]
             point_attrs.data<scalar_t>(),   // [N, C]
-            node2point_index.data<signedindex_t>(),
-            node2point_indexstart.data<signedindex_t>(),
-            node_children_list.data<signedindex_t>(),
+            node2point_index.data<index_t>(),
+            node2point_indexstart.data<index_t>(),
+            node_children_list.data<index_t>(),
             node_attrs.data<scalar_t>(),
             node_is_leaf_list.data<bool>(),
             node_half_w_list.data<scalar_t>(),
             node_reppoints.data<scalar_t>(),
-            num_points_in_node.data<signedindex_t>(),
+            num_points_in_node.data<index_t>(),
             out_attrs.data<scalar_t>(),           // [N, 3]
-            num_queries
+            num_queries,
+            expansion_order,
+            expansion_order >= 1 ? node_moments1.data<scalar_t>() : nullptr,
+            expansion_order >= 2 ? node_moments2.data<scalar_t>() : nullptr,
+            scalar_t(theta)
+        );
+    }));
+    return out_attrs;
+}
+
+
+torch::Tensor multiply_by_G(
+        torch::Tensor query_points,  // [N', 3]
+        torch::Tensor query_width,   // [N',]
+        torch::Tensor points,        // [N, 3]
+        torch::Tensor point_attrs,   // [N, C]
+        torch::Tensor node2point_index,
+        torch::Tensor node2point_indexstart,
+        torch::Tensor node_children_list,
+        torch::Tensor node_attrs,
+        torch::Tensor node_is_leaf_list,
+        torch::Tensor node_half_w_list,
+        torch::Tensor node_reppoints,
+        torch::Tensor num_points_in_node,
+        double theta
+        ) {
+    return multiply_by_G_with_moments(
+        query_points,
+        query_width,
+        points,
+        point_attrs,
+        node2point_index,
+        node2point_indexstart,
+        node_children_list,
+        node_attrs,
+        node_is_leaf_list,
+        node_half_w_list,
+        node_reppoints,
+        num_points_in_node,
+        torch::Tensor(), torch::Tensor(), 0, theta);
+}
+
+
+std::vector<torch::Tensor> build_interaction_lists(
+        torch::Tensor query_points,  // [N', 3]
+        torch::Tensor points,        // [N, 3]
+        torch::Tensor node_children_list,
+        torch::Tensor node_is_leaf_list,
+        torch::Tensor node_half_w_list,
+        torch::Tensor node2point_index,
+        torch::Tensor node2point_indexstart,
+        torch::Tensor num_points_in_node,
+        double theta
+        ) {
+
+    CHECK_INPUT_FOR_CPU(query_points);
+    CHECK_INPUT_FOR_CPU(points);
+    CHECK_INPUT_FOR_CPU(node_children_list);
+    CHECK_INPUT_FOR_CPU(node_is_leaf_list);
+    CHECK_INPUT_FOR_CPU(node_half_w_list);
+    CHECK_INPUT_FOR_CPU(node2point_index);
+    CHECK_INPUT_FOR_CPU(node2point_indexstart);
+    CHECK_INPUT_FOR_CPU(num_points_in_node);
+    TORCH_CHECK(theta > 0, "theta must be positive");
+
+    signedindex_t num_queries = query_points.size(0);
+    signedindex_t num_nodes = node_children_list.size(0);
+
+    auto long_tensor_options = torch::TensorOptions().dtype(torch::kLong);
+    auto float_tensor_options = torch::TensorOptions().dtype(points.dtype());
+    auto node_bboxes = torch::zeros({num_nodes, 2*SPATIAL_DIM}, float_tensor_options);
+    auto num_far = torch::zeros({num_queries}, long_tensor_options);
+    auto num_near = torch::zeros({num_queries}, long_tensor_options);
+    auto num_open = torch::zeros({num_queries}, long_tensor_options);
+
+    DISPATCH_FLOATING_AND_INDEX_TYPES(points.type(), node_children_list.scalar_type(), "count_interaction_lists_cpu_kernel_launcher", ([&] {
+        compute_node_bboxes<scalar_t, index_t>(
+            points.data<scalar_t>(),
+            node_children_list.data<index_t>(),
+            node_is_leaf_list.data<bool>(),
+            node2point_index.data<index_t>(),
+            node2point_indexstart.data<index_t>(),
+            num_points_in_node.data<index_t>(),
+            node_bboxes.data<scalar_t>(),
+            num_nodes
+        );
+        count_interaction_lists_cpu_kernel_launcher<scalar_t, index_t>(
+            query_points.data<scalar_t>(),
+            node_children_list.data<index_t>(),
+            node_is_leaf_list.data<bool>(),
+            node_half_w_list.data<scalar_t>(),
+            node_bboxes.data<scalar_t>(),
+            num_far.data<signedindex_t>(),
+            num_near.data<signedindex_t>(),
+            num_open.data<signedindex_t>(),
+            num_queries,
+            scalar_t(theta)
+        );
+    }));
+
+    // exclusive prefix sums -> CSR offsets
+    auto far_offsets = torch::zeros({num_queries+1}, long_tensor_options);
+    auto near_offsets = torch::zeros({num_queries+1}, long_tensor_options);
+    auto open_offsets = torch::zeros({num_queries+1}, long_tensor_options);
+    for (signedindex_t i = 0; i < num_queries; i++) {
+        far_offsets.data<signedindex_t>()[i+1] = far_offsets.data<signedindex_t>()[i] + num_far.data<signedindex_t>()[i];
+        near_offsets.data<signedindex_t>()[i+1] = near_offsets.data<signedindex_t>()[i] + num_near.data<signedindex_t>()[i];
+        open_offsets.data<signedindex_t>()[i+1] = open_offsets.data<signedindex_t>()[i] + num_open.data<signedindex_t>()[i];
+    }
+
+    // the lists hold node indices, in the dtype of the tree, the offsets can exceed int32
+    auto index_tensor_options = torch::TensorOptions().dtype(node_children_list.scalar_type());
+    auto far_nodes = torch::zeros({far_offsets.data<signedindex_t>()[num_queries]}, index_tensor_options);
+    auto near_leaves = torch::zeros({near_offsets.data<signedindex_t>()[num_queries]}, index_tensor_options);
+    auto open_nodes = torch::zeros({open_offsets.data<signedindex_t>()[num_queries]}, index_tensor_options);
+
+    DISPATCH_FLOATING_AND_INDEX_TYPES(points.type(), node_children_list.scalar_type(), "fill_interaction_lists_cpu_kernel_launcher", ([&] {
+        fill_interaction_lists_cpu_kernel_launcher<scalar_t, index_t>(
+            query_points.data<scalar_t>(),
+            node_children_list.data<index_t>(),
+            node_is_leaf_list.data<bool>(),
+            node_half_w_list.data<scalar_t>(),
+            node_bboxes.data<scalar_t>(),
+            far_offsets.data<signedindex_t>(),
+            near_offsets.data<signedindex_t>(),
+            open_offsets.data<signedindex_t>(),
+            far_nodes.data<index_t>(),
+            near_leaves.data<index_t>(),
+            open_nodes.data<index_t>(),
+            num_queries,
+            scalar_t(theta)
+        );
+    }));
+
+    return {far_offsets, far_nodes, near_offsets, near_leaves, open_offsets, open_nodes};
+}
+
+
+torch::Tensor multiply_by_A_cached_with_moments(
+        torch::Tensor query_points,  // [N', 3]
+        torch::Tensor query_width,   // [N',]
+        torch::Tensor points,        // [N, 3]
+        torch::Tensor point_attrs,   // [N, C]
+        torch::Tensor node2point_index,
+        torch::Tensor node2point_indexstart,
+        torch::Tensor node_children_list,
+        torch::Tensor node_attrs,
+        torch::Tensor node_is_leaf_list,
+        torch::Tensor node_half_w_list,
+        torch::Tensor node_reppoints,
+        torch::Tensor num_points_in_node,
+        torch::Tensor far_offsets,
+        torch::Tensor far_nodes,
+        torch::Tensor near_offsets,
+        torch::Tensor near_leaves,
+        torch::Tensor open_offsets,
+        torch::Tensor open_nodes,
+        torch::Tensor node_moments1,   // [num_nodes, 3, C], see scatter_point_attrs_to_nodes
+        torch::Tensor node_moments2,   // [num_nodes, 3, 3, C]
+        signedindex_t expansion_order,
+        double theta
+        ) {
+
+    CHECK_INPUT_FOR_CPU(query_points);
+    CHECK_INPUT_FOR_CPU(query_width);
+    CHECK_INPUT_FOR_CPU(points);
+    CHECK_INPUT_FOR_CPU(point_attrs);
+    CHECK_INPUT_FOR_CPU(node2point_index);
+    CHECK_INPUT_FOR_CPU(node2point_indexstart);
+    CHECK_INPUT_FOR_CPU(node_children_list);
+    CHECK_INPUT_FOR_CPU(node_attrs);
+    CHECK_INPUT_FOR_CPU(node_is_leaf_list);
+    CHECK_INPUT_FOR_CPU(node_half_w_list);
+    CHECK_INPUT_FOR_CPU(node_reppoints);
+    CHECK_INPUT_FOR_CPU(num_points_in_node);
+    CHECK_INPUT_FOR_CPU(far_offsets);
+    CHECK_INPUT_FOR_CPU(far_nodes);
+    CHECK_INPUT_FOR_CPU(near_offsets);
+    CHECK_INPUT_FOR_CPU(near_leaves);
+    CHECK_INPUT_FOR_CPU(open_offsets);
+    CHECK_INPUT_FOR_CPU(open_nodes);
+    TORCH_CHECK(expansion_order >= 0 && expansion_order <= MAX_EXPANSION_ORDER, "expansion_order must be 0, 1 or 2");
+    if (expansion_order >= 1) { CHECK_INPUT_FOR_CPU(node_moments1); }
+    if (expansion_order >= 2) { CHECK_INPUT_FOR_CPU(node_moments2); }
+    TORCH_CHECK(far_offsets.size(0) == query_points.size(0) + 1, "interaction lists were built for different query points");
+    TORCH_CHECK(theta > 0, "theta must be positive");
+
+    signedindex_t num_queries = query_points.size(0);
+
+    auto float_tensor_options = torch::TensorOptions().dtype(points.dtype()).device(points.device());
+    auto out_attrs = torch::zeros({query_points.size(0), 1}, float_tensor_options);
+
+    DISPATCH_FLOATING_AND_INDEX_TYPES(points.type(), node_children_list.scalar_type(), "multiply_by_A_cached_cpu_kernel_launcher", ([&] {
+        multiply_by_A_cached_cpu_kernel_launcher<scalar_t, index_t>(
+            query_points.data<scalar_t>(),  // [N', 3]
+            query_width.data<scalar_t>(),   // [N',]
+            points.data<scalar_t>(),        // [N, 3]
+            point_attrs.data<scalar_t>(),   // [N, C]
+            node2point_index.data<index_t>(),
+            node2point_indexstart.data<index_t>(),
+            node_children_list.data<index_t>(),
+            node_attrs.data<scalar_t>(),
+            node_is_leaf_list.data<bool>(),
+            node_half_w_list.data<scalar_t>(),
+            node_reppoints.data<scalar_t>(),
+            num_points_in_node.data<index_t>(),
+            far_offsets.data<signedindex_t>(),
+            far_nodes.data<index_t>(),
+            near_offsets.data<signedindex_t>(),
+            near_leaves.data<index_t>(),
+            open_offsets.data<signedindex_t>(),
+            open_nodes.data<index_t>(),
+            out_attrs.data<scalar_t>(),           // [N,]
+            num_queries,
+            false,
+            expansion_order,
+            expansion_order >= 1 ? node_moments1.data<scalar_t>() : nullptr,
+            expansion_order >= 2 ? node_moments2.data<scalar_t>() : nullptr,
+            scalar_t(theta)
         );
     }));
+
     return out_attrs;
 }
 
 
+torch::Tensor multiply_by_A_cached(
+        torch::Tensor query_points,  // [N', 3]
+        torch::Tensor query_width,   // [N',]
+        torch::Tensor points,        // [N, 3]
+        torch::Tensor point_attrs,   // [N, C]
+        torch::Tensor node2point_index,
+        torch::Tensor node2point_indexstart,
+        torch::Tensor node_children_list,
+        torch::Tensor node_attrs,
+        torch::Tensor node_is_leaf_list,
+        torch::Tensor node_half_w_list,
+        torch::Tensor node_reppoints,
+        torch::Tensor num_points_in_node,
+        torch::Tensor far_offsets,
+        torch::Tensor far_nodes,
+        torch::Tensor near_offsets,
+        torch::Tensor near_leaves,
+        torch::Tensor open_offsets,
+        torch::Tensor open_nodes,
+        double theta
+        ) {
+    return multiply_by_A_cached_with_moments(
+        query_points,
+        query_width,
+        points,
+        point_attrs,
+        node2point_index,
+        node2point_indexstart,
+        node_children_list,
+        node_attrs,
+        node_is_leaf_list,
+        node_half_w_list,
+        node_reppoints,
+        num_points_in_node,
+        far_offsets,
+        far_nodes,
+        near_offsets,
+        near_leaves,
+        open_offsets,
+        open_nodes,
+        torch::Tensor(), torch::Tensor(), 0, theta);
+}
+
+
+torch::Tensor multiply_by_AT_cached_with_moments(
+        torch::Tensor query_points,  // [N', 3]
+        torch::Tensor query_width,   // [N',]
+        torch::Tensor points,        // [N, 3]
+        torch::Tensor point_attrs,   // [N, C]
+        torch::Tensor node2point_index,
+        torch::Tensor node2point_indexstart,
+        torch::Tensor node_children_list,
+        torch::Tensor node_attrs,
+        torch::Tensor node_is_leaf_list,
+        torch::Tensor node_half_w_list,
+        torch::Tensor node_reppoints,
+        torch::Tensor num_points_in_node,
+        torch::Tensor far_offsets,
+        torch::Tensor far_nodes,
+        torch::Tensor near_offsets,
+        torch::Tensor near_leaves,
+        torch::Tensor open_offsets,
+        torch::Tensor open_nodes,
+        torch::Tensor node_moments1,   // [num_nodes, 3, C], see scatter_point_attrs_to_nodes
+        torch::Tensor node_moments2,   // [num_nodes, 3, 3, C]
+        signedindex_t expansion_order,
+        double theta
+        ) {
+
+    CHECK_INPUT_FOR_CPU(query_points);
+    CHECK_INPUT_FOR_CPU(query_width);
+    CHECK_INPUT_FOR_CPU(points);
+    CHECK_INPUT_FOR_CPU(point_attrs);
+    CHECK_INPUT_FOR_CPU(node2point_index);
+    CHECK_INPUT_FOR_CPU(node2point_indexstart);
+    CHECK_INPUT_FOR_CPU(node_children_list);
+    CHECK_INPUT_FOR_CPU(node_attrs);
+    CHECK_INPUT_FOR_CPU(node_is_leaf_list);
+    CHECK_INPUT_FOR_CPU(node_half_w_list);
+    CHECK_INPUT_FOR_CPU(node_reppoints);
+    CHECK_INPUT_FOR_CPU(num_points_in_node);
+    CHECK_INPUT_FOR_CPU(far_offsets);
+    CHECK_INPUT_FOR_CPU(far_nodes);
+    CHECK_INPUT_FOR_CPU(near_offsets);
+    CHECK_INPUT_FOR_CPU(near_leaves);
+    CHECK_INPUT_FOR_CPU(open_offsets);
+    CHECK_INPUT_FOR_CPU(open_nodes);
+    TORCH_CHECK(expansion_order >= 0 && expansion_order <= MAX_EXPANSION_ORDER, "expansion_order must be 0, 1 or 2");
+    if (expansion_order >= 1) { CHECK_INPUT_FOR_CPU(node_moments1); }
+    if (expansion_order >= 2) { CHECK_INPUT_FOR_CPU(node_moments2); }
+    TORCH_CHECK(far_offsets.size(0) == query_points.size(0) + 1, "interaction lists were built for different query points");
+    TORCH_CHECK(theta > 0, "theta must be positive");
+
+    signedindex_t num_queries = query_points.size(0);
+
+    auto float_tensor_options = torch::TensorOptions().dtype(points.dtype()).device(points.device());
+    auto out_attrs = torch::zeros({query_points.size(0), SPATIAL_DIM}, float_tensor_options);
+
+    DISPATCH_FLOATING_AND_INDEX_TYPES(points.type(), node_children_list.scalar_type(), "multiply_by_AT_cached_cpu_kernel_launcher", ([&] {
+        multiply_by_AT_cached_cpu_kernel_launcher<scalar_t, index_t>(
+            query_points.data<scalar_t>(),  // [N', 3]
+            query_width.data<scalar_t>(),   // [N',]
+            points.data<scalar_t>(),        // [N, 3]
+            point_attrs.data<scalar_t>(),   // [N, C]
+            node2point_index.data<index_t>(),
+            node2point_indexstart.data<index_t>(),
+            node_children_list.data<index_t>(),
+            node_attrs.data<scalar_t>(),
+            node_is_leaf_list.data<bool>(),
+            node_half_w_list.data<scalar_t>(),
+            node_reppoints.data<scalar_t>(),
+            num_points_in_node.data<index_t>(),
+            far_offsets.data<signedindex_t>(),
+            far_nodes.data<index_t>(),
+            near_offsets.data<signedindex_t>(),
+            near_leaves.data<index_t>(),
+            open_offsets.data<signedindex_t>(),
+            open_nodes.data<index_t>(),
+            out_attrs.data<scalar_t>(),           // [N, 3]
+            num_queries,
+            expansion_order,
+            expansion_order >= 1 ? node_moments1.data<scalar_t>() : nullptr,
+            expansion_order >= 2 ? node_moments2.data<scalar_t>() : nullptr,
+            scalar_t(theta)
+        );
+    }));
+
+    return out_attrs;
+}
+
+
+torch::Tensor multiply_by_AT_cached(
+        torch::Tensor query_points,  // [N', 3]
+        torch::Tensor query_width,   // [N',]
+        torch::Tensor points,        // [N, 3]
+        torch::Tensor point_attrs,   // [N, C]
+        torch::Tensor node2point_index,
+        torch::Tensor node2point_indexstart,
+        torch::Tensor node_children_list,
+        torch::Tensor node_attrs,
+        torch::Tensor node_is_leaf_list,
+        torch::Tensor node_half_w_list,
+        torch::Tensor node_reppoints,
+        torch::Tensor num_points_in_node,
+        torch::Tensor far_offsets,
+        torch::Tensor far_nodes,
+        torch::Tensor near_offsets,
+        torch::Tensor near_leaves,
+        torch::Tensor open_offsets,
+        torch::Tensor open_nodes,
+        double theta
+        ) {
+    return multiply_by_AT_cached_with_moments(
+        query_points,
+        query_width,
+        points,
+        point_attrs,
+        node2point_index,
+        node2point_indexstart,
+        node_children_list,
+        node_attrs,
+        node_is_leaf_list,
+        node_half_w_list,
+        node_reppoints,
+        num_points_in_node,
+        far_offsets,
+        far_nodes,
+        near_offsets,
+        near_leaves,
+        open_offsets,
+        open_nodes,
+        torch::Tensor(), torch::Tensor(), 0, theta);
+}
+
+
+torch::Tensor multiply_by_G_cached_with_moments(
+        torch::Tensor query_points,  // [N', 3]
+        torch::Tensor query_width,   // [N',]
+        torch::Tensor points,        // [N, 3]
+        torch::Tensor point_attrs,   // [N, C]
+        torch::Tensor node2point_index,
+        torch::Tensor node2point_indexstart,
+        torch::Tensor node_children_list,
+        torch::Tensor node_attrs,
+        torch::Tensor node_is_leaf_list,
+        torch::Tensor node_half_w_list,
+        torch::Tensor node_reppoints,
+        torch::Tensor num_points_in_node,
+        torch::Tensor far_offsets,
+        torch::Tensor far_nodes,
+        torch::Tensor near_offsets,
+        torch::Tensor near_leaves,
+        torch::Tensor open_offsets,
+        torch::Tensor open_nodes,
+        torch::Tensor node_moments1,   // [num_nodes, 3, C], see scatter_point_attrs_to_nodes
+        torch::Tensor node_moments2,   // [num_nodes, 3, 3, C]
+        signedindex_t expansion_order,
+        double theta
+        ) {
+
+    CHECK_INPUT_FOR_CPU(query_points);
+    CHECK_INPUT_FOR_CPU(query_width);
+    CHECK_INPUT_FOR_CPU(points);
+    CHECK_INPUT_FOR_CPU(point_attrs);
+    CHECK_INPUT_FOR_CPU(node2point_index);
+    CHECK_INPUT_FOR_CPU(node2point_indexstart);
+    CHECK_INPUT_FOR_CPU(node_children_list);
+    CHECK_INPUT_FOR_CPU(node_attrs);
+    CHECK_INPUT_FOR_CPU(node_is_leaf_list);
+    CHECK_INPUT_FOR_CPU(node_half_w_list);
+    CHECK_INPUT_FOR_CPU(node_reppoints);
+    CHECK_INPUT_FOR_CPU(num_points_in_node);
+    CHECK_INPUT_FOR_CPU(far_offsets);
+    CHECK_INPUT_FOR_CPU(far_nodes);
+    CHECK_INPUT_FOR_CPU(near_offsets);
+    CHECK_INPUT_FOR_CPU(near_leaves);
+    CHECK_INPUT_FOR_CPU(open_offsets);
+    CHECK_INPUT_FOR_CPU(open_nodes);
+    TORCH_CHECK(expansion_order >= 0 && expansion_order <= MAX_EXPANSION_ORDER, "expansion_order must be 0, 1 or 2");
+    if (expansion_order >= 1) { CHECK_INPUT_FOR_CPU(node_moments1); }
+    if (expansion_order >= 2) { CHECK_INPUT_FOR_CPU(node_moments2); }
+    TORCH_CHECK(far_offsets.size(0) == query_points.size(0) + 1, "interaction lists were built for different query points");
+    TORCH_CHECK(theta > 0, "theta must be positive");
+
+    signedindex_t num_queries = query_points.size(0);
+
+    auto float_tensor_options = torch::TensorOptions().dtype(points.dtype()).device(points.device());
+    auto out_attrs = torch::zeros({query_points.size(0), SPATIAL_DIM}, float_tensor_options);
+
+    DISPATCH_FLOATING_AND_INDEX_TYPES(points.type(), node_children_list.scalar_type(), "multiply_by_G_cached_cpu_kernel_launcher", ([&] {
+        multiply_by_G_cached_cpu_kernel_launcher<scalar_t, index_t>(
+            query_points.data<scalar_t>(),  // [N', 3]
+            query_width.data<scalar_t>(),   // [N',]
+            points.data<scalar_t>(),        // [N, 3]
+            point_attrs.data<scalar_t>(),   // [N, C]
+            node2point_index.data<index_t>(),
+            node2point_indexstart.data<index_t>(),
+            node_children_list.data<index_t>(),
+            node_attrs.data<scalar_t>(),
+            node_is_leaf_list.data<bool>(),
+            node_half_w_list.data<scalar_t>(),
+            node_reppoints.data<scalar_t>(),
+            num_points_in_node.data<index_t>(),
+            far_offsets.data<signedindex_t>(),
+            far_nodes.data<index_t>(),
+            near_offsets.data<signedindex_t>(),
+            near_leaves.data<index_t>(),
+            open_offsets.data<signedindex_t>(),
+            open_nodes.data<index_t>(),
+            out_attrs.data<scalar_t>(),           // [N, 3]
+            num_queries,
+            expansion_order,
+            expansion_order >= 1 ? node_moments1.data<scalar_t>() : nullptr,
+            expansion_order >= 2 ? node_moments2.data<scalar_t>() : nullptr,
+            scalar_t(theta)
+        );
+    }));
+
+    return out_attrs;
+}
+
+
+torch::Tensor multiply_by_G_cached(
+        torch::Tensor query_points,  // [N', 3]
+        torch::Tensor query_width,   // [N',]
+        torch::Tensor points,        // [N, 3]
+        torch::Tensor point_attrs,   // [N, C]
+        torch::Tensor node2point_index,
+        torch::Tensor node2point_indexstart,
+        torch::Tensor node_children_list,
+        torch::Tensor node_attrs,
+        torch::Tensor node_is_leaf_list,
+        torch::Tensor node_half_w_list,
+        torch::Tensor node_reppoints,
+        torch::Tensor num_points_in_node,
+        torch::Tensor far_offsets,
+        torch::Tensor far_nodes,
+        torch::Tensor near_offsets,
+        torch::Tensor near_leaves,
+        torch::Tensor open_offsets,
+        torch::Tensor open_nodes,
+        double theta
+        ) {
+    return multiply_by_G_cached_with_moments(
+        query_points,
+        query_width,
+        points,
+        point_attrs,
+        node2point_index,
+        node2point_indexstart,
+        node_children_list,
+        node_attrs,
+        node_is_leaf_list,
+        node_half_w_list,
+        node_reppoints,
+        num_points_in_node,
+        far_offsets,
+        far_nodes,
+        near_offsets,
+        near_leaves,
+        open_offsets,
+        open_nodes,
+        torch::Tensor(), torch::Tensor(), 0, theta);
+}
+
+
+torch::Tensor multiply_by_A_dualtree(
+        torch::Tensor points,        // [N, 3], also the queries
+        torch::Tensor point_width,   // [N,]
+        torch::Tensor point_attrs,   // [N, C]
+        torch::Tensor node2point_index,
+        torch::Tensor node2point_indexstart,
+        torch::Tensor node_children_list,
+        torch::Tensor node_attrs,
+        torch::Tensor node_is_leaf_list,
+        torch::Tensor node_half_w_list,
+        torch::Tensor node_reppoints,
+        torch::Tensor num_points_in_node,
+        double theta
+        ) {
+
+    CHECK_INPUT_FOR_CPU(points);
+    CHECK_INPUT_FOR_CPU(point_width);
+    CHECK_INPUT_FOR_CPU(point_attrs);
+    CHECK_INPUT_FOR_CPU(node2point_index);
+    CHECK_INPUT_FOR_CPU(node2point_indexstart);
+    CHECK_INPUT_FOR_CPU(node_children_list);
+    CHECK_INPUT_FOR_CPU(node_attrs);
+    CHECK_INPUT_FOR_CPU(node_is_leaf_list);
+    CHECK_INPUT_FOR_CPU(node_half_w_list);
+    CHECK_INPUT_FOR_CPU(node_reppoints);
+    CHECK_INPUT_FOR_CPU(num_points_in_node);
+    TORCH_CHECK(point_width.size(0) == points.size(0), "the dual-tree evaluation is at the points of the tree");
+    TORCH_CHECK(theta > 0, "theta must be positive");
+
+    signedindex_t num_nodes = node_is_leaf_list.size(0);
+
+    auto float_tensor_options = torch::TensorOptions().dtype(points.dtype()).device(points.device());
+    auto out_attrs = torch::zeros({points.size(0), 1}, float_tensor_options);
+
+    DISPATCH_FLOATING_AND_INDEX_TYPES(points.type(), node_children_list.scalar_type(), "multiply_by_A_dualtree_cpu_kernel_launcher", ([&] {
+        multiply_by_A_dualtree_cpu_kernel_launcher<scalar_t, index_t>(
+            points.data<scalar_t>(),        // [N, 3]
+            point_width.data<scalar_t>(),   // [N,]
+            point_attrs.data<scalar_t>(),   // [N, C]
+            node2point_index.data<index_t>(),
+            node2point_indexstart.data<index_t>(),
+            node_children_list.data<index_t>(),
+            node_attrs.data<scalar_t>(),
+            node_is_leaf_list.data<bool>(),
+            node_half_w_list.data<scalar_t>(),
+            node_reppoints.data<scalar_t>(),
+            num_points_in_node.data<index_t>(),
+            out_attrs.data<scalar_t>(),
+            num_nodes,
+            false,
+            scalar_t(theta)
+        );
+    }));
+
+    return out_attrs;
+}
+
+
+torch::Tensor multiply_by_AT_dualtree(
+        torch::Tensor points,        // [N, 3], also the queries
+        torch::Tensor point_width,   // [N,]
+        torch::Tensor point_attrs,   // [N, C]
+        torch::Tensor node2point_index,
+        torch::Tensor node2point_indexstart,
+        torch::Tensor node_children_list,
+        torch::Tensor node_attrs,
+        torch::Tensor node_is_leaf_list,
+        torch::Tensor node_half_w_list,
+        torch::Tensor node_reppoints,
+        torch::Tensor num_points_in_node,
+        double theta
+        ) {
+
+    CHECK_INPUT_FOR_CPU(points);
+    CHECK_INPUT_FOR_CPU(point_width);
+    CHECK_INPUT_FOR_CPU(point_attrs);
+    CHECK_INPUT_FOR_CPU(node2point_index);
+    CHECK_INPUT_FOR_CPU(node2point_indexstart);
+    CHECK_INPUT_FOR_CPU(node_children_list);
+    CHECK_INPUT_FOR_CPU(node_attrs);
+    CHECK_INPUT_FOR_CPU(node_is_leaf_list);
+    CHECK_INPUT_FOR_CPU(node_half_w_list);
+    CHECK_INPUT_FOR_CPU(node_reppoints);
+    CHECK_INPUT_FOR_CPU(num_points_in_node);
+    TORCH_CHECK(point_width.size(0) == points.size(0), "the dual-tree evaluation is at the points of the tree");
+    TORCH_CHECK(theta > 0, "theta must be positive");
+
+    signedindex_t num_nodes = node_is_leaf_list.size(0);
+
+    auto float_tensor_options = torch::TensorOptions().dtype(points.dtype()).device(points.device());
+    auto out_attrs = torch::zeros({points.size(0), SPATIAL_DIM}, float_tensor_options);
+
+    DISPATCH_FLOATING_AND_INDEX_TYPES(points.type(), node_children_list.scalar_type(), "multiply_by_AT_dualtree_cpu_kernel_launcher", ([&] {
+        multiply_by_AT_dualtree_cpu_kernel_launcher<scalar_t, index_t>(
+            points.data<scalar_t>(),        // [N, 3]
+            point_width.data<scalar_t>(),   // [N,]
+            point_attrs.data<scalar_t>(),   // [N, C]
+            node2point_index.data<index_t>(),
+            node2point_indexstart.data<index_t>(),
+            node_children_list.data<index_t>(),
+            node_attrs.data<scalar_t>(),
+            node_is_leaf_list.data<bool>(),
+            node_half_w_list.data<scalar_t>(),
+            node_reppoints.data<scalar_t>(),
+            num_points_in_node.data<index_t>(),
+            out_attrs.data<scalar_t>(),
+            num_nodes,
+            scalar_t(theta)
+        );
+    }));
+
+    return out_attrs;
+}
+
+
+torch::Tensor multiply_by_G_dualtree(
+        torch::Tensor points,        // [N, 3], also the queries
+        torch::Tensor point_width,   // [N,]
+        torch::Tensor point_attrs,   // [N, C]
+        torch::Tensor node2point_index,
+        torch::Tensor node2point_indexstart,
+        torch::Tensor node_children_list,
+        torch::Tensor node_attrs,
+        torch::Tensor node_is_leaf_list,
+        torch::Tensor node_half_w_list,
+        torch::Tensor node_reppoints,
+        torch::Tensor num_points_in_node,
+        double theta
+        ) {
+
+    CHECK_INPUT_FOR_CPU(points);
+    CHECK_INPUT_FOR_CPU(point_width);
+    CHECK_INPUT_FOR_CPU(point_attrs);
+    CHECK_INPUT_FOR_CPU(node2point_index);
+    CHECK_INPUT_FOR_CPU(node2point_indexstart);
+    CHECK_INPUT_FOR_CPU(node_children_list);
+    CHECK_INPUT_FOR_CPU(node_attrs);
+    CHECK_INPUT_FOR_CPU(node_is_leaf_list);
+    CHECK_INPUT_FOR_CPU(node_half_w_list);
+    CHECK_INPUT_FOR_CPU(node_reppoints);
+    CHECK_INPUT_FOR_CPU(num_points_in_node);
+    TORCH_CHECK(point_width.size(0) == points.size(0), "the dual-tree evaluation is at the points of the tree");
+    TORCH_CHECK(theta > 0, "theta must be positive");
+
+    signedindex_t num_nodes = node_is_leaf_list.size(0);
+
+    auto float_tensor_options = torch::TensorOptions().dtype(points.dtype()).device(points.device());
+    auto out_attrs = torch::zeros({points.size(0), SPATIAL_DIM}, float_tensor_options);
+
+    DISPATCH_FLOATING_AND_INDEX_TYPES(points.type(), node_children_list.scalar_type(), "multiply_by_G_dualtree_cpu_kernel_launcher", ([&] {
+        multiply_by_G_dualtree_cpu_kernel_launcher<scalar_t, index_t>(
+            points.data<scalar_t>(),        // [N, 3]
+            point_width.data<scalar_t>(),   // [N,]
+            point_attrs.data<scalar_t>(),   // [N, C]
+            node2point_index.data<index_t>(),
+            node2point_indexstart.data<index_t>(),
+            node_children_list.data<index_t>(),
+            node_attrs.data<scalar_t>(),
+            node_is_leaf_list.data<bool>(),
+            node_half_w_list.data<scalar_t>(),
+            node_reppoints.data<scalar_t>(),
+            num_points_in_node.data<index_t>(),
+            out_attrs.data<scalar_t>(),
+            num_nodes,
+            scalar_t(theta)
+        );
+    }));
+
+    return out_attrs;
+}
+
+
+std::vector<torch::Tensor> multiply_fused_with_cache(
+        std::vector<std::string> operators,     // each of "A", "AT", "G"
+        torch::Tensor query_points,  // [N', 3]
+        torch::Tensor query_width,   // [N',]
+        torch::Tensor points,        // [N, 3]
+        std::vector<torch::Tensor> point_attrs,  // one per operator, [N, 3] for A and G, [N, 1] for AT
+        torch::Tensor node_children_list,
+        torch::Tensor node2point_index,
+        torch::Tensor node2point_indexstart,
+        torch::Tensor num_points_in_node,
+        torch::Tensor node_is_leaf_list,
+        torch::Tensor node_half_w_list,
+        torch::Tensor node_level_order,
+        torch::Tensor node_level_offsets,
+        double theta,
+        bool dual_tree,              // A and AT at the points of the tree, see multiply_fused_A_AT_dualtree_cpu_kernel_launcher
+        const TraversalCaches* traversal_caches,   // of the tree, or nullptr
+        TraversalWorkspaces* traversal_workspaces  // reused for the fresh scatter of every call, or nullptr
+        ) {
+
+    CHECK_INPUT_FOR_CPU(query_points);
+    CHECK_INPUT_FOR_CPU(query_width);
+    CHECK_INPUT_FOR_CPU(points);
+    CHECK_INPUT_FOR_CPU(node_children_list);
+    CHECK_INPUT_FOR_CPU(node2point_index);
+    CHECK_INPUT_FOR_CPU(node2point_indexstart);
+    CHECK_INPUT_FOR_CPU(num_points_in_node);
+    CHECK_INPUT_FOR_CPU(node_is_leaf_list);
+    CHECK_INPUT_FOR_CPU(node_half_w_list);
+    CHECK_INPUT_FOR_CPU(node_level_order);
+    CHECK_INPUT_FOR_CPU(node_level_offsets);
+    TORCH_CHECK(operators.size() == point_attrs.size(), "multiply_fused: one attribute tensor per operator");
+    TORCH_CHECK(!dual_tree || query_points.size(0) == points.size(0), "the dual-tree evaluation is at the points of the tree");
+    TORCH_CHECK(!operators.empty(), "multiply_fused: no operator");
+    TORCH_CHECK(theta > 0, "theta must be positive");
+    if (!dual_tree) { CHECK_PACKED_TREE_SIZE(points, node_is_leaf_list); }
+
+    FusedOperators fused_ops;
+    for (size_t k = 0; k < operators.size(); k++) {
+        FusedOperatorKind kind = FUSED_OP_A;
+        if (operators[k] == "A") {
+            kind = FUSED_OP_A;
+        } else if (operators[k] == "AT") {
+            kind = FUSED_OP_AT;
+        } else if (operators[k] == "G") {
+            kind = FUSED_OP_G;
+        } else {
+            AT_ERROR("multiply_fused: unknown operator '", operators[k], "', expected 'A', 'AT' or 'G'");
+        }
+        TORCH_CHECK(add_fused_operator(fused_ops, kind), "multiply_fused: at most ", MAX_FUSED_OPERATORS, " operators");
+        CHECK_INPUT_FOR_CPU(point_attrs[k]);
+        TORCH_CHECK(point_attrs[k].size(0) == points.size(0) && point_attrs[k].size(1) == (kind == FUSED_OP_AT ? 1 : SPATIAL_DIM),
+                    "multiply_fused: the attributes of '", operators[k], "' have the wrong shape");
+    }
+    TORCH_CHECK(!dual_tree || (fused_ops.num_ops == 2 && has_fused_operator(fused_ops, FUSED_OP_A) && has_fused_operator(fused_ops, FUSED_OP_AT)),
+                "multiply_fused: the dual-tree evaluation is for 'A' and 'AT' together");
+
+    // the reppoints are shared by the operators, weighted by the sum of the normalized magnitudes of their attributes
+    auto point_weights = torch::zeros({points.size(0)}, points.options());
+    for (const auto& attrs : point_attrs) {
+        auto magnitudes = (attrs * attrs).sum(-1).sqrt();
+        auto total_magnitude = magnitudes.sum().item<double>();
+        if (total_magnitude > 0) {
+            point_weights += magnitudes / total_magnitude;
+        }
+    }
+    auto fused_attrs = torch::cat(point_attrs, 1).contiguous();
+
+    signedindex_t num_nodes = node_is_leaf_list.size(0);
+    signedindex_t tree_depth = node_level_offsets.size(0) - 2;
+    auto float_tensor_options = torch::TensorOptions().dtype(points.dtype()).device(points.device());
+    auto node_attrs = torch::zeros({num_nodes, fused_ops.attr_dim}, float_tensor_options);
+    auto node_reppoints = torch::zeros({num_nodes, SPATIAL_DIM}, float_tensor_options);
+    auto node_weights = torch::zeros({num_nodes}, float_tensor_options);
+    auto out_attrs = torch::zeros({query_points.size(0), fused_ops.out_dim}, float_tensor_options);
+
+    DISPATCH_FLOATING_AND_INDEX_TYPES(points.type(), node_children_list.scalar_type(), "multiply_fused_cpu_kernel_launcher", ([&] {
+        scatter_point_attrs_to_nodes_cpu_kernel_launcher<scalar_t, index_t>(
+            node_children_list.data<index_t>(),
+            points.data<scalar_t>(),
+            point_weights.data<scalar_t>(),
+            fused_attrs.data<scalar_t>(),
+            node2point_index.data<index_t>(),
+            node2point_indexstart.data<index_t>(),
+            num_points_in_node.data<index_t>(),
+            node_is_leaf_list.data<bool>(),
+            node_level_order.data<index_t>(),
+            node_level_offsets.data<index_t>(),
+            node_attrs.data<scalar_t>(),
+            node_reppoints.data<scalar_t>(),
+            node_weights.data<scalar_t>(),
+            fused_ops.attr_dim,
+            tree_depth
+            );
+        TraversalWorkspace<scalar_t>* workspace = get_traversal_workspace<scalar_t>(traversal_workspaces);
+        if (workspace) {
+            workspace->invalidate();
+        }
+        if (dual_tree) {
+            multiply_fused_A_AT_dualtree_cpu_kernel_launcher<scalar_t, index_t>(
+                fused_ops,
+                points.data<scalar_t>(),        // [N, 3]
+                query_width.data<scalar_t>(),   // [N,]
+                fused_attrs.data<scalar_t>(),   // [N, C_total]
+                node2point_index.data<index_t>(),
+                node2point_indexstart.data<index_t>(),
+                node_children_list.data<index_t>(),
+                node_attrs.data<scalar_t>(),
+                node_is_leaf_list.data<bool>(),
+                node_half_w_list.data<scalar_t>(),
+                node_reppoints.data<scalar_t>(),
+                num_points_in_node.data<index_t>(),
+                out_attrs.data<scalar_t>(),     // [N, D_total]
+                num_nodes,
+                false,
+                scalar_t(theta),
+                get_traversal_cache<scalar_t>(traversal_caches),
+                workspace
+            );
+        } else {
+            multiply_fused_cpu_kernel_launcher<scalar_t, index_t>(
+                fused_ops,
+                query_points.data<scalar_t>(),  // [N', 3]
+                query_width.data<scalar_t>(),   // [N',]
+                points.data<scalar_t>(),        // [N, 3]
+                fused_attrs.data<scalar_t>(),   // [N, C_total]
+                node2point_index.data<index_t>(),
+                node2point_indexstart.data<index_t>(),
+                node_children_list.data<index_t>(),
+                node_attrs.data<scalar_t>(),
+                node_is_leaf_list.data<bool>(),
+                node_half_w_list.data<scalar_t>(),
+                node_reppoints.data<scalar_t>(),
+                num_points_in_node.data<index_t>(),
+                out_attrs.data<scalar_t>(),     // [N', D_total]
+                query_points.size(0),
+                false,
+                scalar_t(theta),
+                get_traversal_cache<scalar_t>(traversal_caches),
+                workspace
+            );
+        }
+    }));
+
+    std::vector<torch::Tensor> outs;
+    for (signedindex_t k = 0; k < fused_ops.num_ops; k++) {
+        signedindex_t out_dim = (fused_ops.kinds[k] == FUSED_OP_A) ? 1 : SPATIAL_DIM;
+        outs.push_back(out_attrs.narrow(1, fused_ops.out_offsets[k], out_dim).contiguous());
+    }
+    return outs;
+}
+
+std::vector<torch::Tensor> multiply_fused(
+        std::vector<std::string> operators,     // each of "A", "AT", "G"
+        torch::Tensor query_points,  // [N', 3]
+        torch::Tensor query_width,   // [N',]
+        torch::Tensor points,        // [N, 3]
+        std::vector<torch::Tensor> point_attrs,  // one per operator, [N, 3] for A and G, [N, 1] for AT
+        torch::Tensor node_children_list,
+        torch::Tensor node2point_index,
+        torch::Tensor node2point_indexstart,
+        torch::Tensor num_points_in_node,
+        torch::Tensor node_is_leaf_list,
+        torch::Tensor node_half_w_list,
+        torch::Tensor node_level_order,
+        torch::Tensor node_level_offsets,
+        double theta,
+        bool dual_tree
+        ) {
+    return multiply_fused_with_cache(operators, query_points, query_width, points, point_attrs, node_children_list, node2point_index, node2point_indexstart,
+                                     num_points_in_node, node_is_leaf_list, node_half_w_list, node_level_order, node_level_offsets, theta, dual_tree, nullptr, nullptr);
+}
+
+
+/// @note the products for K widths per query, [N', K, D] with D = 1 for A and 3 for AT and G,
+//        the node attributes are those of scatter_point_attrs_to_nodes
+torch::Tensor multiply_multiwidth(
+        FusedOperatorKind kind,
+        torch::Tensor query_points,  // [N', 3]
+        torch::Tensor query_widths,  // [N', K]
+        torch::Tensor points,        // [N, 3]
+        torch::Tensor point_attrs,   // [N, C]
+        torch::Tensor node2point_index,
+        torch::Tensor node2point_indexstart,
+        torch::Tensor node_children_list,
+        torch::Tensor node_attrs,
+        torch::Tensor node_is_leaf_list,
+        torch::Tensor node_half_w_list,
+        torch::Tensor node_reppoints,
+        torch::Tensor num_points_in_node,
+        c10::optional<torch::Tensor> out,
+        bool continuous_kernel,
+        double theta,
+        const TraversalCaches* traversal_caches = nullptr,   // of the tree
+        TraversalWorkspaces* traversal_workspaces = nullptr  // of the scatter of node_attrs and node_reppoints
+        ) {
+
+    CHECK_INPUT_FOR_CPU(query_points);
+    CHECK_INPUT_FOR_CPU(query_widths);
+    CHECK_INPUT_FOR_CPU(points);
+    CHECK_INPUT_FOR_CPU(point_attrs);
+    CHECK_INPUT_FOR_CPU(node2point_index);
+    CHECK_INPUT_FOR_CPU(node2point_indexstart);
+    CHECK_INPUT_FOR_CPU(node_children_list);
+    CHECK_INPUT_FOR_CPU(node_attrs);
+    CHECK_INPUT_FOR_CPU(node_is_leaf_list);
+    CHECK_INPUT_FOR_CPU(node_half_w_list);
+    CHECK_INPUT_FOR_CPU(node_reppoints);
+    CHECK_INPUT_FOR_CPU(num_points_in_node);
+    const signedindex_t attr_dim = (kind == FUSED_OP_AT) ? 1 : SPATIAL_DIM;
+    const signedindex_t out_dim = (kind == FUSED_OP_A) ? 1 : SPATIAL_DIM;
+    TORCH_CHECK(query_widths.dim() == 2 && query_widths.size(0) == query_points.size(0) && query_widths.size(1) >= 1, "query_widths must be [N', K]");
+    TORCH_CHECK(point_attrs.dim() == 2 && point_attrs.size(0) == points.size(0) && point_attrs.size(1) == attr_dim, "point_attrs must be [N, ", attr_dim, "]");
+    const signedindex_t num_queries = query_points.size(0);
+    const signedindex_t num_widths = query_widths.size(1);
+    TORCH_CHECK(theta > 0, "theta must be positive");
+    CHECK_PACKED_TREE_SIZE(points, node_is_leaf_list);
+
+    torch::Tensor out_attrs;
+    if (out.has_value()) {
+        out_attrs = out.value();
+        CHECK_INPUT_FOR_CPU(out_attrs);
+        TORCH_CHECK(out_attrs.dim() == 3 && out_attrs.size(0) == num_queries && out_attrs.size(1) == num_widths && out_attrs.size(2) == out_dim, "out must be [N', K, ", out_dim, "]");
+        TORCH_CHECK(out_attrs.dtype() == points.dtype(), "out must have the dtype of the points");
+    } else {
+        out_attrs = torch::empty({num_queries, num_widths, out_dim}, points.options());
+    }
+
+    DISPATCH_FLOATING_AND_INDEX_TYPES(points.type(), node_children_list.scalar_type(), "multiply_multiwidth_cpu_kernel_launcher", ([&] {
+        // the arguments shared by all of the launchers
+        const scalar_t* ptr_query_points = query_points.data<scalar_t>();
+        const scalar_t* ptr_query_widths = query_widths.data<scalar_t>();
+        const scalar_t* ptr_points = points.data<scalar_t>();
+        const scalar_t* ptr_point_attrs = point_attrs.data<scalar_t>();
+        const index_t* ptr_node2point_index = node2point_index.data<index_t>();
+        const index_t* ptr_node2point_indexstart = node2point_indexstart.data<index_t>();
+        const index_t* ptr_node_children_list = node_children_list.data<index_t>();
+        const scalar_t* ptr_node_attrs = node_attrs.data<scalar_t>();
+        const bool* ptr_node_is_leaf_list = node_is_leaf_list.data<bool>();
+        const scalar_t* ptr_node_half_w_list = node_half_w_list.data<scalar_t>();
+        const scalar_t* ptr_node_reppoints = node_reppoints.data<scalar_t>();
+        const index_t* ptr_num_points_in_node = num_points_in_node.data<index_t>();
+        scalar_t* ptr_out_attrs = out_attrs.data<scalar_t>();
+        const TreeTraversalCache<scalar_t>* traversal_cache = get_traversal_cache<scalar_t>(traversal_caches);
+        TraversalWorkspace<scalar_t>* workspace = get_traversal_workspace<scalar_t>(traversal_workspaces);
+
+        if (kind == FUSED_OP_A) {
+            multiply_by_A_multiwidth_cpu_kernel_launcher<scalar_t, index_t>(ptr_query_points, ptr_query_widths, num_widths, ptr_points, ptr_point_attrs, ptr_node2point_index, ptr_node2point_indexstart,
+                ptr_node_children_list, ptr_node_attrs, ptr_node_is_leaf_list, ptr_node_half_w_list, ptr_node_reppoints, ptr_num_points_in_node, ptr_out_attrs, num_queries, continuous_kernel, scalar_t(theta), traversal_cache, workspace);
+        } else if (kind == FUSED_OP_AT) {
+            multiply_by_AT_multiwidth_cpu_kernel_launcher<scalar_t, index_t>(ptr_query_points, ptr_query_widths, num_widths, ptr_points, ptr_point_attrs, ptr_node2point_index, ptr_node2point_indexstart,
+                ptr_node_children_list, ptr_node_attrs, ptr_node_is_leaf_list, ptr_node_half_w_list, ptr_node_reppoints, ptr_num_points_in_node, ptr_out_attrs, num_queries, scalar_t(theta), traversal_cache, workspace);
+        } else {
+            multiply_by_G_multiwidth_cpu_kernel_launcher<scalar_t, index_t>(ptr_query_points, ptr_query_widths, num_widths, ptr_points, ptr_point_attrs, ptr_node2point_index, ptr_node2point_indexstart,
+                ptr_node_children_list, ptr_node_attrs, ptr_node_is_leaf_list, ptr_node_half_w_list, ptr_node_reppoints, ptr_num_points_in_node, ptr_out_attrs, num_queries, scalar_t(theta), traversal_cache, workspace);
+        }
+    }));
+
+    return out_attrs;
+}
+
+
+torch::Tensor multiply_by_A_multiwidth(
+        torch::Tensor query_points,  // [N', 3]
+        torch::Tensor query_widths,  // [N', K]
+        torch::Tensor points,        // [N, 3]
+        torch::Tensor point_attrs,   // [N, C]
+        torch::Tensor node2point_index,
+        torch::Tensor node2point_indexstart,
+        torch::Tensor node_children_list,
+        torch::Tensor node_attrs,
+        torch::Tensor node_is_leaf_list,
+        torch::Tensor node_half_w_list,
+        torch::Tensor node_reppoints,
+        torch::Tensor num_points_in_node,
+        double theta
+        ) {
+    return multiply_multiwidth(FUSED_OP_A, query_points, query_widths, points, point_attrs, node2point_index, node2point_indexstart,
+                               node_children_list, node_attrs, node_is_leaf_list, node_half_w_list, node_reppoints, num_points_in_node,
+                               c10::nullopt, false, theta);
+}
+
+torch::Tensor multiply_by_AT_multiwidth(
+        torch::Tensor query_points,  // [N', 3]
+        torch::Tensor query_widths,  // [N', K]
+        torch::Tensor points,        // [N, 3]
+        torch::Tensor point_attrs,   // [N, C]
+        torch::Tensor node2point_index,
+        torch::Tensor node2point_indexstart,
+        torch::Tensor node_children_list,
+        torch::Tensor node_attrs,
+        torch::Tensor node_is_leaf_list,
+        torch::Tensor node_half_w_list,
+        torch::Tensor node_reppoints,
+        torch::Tensor num_points_in_node,
+        double theta
+        ) {
+    return multiply_multiwidth(FUSED_OP_AT, query_points, query_widths, points, point_attrs, node2point_index, node2point_indexstart,
+                               node_children_list, node_attrs, node_is_leaf_list, node_half_w_list, node_reppoints, num_points_in_node,
+                               c10::nullopt, false, theta);
+}
+
+torch::Tensor multiply_by_G_multiwidth(
+        torch::Tensor query_points,  // [N', 3]
+        torch::Tensor query_widths,  // [N', K]
+        torch::Tensor points,        // [N, 3]
+        torch::Tensor point_attrs,   // [N, C]
+        torch::Tensor node2point_index,
+        torch::Tensor node2point_indexstart,
+        torch::Tensor node_children_list,
+        torch::Tensor node_attrs,
+        torch::Tensor node_is_leaf_list,
+        torch::Tensor node_half_w_list,
+        torch::Tensor node_reppoints,
+        torch::Tensor num_points_in_node,
+        double theta
+        ) {
+    return multiply_multiwidth(FUSED_OP_G, query_points, query_widths, points, point_attrs, node2point_index, node2point_indexstart,
+                               node_children_list, node_attrs, node_is_leaf_list, node_half_w_list, node_reppoints, num_points_in_node,
+                               c10::nullopt, false, theta);
+}
+
+
+/// @note the products for K right hand sides side by side, point_attrs [N, K*C] and node_attrs [num_nodes, K*C]
+//        from scatter_point_attrs_to_nodes of the [N, K*C] attributes, returns [N', K*D]
+torch::Tensor multiply_multirhs(
+        FusedOperatorKind kind,
+        torch::Tensor query_points,  // [N', 3]
+        torch::Tensor query_width,   // [N',]
+        torch::Tensor points,        // [N, 3]
+        torch::Tensor point_attrs,   // [N, K*C]
+        torch::Tensor node2point_index,
+        torch::Tensor node2point_indexstart,
+        torch::Tensor node_children_list,
+        torch::Tensor node_attrs,
+        torch::Tensor node_is_leaf_list,
+        torch::Tensor node_half_w_list,
+        torch::Tensor node_reppoints,
+        torch::Tensor num_points_in_node,
+        double theta
+        ) {
+
+    CHECK_INPUT_FOR_CPU(query_points);
+    CHECK_INPUT_FOR_CPU(query_width);
+    CHECK_INPUT_FOR_CPU(points);
+    CHECK_INPUT_FOR_CPU(point_attrs);
+    CHECK_INPUT_FOR_CPU(node2point_index);
+    CHECK_INPUT_FOR_CPU(node2point_indexstart);
+    CHECK_INPUT_FOR_CPU(node_children_list);
+    CHECK_INPUT_FOR_CPU(node_attrs);
+    CHECK_INPUT_FOR_CPU(node_is_leaf_list);
+    CHECK_INPUT_FOR_CPU(node_half_w_list);
+    CHECK_INPUT_FOR_CPU(node_reppoints);
+    CHECK_INPUT_FOR_CPU(num_points_in_node);
+    const signedindex_t attr_dim = (kind == FUSED_OP_AT) ? 1 : SPATIAL_DIM;
+    const signedindex_t out_dim = (kind == FUSED_OP_A) ? 1 : SPATIAL_DIM;
+    TORCH_CHECK(point_attrs.dim() == 2 && point_attrs.size(1) >= attr_dim && point_attrs.size(1) % attr_dim == 0, "point_attrs must be [N, K*", attr_dim, "]");
+    TORCH_CHECK(node_attrs.numel() == node_is_leaf_list.size(0) * point_attrs.size(1), "node_attrs must be [num_nodes, K*", attr_dim, "]");
+    const signedindex_t num_rhs = point_attrs.size(1) / attr_dim;
+    const signedindex_t num_queries = query_points.size(0);
+    const signedindex_t num_nodes = node_is_leaf_list.size(0);
+    TORCH_CHECK(theta > 0, "theta must be positive");
+    CHECK_PACKED_TREE_SIZE(points, node_is_leaf_list);
+
+    auto out_attrs = torch::empty({num_queries, num_rhs * out_dim}, points.options());
+
+    DISPATCH_FLOATING_AND_INDEX_TYPES(points.type(), node_children_list.scalar_type(), "multiply_multirhs_cpu_kernel_launcher", ([&] {
+        // the arguments shared by all of the launchers
+        const scalar_t* ptr_query_points = query_points.data<scalar_t>();
+        const scalar_t* ptr_query_width = query_width.data<scalar_t>();
+        const scalar_t* ptr_points = points.data<scalar_t>();
+        const scalar_t* ptr_point_attrs = point_attrs.data<scalar_t>();
+        const index_t* ptr_node2point_index = node2point_index.data<index_t>();
+        const index_t* ptr_node2point_indexstart = node2point_indexstart.data<index_t>();
+        const index_t* ptr_node_children_list = node_children_list.data<index_t>();
+        const scalar_t* ptr_node_attrs = node_attrs.data<scalar_t>();
+        const bool* ptr_node_is_leaf_list = node_is_leaf_list.data<bool>();
+        const scalar_t* ptr_node_half_w_list = node_half_w_list.data<scalar_t>();
+        const scalar_t* ptr_node_reppoints = node_reppoints.data<scalar_t>();
+        const index_t* ptr_num_points_in_node = num_points_in_node.data<index_t>();
+        scalar_t* ptr_out_attrs = out_attrs.data<scalar_t>();
+
+        if (kind == FUSED_OP_A) {
+            multiply_by_A_multirhs_cpu_kernel_launcher<scalar_t, index_t>(ptr_query_points, ptr_query_width, num_rhs, ptr_points, ptr_point_attrs, ptr_node2point_index, ptr_node2point_indexstart,
+                ptr_node_children_list, ptr_node_attrs, ptr_node_is_leaf_list, ptr_node_half_w_list, ptr_node_reppoints, ptr_num_points_in_node, ptr_out_attrs, num_queries, num_nodes, false, scalar_t(theta));
+        } else if (kind == FUSED_OP_AT) {
+            multiply_by_AT_multirhs_cpu_kernel_launcher<scalar_t, index_t>(ptr_query_points, ptr_query_width, num_rhs, ptr_points, ptr_point_attrs, ptr_node2point_index, ptr_node2point_indexstart,
+                ptr_node_children_list, ptr_node_attrs, ptr_node_is_leaf_list, ptr_node_half_w_list, ptr_node_reppoints, ptr_num_points_in_node, ptr_out_attrs, num_queries, num_nodes, scalar_t(theta));
+        } else {
+            multiply_by_G_multirhs_cpu_kernel_launcher<scalar_t, index_t>(ptr_query_points, ptr_query_width, num_rhs, ptr_points, ptr_point_attrs, ptr_node2point_index, ptr_node2point_indexstart,
+                ptr_node_children_list, ptr_node_attrs, ptr_node_is_leaf_list, ptr_node_half_w_list, ptr_node_reppoints, ptr_num_points_in_node, ptr_out_attrs, num_queries, num_nodes, scalar_t(theta));
+        }
+    }));
+
+    return out_attrs;
+}
+
+
+torch::Tensor multiply_by_A_multirhs(
+        torch::Tensor query_points,  // [N', 3]
+        torch::Tensor query_width,   // [N',]
+        torch::Tensor points,        // [N, 3]
+        torch::Tensor point_attrs,   // [N, K*C]
+        torch::Tensor node2point_index,
+        torch::Tensor node2point_indexstart,
+        torch::Tensor node_children_list,
+        torch::Tensor node_attrs,
+        torch::Tensor node_is_leaf_list,
+        torch::Tensor node_half_w_list,
+        torch::Tensor node_reppoints,
+        torch::Tensor num_points_in_node,
+        double theta
+        ) {
+    return multiply_multirhs(FUSED_OP_A, query_points, query_width, points, point_attrs, node2point_index, node2point_indexstart,
+                             node_children_list, node_attrs, node_is_leaf_list, node_half_w_list, node_reppoints, num_points_in_node, theta);
+}
+
+torch::Tensor multiply_by_AT_multirhs(
+        torch::Tensor query_points,  // [N', 3]
+        torch::Tensor query_width,   // [N',]
+        torch::Tensor points,        // [N, 3]
+        torch::Tensor point_attrs,   // [N, K*C]
+        torch::Tensor node2point_index,
+        torch::Tensor node2point_indexstart,
+        torch::Tensor node_children_list,
+        torch::Tensor node_attrs,
+        torch::Tensor node_is_leaf_list,
+        torch::Tensor node_half_w_list,
+        torch::Tensor node_reppoints,
+        torch::Tensor num_points_in_node,
+        double theta
+        ) {
+    return multiply_multirhs(FUSED_OP_AT, query_points, query_width, points, point_attrs, node2point_index, node2point_indexstart,
+                             node_children_list, node_attrs, node_is_leaf_list, node_half_w_list, node_reppoints, num_points_in_node, theta);
+}
+
+torch::Tensor multiply_by_G_multirhs(
+        torch::Tensor query_points,  // [N', 3]
+        torch::Tensor query_width,   // [N',]
+        torch::Tensor points,        // [N, 3]
+        torch::Tensor point_attrs,   // [N, K*C]
+        torch::Tensor node2point_index,
+        torch::Tensor node2point_indexstart,
+        torch::Tensor node_children_list,
+        torch::Tensor node_attrs,
+        torch::Tensor node_is_leaf_list,
+        torch::Tensor node_half_w_list,
+        torch::Tensor node_reppoints,
+        torch::Tensor num_points_in_node,
+        double theta
+        ) {
+    return multiply_multirhs(FUSED_OP_G, query_points, query_width, points, point_attrs, node2point_index, node2point_indexstart,
+                             node_children_list, node_attrs, node_is_leaf_list, node_half_w_list, node_reppoints, num_points_in_node, theta);
+}
+
+
+/// @brief the tree of a point cloud and the buffers of its treecode products, kept across calls:
+//         every forward_* scatters into the same node buffers, and writes into out when given,
+//         so repeated products (e.g. the WNNC iterations) allocate nothing but the outputs they are not given
+#define MAX_MEMOIZED_SCATTERS 4
+class WindingNumberTreecodeCPU {
+public:
+    WindingNumberTreecodeCPU(
+            torch::Tensor points,        // [N, 3]
+            signedindex_t max_depth,
+            signedindex_t num_threads,
+            bool cache_interaction_lists,
+            bool dual_tree,
+            double theta,
+            signedindex_t leaf_size,
+            bool int32_indices,
+            bool tree_order
+            ) : points(points), dual_tree(dual_tree), cache_interaction_lists(cache_interaction_lists) {
+        TORCH_CHECK(!(cache_interaction_lists && dual_tree), "dual-tree evaluation does not use cached interaction lists");
+        tree = build_tree(points, max_depth, num_threads, leaf_size, int32_indices);
+        CHECK_PACKED_TREE_SIZE(points, node_is_leaf_list());
+        if (tree_order) {
+            // the leaves then cover contiguous ranges of the points, and node2point_index is the identity
+            point_order = tree[5].to(torch::kLong);
+            this->points = points.index_select(0, point_order).contiguous();
+            tree[5] = torch::arange(points.size(0), tree[5].options());
+        }
+        // what every traversal derives from the tree and the points alone, see prepare_tree_traversal_cache_cpu
+        DISPATCH_FLOATING_AND_INDEX_TYPES(this->points.type(), node_children_list().scalar_type(), "WindingNumberTreecodeCPU", ([&] {
+            prepare_tree_traversal_cache_cpu<scalar_t, index_t>(
+                this->points.data<scalar_t>(),
+                node_children_list().data<index_t>(),
+                node_is_leaf_list().data<bool>(),
+                node2point_index().data<index_t>(),
+                node2point_indexstart().data<index_t>(),
+                num_points_in_node().data<index_t>(),
+                node_parent_list().size(0),
+                std::get<TreeTraversalCache<scalar_t>>(traversal_caches));
+        }));
+        if (cache_interaction_lists) {
+            update_interaction_lists(theta);
+        }
+
+        point_weights = torch::zeros({points.size(0)}, points.options());
+    }
+
+    /// @note the tensors of build_tree, and of build_interaction_lists (empty without cache_interaction_lists)
+    std::vector<torch::Tensor> get_tree() const { return tree; }
+    std::vector<torch::Tensor> get_interaction_lists() const { return interaction_lists; }
+
+    /// @note with tree_order, the points are kept in the order of the tree: point i is the input point point_order[i],
+    //        and forward_* take and return [N, ...] tensors in that order (point_order is empty without tree_order)
+    torch::Tensor get_points() const { return points; }
+    torch::Tensor get_point_order() const { return point_order; }
+
+    /// @note with memoize, the scatter of the attributes is kept and reused by the next calls with the same tensor,
+    //        as long as it is not modified in place (torch version counter), e.g. for a constant right hand side.
+    //        The last MAX_MEMOIZED_SCATTERS tensors are kept alive along with their node buffers
+    //        theta is the accuracy of the products (see TREECODE_THRESHOLD), it can change from call to call:
+    //        the cached interaction lists are rebuilt for the new value, and not otherwise
+    torch::Tensor forward_A(torch::Tensor normals, torch::Tensor widths, signedindex_t expansion_order, c10::optional<torch::Tensor> out, bool memoize, double theta) {
+        return forward(FUSED_OP_A, normals, widths, expansion_order, out, memoize, theta);
+    }
+
+    torch::Tensor forward_AT(torch::Tensor values, torch::Tensor widths, signedindex_t expansion_order, c10::optional<torch::Tensor> out, bool memoize, double theta) {
+        return forward(FUSED_OP_AT, values, widths, expansion_order, out, memoize, theta);
+    }
+
+    torch::Tensor forward_G(torch::Tensor normals, torch::Tensor widths, signedindex_t expansion_order, c10::optional<torch::Tensor> out, bool memoize, double theta) {
+        return forward(FUSED_OP_G, normals, widths, expansion_order, out, memoize, theta);
+    }
+
+    /// @note the products for K widths per point ([N, K]) in one traversal, [N, K, D], far nodes at order 0
+    torch::Tensor forward_A_multiwidth(torch::Tensor normals, torch::Tensor widths, c10::optional<torch::Tensor> out, bool memoize, double theta) {
+        return forward_multiwidth(FUSED_OP_A, normals, widths, out, memoize, theta);
+    }
+
+    torch::Tensor forward_AT_multiwidth(torch::Tensor values, torch::Tensor widths, c10::optional<torch::Tensor> out, bool memoize, double theta) {
+        return forward_multiwidth(FUSED_OP_AT, values, widths, out, memoize, theta);
+    }
+
+    torch::Tensor forward_G_multiwidth(torch::Tensor normals, torch::Tensor widths, c10::optional<torch::Tensor> out, bool memoize, double theta) {
+        return forward_multiwidth(FUSED_OP_G, normals, widths, out, memoize, theta);
+    }
+
+    /// @note multiply_fused at the points, with the traversal caches of the tree
+    std::vector<torch::Tensor> forward_fused(std::vector<std::string> operators, torch::Tensor widths, std::vector<torch::Tensor> point_attrs, double theta, bool dual_tree) {
+        return multiply_fused_with_cache(operators, points, widths, points, point_attrs, node_children_list(), node2point_index(), node2point_indexstart(),
+                                         num_points_in_node(), node_is_leaf_list(), node_half_w_list(), node_level_order(), node_level_offsets(), theta, dual_tree, &traversal_caches, &fused_workspaces);
+    }
+
+private:
+    torch::Tensor points;
+    torch::Tensor point_order;   // [N,] with tree_order
+    bool dual_tree = false;
+    bool cache_interaction_lists = false;
+    std::vector<torch::Tensor> tree;
+    std::vector<torch::Tensor> interaction_lists;
+    double interaction_lists_theta = 0;   // the far and near lists depend on theta
+    TraversalCaches traversal_caches;      // for the dtype of the points
+    TraversalWorkspaces fused_workspaces;  // of forward_fused, which scatters on every call
+
+    // the outputs of one scatter, the moments are only allocated by the first scatter that needs them
+    struct NodeBuffers {
+        torch::Tensor node_attrs;        // [num_nodes, C], C <= 3
+        torch::Tensor node_reppoints;
+        torch::Tensor node_weights;
+        torch::Tensor node_moments1;
+        torch::Tensor node_moments2;
+        // memoized scatters: the scattered tensor, its version, how it was split into right hand sides (their weights
+        // and so the reppoints depend on it, e.g. [N, 3] as one mu or as three s) and the expansion order
+        torch::Tensor point_attrs;
+        int64_t version = -1;
+        signedindex_t attr_dim = -1;
+        signedindex_t num_rhs = -1;
+        signedindex_t expansion_order = -1;
+        signedindex_t last_use = 0;
+        // the far-field distances and packed nodes for these reppoints, invalidated by every scatter into them
+        TraversalWorkspaces workspaces;
+    };
+
+    // reused by every call without memoize
+    torch::Tensor point_weights;
+    NodeBuffers work_buffers;
+    std::vector<NodeBuffers> memoized_buffers;   // at most MAX_MEMOIZED_SCATTERS
+    signedindex_t num_memoized_uses = 0;
+
+    torch::Tensor node_parent_list() const { return tree[0]; }
+    torch::Tensor node_children_list() const { return tree[1]; }
+    torch::Tensor node_is_leaf_list() const { return tree[2]; }
+    torch::Tensor node_half_w_list() const { return tree[3]; }
+    torch::Tensor num_points_in_node() const { return tree[4]; }
+    torch::Tensor node2point_index() const { return tree[5]; }
+    torch::Tensor node2point_indexstart() const { return tree[6]; }
+    torch::Tensor node_level_order() const { return tree[7]; }
+    torch::Tensor node_level_offsets() const { return tree[8]; }
+
+    /// @brief (re)builds the cached interaction lists if they were built for another theta
+    void update_interaction_lists(double theta) {
+        if (interaction_lists.empty() || interaction_lists_theta != theta) {
+            interaction_lists = build_interaction_lists(points, points, node_children_list(), node_is_leaf_list(), node_half_w_list(),
+                                                        node2point_index(), node2point_indexstart(), num_points_in_node(), theta);
+            interaction_lists_theta = theta;
+        }
+    }
+
+    /// @brief scatters the attributes ([N, K*attr_dim], K right hand sides) to the work buffers,
+    //         or finds them in (or adds them to) the memoized ones
+    NodeBuffers& scatter(torch::Tensor point_attrs, signedindex_t attr_dim, signedindex_t expansion_order, bool memoize) {
+        NodeBuffers* buffers = &work_buffers;
+        const signedindex_t num_rhs = point_attrs.size(1) / attr_dim;
+        if (memoize) {
+            num_memoized_uses++;
+            for (NodeBuffers& memoized : memoized_buffers) {
+                if (memoized.point_attrs.is_same(point_attrs) && memoized.version == point_attrs._version() &&
+                    memoized.attr_dim == attr_dim && memoized.num_rhs == num_rhs && memoized.expansion_order == expansion_order) {
+                    memoized.last_use = num_memoized_uses;
+                    return memoized;
+                }
+            }
+            // a new entry, or the least recently used one
+            if (signedindex_t(memoized_buffers.size()) < MAX_MEMOIZED_SCATTERS) {
+                memoized_buffers.emplace_back();
+                buffers = &memoized_buffers.back();
+            } else {
+                buffers = &*std::min_element(memoized_buffers.begin(), memoized_buffers.end(),
+                    [](const NodeBuffers& a, const NodeBuffers& b) { return a.last_use < b.last_use; });
+            }
+            buffers->point_attrs = point_attrs;
+            buffers->version = point_attrs._version();
+            buffers->attr_dim = attr_dim;
+            buffers->num_rhs = num_rhs;
+            buffers->expansion_order = expansion_order;
+            buffers->last_use = num_memoized_uses;
+        }
+
+        const signedindex_t num_points = points.size(0);
+        const signedindex_t num_nodes = node_parent_list().size(0);
+        if (!buffers->node_attrs.defined()) {
+            buffers->node_reppoints = torch::zeros({num_nodes, SPATIAL_DIM}, points.options());
+            buffers->node_weights = torch::zeros({num_nodes}, points.options());
+        }
+        if (!buffers->node_attrs.defined() || buffers->node_attrs.size(0) < num_nodes * SPATIAL_DIM * num_rhs) {
+            buffers->node_attrs = torch::zeros({num_nodes * SPATIAL_DIM * num_rhs}, points.options());   // [num_nodes, K, C], C <= 3
+        }
+        if (expansion_order >= 1 && !buffers->node_moments1.defined()) {
+            buffers->node_moments1 = torch::zeros({num_nodes * SPATIAL_DIM * SPATIAL_DIM}, points.options());   // [num_nodes, 3, C]
+        }
+        if (expansion_order >= 2 && !buffers->node_moments2.defined()) {
+            buffers->node_moments2 = torch::zeros({num_nodes * SPATIAL_DIM * SPATIAL_DIM * SPATIAL_DIM}, points.options());   // [num_nodes, 3, 3, C]
+        }
+
+        // the scatter accumulates into the node buffers
+        invalidate_traversal_workspaces(buffers->workspaces);
+        buffers->node_attrs.zero_();
+        buffers->node_reppoints.zero_();
+        buffers->node_weights.zero_();
+        if (expansion_order >= 1) { buffers->node_moments1.zero_(); }
+        if (expansion_order >= 2) { buffers->node_moments2.zero_(); }
+
+        DISPATCH_FLOATING_AND_INDEX_TYPES(points.type(), node_children_list().scalar_type(), "WindingNumberTreecodeCPU::scatter", ([&] {
+            // the points are weighted by the magnitudes of their attributes, as in wn_treecode_func.py,
+            // with several right hand sides by the sum of their magnitudes normalized by their totals, as in multiply_fused
+            const scalar_t* ptr_attrs_in = point_attrs.data<scalar_t>();
+            scalar_t* ptr_point_weights = point_weights.data<scalar_t>();
+            std::vector<double> total_weights(num_rhs, 0.0);
+            for (signedindex_t k = 0; k < num_rhs && num_rhs > 1; k++) {
+                for (signedindex_t i = 0; i < num_points; i++) {
+                    scalar_t norm2 = 0;
+                    for (signedindex_t c = 0; c < attr_dim; c++) {
+                        norm2 += ptr_attrs_in[(i*num_rhs + k)*attr_dim + c] * ptr_attrs_in[(i*num_rhs + k)*attr_dim + c];
+                    }
+                    total_weights[k] += std::sqrt(norm2);
+                }
+            }
+            for (signedindex_t i = 0; i < num_points; i++) {
+                ptr_point_weights[i] = 0;
+                for (signedindex_t k = 0; k < num_rhs; k++) {
+                    scalar_t norm2 = 0;
+                    for (signedindex_t c = 0; c < attr_dim; c++) {
+                        norm2 += ptr_attrs_in[(i*num_rhs + k)*attr_dim + c] * ptr_attrs_in[(i*num_rhs + k)*attr_dim + c];
+                    }
+                    if (num_rhs == 1) {
+                        ptr_point_weights[i] = std::sqrt(norm2);
+                    } else if (total_weights[k] > 0) {
+                        ptr_point_weights[i] += scalar_t(std::sqrt(norm2) / total_weights[k]);
+                    }
+                }
+            }
+            scatter_point_attrs_to_nodes_cpu_kernel_launcher<scalar_t, index_t>(
+                node_children_list().data<index_t>(),
+                points.data<scalar_t>(),
+                point_weights.data<scalar_t>(),
+                point_attrs.data<scalar_t>(),
+                node2point_index().data<index_t>(),
+                node2point_indexstart().data<index_t>(),
+                num_points_in_node().data<index_t>(),
+                node_is_leaf_list().data<bool>(),
+                node_level_order().data<index_t>(),
+                node_level_offsets().data<index_t>(),
+                buffers->node_attrs.data<scalar_t>(),
+                buffers->node_reppoints.data<scalar_t>(),
+                buffers->node_weights.data<scalar_t>(),
+                attr_dim * num_rhs,
+                node_level_offsets().size(0) - 2,
+                expansion_order >= 1 ? buffers->node_moments1.data<scalar_t>() : nullptr,
+                expansion_order >= 2 ? buffers->node_moments2.data<scalar_t>() : nullptr,
+                expansion_order
+                );
+        }));
+        return *buffers;
+    }
+
+    torch::Tensor forward(FusedOperatorKind kind, torch::Tensor point_attrs, torch::Tensor widths, signedindex_t expansion_order, c10::optional<torch::Tensor> out, bool memoize, double theta) {
+        const signedindex_t num_points = points.size(0);
+        const signedindex_t attr_dim = (kind == FUSED_OP_AT) ? 1 : SPATIAL_DIM;
+        const signedindex_t out_dim = (kind == FUSED_OP_A) ? 1 : SPATIAL_DIM;
+        CHECK_INPUT_FOR_CPU(point_attrs);
+        CHECK_INPUT_FOR_CPU(widths);
+        TORCH_CHECK(point_attrs.dim() == 2 && point_attrs.size(0) == num_points && point_attrs.size(1) >= attr_dim && point_attrs.size(1) % attr_dim == 0,
+                    "point_attrs must be [N, K*", attr_dim, "]");
+        TORCH_CHECK(widths.dim() == 1 && widths.size(0) == num_points, "widths must be [N,]");
+        const signedindex_t num_rhs = point_attrs.size(1) / attr_dim;
+        TORCH_CHECK(num_rhs == 1 || expansion_order == 0, "several right hand sides only support expansion_order == 0");
+        TORCH_CHECK(point_attrs.dtype() == points.dtype() && widths.dtype() == points.dtype(), "point_attrs and widths must have the dtype of the points");
+        TORCH_CHECK(expansion_order >= 0 && expansion_order <= MAX_EXPANSION_ORDER, "expansion_order must be 0, 1 or 2");
+        TORCH_CHECK(!(dual_tree && expansion_order > 0), "dual-tree evaluation only supports expansion_order == 0");
+        TORCH_CHECK(theta > 0, "theta must be positive");
+
+        torch::Tensor out_attrs;
+        if (out.has_value()) {
+            out_attrs = out.value();
+            CHECK_INPUT_FOR_CPU(out_attrs);
+            TORCH_CHECK(out_attrs.dim() == 2 && out_attrs.size(0) == num_points && out_attrs.size(1) == num_rhs * out_dim, "out must be [N, K*", out_dim, "]");
+            TORCH_CHECK(out_attrs.dtype() == points.dtype(), "out must have the dtype of the points");
+        } else {
+            out_attrs = torch::empty({num_points, num_rhs * out_dim}, points.options());
+        }
+
+        signedindex_t num_nodes = node_parent_list().size(0);
+        NodeBuffers& buffers = scatter(point_attrs, attr_dim, expansion_order, memoize);
+
+        const bool use_lists = cache_interaction_lists;
+        if (use_lists) {
+            update_interaction_lists(theta);
+        }
+        DISPATCH_FLOATING_AND_INDEX_TYPES(points.type(), node_children_list().scalar_type(), "WindingNumberTreecodeCPU::forward", ([&] {
+            const scalar_t* ptr_node_moments1 = expansion_order >= 1 ? buffers.node_moments1.data<scalar_t>() : nullptr;
+            const scalar_t* ptr_node_moments2 = expansion_order >= 2 ? buffers.node_moments2.data<scalar_t>() : nullptr;
+
+            // the arguments shared by all of the launchers
+            const scalar_t* ptr_points = points.data<scalar_t>();
+            const scalar_t* ptr_widths = widths.data<scalar_t>();
+            const scalar_t* ptr_point_attrs = point_attrs.data<scalar_t>();
+            const index_t* ptr_node2point_index = node2point_index().data<index_t>();
+            const index_t* ptr_node2point_indexstart = node2point_indexstart().data<index_t>();
+            const index_t* ptr_node_children_list = node_children_list().data<index_t>();
+            const scalar_t* ptr_node_attrs = buffers.node_attrs.data<scalar_t>();
+            const bool* ptr_node_is_leaf_list = node_is_leaf_list().data<bool>();
+            const scalar_t* ptr_node_half_w_list = node_half_w_list().data<scalar_t>();
+            const scalar_t* ptr_node_reppoints = buffers.node_reppoints.data<scalar_t>();
+            const index_t* ptr_num_points_in_node = num_points_in_node().data<index_t>();
+            scalar_t* ptr_out_attrs = out_attrs.data<scalar_t>();
+            const TreeTraversalCache<scalar_t>* traversal_cache = &std::get<TreeTraversalCache<scalar_t>>(traversal_caches);
+            TraversalWorkspace<scalar_t>* workspace = &std::get<TraversalWorkspace<scalar_t>>(buffers.workspaces);
+
+            if (num_rhs > 1) {
+                // one traversal for all of the right hand sides, whatever the evaluation mode
+                if (kind == FUSED_OP_A) {
+                    multiply_by_A_multirhs_cpu_kernel_launcher<scalar_t, index_t>(ptr_points, ptr_widths, num_rhs, ptr_points, ptr_point_attrs, ptr_node2point_index, ptr_node2point_indexstart, ptr_node_children_list,
+                        ptr_node_attrs, ptr_node_is_leaf_list, ptr_node_half_w_list, ptr_node_reppoints, ptr_num_points_in_node, ptr_out_attrs, num_points, num_nodes, false, scalar_t(theta), traversal_cache, workspace);
+                } else if (kind == FUSED_OP_AT) {
+                    multiply_by_AT_multirhs_cpu_kernel_launcher<scalar_t, index_t>(ptr_points, ptr_widths, num_rhs, ptr_points, ptr_point_attrs, ptr_node2point_index, ptr_node2point_indexstart, ptr_node_children_list,
+                        ptr_node_attrs, ptr_node_is_leaf_list, ptr_node_half_w_list, ptr_node_reppoints, ptr_num_points_in_node, ptr_out_attrs, num_points, num_nodes, scalar_t(theta), traversal_cache, workspace);
+                } else {
+                    multiply_by_G_multirhs_cpu_kernel_launcher<scalar_t, index_t>(ptr_points, ptr_widths, num_rhs, ptr_points, ptr_point_attrs, ptr_node2point_index, ptr_node2point_indexstart, ptr_node_children_list,
+                        ptr_node_attrs, ptr_node_is_leaf_list, ptr_node_half_w_list, ptr_node_reppoints, ptr_num_points_in_node, ptr_out_attrs, num_points, num_nodes, scalar_t(theta), traversal_cache, workspace);
+                }
+            } else if (dual_tree) {
+                if (kind == FUSED_OP_A) {
+                    multiply_by_A_dualtree_cpu_kernel_launcher<scalar_t, index_t>(ptr_points, ptr_widths, ptr_point_attrs, ptr_node2point_index, ptr_node2point_indexstart, ptr_node_children_list,
+                        ptr_node_attrs, ptr_node_is_leaf_list, ptr_node_half_w_list, ptr_node_reppoints, ptr_num_points_in_node, ptr_out_attrs, num_nodes, false, scalar_t(theta), traversal_cache, workspace);
+                } else if (kind == FUSED_OP_AT) {
+                    multiply_by_AT_dualtree_cpu_kernel_launcher<scalar_t, index_t>(ptr_points, ptr_widths, ptr_point_attrs, ptr_node2point_index, ptr_node2point_indexstart, ptr_node_children_list,
+                        ptr_node_attrs, ptr_node_is_leaf_list, ptr_node_half_w_list, ptr_node_reppoints, ptr_num_points_in_node, ptr_out_attrs, num_nodes, scalar_t(theta), traversal_cache, workspace);
+                } else {
+                    multiply_by_G_dualtree_cpu_kernel_launcher<scalar_t, index_t>(ptr_points, ptr_widths, ptr_point_attrs, ptr_node2point_index, ptr_node2point_indexstart, ptr_node_children_list,
+                        ptr_node_attrs, ptr_node_is_leaf_list, ptr_node_half_w_list, ptr_node_reppoints, ptr_num_points_in_node, ptr_out_attrs, num_nodes, scalar_t(theta), traversal_cache, workspace);
+                }
+            } else if (use_lists) {
+                const signedindex_t* ptr_far_offsets = interaction_lists[0].data<signedindex_t>();
+                const index_t* ptr_far_nodes = interaction_lists[1].data<index_t>();
+                const signedindex_t* ptr_near_offsets = interaction_lists[2].data<signedindex_t>();
+                const index_t* ptr_near_leaves = interaction_lists[3].data<index_t>();
+                const signedindex_t* ptr_open_offsets = interaction_lists[4].data<signedindex_t>();
+                const index_t* ptr_open_nodes = interaction_lists[5].data<index_t>();
+                if (kind == FUSED_OP_A) {
+                    multiply_by_A_cached_cpu_kernel_launcher<scalar_t, index_t>(ptr_points, ptr_widths, ptr_points, ptr_point_attrs, ptr_node2point_index, ptr_node2point_indexstart, ptr_node_children_list,
+                        ptr_node_attrs, ptr_node_is_leaf_list, ptr_node_half_w_list, ptr_node_reppoints, ptr_num_points_in_node,
+                        ptr_far_offsets, ptr_far_nodes, ptr_near_offsets, ptr_near_leaves, ptr_open_offsets, ptr_open_nodes,
+                        ptr_out_attrs, num_points, false, expansion_order, ptr_node_moments1, ptr_node_moments2, scalar_t(theta), traversal_cache, workspace);
+                } else if (kind == FUSED_OP_AT) {
+                    multiply_by_AT_cached_cpu_kernel_launcher<scalar_t, index_t>(ptr_points, ptr_widths, ptr_points, ptr_point_attrs, ptr_node2point_index, ptr_node2point_indexstart, ptr_node_children_list,
+                        ptr_node_attrs, ptr_node_is_leaf_list, ptr_node_half_w_list, ptr_node_reppoints, ptr_num_points_in_node,
+                        ptr_far_offsets, ptr_far_nodes, ptr_near_offsets, ptr_near_leaves, ptr_open_offsets, ptr_open_nodes,
+                        ptr_out_attrs, num_points, expansion_order, ptr_node_moments1, ptr_node_moments2, scalar_t(theta), traversal_cache, workspace);
+                } else {
+                    multiply_by_G_cached_cpu_kernel_launcher<scalar_t, index_t>(ptr_points, ptr_widths, ptr_points, ptr_point_attrs, ptr_node2point_index, ptr_node2point_indexstart, ptr_node_children_list,
+                        ptr_node_attrs, ptr_node_is_leaf_list, ptr_node_half_w_list, ptr_node_reppoints, ptr_num_points_in_node,
+                        ptr_far_offsets, ptr_far_nodes, ptr_near_offsets, ptr_near_leaves, ptr_open_offsets, ptr_open_nodes,
+                        ptr_out_attrs, num_points, expansion_order, ptr_node_moments1, ptr_node_moments2, scalar_t(theta), traversal_cache, workspace);
+                }
+            } else {
+                if (kind == FUSED_OP_A) {
+                    multiply_by_A_cpu_kernel_launcher<scalar_t, index_t>(ptr_points, ptr_widths, ptr_points, ptr_point_attrs, ptr_node2point_index, ptr_node2point_indexstart, ptr_node_children_list,
+                        ptr_node_attrs, ptr_node_is_leaf_list, ptr_node_half_w_list, ptr_node_reppoints, ptr_num_points_in_node,
+                        ptr_out_attrs, num_points, false, expansion_order, ptr_node_moments1, ptr_node_moments2, scalar_t(theta), traversal_cache, workspace);
+                } else if (kind == FUSED_OP_AT) {
+                    multiply_by_AT_cpu_kernel_launcher<scalar_t, index_t>(ptr_points, ptr_widths, ptr_points, ptr_point_attrs, ptr_node2point_index, ptr_node2point_indexstart, ptr_node_children_list,
+                        ptr_node_attrs, ptr_node_is_leaf_list, ptr_node_half_w_list, ptr_node_reppoints, ptr_num_points_in_node,
+                        ptr_out_attrs, num_points, expansion_order, ptr_node_moments1, ptr_node_moments2, scalar_t(theta), traversal_cache, workspace);
+                } else {
+                    multiply_by_G_cpu_kernel_launcher<scalar_t, index_t>(ptr_points, ptr_widths, ptr_points, ptr_point_attrs, ptr_node2point_index, ptr_node2point_indexstart, ptr_node_children_list,
+                        ptr_node_attrs, ptr_node_is_leaf_list, ptr_node_half_w_list, ptr_node_reppoints, ptr_num_points_in_node,
+                        ptr_out_attrs, num_points, expansion_order, ptr_node_moments1, ptr_node_moments2, scalar_t(theta), traversal_cache, workspace);
+                }
+            }
+        }));
+
+        return out_attrs;
+    }
+
+    torch::Tensor forward_multiwidth(FusedOperatorKind kind, torch::Tensor point_attrs, torch::Tensor widths, c10::optional<torch::Tensor> out, bool memoize, double theta) {
+        const signedindex_t num_points = points.size(0);
+        const signedindex_t attr_dim = (kind == FUSED_OP_AT) ? 1 : SPATIAL_DIM;
+        CHECK_INPUT_FOR_CPU(point_attrs);
+        CHECK_INPUT_FOR_CPU(widths);
+        TORCH_CHECK(point_attrs.dim() == 2 && point_attrs.size(0) == num_points && point_attrs.size(1) == attr_dim, "point_attrs must be [N, ", attr_dim, "]");
+        TORCH_CHECK(widths.dim() == 2 && widths.size(0) == num_points, "widths must be [N, K]");
+        TORCH_CHECK(point_attrs.dtype() == points.dtype() && widths.dtype() == points.dtype(), "point_attrs and widths must have the dtype of the points");
+
+        NodeBuffers& buffers = scatter(point_attrs, attr_dim, 0, memoize);
+        return multiply_multiwidth(kind, points, widths, points, point_attrs, node2point_index(), node2point_indexstart(), node_children_list(),
+                                   buffers.node_attrs, node_is_leaf_list(), node_half_w_list(), buffers.node_reppoints, num_points_in_node(), out, false, theta, &traversal_caches, &buffers.workspaces);
+    }
+};
+
+
+void set_schedule_by_name(std::string schedule_kind, signedindex_t chunk_size) {
+    if (schedule_kind == "static") {
+        set_schedule(SCHEDULE_STATIC, chunk_size);
+    } else if (schedule_kind == "dynamic") {
+        set_schedule(SCHEDULE_DYNAMIC, chunk_size);
+    } else if (schedule_kind == "guided") {
+        set_schedule(SCHEDULE_GUIDED, chunk_size);
+    } else if (schedule_kind == "balanced") {
+        set_schedule(SCHEDULE_BALANCED, chunk_size);
+    } else {
+        AT_ERROR("set_schedule: unknown schedule '", schedule_kind, "', expected 'static', 'dynamic', 'guided' or 'balanced'");
+    }
+}
+
+std::tuple<std::string, signedindex_t> get_schedule_by_name() {
+    const char* schedule_names[] = {"static", "dynamic", "guided", "balanced"};
+    return {schedule_names[get_schedule_kind()], get_schedule_chunk_size()};
+}
+
+void set_opening_criterion_by_name(std::string opening_criterion) {
+    if (opening_criterion == "cell") {
+        set_opening_criterion(OPENING_CELL);
+    } else if (opening_criterion == "tight") {
+        set_opening_criterion(OPENING_TIGHT);
+    } else {
+        AT_ERROR("set_opening_criterion: unknown criterion '", opening_criterion, "', expected 'cell' or 'tight'");
+    }
+}
+
+std::string get_opening_criterion_by_name() {
+    return get_opening_criterion() == OPENING_TIGHT ? "tight" : "cell";
+}
+
+void set_query_packet_size_checked(signedindex_t query_packet_size) {
+    TORCH_CHECK(query_packet_size >= 0 && query_packet_size <= MAX_QUERY_PACKET_SIZE,
+                "set_query_packet_size: expected 0 to ", MAX_QUERY_PACKET_SIZE, ", got ", query_packet_size);
+    set_query_packet_size(query_packet_size);
+}
+
+
 PYBIND11_MODULE(TORCH_EXTENSION_NAME, m) {
-  m.def("build_tree", &build_tree, "build tree (CPU)");
+  m.def("build_tree", &build_tree, "build tree (CPU), int32 index tensors when they fit and int32_indices, int64 otherwise",
+        py::arg("points"), py::arg("max_depth"), py::arg("num_threads"), py::arg("leaf_size") = 1, py::arg("int32_indices") = true);
   m.def("scatter_point_attrs_to_nodes", &scatter_point_attrs_to_nodes, "scatter_point_attrs_to_nodes (CPU)");
+  m.def("scatter_point_attrs_to_nodes", &scatter_point_attrs_to_nodes_with_moments, "scatter_point_attrs_to_nodes, also returning the first and second moments about the reppoints up to expansion_order (CPU)");
   m.def("multiply_by_A", &multiply_by_A, "multiply by A (CPU)");
+  m.def("multiply_by_A", &multiply_by_A_with_moments, "multiply by A, far field by a multipole expansion of expansion_order with the moments from scatter_point_attrs_to_nodes (CPU)");
   m.def("multiply_by_AT", &multiply_by_AT, "multiply by AT (CPU)");
+  m.def("multiply_by_AT", &multiply_by_AT_with_moments, "multiply by AT, far field by a multipole expansion of expansion_order with the moments from scatter_point_attrs_to_nodes (CPU)");
   m.def("multiply_by_G", &multiply_by_G, "multiply by AT (CPU)");
+  m.def("multiply_by_G", &multiply_by_G_with_moments, "multiply by G, far field by a multipole expansion of expansion_order with the moments from scatter_point_attrs_to_nodes (CPU)");
+  m.def("build_interaction_lists", &build_interaction_lists, "build cached interaction lists for a theta, to be used by the cached products with the same theta (CPU)");
+  m.def("multiply_by_A_cached", &multiply_by_A_cached, "multiply by A with cached interaction lists (CPU)");
+  m.def("multiply_by_A_cached", &multiply_by_A_cached_with_moments, "multiply by A with cached interaction lists, far field by a multipole expansion of expansion_order with the moments from scatter_point_attrs_to_nodes (CPU)");
+  m.def("multiply_by_AT_cached", &multiply_by_AT_cached, "multiply by AT with cached interaction lists (CPU)");
+  m.def("multiply_by_AT_cached", &multiply_by_AT_cached_with_moments, "multiply by AT with cached interaction lists, far field by a multipole expansion of expansion_order with the moments from scatter_point_attrs_to_nodes (CPU)");
+  m.def("multiply_by_G_cached", &multiply_by_G_cached, "multiply by G with cached interaction lists (CPU)");
+  m.def("multiply_by_G_cached", &multiply_by_G_cached_with_moments, "multiply by G with cached interaction lists, far field by a multipole expansion of expansion_order with the moments from scatter_point_attrs_to_nodes (CPU)");
+  m.def("multiply_by_A_dualtree", &multiply_by_A_dualtree, "multiply by A at the points of the tree, by dual-tree traversal (CPU)");
+  m.def("multiply_by_AT_dualtree", &multiply_by_AT_dualtree, "multiply by AT at the points of the tree, by dual-tree traversal (CPU)");
+  m.def("multiply_by_G_dualtree", &multiply_by_G_dualtree, "multiply by G at the points of the tree, by dual-tree traversal (CPU)");
+  m.def("multiply_by_A_multiwidth", &multiply_by_A_multiwidth, "multiply by A for [N', K] query widths in one traversal, [N', K, 1] (CPU)");
+  m.def("multiply_by_AT_multiwidth", &multiply_by_AT_multiwidth, "multiply by AT for [N', K] query widths in one traversal, [N', K, 3] (CPU)");
+  m.def("multiply_by_G_multiwidth", &multiply_by_G_multiwidth, "multiply by G for [N', K] query widths in one traversal, [N', K, 3] (CPU)");
+  m.def("multiply_by_A_multirhs", &multiply_by_A_multirhs, "multiply by A for K right hand sides [N, K*3] in one traversal, [N', K] (CPU)");
+  m.def("multiply_by_AT_multirhs", &multiply_by_AT_multirhs, "multiply by AT for K right hand sides [N, K] in one traversal, [N', K*3] (CPU)");
+  m.def("multiply_by_G_multirhs", &multiply_by_G_multirhs, "multiply by G for K right hand sides [N, K*3] in one traversal, [N', K*3] (CPU)");
+  m.def("multiply_fused", &multiply_fused, "multiply by several of A, AT and G (list of names and of attributes), with one scatter and one traversal per query, "
+        "or with dual_tree, A and AT at the points of the tree with one symmetric dual-tree traversal (CPU)");
+  py::class_<WindingNumberTreecodeCPU>(m, "WindingNumberTreecodeCPU", "tree of a point cloud with the buffers of its treecode products, reused across calls (CPU)")
+    .def(py::init<torch::Tensor, signedindex_t, signedindex_t, bool, bool, double, signedindex_t, bool, bool>(),
+         py::arg("points"), py::arg("max_depth"), py::arg("num_threads"), py::arg("cache_interaction_lists"), py::arg("dual_tree"), py::arg("theta") = TREECODE_THRESHOLD,
+         py::arg("leaf_size") = 1, py::arg("int32_indices") = true, py::arg("tree_order") = false)
+    .def("get_tree", &WindingNumberTreecodeCPU::get_tree, "the tensors of build_tree")
+    .def("get_points", &WindingNumberTreecodeCPU::get_points, "the points, in the order of the tree with tree_order")
+    .def("get_point_order", &WindingNumberTreecodeCPU::get_point_order, "with tree_order, the input index of every point of get_points, empty otherwise")
+    .def("get_interaction_lists", &WindingNumberTreecodeCPU::get_interaction_lists, "the tensors of build_interaction_lists, empty if not cached")
+    .def("forward_A", &WindingNumberTreecodeCPU::forward_A, "multiply by A at the points (normals [N, K*3] for K right hand sides), into out if given, reusing the scatter of the normals with memoize",
+         py::arg("normals"), py::arg("widths"), py::arg("expansion_order") = 0, py::arg("out") = py::none(), py::arg("memoize") = false, py::arg("theta") = TREECODE_THRESHOLD)
+    .def("forward_AT", &WindingNumberTreecodeCPU::forward_AT, "multiply by AT at the points (values [N, K] for K right hand sides), into out if given, reusing the scatter of the values with memoize",
+         py::arg("values"), py::arg("widths"), py::arg("expansion_order") = 0, py::arg("out") = py::none(), py::arg("memoize") = false, py::arg("theta") = TREECODE_THRESHOLD)
+    .def("forward_G", &WindingNumberTreecodeCPU::forward_G, "multiply by G at the points (normals [N, K*3] for K right hand sides), into out if given, reusing the scatter of the normals with memoize",
+         py::arg("normals"), py::arg("widths"), py::arg("expansion_order") = 0, py::arg("out") = py::none(), py::arg("memoize") = false, py::arg("theta") = TREECODE_THRESHOLD)
+    .def("forward_A_multiwidth", &WindingNumberTreecodeCPU::forward_A_multiwidth, "multiply by A at the points for [N, K] widths in one traversal, [N, K, 1]",
+         py::arg("normals"), py::arg("widths"), py::arg("out") = py::none(), py::arg("memoize") = false, py::arg("theta") = TREECODE_THRESHOLD)
+    .def("forward_AT_multiwidth", &WindingNumberTreecodeCPU::forward_AT_multiwidth, "multiply by AT at the points for [N, K] widths in one traversal, [N, K, 3]",
+         py::arg("values"), py::arg("widths"), py::arg("out") = py::none(), py::arg("memoize") = false, py::arg("theta") = TREECODE_THRESHOLD)
+    .def("forward_G_multiwidth", &WindingNumberTreecodeCPU::forward_G_multiwidth, "multiply by G at the points for [N, K] widths in one traversal, [N, K, 3]",
+         py::arg("normals"), py::arg("widths"), py::arg("out") = py::none(), py::arg("memoize") = false, py::arg("theta") = TREECODE_THRESHOLD)
+    .def("forward_fused", &WindingNumberTreecodeCPU::forward_fused, "multiply_fused at the points, the attributes in the order of the operators",
+         py::arg("operators"), py::arg("widths"), py::arg("point_attrs"), py::arg("theta") = TREECODE_THRESHOLD, py::arg("dual_tree") = false);
+  m.def("set_num_threads", &set_num_threads, "set the number of threads of all CPU ops, <= 0 for the OpenMP default");
+  m.def("get_num_threads", &get_num_threads, "number of threads used by CPU ops");
+  m.def("set_schedule", &set_schedule_by_name, "set the OpenMP loop schedule of CPU ops: 'static', 'dynamic', 'guided' or 'balanced' (default, cost-balanced Morton-ordered query chunks), and a chunk size (<= 0 for default)");
+  m.def("get_schedule", &get_schedule_by_name, "OpenMP loop schedule and chunk size of CPU ops");
+  m.def("set_thread_affinity", &set_thread_affinity, "pin (True) or unpin (False) the threads of CPU ops to cores, Linux only");
+  m.def("get_thread_affinity", &get_thread_affinity, "whether the threads of CPU ops are pinned");
+  m.def("set_opening_criterion", &set_opening_criterion_by_name, "set the far-field test of CPU ops: 'cell' (default, the half width of the node cube) or 'tight' (the bounding box of the node points about the reppoint)");
+  m.def("get_opening_criterion", &get_opening_criterion_by_name, "far-field test of CPU ops, 'cell' or 'tight'");
+  m.def("set_query_packet_size", &set_query_packet_size_checked, "set the number of queries close to each other that the per-query A, AT and G of CPU ops walk the tree for at once at expansion order 0, evaluating their far field together, up to 64 (default 32), 0 or 1 for one walk per query");
+  m.def("get_query_packet_size", &get_query_packet_size, "number of queries per tree walk of the per-query A, AT and G of CPU ops");
+  m.def("get_near_field_isa", &get_near_field_isa, "instruction set of the float near-field kernels: 'avx512', 'avx2' or 'scalar'");
 }
 
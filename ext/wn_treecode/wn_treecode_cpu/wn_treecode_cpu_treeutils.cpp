@@ -25,255 +25,664 @@ SOFTWARE.
 
 #include "wn_treecode_cpu.h"
 #include <vector>
-#include <fstream>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cassert>
+#include <stdexcept>
+#include <omp.h>
 
 #define NUM_OCT_CHILDREN 8
 typedef long signedindex_t;
 
 
-int color_list[11*3] = {
-    255, 0, 0,
-    0, 255, 0,
-    0, 0, 255,
-    0, 255, 255,
-    255, 0, 255,
-    255, 255, 0,
-    255, 80, 80,
-    80, 255, 80,
-    80, 80, 255,
-    0, 160, 255,
-};
-
+/// @note 3 bits per level from the root down, bit 0/1/2 set if x/y/z >= the cell center,
+//        i.e. the child code used by the octree, so sorting by code sorts points in
+//        depth-first preorder (children 0...7) of the tree.
+//        The code is derived with the same comparisons against the same (exactly representable)
+//        cell centers as a top-down subdivision, so points on cell boundaries end up in the same cell.
 template<typename scalar_t>
-struct OctNode {
-    scalar_t c_x, c_y, c_z;
-    scalar_t half_w;   // half width
-    
-    std::vector<signedindex_t> point_indices;
-    OctNode<scalar_t>* children[NUM_OCT_CHILDREN] = {nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr};
-    OctNode<scalar_t>* parent = nullptr;
-
-    signedindex_t serial_index = -1;
-    signedindex_t depth = -1;
-    bool is_leaf = false;
-};
+uint64_t compute_morton_code(
+        const scalar_t* point_coords,
+        signedindex_t max_depth
+    ) {
+    scalar_t x = point_coords[0];
+    scalar_t y = point_coords[1];
+    scalar_t z = point_coords[2];
+
+    scalar_t c_x = 0.0, c_y = 0.0, c_z = 0.0;
+    scalar_t half_w = 1.0;
+    uint64_t code = 0;
+    for (signedindex_t depth = 0; depth < max_depth; depth++) {
+        uint64_t child_node_code = 0;
+        if (x >= c_x) child_node_code += 1;
+        if (y >= c_y) child_node_code += 2;
+        if (z >= c_z) child_node_code += 4;
 
+        scalar_t next_w = half_w / 2.0;   // width for next level
+        c_x += (child_node_code & 1) ? next_w : -next_w;
+        c_y += (child_node_code & 2) ? next_w : -next_w;
+        c_z += (child_node_code & 4) ? next_w : -next_w;
+        half_w = next_w;
 
-template<typename scalar_t>
-void debug_output_grid_corners_recursive(std::ofstream& fout, const OctNode<scalar_t>* cur_node, signedindex_t depth) {
-    if (cur_node == nullptr) {
-        return;
+        code = (code << 3) | child_node_code;
     }
-    fout << "v " << cur_node->c_x - cur_node->half_w << " " << cur_node->c_y - cur_node->half_w << " " << cur_node->c_z - cur_node->half_w << " " << color_list[3*depth+0] << " " << color_list[3*depth+1] << " " << color_list[3*depth+2] << "\n"
-         << "v " << cur_node->c_x + cur_node->half_w << " " << cur_node->c_y - cur_node->half_w << " " << cur_node->c_z - cur_node->half_w << " " << color_list[3*depth+0] << " " << color_list[3*depth+1] << " " << color_list[3*depth+2] << "\n"
-         << "v " << cur_node->c_x - cur_node->half_w << " " << cur_node->c_y + cur_node->half_w << " " << cur_node->c_z - cur_node->half_w << " " << color_list[3*depth+0] << " " << color_list[3*depth+1] << " " << color_list[3*depth+2] << "\n"
-         << "v " << cur_node->c_x + cur_node->half_w << " " << cur_node->c_y + cur_node->half_w << " " << cur_node->c_z - cur_node->half_w << " " << color_list[3*depth+0] << " " << color_list[3*depth+1] << " " << color_list[3*depth+2] << "\n"
-         << "v " << cur_node->c_x - cur_node->half_w << " " << cur_node->c_y - cur_node->half_w << " " << cur_node->c_z + cur_node->half_w << " " << color_list[3*depth+0] << " " << color_list[3*depth+1] << " " << color_list[3*depth+2] << "\n"
-         << "v " << cur_node->c_x + cur_node->half_w << " " << cur_node->c_y - cur_node->half_w << " " << cur_node->c_z + cur_node->half_w << " " << color_list[3*depth+0] << " " << color_list[3*depth+1] << " " << color_list[3*depth+2] << "\n"
-         << "v " << cur_node->c_x - cur_node->half_w << " " << cur_node->c_y + cur_node->half_w << " " << cur_node->c_z + cur_node->half_w << " " << color_list[3*depth+0] << " " << color_list[3*depth+1] << " " << color_list[3*depth+2] << "\n"
-         << "v " << cur_node->c_x + cur_node->half_w << " " << cur_node->c_y + cur_node->half_w << " " << cur_node->c_z + cur_node->half_w << " " << color_list[3*depth+0] << " " << color_list[3*depth+1] << " " << color_list[3*depth+2] << "\n";
-    
-    for (signedindex_t k = 0; k < NUM_OCT_CHILDREN; k++) {
-        if (cur_node->children[k] != nullptr) {
-            debug_output_grid_corners_recursive(fout, cur_node->children[k], depth+1);
+    return code;
+}
+
+
+/// @brief LSD radix sort of (code, point index) pairs, stable, 8 bits per pass
+/// @note every thread histograms and scatters its own contiguous chunk, buckets are laid out
+//        bucket-major then thread-major, so the output does not depend on the number of threads
+void radix_sort_morton_codes(
+        std::vector<uint64_t>& codes,
+        std::vector<signedindex_t>& point_indices,
+        signedindex_t num_bits,
+        signedindex_t num_threads
+    ) {
+    const signedindex_t num_points = codes.size();
+    std::vector<uint64_t> codes_tmp(num_points);
+    std::vector<signedindex_t> point_indices_tmp(num_points);
+    std::vector<signedindex_t> bucket_start(num_threads*256);
+
+    for (signedindex_t shift = 0; shift < num_bits; shift += 8) {
+        #pragma omp parallel num_threads(num_threads)
+        {
+            const signedindex_t team_size = omp_get_num_threads();
+            const signedindex_t t = omp_get_thread_num();
+            const signedindex_t chunk_begin = num_points * t / team_size;
+            const signedindex_t chunk_end = num_points * (t+1) / team_size;
+            signedindex_t* thread_bucket_start = bucket_start.data() + t*256;
+
+            std::fill(thread_bucket_start, thread_bucket_start + 256, 0);
+            for (signedindex_t i = chunk_begin; i < chunk_end; i++) {
+                thread_bucket_start[(codes[i] >> shift) & 0xff]++;
+            }
+            #pragma omp barrier
+
+            #pragma omp single
+            {
+                signedindex_t offset = 0;
+                for (signedindex_t b = 0; b < 256; b++) {
+                    for (signedindex_t tt = 0; tt < team_size; tt++) {
+                        signedindex_t count = bucket_start[tt*256 + b];
+                        bucket_start[tt*256 + b] = offset;
+                        offset += count;
+                    }
+                }
+            }
+
+            for (signedindex_t i = chunk_begin; i < chunk_end; i++) {
+                signedindex_t dst = thread_bucket_start[(codes[i] >> shift) & 0xff]++;
+                codes_tmp[dst] = codes[i];
+                point_indices_tmp[dst] = point_indices[i];
+            }
         }
+        codes.swap(codes_tmp);
+        point_indices.swap(point_indices_tmp);
     }
 }
 
-template<typename scalar_t>
-void debug_output_grid_corners(std::string filename, const OctNode<scalar_t>* root) {
-    std::ofstream fout(filename);
-    debug_output_grid_corners_recursive<scalar_t>(fout, root, 0);
-    fout.close();
+
+inline bool is_linear_octree_leaf(
+        signedindex_t begin,
+        signedindex_t end,
+        signedindex_t cur_depth,
+        signedindex_t max_depth,
+        signedindex_t max_points_per_node
+    ) {
+    // stop splitting if maximum depth reached, or point threshold reached
+    return (max_depth >= 0 && cur_depth >= max_depth) || end - begin <= max_points_per_node;
 }
 
-template<typename scalar_t>
-OctNode<scalar_t>* build_tree_cpu_recursive(
-        const scalar_t* point_coords,
-        const std::vector<signedindex_t>& point_indices,
-        OctNode<scalar_t>* const parent,
-        scalar_t c_x, scalar_t c_y, scalar_t c_z, scalar_t half_w,
+
+/// @brief children are consecutive runs of the 3 bits of this level in the sorted codes,
+//         child k covers sorted points [child_begin[k], child_begin[k+1])
+inline void split_linear_octree_range(
+        const std::vector<uint64_t>& sorted_codes,
+        signedindex_t begin,
+        signedindex_t end,
         signedindex_t cur_depth,
-        signedindex_t & cur_node_index,
-        const signedindex_t & max_depth,
-        const signedindex_t & max_points_per_node
+        signedindex_t max_depth,
+        signedindex_t* child_begin      // [NUM_OCT_CHILDREN+1,]
     ) {
+    const signedindex_t shift = 3*(max_depth - cur_depth - 1);
+    child_begin[0] = begin;
+    for (signedindex_t k = 0; k < NUM_OCT_CHILDREN; k++) {
+        child_begin[k+1] = std::partition_point(
+            sorted_codes.begin() + child_begin[k], sorted_codes.begin() + end,
+            [shift, k](uint64_t code) { return signedindex_t((code >> shift) & 7) <= k; }
+        ) - sorted_codes.begin();
+    }
+}
 
-    signedindex_t num_points = point_indices.size();
-    if (num_points == 0) {
-        return nullptr;
+
+signedindex_t count_linear_octree_nodes(
+        const std::vector<uint64_t>& sorted_codes,
+        signedindex_t begin,
+        signedindex_t end,
+        signedindex_t cur_depth,
+        signedindex_t max_depth,
+        signedindex_t max_points_per_node
+    ) {
+    if (is_linear_octree_leaf(begin, end, cur_depth, max_depth, max_points_per_node)) {
+        return 1;
     }
+    signedindex_t child_begin[NUM_OCT_CHILDREN+1];
+    split_linear_octree_range(sorted_codes, begin, end, cur_depth, max_depth, child_begin);
+
+    signedindex_t num_nodes = 1;
+    for (signedindex_t k = 0; k < NUM_OCT_CHILDREN; k++) {
+        if (child_begin[k+1] > child_begin[k]) {
+            num_nodes += count_linear_octree_nodes(sorted_codes, child_begin[k], child_begin[k+1], cur_depth+1, max_depth, max_points_per_node);
+        }
+    }
+    return num_nodes;
+}
 
-    // basic properties of this node
-    OctNode<scalar_t>* node = new OctNode<scalar_t>;
-    node->serial_index = cur_node_index;
 
-    node->c_x = c_x;
-    node->c_y = c_y;
-    node->c_z = c_z;
-    node->half_w = half_w;
-    node->point_indices = point_indices;
-    node->parent = parent;
-    node->depth = cur_depth;
+/// @brief writes the node covering sorted points [begin, end) at node_index, and its subtree after it (preorder)
+/// @return one past the last node index of the subtree
+template<typename scalar_t>
+signedindex_t fill_linear_octree_nodes(
+        const std::vector<uint64_t>& sorted_codes,
+        signedindex_t begin,
+        signedindex_t end,
+        signedindex_t parent_index,
+        scalar_t half_w,
+        signedindex_t cur_depth,
+        signedindex_t max_depth,
+        signedindex_t max_points_per_node,
+        signedindex_t node_index,
+        LinearOctree<scalar_t>& tree,       // arrays already sized to the full tree
+        signedindex_t& num_leaves,
+        signedindex_t& tree_depth
+    ) {
+    tree.node_parent_list[node_index] = parent_index;
+    tree.node_half_w_list[node_index] = half_w;
+    tree.num_points_in_node[node_index] = end - begin;
+    tree.node2point_indexstart[node_index] = begin;
+    tree_depth = std::max(tree_depth, cur_depth);
+
+    if (is_linear_octree_leaf(begin, end, cur_depth, max_depth, max_points_per_node)) {
+        tree.node_is_leaf_list[node_index] = true;
+        num_leaves += 1;
+        return node_index + 1;
+    }
+    tree.node_is_leaf_list[node_index] = false;
 
-    cur_node_index += 1;
+    signedindex_t child_begin[NUM_OCT_CHILDREN+1];
+    split_linear_octree_range(sorted_codes, begin, end, cur_depth, max_depth, child_begin);
 
-    // stop splitting if maximum depth reached, or point threshold reached
-    if ((max_depth >= 0 && cur_depth >= max_depth) || num_points <= max_points_per_node) {
-        node->is_leaf = true;
-        return node;
+    scalar_t next_w = half_w / 2.0;   // width for next level
+    signedindex_t next_index = node_index + 1;
+    for (signedindex_t k = 0; k < NUM_OCT_CHILDREN; k++) {
+        if (child_begin[k+1] > child_begin[k]) {
+            tree.node_children_list[node_index*NUM_OCT_CHILDREN + k] = next_index;
+            next_index = fill_linear_octree_nodes<scalar_t>(
+                sorted_codes, child_begin[k], child_begin[k+1], node_index, next_w,
+                cur_depth+1, max_depth, max_points_per_node, next_index, tree, num_leaves, tree_depth);
+        }
     }
+    return next_index;
+}
 
-    std::vector<signedindex_t> subdivision_point_indices[NUM_OCT_CHILDREN];
 
-    for (signedindex_t i = 0; i < num_points; i++) {
-        signedindex_t pid = point_indices[i];
-        scalar_t x = point_coords[3*pid+0];
-        scalar_t y = point_coords[3*pid+1];
-        scalar_t z = point_coords[3*pid+2];
+/// @note a node near the root (emitted serially), or a whole subtree handed to one thread
+template<typename scalar_t>
+struct LinearOctreeBuildItem {
+    signedindex_t begin, end;
+    signedindex_t cur_depth;
+    scalar_t half_w;
+    signedindex_t parent_item;      // -1 for the root
+    signedindex_t child_slot;
+    bool is_subtree;
+
+    signedindex_t num_nodes = 1;
+    signedindex_t node_index = -1;
+    signedindex_t num_leaves = 0;
+    signedindex_t tree_depth = 0;
+};
 
-        // morton code
-        signedindex_t child_node_code = 0;
-        if (x >= c_x) child_node_code += 1;
-        if (y >= c_y) child_node_code += 2;
-        if (z >= c_z) child_node_code += 4;
 
-        subdivision_point_indices[child_node_code].push_back(pid);
+/// @brief splits the top of the tree (preorder) until subtrees have at most subtree_grain points
+template<typename scalar_t>
+void collect_linear_octree_build_items(
+        const std::vector<uint64_t>& sorted_codes,
+        signedindex_t begin,
+        signedindex_t end,
+        signedindex_t parent_item,
+        signedindex_t child_slot,
+        scalar_t half_w,
+        signedindex_t cur_depth,
+        signedindex_t max_depth,
+        signedindex_t max_points_per_node,
+        signedindex_t subtree_grain,
+        std::vector<LinearOctreeBuildItem<scalar_t>>& items
+    ) {
+    bool is_subtree = end - begin <= subtree_grain || is_linear_octree_leaf(begin, end, cur_depth, max_depth, max_points_per_node);
+
+    LinearOctreeBuildItem<scalar_t> item;
+    item.begin = begin;
+    item.end = end;
+    item.cur_depth = cur_depth;
+    item.half_w = half_w;
+    item.parent_item = parent_item;
+    item.child_slot = child_slot;
+    item.is_subtree = is_subtree;
+    item.tree_depth = cur_depth;
+    items.push_back(item);
+
+    if (is_subtree) {
+        return;
     }
 
+    signedindex_t item_index = items.size() - 1;
+    signedindex_t child_begin[NUM_OCT_CHILDREN+1];
+    split_linear_octree_range(sorted_codes, begin, end, cur_depth, max_depth, child_begin);
+
     scalar_t next_w = half_w / 2.0;   // width for next level
-    if (subdivision_point_indices[0].size() > 0)
-        node->children[0] = build_tree_cpu_recursive(point_coords, subdivision_point_indices[0], node,
-            c_x-next_w, c_y-next_w, c_z-next_w, next_w, cur_depth+1, cur_node_index, max_depth, max_points_per_node);
-    if (subdivision_point_indices[1].size() > 0)
-        node->children[1] = build_tree_cpu_recursive(point_coords, subdivision_point_indices[1], node,
-            c_x+next_w, c_y-next_w, c_z-next_w, next_w, cur_depth+1, cur_node_index, max_depth, max_points_per_node);
-    if (subdivision_point_indices[2].size() > 0)
-        node->children[2] = build_tree_cpu_recursive(point_coords, subdivision_point_indices[2], node,
-            c_x-next_w, c_y+next_w, c_z-next_w, next_w, cur_depth+1, cur_node_index, max_depth, max_points_per_node);
-    if (subdivision_point_indices[3].size() > 0)
-        node->children[3] = build_tree_cpu_recursive(point_coords, subdivision_point_indices[3], node,
-            c_x+next_w, c_y+next_w, c_z-next_w, next_w, cur_depth+1, cur_node_index, max_depth, max_points_per_node);
-    if (subdivision_point_indices[4].size() > 0)
-        node->children[4] = build_tree_cpu_recursive(point_coords, subdivision_point_indices[4], node,
-            c_x-next_w, c_y-next_w, c_z+next_w, next_w, cur_depth+1, cur_node_index, max_depth, max_points_per_node);
-    if (subdivision_point_indices[5].size() > 0)
-        node->children[5] = build_tree_cpu_recursive(point_coords, subdivision_point_indices[5], node,
-            c_x+next_w, c_y-next_w, c_z+next_w, next_w, cur_depth+1, cur_node_index, max_depth, max_points_per_node);
-    if (subdivision_point_indices[6].size() > 0)
-        node->children[6] = build_tree_cpu_recursive(point_coords, subdivision_point_indices[6], node,
-            c_x-next_w, c_y+next_w, c_z+next_w, next_w, cur_depth+1, cur_node_index, max_depth, max_points_per_node);
-    if (subdivision_point_indices[7].size() > 0)
-        node->children[7] = build_tree_cpu_recursive(point_coords, subdivision_point_indices[7], node,
-            c_x+next_w, c_y+next_w, c_z+next_w, next_w, cur_depth+1, cur_node_index, max_depth, max_points_per_node);
-    bool is_leaf = true;
     for (signedindex_t k = 0; k < NUM_OCT_CHILDREN; k++) {
-        if (node->children[k] != nullptr) {
-            is_leaf = false;
+        if (child_begin[k+1] > child_begin[k]) {
+            collect_linear_octree_build_items<scalar_t>(
+                sorted_codes, child_begin[k], child_begin[k+1], item_index, k, next_w,
+                cur_depth+1, max_depth, max_points_per_node, subtree_grain, items);
         }
     }
-    node->is_leaf = is_leaf;
-    return node;
 }
 
 
 template<typename scalar_t>
-void compute_tree_attributes(
-        const OctNode<scalar_t> * cur_node,
-        signedindex_t & num_nodes,
-        signedindex_t & num_leaves,
-        signedindex_t & depth
+void build_tree_morton_cpu(
+        const scalar_t* point_coords,
+        signedindex_t num_points,
+        signedindex_t max_depth,
+        signedindex_t max_points_per_node,
+        LinearOctree<scalar_t>& tree,
+        signedindex_t num_threads
     ) {
-    if (cur_node != nullptr) {
-        num_nodes += 1;
-        if (cur_node->depth > depth) {
-            depth = cur_node->depth;
+    assert(max_depth >= 0 && max_depth <= ALLOWED_MAX_DEPTH);
+    const signedindex_t context_num_threads = prepare_parallel_launch();
+    if (num_threads <= 0) {
+        num_threads = context_num_threads;
+    }
+
+    tree = LinearOctree<scalar_t>();
+    if (num_points == 0) {
+        return;
+    }
+
+    std::vector<uint64_t> codes(num_points);
+    tree.sorted_point_indices.resize(num_points);
+    #pragma omp parallel for num_threads(num_threads)
+    for (signedindex_t i = 0; i < num_points; i++) {
+        codes[i] = compute_morton_code<scalar_t>(point_coords + i*SPATIAL_DIM, max_depth);
+        tree.sorted_point_indices[i] = i;
+    }
+
+    // stable, so points sharing a code (e.g. a leaf at max_depth) stay in index order
+    radix_sort_morton_codes(codes, tree.sorted_point_indices, 3*max_depth, num_threads);
+
+    // nodes near the root are emitted serially, the subtrees below them in parallel.
+    // preorder numbering is unique for a given tree, so the result does not depend on num_threads
+    const signedindex_t subtree_grain = std::max<signedindex_t>(1024, num_points / (32*num_threads));
+    std::vector<LinearOctreeBuildItem<scalar_t>> items;
+    collect_linear_octree_build_items<scalar_t>(
+        codes, 0, num_points,
+        /*parent_item = */-1,
+        /*child_slot = */-1,
+        /*half_width = */1.0,
+        /*depth = */0,
+        max_depth,
+        max_points_per_node,
+        subtree_grain,
+        items
+    );
+
+    const signedindex_t num_items = items.size();
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(num_threads)
+    for (signedindex_t i = 0; i < num_items; i++) {
+        if (items[i].is_subtree) {
+            items[i].num_nodes = count_linear_octree_nodes(codes, items[i].begin, items[i].end, items[i].cur_depth, max_depth, max_points_per_node);
         }
-        if (cur_node->is_leaf) {
-            num_leaves++;
+    }
+
+    // every item takes the next num_nodes indices, in preorder
+    signedindex_t num_nodes = 0;
+    for (signedindex_t i = 0; i < num_items; i++) {
+        items[i].node_index = num_nodes;
+        num_nodes += items[i].num_nodes;
+    }
+
+    tree.num_nodes = num_nodes;
+    tree.node_parent_list.resize(num_nodes);
+    tree.node_children_list.assign(num_nodes*NUM_OCT_CHILDREN, -1);
+    tree.node_is_leaf_list.resize(num_nodes);
+    tree.node_half_w_list.resize(num_nodes);
+    tree.num_points_in_node.resize(num_nodes);
+    tree.node2point_indexstart.resize(num_nodes);
+
+    // a child slot is written only by the item that owns the parent, or serially here
+    for (signedindex_t i = 0; i < num_items; i++) {
+        if (items[i].parent_item != -1) {
+            tree.node_children_list[items[items[i].parent_item].node_index*NUM_OCT_CHILDREN + items[i].child_slot] = items[i].node_index;
         }
-        for (signedindex_t i = 0; i < NUM_OCT_CHILDREN; i++) {
-            compute_tree_attributes(cur_node->children[i], num_nodes, num_leaves, depth);
+    }
+
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(num_threads)
+    for (signedindex_t i = 0; i < num_items; i++) {
+        LinearOctreeBuildItem<scalar_t>& item = items[i];
+        signedindex_t parent_index = (item.parent_item == -1) ? -1 : items[item.parent_item].node_index;
+        if (item.is_subtree) {
+            fill_linear_octree_nodes<scalar_t>(
+                codes, item.begin, item.end, parent_index, item.half_w,
+                item.cur_depth, max_depth, max_points_per_node, item.node_index, tree,
+                item.num_leaves, item.tree_depth);
+        } else {
+            tree.node_parent_list[item.node_index] = parent_index;
+            tree.node_half_w_list[item.node_index] = item.half_w;
+            tree.num_points_in_node[item.node_index] = item.end - item.begin;
+            tree.node2point_indexstart[item.node_index] = item.begin;
+            tree.node_is_leaf_list[item.node_index] = false;
         }
-        
+    }
+
+    for (signedindex_t i = 0; i < num_items; i++) {
+        tree.num_leaves += items[i].num_leaves;
+        tree.tree_depth = std::max(tree.tree_depth, items[i].tree_depth);
     }
 }
 
-template<typename scalar_t>
-void serialize_tree_recursive(
-        OctNode<scalar_t>* cur_node,
-        signedindex_t* ptr_node_parent_list,
-        signedindex_t* ptr_node_children_list,
+
+template<typename scalar_t, typename index_t>
+void serialize_linear_octree(
+        const LinearOctree<scalar_t>& tree,
+        index_t* ptr_node_parent_list,
+        index_t* ptr_node_children_list,
         bool* ptr_node_is_leaf_list,
         scalar_t* ptr_node_half_w_list,
-        signedindex_t* ptr_num_points_in_node,
-        signedindex_t* ptr_node2point_indexstart,
-        std::vector<signedindex_t>& stdvec_node2point_index
+        index_t* ptr_num_points_in_node,
+        index_t* ptr_node2point_indexstart,
+        index_t* ptr_node2point_index
     ) {
-    if (cur_node == nullptr) {
-        return;
+    const signedindex_t num_nodes = tree.num_nodes;
+    const signedindex_t num_points = tree.sorted_point_indices.size();
+    // std::copy narrows the indices for int32 trees
+    std::copy(tree.node_parent_list.begin(), tree.node_parent_list.begin() + num_nodes, ptr_node_parent_list);
+    std::copy(tree.node_children_list.begin(), tree.node_children_list.begin() + num_nodes*NUM_OCT_CHILDREN, ptr_node_children_list);
+    std::memcpy(ptr_node_half_w_list, tree.node_half_w_list.data(), num_nodes*sizeof(scalar_t));
+    std::copy(tree.num_points_in_node.begin(), tree.num_points_in_node.begin() + num_nodes, ptr_num_points_in_node);
+    std::copy(tree.node2point_indexstart.begin(), tree.node2point_indexstart.begin() + num_nodes, ptr_node2point_indexstart);
+    std::copy(tree.sorted_point_indices.begin(), tree.sorted_point_indices.begin() + num_points, ptr_node2point_index);
+    for (signedindex_t node_index = 0; node_index < num_nodes; node_index++) {
+        ptr_node_is_leaf_list[node_index] = tree.node_is_leaf_list[node_index];
     }
+}
 
-    signedindex_t node_index = cur_node->serial_index;
 
+template<typename index_t>
+void compute_node_level_order(
+        const index_t* ptr_node_parent_list,
+        index_t* ptr_out_node_level_order,
+        index_t* ptr_out_node_level_offsets,
+        signedindex_t num_nodes,
+        signedindex_t tree_depth
+    ) {
+    // parents are serialized before their children, so one forward sweep gives all depths
+    std::vector<signedindex_t> node_depth(num_nodes, 0);
+    std::vector<signedindex_t> level_count(tree_depth+1, 0);
+    for (signedindex_t node_index = 0; node_index < num_nodes; node_index++) {
+        signedindex_t parent_index = ptr_node_parent_list[node_index];
+        node_depth[node_index] = (parent_index == -1) ? 0 : node_depth[parent_index] + 1;
+        level_count[node_depth[node_index]]++;
+    }
 
-    signedindex_t node2point_indexstart = stdvec_node2point_index.size();
-    ptr_node_half_w_list[node_index] = cur_node->half_w;
+    // counting sort by depth, stable so that each level keeps the serialization order
+    ptr_out_node_level_offsets[0] = 0;
+    for (signedindex_t depth = 0; depth <= tree_depth; depth++) {
+        ptr_out_node_level_offsets[depth+1] = ptr_out_node_level_offsets[depth] + level_count[depth];
+    }
+    std::vector<signedindex_t> level_fill(ptr_out_node_level_offsets, ptr_out_node_level_offsets + tree_depth+1);
+    for (signedindex_t node_index = 0; node_index < num_nodes; node_index++) {
+        ptr_out_node_level_order[level_fill[node_depth[node_index]]++] = node_index;
+    }
+}
+
+template<typename scalar_t, typename index_t>
+void build_query_schedule_cpu(
+        const scalar_t* query_points,
+        const signedindex_t* query_costs,
+        const index_t* node_children_list,
+        const bool* node_is_leaf_list,
+        const index_t* num_points_in_node,
+        signedindex_t num_queries,
+        signedindex_t num_threads,
+        QuerySchedule& schedule
+    ) {
+    schedule.query_order.resize(num_queries);
+    schedule.chunk_offsets.assign(1, 0);
+    if (num_queries == 0) {
+        return;
+    }
 
-    // set up point2node indexing and vice versa
-    ptr_num_points_in_node[node_index] = cur_node->point_indices.size();
-    ptr_node2point_indexstart[node_index] = node2point_indexstart;
-    for (signedindex_t i = 0; i < cur_node->point_indices.size(); i++) {
-        // point2node
-        // point2node_index[cur_node->depth][pid] = cur_node->serialize_index;
+    std::vector<uint64_t> codes(num_queries);
+    #pragma omp parallel for num_threads(num_threads)
+    for (signedindex_t i = 0; i < num_queries; i++) {
+        codes[i] = compute_morton_code<scalar_t>(query_points + i*SPATIAL_DIM, ALLOWED_MAX_DEPTH);
+        schedule.query_order[i] = i;
+    }
 
-        // node2point
-        signedindex_t point_index = cur_node->point_indices[i];
-        stdvec_node2point_index.push_back(point_index);
+    // the code digits are the child codes of the query's own cell from the root down,
+    // queries in empty space stop near the root, queries on the surface go down to a leaf
+    std::vector<signedindex_t> estimated_costs;
+    if (query_costs == nullptr) {
+        estimated_costs.resize(num_queries);
+        #pragma omp parallel for num_threads(num_threads)
+        for (signedindex_t i = 0; i < num_queries; i++) {
+            signedindex_t cost = 0;
+            signedindex_t node_index = 0;
+            for (signedindex_t depth = 0; depth < ALLOWED_MAX_DEPTH; depth++) {
+                cost += NUM_OCT_CHILDREN;
+                if (node_is_leaf_list[node_index]) {
+                    cost += (num_points_in_node != nullptr) ? num_points_in_node[node_index] : 0;
+                    break;
+                }
+                signedindex_t child_node_code = (codes[i] >> (3*(ALLOWED_MAX_DEPTH - depth - 1))) & 7;
+                node_index = node_children_list[node_index*NUM_OCT_CHILDREN + child_node_code];
+                if (node_index == -1) {
+                    break;
+                }
+            }
+            estimated_costs[i] = cost;
+        }
+        query_costs = estimated_costs.data();
     }
 
-    // actual serialization
-    if (cur_node->parent == nullptr) {
-        ptr_node_parent_list[node_index] = -1;    
-    } else {
-        ptr_node_parent_list[node_index] = cur_node->parent->serial_index;
+    radix_sort_morton_codes(codes, schedule.query_order, 3*ALLOWED_MAX_DEPTH, num_threads);
+
+    signedindex_t total_cost = 0;
+    for (signedindex_t i = 0; i < num_queries; i++) {
+        total_cost += std::max<signedindex_t>(query_costs[i], 1);
     }
-    ptr_node_is_leaf_list[node_index] = cur_node->is_leaf;
-    
-    for (signedindex_t k = 0; k < NUM_OCT_CHILDREN; k++) {
-        if (cur_node->children[k] != nullptr) {
-            ptr_node_children_list[node_index*NUM_OCT_CHILDREN + k] = cur_node->children[k]->serial_index;
-            serialize_tree_recursive(cur_node->children[k],
-                                     ptr_node_parent_list,
-                                     ptr_node_children_list,
-                                     ptr_node_is_leaf_list,
-                                     ptr_node_half_w_list,
-                                     ptr_num_points_in_node,
-                                     ptr_node2point_indexstart,
-                                     stdvec_node2point_index);
+    const signedindex_t min_chunk_cost = std::max<signedindex_t>(1, total_cost / (QUERY_CHUNKS_PER_THREAD*num_threads));
+
+    signedindex_t remaining_cost = total_cost;
+    signedindex_t chunk_cost = 0;
+    for (signedindex_t i = 0; i < num_queries; i++) {
+        chunk_cost += std::max<signedindex_t>(query_costs[schedule.query_order[i]], 1);
+        if (chunk_cost >= std::max(min_chunk_cost, remaining_cost / (2*num_threads)) || i == num_queries-1) {
+            schedule.chunk_offsets.push_back(i+1);
+            remaining_cost -= chunk_cost;
+            chunk_cost = 0;
+        }
+    }
+}
+
+
+/// @note nodes are serialized in depth-first preorder, so every child has a larger index than its parent,
+//        and a reverse sweep over node indices sees all children before their parent
+template<typename scalar_t, typename index_t>
+void compute_node_bboxes(
+        const scalar_t* ptr_points,
+        const index_t* ptr_node_children_list,
+        const bool* ptr_node_is_leaf_list,
+        const index_t* ptr_node2point_index,
+        const index_t* ptr_node2point_indexstart,
+        const index_t* ptr_num_points_in_node,
+        scalar_t* ptr_out_node_bboxes,
+        signedindex_t num_nodes
+    ) {
+    for (signedindex_t node_index = num_nodes-1; node_index >= 0; node_index--) {
+        scalar_t* bbox = ptr_out_node_bboxes + node_index*2*SPATIAL_DIM;    // [min_x, min_y, min_z, max_x, max_y, max_z]
+        for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+            bbox[d] = std::numeric_limits<scalar_t>::max();
+            bbox[SPATIAL_DIM+d] = std::numeric_limits<scalar_t>::lowest();
+        }
+
+        if (ptr_node_is_leaf_list[node_index]) {
+            for (signedindex_t j = 0; j < ptr_num_points_in_node[node_index]; j++) {
+                signedindex_t point_index = ptr_node2point_index[ptr_node2point_indexstart[node_index] + j];
+                for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+                    bbox[d] = std::min(bbox[d], ptr_points[point_index*SPATIAL_DIM + d]);
+                    bbox[SPATIAL_DIM+d] = std::max(bbox[SPATIAL_DIM+d], ptr_points[point_index*SPATIAL_DIM + d]);
+                }
+            }
         } else {
-            ptr_node_children_list[node_index*NUM_OCT_CHILDREN + k] = -1;
+            for (signedindex_t k = 0; k < NUM_OCT_CHILDREN; k++) {
+                signedindex_t child_index = ptr_node_children_list[node_index*NUM_OCT_CHILDREN + k];
+                if (child_index != -1) {
+                    const scalar_t* child_bbox = ptr_out_node_bboxes + child_index*2*SPATIAL_DIM;
+                    for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+                        bbox[d] = std::min(bbox[d], child_bbox[d]);
+                        bbox[SPATIAL_DIM+d] = std::max(bbox[SPATIAL_DIM+d], child_bbox[SPATIAL_DIM+d]);
+                    }
+                }
+            }
         }
     }
 }
 
+/// @note the farthest point of the box from the reppoint bounds the distance to every point of the node,
+//        R/sqrt(3) is the half width of the cube with the same circumradius, so that the cell criterion is unchanged
+//        for a full cell around its center
 template<typename scalar_t>
-void free_tree_recursive(OctNode<scalar_t>* cur_node) {
-    if (cur_node == nullptr) {
-        return;
+void compute_node_opening_half_w(
+        const scalar_t* ptr_node_reppoints,
+        const scalar_t* ptr_node_bboxes,
+        scalar_t* ptr_out_node_opening_half_w,
+        signedindex_t num_nodes
+    ) {
+    const scalar_t inv_sqrt3 = scalar_t(1) / std::sqrt(scalar_t(3));
+    const signedindex_t num_threads = prepare_parallel_launch();
+    #pragma omp parallel for num_threads(num_threads) schedule(static)
+    for (signedindex_t node_index = 0; node_index < num_nodes; node_index++) {
+        const scalar_t* reppoint = ptr_node_reppoints + node_index*SPATIAL_DIM;
+        const scalar_t* bbox = ptr_node_bboxes + node_index*2*SPATIAL_DIM;
+        scalar_t radius2 = 0;
+        for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+            scalar_t farthest = std::max(reppoint[d] - bbox[d], bbox[SPATIAL_DIM+d] - reppoint[d]);
+            radius2 += farthest * farthest;
+        }
+        ptr_out_node_opening_half_w[node_index] = std::sqrt(radius2) * inv_sqrt3;
     }
-    for (signedindex_t k = 0; k < NUM_OCT_CHILDREN; k++) {
-        free_tree_recursive(cur_node->children[k]);
+}
+
+template<typename scalar_t, typename index_t>
+void pack_tree_skeleton_cpu(
+        const index_t* ptr_node_children_list,
+        const bool* ptr_node_is_leaf_list,
+        const index_t* ptr_node2point_indexstart,
+        const index_t* ptr_num_points_in_node,
+        signedindex_t num_nodes,
+        std::vector<PackedNode<scalar_t>>& out_packed_nodes
+    ) {
+    // a hard error rather than an assert: past it the int32 fields would silently wrap
+    const signedindex_t max_int32 = std::numeric_limits<int32_t>::max();
+    if (num_nodes > max_int32 || ptr_num_points_in_node[0] > max_int32) {
+        throw std::length_error("pack_tree_skeleton_cpu: the packed nodes hold int32 indices, the tree has more than INT32_MAX nodes or points");
     }
-    delete cur_node;
+    out_packed_nodes.assign(num_nodes, PackedNode<scalar_t>());
+    std::vector<signedindex_t> packed_parents(num_nodes, -1);
+    signedindex_t next_packed_index = 0;
+    // (node index, packed index of its parent)
+    std::vector<std::pair<signedindex_t, signedindex_t>> pack_stack(1, {0, -1});
+    while (!pack_stack.empty()) {
+        const signedindex_t node_index = pack_stack.back().first;
+        const signedindex_t packed_index = next_packed_index++;
+        packed_parents[packed_index] = pack_stack.back().second;
+        pack_stack.pop_back();
+
+        PackedNode<scalar_t>& packed_node = out_packed_nodes[packed_index];
+        packed_node.node_index = node_index;
+        packed_node.skip = packed_index + 1;
+        if (ptr_node_is_leaf_list[node_index]) {
+            packed_node.first_point = ptr_node2point_indexstart[node_index];
+            packed_node.num_points = ptr_num_points_in_node[node_index];
+            continue;
+        }
+        packed_node.first_point = 0;
+        packed_node.num_points = -1;
+        // pushed in child slot order, so that the last slot is popped, and laid out, first
+        for (signedindex_t k = 0; k < NUM_OCT_CHILDREN; k++) {
+            signedindex_t child_index = ptr_node_children_list[node_index * NUM_OCT_CHILDREN + k];
+            if (child_index != -1) {
+                pack_stack.emplace_back(child_index, packed_index);
+            }
+        }
+    }
+    assert(next_packed_index == num_nodes);
+    // a subtree ends where the subtree of its last descendant ends, children are after their parent
+    for (signedindex_t packed_index = num_nodes - 1; packed_index > 0; packed_index--) {
+        PackedNode<scalar_t>& parent = out_packed_nodes[packed_parents[packed_index]];
+        parent.skip = std::max(parent.skip, out_packed_nodes[packed_index].skip);
+    }
+}
+
+template<typename scalar_t, typename index_t>
+void prepare_tree_traversal_cache_cpu(
+        const scalar_t* ptr_points,
+        const index_t* ptr_node_children_list,
+        const bool* ptr_node_is_leaf_list,
+        const index_t* ptr_node2point_index,
+        const index_t* ptr_node2point_indexstart,
+        const index_t* ptr_num_points_in_node,
+        signedindex_t num_nodes,
+        TreeTraversalCache<scalar_t>& cache
+    ) {
+    cache.num_nodes = num_nodes;
+    cache.node_bboxes.resize(num_nodes*2*SPATIAL_DIM);
+    compute_node_bboxes<scalar_t, index_t>(ptr_points, ptr_node_children_list, ptr_node_is_leaf_list, ptr_node2point_index,
+                                           ptr_node2point_indexstart, ptr_num_points_in_node, cache.node_bboxes.data(), num_nodes);
+    pack_tree_skeleton_cpu<scalar_t, index_t>(ptr_node_children_list, ptr_node_is_leaf_list, ptr_node2point_indexstart,
+                                              ptr_num_points_in_node, num_nodes, cache.packed_nodes);
 }
 
 //////////// instantiation ////////////
-auto ptr_build_tree_cpu_recursive_float  = build_tree_cpu_recursive<float>;
-auto ptr_build_tree_cpu_recursive_double = build_tree_cpu_recursive<double>;
-auto ptr_compute_tree_attributes_float  = compute_tree_attributes<float>;
-auto ptr_compute_tree_attributes_double = compute_tree_attributes<double>;
-auto ptr_serialize_tree_recursive_float  = serialize_tree_recursive<float>;
-auto ptr_serialize_tree_recursive_double = serialize_tree_recursive<double>;
-auto ptr_free_tree_recursive_float  = free_tree_recursive<float>;
-auto ptr_free_tree_recursive_double = free_tree_recursive<double>;
+auto ptr_build_tree_morton_cpu_float  = build_tree_morton_cpu<float>;
+auto ptr_build_tree_morton_cpu_double = build_tree_morton_cpu<double>;
+auto ptr_serialize_linear_octree_float  = serialize_linear_octree<float>;
+auto ptr_serialize_linear_octree_double = serialize_linear_octree<double>;
+auto ptr_build_query_schedule_cpu_float  = build_query_schedule_cpu<float>;
+auto ptr_build_query_schedule_cpu_double = build_query_schedule_cpu<double>;
+auto ptr_compute_node_bboxes_float  = compute_node_bboxes<float>;
+auto ptr_compute_node_bboxes_double = compute_node_bboxes<double>;
+auto ptr_compute_node_opening_half_w_float  = compute_node_opening_half_w<float>;
+auto ptr_compute_node_opening_half_w_double = compute_node_opening_half_w<double>;
+auto ptr_pack_tree_skeleton_cpu_float  = pack_tree_skeleton_cpu<float>;
+auto ptr_pack_tree_skeleton_cpu_double = pack_tree_skeleton_cpu<double>;
+auto ptr_prepare_tree_traversal_cache_cpu_float  = prepare_tree_traversal_cache_cpu<float>;
+auto ptr_prepare_tree_traversal_cache_cpu_double = prepare_tree_traversal_cache_cpu<double>;
+auto ptr_compute_node_level_order_int64 = compute_node_level_order<signedindex_t>;
+auto ptr_compute_node_level_order_int32 = compute_node_level_order<int32_t>;
+auto ptr_serialize_linear_octree_float_int32  = serialize_linear_octree<float, int32_t>;
+auto ptr_serialize_linear_octree_double_int32 = serialize_linear_octree<double, int32_t>;
+auto ptr_build_query_schedule_cpu_float_int32  = build_query_schedule_cpu<float, int32_t>;
+auto ptr_build_query_schedule_cpu_double_int32 = build_query_schedule_cpu<double, int32_t>;
+auto ptr_compute_node_bboxes_float_int32  = compute_node_bboxes<float, int32_t>;
+auto ptr_compute_node_bboxes_double_int32 = compute_node_bboxes<double, int32_t>;
+auto ptr_pack_tree_skeleton_cpu_float_int32  = pack_tree_skeleton_cpu<float, int32_t>;
+auto ptr_pack_tree_skeleton_cpu_double_int32 = pack_tree_skeleton_cpu<double, int32_t>;
+auto ptr_prepare_tree_traversal_cache_cpu_float_int32  = prepare_tree_traversal_cache_cpu<float, int32_t>;
+auto ptr_prepare_tree_traversal_cache_cpu_double_int32 = prepare_tree_traversal_cache_cpu<double, int32_t>;
@@ -0,0 +1,435 @@
+/*
+MIT License
+
+Copyright (c) 2024 Siyou Lin, Zuoqiang Shi, Yebin Liu
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "wn_treecode_cpu.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+
+bool get_wnnc_width_preset(const char* width_config, double& wsmin, double& wsmax) {
+    const char* preset_names[] = {"l0", "l1", "l2", "l3", "l4", "l5"};
+    const double preset_widths[][2] = {
+        {0.002, 0.016},     // noise level 0, used for uniform, noise free points in the paper
+        {0.01, 0.04},       // noise level 1, used for real scans in the paper
+        {0.02, 0.08},       // noise level 2, used for sigma=0.25% in the paper
+        {0.03, 0.12},       // noise level 3, used for sigma=0.5% in the paper
+        {0.04, 0.16},       // noise level 4, used for sigma=1% in the paper
+        {0.05, 0.2},        // noise level 5, used for sparse points and 3D sketches in the paper
+    };
+    for (signedindex_t i = 0; i < 6; i++) {
+        if (std::strcmp(width_config, preset_names[i]) == 0) {
+            wsmin = preset_widths[i][0];
+            wsmax = preset_widths[i][1];
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/// @brief the tree and the node buffers of the treecode products, allocated once for the whole solve
+template<typename scalar_t, typename index_t>
+struct WNNCTreecode {
+    signedindex_t num_points = 0;
+    signedindex_t num_nodes = 0;
+    signedindex_t tree_depth = 0;
+    signedindex_t expansion_order = 0;
+    scalar_t theta = TREECODE_THRESHOLD;   // of the current iteration
+
+    std::vector<index_t> node_parent_list;
+    std::vector<index_t> node_children_list;
+    std::unique_ptr<bool[]> node_is_leaf_list;
+    std::vector<scalar_t> node_half_w_list;
+    std::vector<index_t> num_points_in_node;
+    std::vector<index_t> node2point_indexstart;
+    std::vector<index_t> node2point_index;
+    std::vector<index_t> node_level_order;
+    std::vector<index_t> node_level_offsets;
+    TreeTraversalCache<scalar_t> traversal_cache;
+
+    // scatter outputs, sized for 3 attributes per node
+    std::vector<scalar_t> point_weights;
+    std::vector<scalar_t> node_attrs;
+    std::vector<scalar_t> node_reppoints;
+    std::vector<scalar_t> node_weights;
+    std::vector<scalar_t> node_moments1;
+    std::vector<scalar_t> node_moments2;
+    TraversalWorkspace<scalar_t> workspace;   // of the last scatter
+};
+
+
+template<typename scalar_t, typename index_t>
+void build_wnnc_treecode(const scalar_t* points, const LinearOctree<scalar_t>& tree, signedindex_t num_points, const WNNCOptions& options, WNNCTreecode<scalar_t, index_t>& treecode) {
+    const signedindex_t num_nodes = tree.num_nodes;
+    treecode.num_points = num_points;
+    treecode.num_nodes = num_nodes;
+    treecode.tree_depth = tree.tree_depth;
+    treecode.expansion_order = options.expansion_order;
+
+    treecode.node_parent_list.resize(num_nodes);
+    treecode.node_children_list.resize(num_nodes * NUM_OCT_CHILDREN);
+    treecode.node_is_leaf_list.reset(new bool[num_nodes]);
+    treecode.node_half_w_list.resize(num_nodes);
+    treecode.num_points_in_node.resize(num_nodes);
+    treecode.node2point_indexstart.resize(num_nodes);
+    treecode.node2point_index.resize(num_points);
+    serialize_linear_octree<scalar_t, index_t>(tree,
+                                             treecode.node_parent_list.data(),
+                                             treecode.node_children_list.data(),
+                                             treecode.node_is_leaf_list.get(),
+                                             treecode.node_half_w_list.data(),
+                                             treecode.num_points_in_node.data(),
+                                             treecode.node2point_indexstart.data(),
+                                             treecode.node2point_index.data());
+
+    treecode.node_level_order.resize(num_nodes);
+    treecode.node_level_offsets.resize(tree.tree_depth + 2);
+    compute_node_level_order<index_t>(treecode.node_parent_list.data(),
+                                      treecode.node_level_order.data(),
+                                      treecode.node_level_offsets.data(),
+                                      num_nodes,
+                                      tree.tree_depth);
+    prepare_tree_traversal_cache_cpu<scalar_t, index_t>(points,
+                                                        treecode.node_children_list.data(),
+                                                        treecode.node_is_leaf_list.get(),
+                                                        treecode.node2point_index.data(),
+                                                        treecode.node2point_indexstart.data(),
+                                                        treecode.num_points_in_node.data(),
+                                                        num_nodes,
+                                                        treecode.traversal_cache);
+
+    treecode.point_weights.resize(num_points);
+    treecode.node_attrs.resize(num_nodes * SPATIAL_DIM);
+    treecode.node_reppoints.resize(num_nodes * SPATIAL_DIM);
+    treecode.node_weights.resize(num_nodes);
+    treecode.node_moments1.resize(options.expansion_order >= 1 ? num_nodes * SPATIAL_DIM * SPATIAL_DIM : 0);
+    treecode.node_moments2.resize(options.expansion_order >= 2 ? num_nodes * SPATIAL_DIM * SPATIAL_DIM * SPATIAL_DIM : 0);
+}
+
+
+/// @brief scatters [N, attr_dim] point attributes to the nodes, weighted by their magnitudes as in wn_treecode_func.py,
+//         with the moments up to expansion_order (<= treecode.expansion_order)
+template<typename scalar_t, typename index_t>
+void scatter_wnnc_treecode(const scalar_t* points, const scalar_t* point_attrs, signedindex_t attr_dim, signedindex_t expansion_order, WNNCTreecode<scalar_t, index_t>& treecode) {
+    const signedindex_t num_threads = prepare_parallel_launch();
+    #pragma omp parallel for num_threads(num_threads) schedule(static)
+    for (signedindex_t i = 0; i < treecode.num_points; i++) {
+        scalar_t norm2 = 0;
+        for (signedindex_t c = 0; c < attr_dim; c++) {
+            norm2 += point_attrs[i*attr_dim + c] * point_attrs[i*attr_dim + c];
+        }
+        treecode.point_weights[i] = std::sqrt(norm2);
+    }
+
+    // the scatter accumulates into the node buffers
+    treecode.workspace.invalidate();
+    std::fill(treecode.node_attrs.begin(), treecode.node_attrs.end(), scalar_t(0));
+    std::fill(treecode.node_reppoints.begin(), treecode.node_reppoints.end(), scalar_t(0));
+    std::fill(treecode.node_weights.begin(), treecode.node_weights.end(), scalar_t(0));
+    std::fill(treecode.node_moments1.begin(), treecode.node_moments1.end(), scalar_t(0));
+    std::fill(treecode.node_moments2.begin(), treecode.node_moments2.end(), scalar_t(0));
+
+    scatter_point_attrs_to_nodes_cpu_kernel_launcher<scalar_t, index_t>(
+        treecode.node_children_list.data(),
+        points,
+        treecode.point_weights.data(),
+        point_attrs,
+        treecode.node2point_index.data(),
+        treecode.node2point_indexstart.data(),
+        treecode.num_points_in_node.data(),
+        treecode.node_is_leaf_list.get(),
+        treecode.node_level_order.data(),
+        treecode.node_level_offsets.data(),
+        treecode.node_attrs.data(),
+        treecode.node_reppoints.data(),
+        treecode.node_weights.data(),
+        attr_dim,
+        treecode.tree_depth,
+        expansion_order >= 1 ? treecode.node_moments1.data() : nullptr,
+        expansion_order >= 2 ? treecode.node_moments2.data() : nullptr,
+        expansion_order
+    );
+}
+
+
+/// @brief out [N,] = A normals, at the points themselves
+template<typename scalar_t, typename index_t>
+void wnnc_forward_A(const scalar_t* points, const scalar_t* widths, const scalar_t* normals, WNNCTreecode<scalar_t, index_t>& treecode, scalar_t* out_vals) {
+    scatter_wnnc_treecode<scalar_t, index_t>(points, normals, SPATIAL_DIM, treecode.expansion_order, treecode);
+    multiply_by_A_cpu_kernel_launcher<scalar_t, index_t>(
+        points, widths, points, normals,
+        treecode.node2point_index.data(), treecode.node2point_indexstart.data(), treecode.node_children_list.data(),
+        treecode.node_attrs.data(), treecode.node_is_leaf_list.get(), treecode.node_half_w_list.data(),
+        treecode.node_reppoints.data(), treecode.num_points_in_node.data(),
+        out_vals, treecode.num_points, false,
+        treecode.expansion_order, treecode.node_moments1.data(), treecode.node_moments2.data(), treecode.theta, &treecode.traversal_cache, &treecode.workspace);
+}
+
+/// @brief out [N, 3] = AT values
+template<typename scalar_t, typename index_t>
+void wnnc_forward_AT(const scalar_t* points, const scalar_t* widths, const scalar_t* values, WNNCTreecode<scalar_t, index_t>& treecode, scalar_t* out_vecs) {
+    scatter_wnnc_treecode<scalar_t, index_t>(points, values, 1, treecode.expansion_order, treecode);
+    multiply_by_AT_cpu_kernel_launcher<scalar_t, index_t>(
+        points, widths, points, values,
+        treecode.node2point_index.data(), treecode.node2point_indexstart.data(), treecode.node_children_list.data(),
+        treecode.node_attrs.data(), treecode.node_is_leaf_list.get(), treecode.node_half_w_list.data(),
+        treecode.node_reppoints.data(), treecode.num_points_in_node.data(),
+        out_vecs, treecode.num_points,
+        treecode.expansion_order, treecode.node_moments1.data(), treecode.node_moments2.data(), treecode.theta, &treecode.traversal_cache, &treecode.workspace);
+}
+
+/// @brief out [N, K, 3] = AT values for K widths per point, in one traversal
+template<typename scalar_t, typename index_t>
+void wnnc_forward_AT_multiwidth(const scalar_t* points, const scalar_t* widths, signedindex_t num_widths, const scalar_t* values, WNNCTreecode<scalar_t, index_t>& treecode, scalar_t* out_vecs) {
+    // the multiwidth kernel approximates far nodes at order 0
+    scatter_wnnc_treecode<scalar_t, index_t>(points, values, 1, 0, treecode);
+    multiply_by_AT_multiwidth_cpu_kernel_launcher<scalar_t, index_t>(
+        points, widths, num_widths, points, values,
+        treecode.node2point_index.data(), treecode.node2point_indexstart.data(), treecode.node_children_list.data(),
+        treecode.node_attrs.data(), treecode.node_is_leaf_list.get(), treecode.node_half_w_list.data(),
+        treecode.node_reppoints.data(), treecode.num_points_in_node.data(),
+        out_vecs, treecode.num_points, treecode.theta, &treecode.traversal_cache, &treecode.workspace);
+}
+
+/// @brief out [N, 3] = G normals
+template<typename scalar_t, typename index_t>
+void wnnc_forward_G(const scalar_t* points, const scalar_t* widths, const scalar_t* normals, WNNCTreecode<scalar_t, index_t>& treecode, scalar_t* out_vecs) {
+    scatter_wnnc_treecode<scalar_t, index_t>(points, normals, SPATIAL_DIM, treecode.expansion_order, treecode);
+    multiply_by_G_cpu_kernel_launcher<scalar_t, index_t>(
+        points, widths, points, normals,
+        treecode.node2point_index.data(), treecode.node2point_indexstart.data(), treecode.node_children_list.data(),
+        treecode.node_attrs.data(), treecode.node_is_leaf_list.get(), treecode.node_half_w_list.data(),
+        treecode.node_reppoints.data(), treecode.num_points_in_node.data(),
+        out_vecs, treecode.num_points,
+        treecode.expansion_order, treecode.node_moments1.data(), treecode.node_moments2.data(), treecode.theta, &treecode.traversal_cache, &treecode.workspace);
+}
+
+
+/// @brief the iterations of wnnc_solve on the normalized points, with the tree serialized to index_t
+template<typename scalar_t, typename index_t>
+void wnnc_iterate(const scalar_t* points, signedindex_t num_points, const LinearOctree<scalar_t>& tree, const WNNCOptions& options, scalar_t* out_normals) {
+    WNNCTreecode<scalar_t, index_t> treecode;
+    build_wnnc_treecode<scalar_t, index_t>(points, tree, num_points, options, treecode);
+
+    // all buffers of the iterations
+    std::vector<scalar_t> normals(num_points * SPATIAL_DIM, scalar_t(0));
+    std::vector<scalar_t> b(num_points, scalar_t(0.5));
+    std::vector<scalar_t> widths(num_points);
+    std::vector<scalar_t> A_mu(num_points);
+    std::vector<scalar_t> AT_A_mu(num_points * SPATIAL_DIM);
+    std::vector<scalar_t> AT_b(num_points * SPATIAL_DIM);
+    std::vector<scalar_t> A_r(num_points);
+    std::vector<scalar_t> out_vecs(num_points * SPATIAL_DIM, scalar_t(0));
+    // r reuses AT_b
+    scalar_t* r = AT_b.data();
+
+    auto get_width_scale = [&](signedindex_t iter) {
+        return (options.iters > 1)
+            ? options.wsmin + (double(options.iters - 1 - iter) / double(options.iters - 1)) * (options.wsmax - options.wsmin)
+            : options.wsmin;
+    };
+    auto get_theta = [&](signedindex_t iter) {
+        return (options.theta_start > 0 && options.iters > 1)
+            ? options.theta_start + (double(iter) / double(options.iters - 1)) * (options.theta - options.theta_start)
+            : options.theta;
+    };
+
+    // b is constant, AT b of every iteration in one traversal
+    const bool precompute_AT_b = options.precompute_AT_b && options.expansion_order == 0;
+    std::vector<scalar_t> AT_b_schedule;   // [N, iters, 3]
+    if (precompute_AT_b) {
+        std::vector<scalar_t> width_schedule(num_points * options.iters);   // [N, iters]
+        for (signedindex_t i = 0; i < num_points; i++) {
+            for (signedindex_t iter = 0; iter < options.iters; iter++) {
+                width_schedule[i*options.iters + iter] = scalar_t(get_width_scale(iter));
+            }
+        }
+        AT_b_schedule.resize(num_points * options.iters * SPATIAL_DIM);
+        treecode.theta = scalar_t(options.theta);
+        wnnc_forward_AT_multiwidth<scalar_t, index_t>(points, width_schedule.data(), options.iters, b.data(), treecode, AT_b_schedule.data());
+    }
+
+    const signedindex_t num_threads = prepare_parallel_launch();
+    for (signedindex_t iter = 0; iter < options.iters; iter++) {
+        double width_scale = get_width_scale(iter);
+        std::fill(widths.begin(), widths.end(), scalar_t(width_scale));
+        treecode.theta = scalar_t(get_theta(iter));
+
+        // grad step
+        wnnc_forward_A<scalar_t, index_t>(points, widths.data(), normals.data(), treecode, A_mu.data());
+        wnnc_forward_AT<scalar_t, index_t>(points, widths.data(), A_mu.data(), treecode, AT_A_mu.data());
+        if (precompute_AT_b) {
+            #pragma omp parallel for num_threads(num_threads) schedule(static)
+            for (signedindex_t i = 0; i < num_points; i++) {
+                for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+                    AT_b[i*SPATIAL_DIM + d] = AT_b_schedule[(i*options.iters + iter)*SPATIAL_DIM + d];
+                }
+            }
+        } else {
+            wnnc_forward_AT<scalar_t, index_t>(points, widths.data(), b.data(), treecode, AT_b.data());
+        }
+        #pragma omp parallel for num_threads(num_threads) schedule(static)
+        for (signedindex_t j = 0; j < num_points * SPATIAL_DIM; j++) {
+            r[j] = AT_b[j] - AT_A_mu[j];
+        }
+        wnnc_forward_A<scalar_t, index_t>(points, widths.data(), r, treecode, A_r.data());
+
+        double r_norm2 = 0, A_r_norm2 = 0;
+        #pragma omp parallel for num_threads(num_threads) schedule(static) reduction(+:r_norm2)
+        for (signedindex_t j = 0; j < num_points * SPATIAL_DIM; j++) {
+            r_norm2 += double(r[j]) * double(r[j]);
+        }
+        #pragma omp parallel for num_threads(num_threads) schedule(static) reduction(+:A_r_norm2)
+        for (signedindex_t i = 0; i < num_points; i++) {
+            A_r_norm2 += double(A_r[i]) * double(A_r[i]);
+        }
+        const scalar_t alpha = (A_r_norm2 > 0) ? scalar_t(r_norm2 / A_r_norm2) : scalar_t(0);
+        #pragma omp parallel for num_threads(num_threads) schedule(static)
+        for (signedindex_t j = 0; j < num_points * SPATIAL_DIM; j++) {
+            normals[j] += alpha * r[j];
+        }
+
+        // WNNC step
+        wnnc_forward_G<scalar_t, index_t>(points, widths.data(), normals.data(), treecode, out_vecs.data());
+
+        // rescale, as F.normalize (eps 1e-12)
+        #pragma omp parallel for num_threads(num_threads) schedule(static)
+        for (signedindex_t i = 0; i < num_points; i++) {
+            scalar_t* out_vec = out_vecs.data() + i*SPATIAL_DIM;
+            scalar_t* normal = normals.data() + i*SPATIAL_DIM;
+            scalar_t out_len = std::max(std::sqrt(out_vec[0]*out_vec[0] + out_vec[1]*out_vec[1] + out_vec[2]*out_vec[2]), scalar_t(1e-12));
+            scalar_t normal_len = std::sqrt(normal[0]*normal[0] + normal[1]*normal[1] + normal[2]*normal[2]);
+            for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+                out_vec[d] /= out_len;
+                normal[d] = out_vec[d] * normal_len;
+            }
+        }
+
+        if (options.verbose) {
+            std::printf("[LOG] iter %ld/%ld, width scale %.4f, theta %.2f, step %.4e\n", iter + 1, options.iters, width_scale, double(treecode.theta), double(alpha));
+        }
+    }
+
+    std::copy(out_vecs.begin(), out_vecs.end(), out_normals);
+}
+
+
+
+template<typename scalar_t>
+void wnnc_solve(
+        const scalar_t* points,        // [N, 3], any scale
+        signedindex_t num_points,
+        const WNNCOptions& options,
+        scalar_t* out_normals          // [N, 3]
+    ) {
+    // hard errors rather than asserts, past them e.g. a deeper tree overflows the 64-bit Morton codes
+    if (!(options.wsmin > 0 && options.wsmin <= options.wsmax)) {
+        throw std::invalid_argument("wnnc_solve: the widths must satisfy 0 < wsmin <= wsmax");
+    }
+    if (options.expansion_order < 0 || options.expansion_order > MAX_EXPANSION_ORDER) {
+        throw std::invalid_argument("wnnc_solve: expansion_order must be 0, 1 or 2");
+    }
+    if (options.max_tree_depth < 0 || options.max_tree_depth > ALLOWED_MAX_DEPTH) {
+        throw std::invalid_argument("wnnc_solve: max_tree_depth must be in [0, ALLOWED_MAX_DEPTH]");
+    }
+    if (options.leaf_size < 1 || options.iters < 1) {
+        throw std::invalid_argument("wnnc_solve: leaf_size and iters must be positive");
+    }
+    if (!(options.theta > 0) || options.theta_start < 0) {
+        throw std::invalid_argument("wnnc_solve: theta must be positive, theta_start positive or 0");
+    }
+    if (num_points <= 0) {
+        return;
+    }
+
+    // normalize into [-1, 1]^3, the widths are relative to this box
+    const scalar_t bbox_scale = 1.1;
+    scalar_t bbox_min[SPATIAL_DIM], bbox_max[SPATIAL_DIM];
+    for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+        bbox_min[d] = bbox_max[d] = points[d];
+    }
+    for (signedindex_t i = 0; i < num_points; i++) {
+        for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+            bbox_min[d] = std::min(bbox_min[d], points[i*SPATIAL_DIM + d]);
+            bbox_max[d] = std::max(bbox_max[d], points[i*SPATIAL_DIM + d]);
+        }
+    }
+    scalar_t bbox_len = 0;
+    for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+        bbox_len = std::max(bbox_len, bbox_max[d] - bbox_min[d]);
+    }
+    const scalar_t normalize_scale = (bbox_len > 0) ? scalar_t(2) / (bbox_len * bbox_scale) : scalar_t(1);
+
+    std::vector<scalar_t> points_normalized(num_points * SPATIAL_DIM);
+    for (signedindex_t i = 0; i < num_points; i++) {
+        for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+            scalar_t bbox_center = (bbox_min[d] + bbox_max[d]) / 2;
+            points_normalized[i*SPATIAL_DIM + d] = (points[i*SPATIAL_DIM + d] - bbox_center) * normalize_scale;
+        }
+    }
+
+    LinearOctree<scalar_t> tree;
+    build_tree_morton_cpu<scalar_t>(points_normalized.data(), num_points, options.max_tree_depth, options.leaf_size, tree);
+    if (options.verbose) {
+        std::printf("[LOG] num_points: %ld, num_nodes: %ld, tree depth: %ld\n", num_points, tree.num_nodes, tree.tree_depth);
+    }
+
+    // the iterations run on the points in tree order (node2point_index is the identity), permuted back at the end
+    std::vector<signedindex_t> point_order;
+    point_order.swap(tree.sorted_point_indices);
+    tree.sorted_point_indices.resize(num_points);
+    std::vector<scalar_t> points_tree_order(num_points * SPATIAL_DIM);
+    for (signedindex_t i = 0; i < num_points; i++) {
+        tree.sorted_point_indices[i] = i;
+        for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+            points_tree_order[i*SPATIAL_DIM + d] = points_normalized[point_order[i]*SPATIAL_DIM + d];
+        }
+    }
+
+    // int32 tree indices whenever the point and node indices fit
+    std::vector<scalar_t> normals_tree_order(num_points * SPATIAL_DIM);
+    const signedindex_t max_int32 = std::numeric_limits<int32_t>::max();
+    if (num_points <= max_int32 && tree.num_nodes * NUM_OCT_CHILDREN <= max_int32) {
+        wnnc_iterate<scalar_t, int32_t>(points_tree_order.data(), num_points, tree, options, normals_tree_order.data());
+    } else {
+        wnnc_iterate<scalar_t, signedindex_t>(points_tree_order.data(), num_points, tree, options, normals_tree_order.data());
+    }
+    for (signedindex_t i = 0; i < num_points; i++) {
+        for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+            out_normals[point_order[i]*SPATIAL_DIM + d] = normals_tree_order[i*SPATIAL_DIM + d];
+        }
+    }
+}
+
+
+//////////// instantiation ////////////
+auto ptr_wnnc_solve_float  = wnnc_solve<float>;
+auto ptr_wnnc_solve_double = wnnc_solve<double>;
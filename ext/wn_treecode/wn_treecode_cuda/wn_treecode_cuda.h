@@ -29,35 +29,15 @@ SOFTWARE.
 #define SPATIAL_DIM 3
 #define NUM_OCT_CHILDREN 8
 #define THREADS_PER_BLOCK 1024
-#define TREECODE_THRESHOLD 2.0f
+#define TREECODE_THRESHOLD 2.0f    // default theta of the kernels, see wn_treecode_cpu.h
 
 typedef long signedindex_t;
 
 // CUDA kernel declarations
+/// @note one launch per tree level, deepest level first, over the nodes
+//        node_level_order[node_level_offsets[l]:node_level_offsets[l+1]]
 template<typename scalar_t>
-__global__ void scatter_point_attrs_to_nodes_leaf_cuda_kernel(
-    const signedindex_t* ptr_node_parent_list,
-    const scalar_t* ptr_points,
-    const scalar_t* ptr_point_weights,
-    const scalar_t* ptr_point_attrs,
-    const signedindex_t* ptr_node2point_index,
-    const signedindex_t* ptr_node2point_indexstart,
-    const signedindex_t* ptr_num_points_in_node,
-    const bool* ptr_node_is_leaf_list,
-    bool* ptr_scattered_mask,
-
-    scalar_t* ptr_out_node_attrs,
-    scalar_t* ptr_out_node_reppoints,
-    scalar_t* ptr_out_node_weights,
-
-    signedindex_t attr_dim,
-    signedindex_t num_nodes
-);
-
-
-template<typename scalar_t>
-__global__ void scatter_point_attrs_to_nodes_nonleaf_cuda_kernel(
-    const signedindex_t* ptr_node_parent_list,
+__global__ void scatter_point_attrs_to_nodes_level_cuda_kernel(
     const signedindex_t* ptr_node_children_list,
     const scalar_t* ptr_points,
     const scalar_t* ptr_point_weights,
@@ -66,25 +46,14 @@ __global__ void scatter_point_attrs_to_nodes_nonleaf_cuda_kernel(
     const signedindex_t* ptr_node2point_indexstart,
     const signedindex_t* ptr_num_points_in_node,
     const bool* ptr_node_is_leaf_list,
-    bool* ptr_scattered_mask,
-    const bool* ptr_next_to_scatter_mask,
+    const signedindex_t* ptr_level_nodes,
 
     scalar_t* ptr_out_node_attrs,
     scalar_t* ptr_out_node_reppoints,
     scalar_t* ptr_out_node_weights,
 
     signedindex_t attr_dim,
-    signedindex_t num_nodes
-);
-
-template<typename scalar_t>
-__global__ void find_next_to_scatter_cuda_kernel(
-    const signedindex_t* ptr_node_children_list,
-    const bool* ptr_node_is_leaf_list,
-    bool* ptr_scattered_mask,
-    bool* ptr_next_to_scatter_mask,
-    const signedindex_t* node2point_index,
-    signedindex_t num_nodes
+    signedindex_t num_level_nodes
 );
 
 template<typename scalar_t>
@@ -103,7 +72,8 @@ __global__ void multiply_by_A_cuda_kernel(
     const signedindex_t* num_points_in_node,
     scalar_t* out_attrs,           // [N,]
     signedindex_t num_queries,
-    bool continuous=false
+    bool continuous=false,
+    scalar_t theta=TREECODE_THRESHOLD
 );
 
 
@@ -122,7 +92,8 @@ __global__ void multiply_by_AT_cuda_kernel(
     const scalar_t* node_reppoints,
     const signedindex_t* num_points_in_node,
     scalar_t* out_attrs,           // [N, 3]
-    signedindex_t num_queries
+    signedindex_t num_queries,
+    scalar_t theta=TREECODE_THRESHOLD
 );
 
 template<typename scalar_t>
@@ -140,5 +111,6 @@ __global__ void multiply_by_G_cuda_kernel(
     const scalar_t* node_reppoints,
     const signedindex_t* num_points_in_node,
     scalar_t* out_attrs,           // [N, 3]
-    signedindex_t num_queries
+    signedindex_t num_queries,
+    scalar_t theta=TREECODE_THRESHOLD
 );
\ No newline at end of file
@@ -172,8 +172,8 @@ __forceinline__ __device__ void eval_G_mu_add_(scalar_t* out, const scalar_t* di
 
 /// @brief collect point attributes to nodes
 template<typename scalar_t>
-__global__ void scatter_point_attrs_to_nodes_leaf_cuda_kernel(
-        const signedindex_t* ptr_node_parent_list,
+__global__ void scatter_point_attrs_to_nodes_level_cuda_kernel(
+        const signedindex_t* ptr_node_children_list,
         const scalar_t* ptr_points,
         const scalar_t* ptr_point_weights,
         const scalar_t* ptr_point_attrs,
@@ -181,26 +181,24 @@ __global__ void scatter_point_attrs_to_nodes_leaf_cuda_kernel(
         const signedindex_t* ptr_node2point_indexstart,
         const signedindex_t* ptr_num_points_in_node,
         const bool* ptr_node_is_leaf_list,
-        bool* ptr_scattered_mask,
+        const signedindex_t* ptr_level_nodes,
 
         scalar_t* ptr_out_node_attrs,
         scalar_t* ptr_out_node_reppoints,
         scalar_t* ptr_out_node_weights,
 
         signedindex_t attr_dim,
-        signedindex_t num_nodes) {
-    signedindex_t node_index = blockDim.x * blockIdx.x + threadIdx.x;
-    if (node_index < num_nodes) {
-        ptr_scattered_mask[node_index] = false;
-
-        if (ptr_node_is_leaf_list[node_index]) {
-            ptr_scattered_mask[node_index] = true;
+        signedindex_t num_level_nodes) {
+    signedindex_t level_index = blockDim.x * blockIdx.x + threadIdx.x;
+    if (level_index < num_level_nodes) {
+        signedindex_t node_index = ptr_level_nodes[level_index];
 
-            // representative points
-            scalar_t reppoint[SPATIAL_DIM] = {};
-            scalar_t reppoint_zero[SPATIAL_DIM] = {};
+        // representative points
+        scalar_t reppoint[SPATIAL_DIM] = {};
+        scalar_t reppoint_zero[SPATIAL_DIM] = {};
 
-            scalar_t total_weight = 0;
+        scalar_t total_weight = 0;
+        if (ptr_node_is_leaf_list[node_index]) {
             for (signedindex_t j = 0; j < ptr_num_points_in_node[node_index]; j++) {
                 signedindex_t point_index = ptr_node2point_index[ptr_node2point_indexstart[node_index] + j];
 
@@ -210,50 +208,8 @@ __global__ void scatter_point_attrs_to_nodes_leaf_cuda_kernel(
                 add_vec_<scalar_t>(reppoint, ptr_points + point_index*SPATIAL_DIM, ptr_point_weights[point_index], SPATIAL_DIM);
                 add_vec_<scalar_t>(reppoint_zero, ptr_points + point_index*SPATIAL_DIM, SPATIAL_DIM);
             }
-
-            if (total_weight > 0) {
-                assign_vec<scalar_t>(reppoint, reppoint, scalar_t(1) / total_weight, SPATIAL_DIM);
-            } else {
-                assign_vec<scalar_t>(reppoint, reppoint_zero, scalar_t(1) / scalar_t(ptr_num_points_in_node[node_index]), SPATIAL_DIM);
-            }
-            ptr_out_node_weights[node_index] = total_weight;
-            assign_vec<scalar_t>(ptr_out_node_reppoints + node_index*SPATIAL_DIM, reppoint, SPATIAL_DIM);
-        }
-    }
-}
-
-template<typename scalar_t>
-__global__ void scatter_point_attrs_to_nodes_nonleaf_cuda_kernel(
-        const signedindex_t* ptr_node_parent_list,
-        const signedindex_t* ptr_node_children_list,
-        const scalar_t* ptr_points,
-        const scalar_t* ptr_point_weights,
-        const scalar_t* ptr_point_attrs,
-        const signedindex_t* ptr_node2point_index,
-        const signedindex_t* ptr_node2point_indexstart,
-        const signedindex_t* ptr_num_points_in_node,
-        const bool* ptr_node_is_leaf_list,
-        bool* ptr_scattered_mask,
-        const bool* ptr_next_to_scatter_mask,
-
-        scalar_t* ptr_out_node_attrs,
-        scalar_t* ptr_out_node_reppoints,
-        scalar_t* ptr_out_node_weights,
-
-        signedindex_t attr_dim,
-        signedindex_t num_nodes
-    ) {
-    signedindex_t node_index = blockDim.x * blockIdx.x + threadIdx.x;
-    if (node_index < num_nodes) {
-        /// @note scatter only if it hasn't been scattered && it's not a leaf && all of its children have been scattered
-        if (ptr_next_to_scatter_mask[node_index]) {
-
-            ptr_scattered_mask[node_index] = true;
-
-            scalar_t reppoint[SPATIAL_DIM] = {};
-            scalar_t reppoint_zero[SPATIAL_DIM] = {};
-
-            scalar_t total_weight = 0;
+        } else {
+            /// @note all children are on the next level, which has been scattered by the previous launch
             for (signedindex_t k = 0; k < NUM_OCT_CHILDREN; k++) {
                 signedindex_t child_index = ptr_node_children_list[node_index*NUM_OCT_CHILDREN + k];
                 if (child_index != -1) {
@@ -264,46 +220,15 @@ __global__ void scatter_point_attrs_to_nodes_nonleaf_cuda_kernel(
                     add_vec_<scalar_t>(reppoint_zero, ptr_out_node_reppoints + child_index*SPATIAL_DIM, SPATIAL_DIM);
                 }
             }
-
-            if (total_weight > 0) {
-                assign_vec<scalar_t>(reppoint, reppoint, scalar_t(1) / total_weight, SPATIAL_DIM);
-            } else {
-                assign_vec<scalar_t>(reppoint, reppoint_zero, scalar_t(1) / scalar_t(ptr_num_points_in_node[node_index]), SPATIAL_DIM);
-            }
-
-            ptr_out_node_weights[node_index] = total_weight;
-            assign_vec<scalar_t>(ptr_out_node_reppoints + node_index*SPATIAL_DIM, reppoint, SPATIAL_DIM);
         }
-    }
-}
-
 
-template<typename scalar_t>
-__global__ void find_next_to_scatter_cuda_kernel(
-        const signedindex_t* ptr_node_children_list,
-        const bool* ptr_node_is_leaf_list,
-        bool* ptr_scattered_mask,
-        bool* ptr_next_to_scatter_mask,
-        const signedindex_t* node2point_index,
-        signedindex_t num_nodes
-    ) {
-    signedindex_t node_index = blockDim.x * blockIdx.x + threadIdx.x;
-    if (node_index < num_nodes) {
-        ptr_next_to_scatter_mask[node_index] = false;
-        bool all_children_scattered = true;
-
-        for (signedindex_t k = 0; k < NUM_OCT_CHILDREN; k++) {
-            signedindex_t child_index = ptr_node_children_list[node_index*NUM_OCT_CHILDREN + k];
-            if (child_index != -1) {
-                if (!(ptr_scattered_mask[child_index])) {
-                    all_children_scattered = false;
-                }
-            }
-        }
-
-        if ((!(ptr_scattered_mask[node_index])) && (!ptr_node_is_leaf_list[node_index]) && all_children_scattered) {
-            ptr_next_to_scatter_mask[node_index] = true;
+        if (total_weight > 0) {
+            assign_vec<scalar_t>(reppoint, reppoint, scalar_t(1) / total_weight, SPATIAL_DIM);
+        } else {
+            assign_vec<scalar_t>(reppoint, reppoint_zero, scalar_t(1) / scalar_t(ptr_num_points_in_node[node_index]), SPATIAL_DIM);
         }
+        ptr_out_node_weights[node_index] = total_weight;
+        assign_vec<scalar_t>(ptr_out_node_reppoints + node_index*SPATIAL_DIM, reppoint, SPATIAL_DIM);
     }
 }
 
@@ -324,7 +249,8 @@ __global__ void multiply_by_A_cuda_kernel(
         const signedindex_t* num_points_in_node,
         scalar_t* out_attrs,           // [N,]
         signedindex_t num_queries,
-        bool continuous_kernel
+        bool continuous_kernel,
+        scalar_t theta
     ) {
     // the caller is responsible for making sure 'point_attrs' is [N, C=3]
     signedindex_t query_index = blockDim.x * blockIdx.x + threadIdx.x;
@@ -347,7 +273,7 @@ __global__ void multiply_by_A_cuda_kernel(
                                                               node_reppoints + cur_node_index*SPATIAL_DIM);
 
             /// @case 1: the query point is far from the sample, approximate the query value with the node center
-            if (point2node_dist2 > pow(scalar_t(TREECODE_THRESHOLD * 2.0f) * node_half_w_list[cur_node_index], scalar_t(2.0f))) {
+            if (point2node_dist2 > pow(scalar_t(theta * 2.0f) * node_half_w_list[cur_node_index], scalar_t(2.0f))) {
                 scalar_t diff[SPATIAL_DIM];     // x - y
                 subtract_vec<scalar_t>(diff, query_points + query_index*SPATIAL_DIM, node_reppoints + cur_node_index*SPATIAL_DIM, SPATIAL_DIM);
                 out_val += eval_A_mu<scalar_t>(diff, node_attrs + cur_node_index * SPATIAL_DIM, query_width[query_index], continuous_kernel);
@@ -390,7 +316,8 @@ __global__ void multiply_by_AT_cuda_kernel(
         const scalar_t* node_reppoints,
         const signedindex_t* num_points_in_node,
         scalar_t* out_attrs,           // [N, 3]
-        signedindex_t num_queries
+        signedindex_t num_queries,
+        scalar_t theta
     ) {
     // the caller is responsible for making sure 'point_attrs' is [N, C=3]
     signedindex_t query_index = blockDim.x * blockIdx.x + threadIdx.x;
@@ -412,7 +339,7 @@ __global__ void multiply_by_AT_cuda_kernel(
                                                               node_reppoints + cur_node_index*SPATIAL_DIM);
 
             /// @case 1: the query point is far from the sample, approximate the query value with the node center
-            if (point2node_dist2 > pow(scalar_t(TREECODE_THRESHOLD * 2.0f) * node_half_w_list[cur_node_index], scalar_t(2.0f))) {
+            if (point2node_dist2 > pow(scalar_t(theta * 2.0f) * node_half_w_list[cur_node_index], scalar_t(2.0f))) {
                 scalar_t diff[SPATIAL_DIM];     // x - y
                 subtract_vec<scalar_t>(diff, query_points + query_index*SPATIAL_DIM, node_reppoints + cur_node_index*SPATIAL_DIM, SPATIAL_DIM);
                 eval_AT_s_add_<scalar_t>(out_vec, diff, node_attrs + cur_node_index, query_width[query_index]);
@@ -462,7 +389,8 @@ __global__ void multiply_by_G_cuda_kernel(
         const scalar_t* node_reppoints,
         const signedindex_t* num_points_in_node,
         scalar_t* out_attrs,           // [N, 3]
-        signedindex_t num_queries
+        signedindex_t num_queries,
+        scalar_t theta
     ) {
     // the caller is responsible for making sure 'point_attrs' is [N, C=3]
     signedindex_t query_index = blockDim.x * blockIdx.x + threadIdx.x;
@@ -483,7 +411,7 @@ __global__ void multiply_by_G_cuda_kernel(
                                                               node_reppoints + cur_node_index*SPATIAL_DIM);
 
             /// @case 1: the query point is far from the sample, approximate the query value with the node center
-            if (point2node_dist2 > pow(scalar_t(TREECODE_THRESHOLD * 2.0f) * node_half_w_list[cur_node_index], scalar_t(2.0f))) {
+            if (point2node_dist2 > pow(scalar_t(theta * 2.0f) * node_half_w_list[cur_node_index], scalar_t(2.0f))) {
                 scalar_t diff[SPATIAL_DIM];     // x - y
                 subtract_vec<scalar_t>(diff, query_points + query_index*SPATIAL_DIM, node_reppoints + cur_node_index*SPATIAL_DIM, SPATIAL_DIM);
                 eval_G_mu_add_<scalar_t>(out_vec, diff, node_attrs + cur_node_index*SPATIAL_DIM, query_width[query_index]);
@@ -512,14 +440,8 @@ __global__ void multiply_by_G_cuda_kernel(
 }
 
 //////////////////// instantiation ////////////////////
-auto ptr_find_next_to_scatter_cuda_kernel_float  = find_next_to_scatter_cuda_kernel<float>;
-auto ptr_find_next_to_scatter_cuda_kernel_double = find_next_to_scatter_cuda_kernel<double>;
-
-auto ptr_scatter_point_attrs_to_nodes_leaf_cuda_kernel_float  = scatter_point_attrs_to_nodes_leaf_cuda_kernel<float>;
-auto ptr_scatter_point_attrs_to_nodes_leaf_cuda_kernel_double = scatter_point_attrs_to_nodes_leaf_cuda_kernel<double>;
-
-auto ptr_scatter_point_attrs_to_nodes_nonleaf_cuda_kernel_float  = scatter_point_attrs_to_nodes_nonleaf_cuda_kernel<float>;
-auto ptr_scatter_point_attrs_to_nodes_nonleaf_cuda_kernel_double = scatter_point_attrs_to_nodes_nonleaf_cuda_kernel<double>;
+auto ptr_scatter_point_attrs_to_nodes_level_cuda_kernel_float  = scatter_point_attrs_to_nodes_level_cuda_kernel<float>;
+auto ptr_scatter_point_attrs_to_nodes_level_cuda_kernel_double = scatter_point_attrs_to_nodes_level_cuda_kernel<double>;
 
 auto ptr_multiply_by_A_cuda_kernel_float  = multiply_by_A_cuda_kernel<float>;
 auto ptr_multiply_by_A_cuda_kernel_double = multiply_by_A_cuda_kernel<double>;
@@ -48,7 +48,8 @@ std::vector<torch::Tensor> scatter_point_attrs_to_nodes(
         torch::Tensor node2point_indexstart,
         torch::Tensor num_points_in_node,
         torch::Tensor node_is_leaf_list,
-        signedindex_t tree_depth
+        torch::Tensor node_level_order,
+        torch::Tensor node_level_offsets
     ) {
 
     CHECK_INPUT_FOR_CUDA(node_parent_list);
@@ -60,57 +61,29 @@ std::vector<torch::Tensor> scatter_point_attrs_to_nodes(
     CHECK_INPUT_FOR_CUDA(node2point_indexstart);
     CHECK_INPUT_FOR_CUDA(num_points_in_node);
     CHECK_INPUT_FOR_CUDA(node_is_leaf_list);
+    CHECK_INPUT_FOR_CUDA(node_level_order);
+    CHECK_INPUT_FOR_CPU(node_level_offsets);    // read on the host to size the per-level launches
 
     signedindex_t num_nodes = node_parent_list.size(0);
     signedindex_t attr_dim = point_attrs.size(1);
+    signedindex_t tree_depth = node_level_offsets.size(0) - 2;
     assert(attr_dim == SPATIAL_DIM or attr_dim == 1);
-
-    auto bool_tensor_options = torch::TensorOptions().dtype(torch::kBool).device(points.device());
-    auto scattered_mask = torch::zeros({num_nodes}, bool_tensor_options);
-    auto next_to_scatter_mask = torch::zeros({num_nodes}, bool_tensor_options);
     
     auto float_tensor_options = torch::TensorOptions().dtype(points.dtype()).device(points.device());
     auto out_node_attrs = torch::zeros({num_nodes, point_attrs.size(1)}, float_tensor_options);
     auto out_node_reppoints = torch::zeros({num_nodes, SPATIAL_DIM}, float_tensor_options);
     auto out_node_weights = torch::zeros({num_nodes}, float_tensor_options);
 
-    signedindex_t num_blocks = (num_nodes + THREADS_PER_BLOCK - 1) / THREADS_PER_BLOCK;
-    
-    AT_DISPATCH_FLOATING_TYPES(points.type(), "scatter_point_attrs_to_nodes_leaf_cuda_kernel", ([&] {
-        scatter_point_attrs_to_nodes_leaf_cuda_kernel<scalar_t><<<num_blocks, THREADS_PER_BLOCK>>>(
-            node_parent_list.data<signedindex_t>(),
-            points.data<scalar_t>(),
-            point_weights.data<scalar_t>(),
-            point_attrs.data<scalar_t>(),
-            node2point_index.data<signedindex_t>(),
-            node2point_indexstart.data<signedindex_t>(),
-            num_points_in_node.data<signedindex_t>(),
-            node_is_leaf_list.data<bool>(),
-            scattered_mask.data<bool>(),
-            out_node_attrs.data<scalar_t>(),
-            out_node_reppoints.data<scalar_t>(),
-            out_node_weights.data<scalar_t>(),
-            attr_dim,
-            num_nodes
-            );
-    }));
-
+    const signedindex_t* ptr_node_level_offsets = node_level_offsets.data<signedindex_t>();
+    for (signedindex_t depth = tree_depth; depth >= 0; depth--) {
+        signedindex_t num_level_nodes = ptr_node_level_offsets[depth+1] - ptr_node_level_offsets[depth];
+        if (num_level_nodes == 0) {
+            continue;
+        }
+        signedindex_t num_blocks = (num_level_nodes + THREADS_PER_BLOCK - 1) / THREADS_PER_BLOCK;
 
-    for (signedindex_t depth = tree_depth-1; depth >= 0; depth--) {
-        AT_DISPATCH_FLOATING_TYPES(points.type(), "find_next_to_scatter_cuda_kernel", ([&] {
-            find_next_to_scatter_cuda_kernel<scalar_t><<<num_blocks, THREADS_PER_BLOCK>>>(
-                node_children_list.data<signedindex_t>(),
-                node_is_leaf_list.data<bool>(),
-                scattered_mask.data<bool>(),
-                next_to_scatter_mask.data<bool>(),
-                node2point_index.data<signedindex_t>(),
-                num_nodes
-            );
-        }));
-
-        AT_DISPATCH_FLOATING_TYPES(points.type(), "scatter_point_attrs_to_nodes_nonleaf_cuda_kernel", ([&] {
-            scatter_point_attrs_to_nodes_nonleaf_cuda_kernel<scalar_t><<<num_blocks, THREADS_PER_BLOCK>>>(
-                node_parent_list.data<signedindex_t>(),
+        AT_DISPATCH_FLOATING_TYPES(points.type(), "scatter_point_attrs_to_nodes_level_cuda_kernel", ([&] {
+            scatter_point_attrs_to_nodes_level_cuda_kernel<scalar_t><<<num_blocks, THREADS_PER_BLOCK>>>(
                 node_children_list.data<signedindex_t>(),
                 points.data<scalar_t>(),
                 point_weights.data<scalar_t>(),
@@ -119,13 +92,12 @@ std::vector<torch::Tensor> scatter_point_attrs_to_nodes(
                 node2point_indexstart.data<signedindex_t>(),
                 num_points_in_node.data<signedindex_t>(),
                 node_is_leaf_list.data<bool>(),
-                scattered_mask.data<bool>(),
-                next_to_scatter_mask.data<bool>(),
+                node_level_order.data<signedindex_t>() + ptr_node_level_offsets[depth],
                 out_node_attrs.data<scalar_t>(),
                 out_node_reppoints.data<scalar_t>(),
                 out_node_weights.data<scalar_t>(),
                 attr_dim,
-                num_nodes
+                num_level_nodes
             );
         }));
     }
@@ -146,7 +118,8 @@ torch::Tensor multiply_by_A(
         torch::Tensor node_is_leaf_list,
         torch::Tensor node_half_w_list,
         torch::Tensor node_reppoints,
-        torch::Tensor num_points_in_node
+        torch::Tensor num_points_in_node,
+        double theta
     ) {
 
     CHECK_INPUT_FOR_CUDA(query_points);
@@ -183,7 +156,9 @@ torch::Tensor multiply_by_A(
             node_reppoints.data<scalar_t>(),
             num_points_in_node.data<signedindex_t>(),
             out_attrs.data<scalar_t>(),           // [N, 3]
-            num_queries
+            num_queries,
+            false,
+            scalar_t(theta)
         );
     }));
 
@@ -203,7 +178,8 @@ torch::Tensor multiply_by_AT(
         torch::Tensor node_is_leaf_list,
         torch::Tensor node_half_w_list,
         torch::Tensor node_reppoints,
-        torch::Tensor num_points_in_node
+        torch::Tensor num_points_in_node,
+        double theta
         ) {
 
     CHECK_INPUT_FOR_CUDA(query_points);
@@ -244,7 +220,8 @@ torch::Tensor multiply_by_AT(
             node_reppoints.data<scalar_t>(),
             num_points_in_node.data<signedindex_t>(),
             out_attrs.data<scalar_t>(),           // [N, 3]
-            num_queries
+            num_queries,
+            scalar_t(theta)
         );
     }));
 
@@ -263,7 +240,8 @@ torch::Tensor multiply_by_G(
         torch::Tensor node_is_leaf_list,
         torch::Tensor node_half_w_list,
         torch::Tensor node_reppoints,
-        torch::Tensor num_points_in_node
+        torch::Tensor num_points_in_node,
+        double theta
         ) {
     
     CHECK_INPUT_FOR_CUDA(query_points);
@@ -300,7 +278,8 @@ torch::Tensor multiply_by_G(
             node_reppoints.data<scalar_t>(),
             num_points_in_node.data<signedindex_t>(),
             out_attrs.data<scalar_t>(),           // [N, 3]
-            num_queries
+            num_queries,
+            scalar_t(theta)
         );
     }));
     return out_attrs;
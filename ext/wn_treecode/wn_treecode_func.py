@@ -3,13 +3,48 @@ import torch
 class WindingNumberTreecode:
     def __init__(self,
                  points: torch.Tensor,
-                 max_tree_depth=15):
+                 max_tree_depth=15,
+                 cache_interaction_lists=False,
+                 num_threads=-1,
+                 expansion_order=0,
+                 dual_tree=False,
+                 theta=2.0,
+                 leaf_size=1,
+                 tree_order=False):
         """
         points: [N, 3]
+        num_threads: threads used to build the tree, -1 for the process-wide setting (wn_treecode.set_num_threads).
+            The tree is the same for any number of threads.
+        cache_interaction_lists: (CPU only) classify the tree nodes for every point once at init,
+            and replay the stored far/near/undecided lists in forward_* instead of traversing from the root.
+            The result is the same as without caching, for any widths and attributes,
+            at the cost of a few hundred indices of memory per point.
+        expansion_order: (CPU only) order of the multipole expansion used for far-field nodes, 0, 1 or 2.
+            0 approximates a node by its summed attribute at the reppoint, 1 and 2 add the first and second moments
+            of the attributes about the reppoint, which is more accurate for the same opening criterion.
+            Can be changed between forward_* calls (self.expansion_order).
+        dual_tree: (CPU only) evaluate forward_* by traversing pairs of target and source nodes,
+            so that nearby points share their traversal decisions and far-field interactions (local expansions).
+            This relies on the queries of forward_* being the points of the tree. The approximation error differs from
+            (and is typically smaller than) that of the per-point traversal. Only for expansion_order == 0.
+            Faster than the per-point traversal for large N, see the README for measured times.
+        theta: accuracy of the treecode, a node is approximated when its reppoint is farther than 2*theta times
+            its half width from the query. Larger is more accurate and slower, 2.0 is the default; at expansion_order 0
+            the relative error is about 0.075/theta^2, see the README for measured values.
+            Can be changed between forward_* calls (self.theta), e.g. coarse early iterations and precise late ones;
+            cached interaction lists are rebuilt when it changes.
+        leaf_size: max number of points in a leaf of the tree (more only at max_tree_depth). The points of near leaves
+            are summed exactly, a block at a time; 16-64 gives a several times smaller tree, and is faster and more accurate
+            than the default 1.
+        tree_order: keep the points in the order of the tree (Morton order), so that the points of a leaf are contiguous
+            and neighbouring queries are processed together. forward_* permute their inputs into that order and their
+            outputs back, unless called with in_tree_order=True: a caller that permutes its own tensors once
+            (to_tree_order / from_tree_order) does not pay for the permutations in every call.
         """
 
         assert len(points.shape) == 2
         assert points.shape[1] == 3
+        assert leaf_size >= 1
 
         import wn_treecode._cpu  # necessary, because tree build is cpu either way
         self.is_cuda = points.is_cuda   # undefined behavior if changed after init
@@ -20,12 +55,35 @@ class WindingNumberTreecode:
         self.device = points.device
 
         tree_depth = max_tree_depth
-        tree_packed = wn_treecode._cpu.build_tree(points.cpu(), tree_depth)   # tree build is on CPU either way
+        if dual_tree:
+            assert not self.is_cuda, 'dual-tree evaluation is only implemented for CPU'
+            assert not cache_interaction_lists, 'dual-tree evaluation does not use cached interaction lists'
+        if cache_interaction_lists:
+            assert not self.is_cuda, 'cached interaction lists are only implemented for CPU'
 
+        self.cpu_treecode = None
+        self.point_order = None   # point i of self.points is the input point self.point_order[i] with tree_order
         if self.is_cuda:
-            for i in range(len(tree_packed)):
+            tree_packed = wn_treecode._cpu.build_tree(points.cpu(), tree_depth, num_threads, leaf_size, False)   # tree build is on CPU either way, int64 for the CUDA ops
+            for i in range(len(tree_packed) - 1):   # node_level_offsets stays on CPU, it only drives the per-level launches
                 tree_packed[i] = tree_packed[i].to(self.device)
-        node_parent_list, node_children_list, node_is_leaf_list, node_half_w_list, num_points_in_node, node2point_index, node2point_indexstart = tree_packed
+            if tree_order:
+                self.point_order = tree_packed[5]
+                points = points[self.point_order].contiguous()
+                tree_packed[5] = torch.arange(points.shape[0], dtype=tree_packed[5].dtype, device=self.device)
+        else:
+            # holds the tree, the interaction lists and the scatter buffers, reused by every forward_*
+            self.cpu_treecode = wn_treecode._cpu.WindingNumberTreecodeCPU(points, tree_depth, num_threads, cache_interaction_lists, dual_tree, theta, leaf_size,
+                                                                          tree_order=tree_order)
+            tree_packed = self.cpu_treecode.get_tree()
+            if tree_order:
+                self.point_order = self.cpu_treecode.get_point_order()
+                points = self.cpu_treecode.get_points()
+        self.inverse_point_order = None
+        if tree_order:
+            self.inverse_point_order = torch.empty_like(self.point_order)
+            self.inverse_point_order[self.point_order] = torch.arange(points.shape[0], dtype=self.point_order.dtype, device=self.device)
+        node_parent_list, node_children_list, node_is_leaf_list, node_half_w_list, num_points_in_node, node2point_index, node2point_indexstart, node_level_order, node_level_offsets = tree_packed
         
         # if widths is not None:
         #     self.widths = widths.clone().to(self.device)
@@ -39,28 +97,91 @@ class WindingNumberTreecode:
         self.num_points_in_node = num_points_in_node
         self.node_is_leaf_list = node_is_leaf_list
         self.node_half_w_list = node_half_w_list
+        self.node_level_order = node_level_order
+        self.node_level_offsets = node_level_offsets
         self.tree_depth = tree_depth
+        self.leaf_size = leaf_size
+        self.expansion_order = expansion_order
+        self.dual_tree = dual_tree
+        self.theta = theta
+        self.cache_interaction_lists = cache_interaction_lists
+        self.tree_order = tree_order
 
-    def forward_A(self, normals, widths):
+    @property
+    def interaction_lists(self):
         """
-        normals: [N, 3]
+        (CPU) the cached interaction lists, for the theta of the last forward_* call, or None
+        """
+        if not self.cache_interaction_lists:
+            return None
+        return self.cpu_treecode.get_interaction_lists()
+
+    def to_tree_order(self, x):
+        """
+        x: [N, ...] in the order of the input points, returns it in the order of self.points (x itself without tree_order)
+        """
+        if not self.tree_order:
+            return x
+        return x[self.point_order].contiguous()
+
+    def from_tree_order(self, x):
+        """
+        x: [N, ...] in the order of self.points, returns it in the order of the input points (x itself without tree_order)
+        """
+        if not self.tree_order:
+            return x
+        return x[self.inverse_point_order].contiguous()
+
+    def _forward_permuted(self, forward_func, attrs, widths, out, memoize):
+        """
+        (tree_order) calls forward_func on the inputs in tree order, and returns its output in the order of the input points
+        """
+        out_vals = self.from_tree_order(forward_func(self.to_tree_order(attrs), self.to_tree_order(widths), memoize=memoize, in_tree_order=True))
+        if out is not None:
+            return out.copy_(out_vals)
+        return out_vals
+
+    def _scatter_to_nodes(self, point_weights, point_attrs):
+        """
+        (CUDA) returns the node attributes and the node reppoints, the CPU ops scatter inside self.cpu_treecode
+        """
+        assert self.expansion_order == 0, 'far-field expansions of order > 0 are only implemented for CPU'
+        node_attrs, node_reppoints, _ = self.treecode_package.scatter_point_attrs_to_nodes(self.node_parent_list,
+                                                                                           self.node_children_list,
+                                                                                           self.points,
+                                                                                           point_weights,
+                                                                                           point_attrs,
+                                                                                           self.node2point_index,
+                                                                                           self.node2point_indexstart,
+                                                                                           self.num_points_in_node,
+                                                                                           self.node_is_leaf_list,
+                                                                                           self.node_level_order,
+                                                                                           self.node_level_offsets)
+        return node_attrs, node_reppoints
+
+    def forward_A(self, normals, widths, out=None, memoize=False, in_tree_order=False):
+        """
+        normals: [N, 3], or [N, K*3] for K right hand sides (one traversal for all of them on CPU)
         widths: [N,]
+        out: [N, 1] ([N, K]) or None, the result is written into it (without allocating on CPU)
+        memoize: (CPU) reuse the scatter of normals by the next calls with the same tensor, unless it is modified in place,
+                 e.g. for a constant right hand side (with tree_order, only for inputs in tree order)
+        in_tree_order: (tree_order) the inputs and the output are in the order of self.points, see to_tree_order
         """
-        assert self.points.shape == normals.shape
+        assert len(normals.shape) == 2
+        assert normals.shape[0] == self.points.shape[0]
+        assert normals.shape[1] % 3 == 0
         assert len(widths.shape) == 1
         assert self.points.shape[0] == widths.shape[0]
+        if self.tree_order and not in_tree_order:
+            return self._forward_permuted(self.forward_A, normals, widths, out, memoize)
+        if self.cpu_treecode is not None:
+            return self.cpu_treecode.forward_A(normals, widths, self.expansion_order, out, memoize, self.theta)
+        if normals.shape[1] > 3:
+            return self._forward_rhs_by_rhs(self.forward_A, normals, 3, widths, out)
+
         point_weights = (normals ** 2).sum(-1).sqrt()
-        node_normals, node_reppoints, _ = \
-            self.treecode_package.scatter_point_attrs_to_nodes(self.node_parent_list,
-                                                    self.node_children_list,
-                                                    self.points,
-                                                    point_weights,
-                                                    normals,
-                                                    self.node2point_index,
-                                                    self.node2point_indexstart,
-                                                    self.num_points_in_node,
-                                                    self.node_is_leaf_list,
-                                                    self.tree_depth)
+        node_normals, node_reppoints = self._scatter_to_nodes(point_weights, normals)
         out_vals = self.treecode_package.multiply_by_A(
             self.points,
             widths,
@@ -74,33 +195,34 @@ class WindingNumberTreecode:
             self.node_half_w_list,
             node_reppoints,
             self.num_points_in_node,
+            self.theta,
         )
-
+        if out is not None:
+            return out.copy_(out_vals)
         return out_vals
     
-    def forward_AT(self, values, widths):
+    def forward_AT(self, values, widths, out=None, memoize=False, in_tree_order=False):
         """
-        values: [N, 1]
+        values: [N, 1], or [N, K] for K right hand sides (one traversal for all of them on CPU)
         widths: [N,]
+        out: [N, 3] ([N, K*3]) or None, the result is written into it (without allocating on CPU)
+        memoize: (CPU) reuse the scatter of values by the next calls with the same tensor, unless it is modified in place,
+                 e.g. for a constant right hand side (with tree_order, only for inputs in tree order)
+        in_tree_order: (tree_order) the inputs and the output are in the order of self.points, see to_tree_order
         """
         assert len(values.shape) == 2
         assert values.shape[0] == self.points.shape[0]
-        assert values.shape[1] == 1
         assert len(widths.shape) == 1
         assert self.points.shape[0] == widths.shape[0]
+        if self.tree_order and not in_tree_order:
+            return self._forward_permuted(self.forward_AT, values, widths, out, memoize)
+        if self.cpu_treecode is not None:
+            return self.cpu_treecode.forward_AT(values, widths, self.expansion_order, out, memoize, self.theta)
+        if values.shape[1] > 1:
+            return self._forward_rhs_by_rhs(self.forward_AT, values, 1, widths, out)
+
         point_weights = (values ** 2).sum(-1).sqrt()
-        node_scalars, node_reppoints, _  = \
-            self.treecode_package.scatter_point_attrs_to_nodes(self.node_parent_list,
-                                                    self.node_children_list,
-                                                    self.points,
-                                                    point_weights,
-                                                    values,
-                                                    self.node2point_index,
-                                                    self.node2point_indexstart,
-                                                    self.num_points_in_node,
-                                                    self.node_is_leaf_list,
-                                                    self.tree_depth)
-        
+        node_scalars, node_reppoints = self._scatter_to_nodes(point_weights, values)
         out_vecs = self.treecode_package.multiply_by_AT(
             self.points,
             widths,
@@ -114,31 +236,35 @@ class WindingNumberTreecode:
             self.node_half_w_list,
             node_reppoints,
             self.num_points_in_node,
+            self.theta,
         )
-
+        if out is not None:
+            return out.copy_(out_vecs)
         return out_vecs
     
-    def forward_G(self, normals, widths):
+    def forward_G(self, normals, widths, out=None, memoize=False, in_tree_order=False):
         """
-        normals: [N, 3]
+        normals: [N, 3], or [N, K*3] for K right hand sides (one traversal for all of them on CPU)
         widths: [N,]
+        out: [N, 3] ([N, K*3]) or None, the result is written into it (without allocating on CPU)
+        memoize: (CPU) reuse the scatter of normals by the next calls with the same tensor, unless it is modified in place,
+                 e.g. for a constant right hand side (with tree_order, only for inputs in tree order)
+        in_tree_order: (tree_order) the inputs and the output are in the order of self.points, see to_tree_order
         """
-        assert self.points.shape == normals.shape
+        assert len(normals.shape) == 2
+        assert normals.shape[0] == self.points.shape[0]
+        assert normals.shape[1] % 3 == 0
         assert len(widths.shape) == 1
         assert self.points.shape[0] == widths.shape[0]
+        if self.tree_order and not in_tree_order:
+            return self._forward_permuted(self.forward_G, normals, widths, out, memoize)
+        if self.cpu_treecode is not None:
+            return self.cpu_treecode.forward_G(normals, widths, self.expansion_order, out, memoize, self.theta)
+        if normals.shape[1] > 3:
+            return self._forward_rhs_by_rhs(self.forward_G, normals, 3, widths, out)
         
         point_weights = (normals ** 2).sum(-1).sqrt()
-        node_normals, node_reppoints, _ = \
-            self.treecode_package.scatter_point_attrs_to_nodes(self.node_parent_list,
-                                                    self.node_children_list,
-                                                    self.points,
-                                                    point_weights,
-                                                    normals,
-                                                    self.node2point_index,
-                                                    self.node2point_indexstart,
-                                                    self.num_points_in_node,
-                                                    self.node_is_leaf_list,
-                                                    self.tree_depth)
+        node_normals, node_reppoints = self._scatter_to_nodes(point_weights, normals)
         out_normals = self.treecode_package.multiply_by_G(
             self.points,
             widths,
@@ -152,6 +278,99 @@ class WindingNumberTreecode:
             self.node_half_w_list,
             node_reppoints,
             self.num_points_in_node,
+            self.theta,
         )
+        if out is not None:
+            return out.copy_(out_normals)
+        return out_normals
 
-        return out_normals
\ No newline at end of file
+    def _forward_rhs_by_rhs(self, forward_func, attrs, attr_dim, widths, out):
+        """
+        (CUDA) several right hand sides side by side in attrs, one call per right hand side
+        """
+        out_vals = torch.cat([forward_func(attrs[:, k:k+attr_dim].contiguous(), widths, in_tree_order=True) for k in range(0, attrs.shape[1], attr_dim)], dim=1)
+        if out is not None:
+            return out.copy_(out_vals)
+        return out_vals
+
+    def forward_A_multiwidth(self, normals, widths, out=None, memoize=False, in_tree_order=False):
+        """
+        normals: [N, 3]
+        widths: [N, K], e.g. a width sweep or the widths of all the iterations of a schedule
+        out: [N, K, 1] or None
+        returns A values for every column of widths, as K calls to forward_A would
+        """
+        assert self.points.shape == normals.shape
+        if self.tree_order and not in_tree_order:
+            return self._forward_permuted(self.forward_A_multiwidth, normals, widths, out, memoize)
+        return self._forward_multiwidth('A', normals, widths, out, memoize)
+
+    def forward_AT_multiwidth(self, values, widths, out=None, memoize=False, in_tree_order=False):
+        """
+        values: [N, 1]
+        widths: [N, K]
+        out: [N, K, 3] or None
+        returns AT values for every column of widths, as K calls to forward_AT would
+        """
+        assert len(values.shape) == 2
+        assert values.shape[0] == self.points.shape[0]
+        assert values.shape[1] == 1
+        if self.tree_order and not in_tree_order:
+            return self._forward_permuted(self.forward_AT_multiwidth, values, widths, out, memoize)
+        return self._forward_multiwidth('AT', values, widths, out, memoize)
+
+    def forward_G_multiwidth(self, normals, widths, out=None, memoize=False, in_tree_order=False):
+        """
+        normals: [N, 3]
+        widths: [N, K]
+        out: [N, K, 3] or None
+        returns G values for every column of widths, as K calls to forward_G would
+        """
+        assert self.points.shape == normals.shape
+        if self.tree_order and not in_tree_order:
+            return self._forward_permuted(self.forward_G_multiwidth, normals, widths, out, memoize)
+        return self._forward_multiwidth('G', normals, widths, out, memoize)
+
+    def _forward_multiwidth(self, operator, attrs, widths, out, memoize):
+        """
+        (CPU) one scatter and one traversal for all the widths, far nodes are approximated at order 0 whatever expansion_order.
+        Falls back to K calls to forward_A / forward_AT / forward_G on CUDA.
+        """
+        assert len(widths.shape) == 2
+        assert self.points.shape[0] == widths.shape[0]
+        if self.cpu_treecode is not None:
+            forward_funcs = {'A': self.cpu_treecode.forward_A_multiwidth, 'AT': self.cpu_treecode.forward_AT_multiwidth, 'G': self.cpu_treecode.forward_G_multiwidth}
+            return forward_funcs[operator](attrs, widths.contiguous(), out, memoize, self.theta)
+
+        forward_funcs = {'A': self.forward_A, 'AT': self.forward_AT, 'G': self.forward_G}
+        out_vals = torch.stack([forward_funcs[operator](attrs, widths[:, k].contiguous(), in_tree_order=True) for k in range(widths.shape[1])], dim=1)
+        if out is not None:
+            return out.copy_(out_vals)
+        return out_vals
+
+    def forward_fused(self, operators, attrs_list, widths, in_tree_order=False):
+        """
+        operators: list of 'A', 'AT' and 'G', at most 4
+        attrs_list: the input of each operator, [N, 3] for 'A' and 'G', [N, 1] for 'AT'
+        widths: [N,], shared by the operators
+        returns the list of outputs, as forward_A / forward_AT / forward_G would
+        (CPU) one scatter and one traversal per point for all of the operators, which share their reppoints,
+        so the far-field approximation differs slightly from that of the separate calls.
+        With dual_tree, exactly 'A' and 'AT' (in either order) are evaluated by one symmetric dual-tree traversal:
+        every pair of nodes and of near leaves is visited once for both operators and both directions,
+        the result is deterministic for a given number of threads, and the near field takes 4 * N scalars in all.
+        Falls back to the separate calls on CUDA, with dual_tree and other operators, cached interaction lists or expansion_order > 0.
+        in_tree_order: (tree_order) the inputs and the outputs are in the order of self.points, see to_tree_order
+        """
+        assert len(operators) == len(attrs_list)
+        forward_funcs = {'A': self.forward_A, 'AT': self.forward_AT, 'G': self.forward_G}
+        dual_tree = self.dual_tree and sorted(operators) == ['A', 'AT']
+        if self.is_cuda or (self.dual_tree and not dual_tree) or self.cache_interaction_lists or self.expansion_order != 0:
+            return [forward_funcs[op](attrs, widths, in_tree_order=in_tree_order) for op, attrs in zip(operators, attrs_list)]
+        if self.tree_order and not in_tree_order:
+            out_list = self.forward_fused(operators, [self.to_tree_order(attrs) for attrs in attrs_list], self.to_tree_order(widths), in_tree_order=True)
+            return [self.from_tree_order(out_vals) for out_vals in out_list]
+
+        assert len(widths.shape) == 1
+        assert self.points.shape[0] == widths.shape[0]
+        return self.cpu_treecode.forward_fused(list(operators), widths, [attrs.contiguous() for attrs in attrs_list], self.theta, dual_tree)
@@ -0,0 +1,324 @@
+/*
+MIT License
+
+Copyright (c) 2024 Siyou Lin, Zuoqiang Shi, Yebin Liu
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/// @note main_wnnc.py without python or torch: orients the normals of an xyz/ply point cloud
+//        and writes the points with their normals as xyz or ply (by the extension of the output)
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <chrono>
+#include <filesystem>
+#include <stdexcept>
+#include <CLI11.hpp>
+#include "wn_treecode_cpu.h"
+
+typedef float used_dtype;
+
+
+static std::string get_extension(const std::string& file_name) {
+    auto dot = file_name.find_last_of('.');
+    return (dot == std::string::npos) ? std::string() : file_name.substr(dot);
+}
+
+/// @brief the first 3 columns of every non-empty line
+static bool read_xyz(const std::string& file_name, std::vector<double>& points) {
+    std::ifstream in(file_name);
+    if (!in) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream line_stream(line);
+        double x, y, z;
+        if (line_stream >> x >> y >> z) {
+            points.push_back(x);
+            points.push_back(y);
+            points.push_back(z);
+        }
+    }
+    return true;
+}
+
+static signedindex_t get_ply_type_size(const std::string& type) {
+    if (type == "char" || type == "uchar" || type == "int8" || type == "uint8") { return 1; }
+    if (type == "short" || type == "ushort" || type == "int16" || type == "uint16") { return 2; }
+    if (type == "int" || type == "uint" || type == "float" || type == "int32" || type == "uint32" || type == "float32") { return 4; }
+    if (type == "double" || type == "float64") { return 8; }
+    return 0;
+}
+
+static double read_ply_binary_value(const char* bytes, const std::string& type) {
+    if (type == "float" || type == "float32") { float v; std::memcpy(&v, bytes, 4); return v; }
+    if (type == "double" || type == "float64") { double v; std::memcpy(&v, bytes, 8); return v; }
+    if (type == "int" || type == "int32") { int32_t v; std::memcpy(&v, bytes, 4); return v; }
+    if (type == "uint" || type == "uint32") { uint32_t v; std::memcpy(&v, bytes, 4); return v; }
+    if (type == "short" || type == "int16") { int16_t v; std::memcpy(&v, bytes, 2); return v; }
+    if (type == "ushort" || type == "uint16") { uint16_t v; std::memcpy(&v, bytes, 2); return v; }
+    if (type == "char" || type == "int8") { int8_t v; std::memcpy(&v, bytes, 1); return v; }
+    uint8_t v; std::memcpy(&v, bytes, 1); return v;
+}
+
+/// @brief x, y, z of the vertices, ascii or binary_little_endian, the vertex element must come first
+static bool read_ply(const std::string& file_name, std::vector<double>& points) {
+    std::ifstream in(file_name, std::ios::binary);
+    if (!in) {
+        return false;
+    }
+    std::string line, format;
+    signedindex_t num_vertices = -1;
+    bool in_vertex_element = false;
+    std::vector<std::string> property_types, property_names;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') { line.pop_back(); }
+        std::istringstream line_stream(line);
+        std::string keyword;
+        line_stream >> keyword;
+        if (keyword == "format") {
+            line_stream >> format;
+        } else if (keyword == "element") {
+            std::string element_name;
+            signedindex_t count;
+            line_stream >> element_name >> count;
+            if (element_name == "vertex") {
+                if (num_vertices >= 0 || !property_names.empty()) { return false; }
+                num_vertices = count;
+            } else if (num_vertices < 0) {
+                std::cout << "[ERROR] only ply files with the vertex element first are supported\n";
+                return false;
+            }
+            in_vertex_element = (element_name == "vertex");
+        } else if (keyword == "property" && in_vertex_element) {
+            std::string type, name;
+            line_stream >> type >> name;
+            if (type == "list" || get_ply_type_size(type) == 0) {
+                std::cout << "[ERROR] unsupported vertex property: " << line << "\n";
+                return false;
+            }
+            property_types.push_back(type);
+            property_names.push_back(name);
+        } else if (keyword == "end_header") {
+            break;
+        }
+    }
+
+    signedindex_t xyz_index[SPATIAL_DIM] = {-1, -1, -1};
+    const char* xyz_names[SPATIAL_DIM] = {"x", "y", "z"};
+    for (signedindex_t k = 0; k < (signedindex_t)property_names.size(); k++) {
+        for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+            if (property_names[k] == xyz_names[d]) { xyz_index[d] = k; }
+        }
+    }
+    if (num_vertices < 0 || xyz_index[0] < 0 || xyz_index[1] < 0 || xyz_index[2] < 0) {
+        return false;
+    }
+
+    points.resize(num_vertices * SPATIAL_DIM);
+    if (format == "ascii") {
+        std::vector<double> values(property_names.size());
+        for (signedindex_t i = 0; i < num_vertices; i++) {
+            for (auto& value : values) {
+                if (!(in >> value)) { return false; }
+            }
+            for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+                points[i*SPATIAL_DIM + d] = values[xyz_index[d]];
+            }
+        }
+    } else if (format == "binary_little_endian") {
+        std::vector<signedindex_t> property_offsets(property_names.size());
+        signedindex_t vertex_size = 0;
+        for (signedindex_t k = 0; k < (signedindex_t)property_names.size(); k++) {
+            property_offsets[k] = vertex_size;
+            vertex_size += get_ply_type_size(property_types[k]);
+        }
+        std::vector<char> vertex_bytes(vertex_size);
+        for (signedindex_t i = 0; i < num_vertices; i++) {
+            if (!in.read(vertex_bytes.data(), vertex_size)) { return false; }
+            for (signedindex_t d = 0; d < SPATIAL_DIM; d++) {
+                signedindex_t k = xyz_index[d];
+                points[i*SPATIAL_DIM + d] = read_ply_binary_value(vertex_bytes.data() + property_offsets[k], property_types[k]);
+            }
+        }
+    } else {
+        std::cout << "[ERROR] unsupported ply format: " << format << "\n";
+        return false;
+    }
+    return true;
+}
+
+/// @brief x y z nx ny nz per line, as np.savetxt in main_wnnc.py
+static bool write_xyz(const std::string& file_name, const std::vector<double>& points, const std::vector<used_dtype>& normals) {
+    FILE* out = std::fopen(file_name.c_str(), "w");
+    if (out == nullptr) {
+        return false;
+    }
+    const size_t num_points = points.size() / SPATIAL_DIM;
+    for (size_t i = 0; i < num_points; i++) {
+        std::fprintf(out, "%.18e %.18e %.18e %.18e %.18e %.18e\n",
+                     points[i*3+0], points[i*3+1], points[i*3+2],
+                     double(normals[i*3+0]), double(normals[i*3+1]), double(normals[i*3+2]));
+    }
+    std::fclose(out);
+    return true;
+}
+
+/// @brief binary little-endian ply with float x y z nx ny nz
+static bool write_ply(const std::string& file_name, const std::vector<double>& points, const std::vector<used_dtype>& normals) {
+    std::ofstream out(file_name, std::ios::binary);
+    if (!out) {
+        return false;
+    }
+    const size_t num_points = points.size() / SPATIAL_DIM;
+    out << "ply\nformat binary_little_endian 1.0\n"
+        << "element vertex " << num_points << "\n"
+        << "property float x\nproperty float y\nproperty float z\n"
+        << "property float nx\nproperty float ny\nproperty float nz\n"
+        << "end_header\n";
+    for (size_t i = 0; i < num_points; i++) {
+        float vertex[6] = {float(points[i*3+0]), float(points[i*3+1]), float(points[i*3+2]),
+                           float(normals[i*3+0]), float(normals[i*3+1]), float(normals[i*3+2])};
+        out.write(reinterpret_cast<const char*>(vertex), sizeof(vertex));
+    }
+    return bool(out);
+}
+
+
+int main(int argc, char** argv) {
+
+    std::string inFileName;
+    std::string outFileName;
+    std::string width_config;
+    double wsmin = 0.01;
+    double wsmax = 0.04;
+    int iters = 40;
+    int expansion_order = 0;
+    bool no_precompute_ATb = false;
+    bool tight_opening = false;
+    int query_packet_size = DEFAULT_QUERY_PACKET_SIZE;
+    double theta = TREECODE_THRESHOLD;
+    double theta_start = 0;
+    int leaf_size = 1;
+    int num_threads = -1;
+
+    CLI::App app("wnnc_cpu");
+    app.add_option("-i", inFileName, "input point cloud, xyz or ply")->required();
+    app.add_option("-o", outFileName, "output point cloud with normals, xyz or ply")->required();
+    app.add_option("--width_config", width_config, "preset width config l0-l5, or custom with --wsmin --wsmax")->required()
+        ->check(CLI::IsMember({"l0", "l1", "l2", "l3", "l4", "l5", "custom"}));
+    app.add_option("--wsmin", wsmin, "min width, only with --width_config custom")
+        ->check(CLI::PositiveNumber);
+    app.add_option("--wsmax", wsmax, "max width, only with --width_config custom")
+        ->check(CLI::PositiveNumber);
+    app.add_option("--iters", iters, "number of iterations");
+    app.add_option("--expansion_order", expansion_order, "order of the far-field multipole expansion of the treecode")
+        ->check(CLI::Range(0, MAX_EXPANSION_ORDER));
+    app.add_flag("--no_precompute_ATb", no_precompute_ATb, "compute AT(b) in every iteration, instead of for the whole width schedule in one pass");
+    app.add_option("--theta", theta, "accuracy of the treecode, larger is more accurate and slower, relative error ~ 0.075/theta^2 at expansion order 0")
+        ->check(CLI::PositiveNumber);
+    app.add_option("--theta_start", theta_start, "theta of the first iteration, going linearly to --theta at the last, default: --theta throughout")
+        ->check(CLI::PositiveNumber);
+    app.add_option("--leaf_size", leaf_size, "max number of points in a leaf of the treecode tree, 16-64 is faster and more accurate than the default 1")
+        ->check(CLI::PositiveNumber);
+    app.add_flag("--tight_opening", tight_opening, "accept far-field tree nodes by the bounding box of their points about the reppoint, instead of the node cube");
+    app.add_option("--query_packet_size", query_packet_size, "walk the treecode tree once per run of up to N queries close to each other at expansion order 0 (default 32), 0 or 1 walks once per query")
+        ->check(CLI::Range(0, MAX_QUERY_PACKET_SIZE));
+    app.add_option("-t", num_threads, "number of CPU threads, default: OpenMP default");
+
+    CLI11_PARSE(app, argc, argv);
+    set_num_threads(num_threads);
+    set_opening_criterion(tight_opening ? OPENING_TIGHT : OPENING_CELL);
+    set_query_packet_size(query_packet_size);
+
+    const std::string in_extension = get_extension(inFileName);
+    const std::string out_extension = get_extension(outFileName);
+    if (out_extension != ".xyz" && out_extension != ".ply") {
+        std::cout << "[ERROR] the output file must have extension xyz/ply\n";
+        return 1;
+    }
+
+    std::vector<double> points_unnormalized;
+    bool read_ok = false;
+    if (in_extension == ".xyz") {
+        read_ok = read_xyz(inFileName, points_unnormalized);
+    } else if (in_extension == ".ply") {
+        read_ok = read_ply(inFileName, points_unnormalized);
+    } else {
+        std::cout << "[ERROR] the input file must have extension xyz/ply\n";
+        return 1;
+    }
+    if (!read_ok || points_unnormalized.empty()) {
+        std::cout << "[ERROR] cannot read points from " << inFileName << "\n";
+        return 1;
+    }
+    const signedindex_t num_points = points_unnormalized.size() / SPATIAL_DIM;
+
+    WNNCOptions options;
+    if (width_config == "custom") {
+        if (wsmin > wsmax) {
+            std::cout << "[ERROR] --wsmin " << wsmin << " is larger than --wsmax " << wsmax << "\n";
+            return 1;
+        }
+        options.wsmin = wsmin;
+        options.wsmax = wsmax;
+    } else {
+        get_wnnc_width_preset(width_config.c_str(), options.wsmin, options.wsmax);
+    }
+    options.iters = iters;
+    options.expansion_order = expansion_order;
+    options.precompute_AT_b = !no_precompute_ATb;
+    options.theta = theta;
+    options.theta_start = theta_start;
+    options.leaf_size = leaf_size;
+    std::cout << "[LOG] You are using width config " << width_config << " width wsmin = " << options.wsmin << ", wsmax = " << options.wsmax << "\n";
+
+    auto time_start = std::chrono::steady_clock::now();
+    std::vector<used_dtype> points(points_unnormalized.begin(), points_unnormalized.end());
+    std::vector<used_dtype> normals(num_points * SPATIAL_DIM);
+    try {
+        wnnc_solve<used_dtype>(points.data(), num_points, options, normals.data());
+    } catch (const std::exception& e) {
+        std::cout << "[ERROR] " << e.what() << "\n";
+        return 1;
+    }
+    auto time_end = std::chrono::steady_clock::now();
+    std::cout << "[LOG] time_main: " << std::chrono::duration<double>(time_end - time_start).count() << "\n";
+
+    const auto out_dir = std::filesystem::path(outFileName).parent_path();
+    if (!out_dir.empty()) {
+        std::filesystem::create_directories(out_dir);
+    }
+    bool write_ok = (out_extension == ".xyz") ? write_xyz(outFileName, points_unnormalized, normals)
+                                              : write_ply(outFileName, points_unnormalized, normals);
+    if (!write_ok) {
+        std::cout << "[ERROR] cannot write " << outFileName << "\n";
+        return 1;
+    }
+    std::cout << "[LOG] oriented points written to " << outFileName << "\n";
+    return 0;
+}
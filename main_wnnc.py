@@ -20,7 +20,25 @@ parser.add_argument('--iters', type=int, default=40, help='number of iterations'
 parser.add_argument('--out_dir', type=str, default='results')
 parser.add_argument('--cpu', action='store_true', help='use cpu code only')
 parser.add_argument('--tqdm', action='store_true', help='use tqdm bar')
+parser.add_argument('--cache_interaction_lists', action='store_true', help='build the treecode interaction lists once and reuse them in all iterations (cpu only, uses more memory)')
+parser.add_argument('--expansion_order', type=int, default=0, choices=[0, 1, 2], help='order of the far-field multipole expansion of the treecode (cpu only)')
+parser.add_argument('--dual_tree', action='store_true', help='evaluate the treecode by dual-tree traversal (cpu only)')
+parser.add_argument('--fuse_operators', action='store_true', help='evaluate A(normals) and AT(b) of each iteration in one treecode pass with shared reppoints (cpu only, with --no_precompute_ATb or --expansion_order > 0; with --dual_tree, one symmetric dual-tree traversal for both)')
+parser.add_argument('--no_precompute_ATb', action='store_true', help='compute AT(b) in every iteration, instead of for all the widths of the schedule in one treecode pass before the first iteration (cpu only, expansion_order 0, the precomputed values take N*iters*3 floats)')
+parser.add_argument('--num_threads', type=int, default=-1, help='number of threads for the cpu code, -1 for the OpenMP default')
+parser.add_argument('--theta', type=float, default=2.0, help='accuracy of the treecode, larger is more accurate and slower, relative error ~ 0.075/theta^2 at expansion order 0')
+parser.add_argument('--theta_start', type=float, default=None, help='theta of the first iteration, going linearly to --theta at the last (cheap early iterations), default: --theta throughout')
+parser.add_argument('--leaf_size', type=int, default=1, help='max number of points in a leaf of the treecode tree, 16-64 is faster and more accurate than the default 1')
+parser.add_argument('--tight_opening', action='store_true', help='accept far-field tree nodes by the bounding box of their points about the reppoint, instead of the node cube (cpu only)')
+parser.add_argument('--query_packet_size', type=int, default=32, help='walk the treecode tree once per run of up to this many queries close to each other at expansion order 0, 0 or 1 walks once per query (cpu only, up to 64)')
 args = parser.parse_args()
+if args.cache_interaction_lists and args.theta_start is not None and args.theta_start != args.theta:
+    # the lists are built for one theta, a schedule would rebuild them in every iteration
+    parser.error('--cache_interaction_lists cannot be used with a --theta_start schedule')
+wn_treecode.set_num_threads(args.num_threads)
+if args.tight_opening:
+    wn_treecode.set_opening_criterion('tight')
+wn_treecode.set_query_packet_size(args.query_packet_size)
 os.makedirs(args.out_dir, exist_ok=True)
 
 
@@ -55,7 +73,12 @@ if not args.cpu:
     b = b.cuda()
     widths = widths.cuda()
 
-wn_func = wn_treecode.WindingNumberTreecode(points_normalized)
+theta_start = args.theta if args.theta_start is None else args.theta_start
+thetas = [theta_start + (i / max(args.iters-1, 1)) * (args.theta - theta_start) for i in range(args.iters)]
+wn_func = wn_treecode.WindingNumberTreecode(points_normalized, cache_interaction_lists=args.cache_interaction_lists, expansion_order=args.expansion_order, dual_tree=args.dual_tree, theta=thetas[0], leaf_size=args.leaf_size, tree_order=True)
+# the iterations run on the points in the order of the tree, permuted once here and back after the last one
+normals = wn_func.to_tree_order(normals)
+widths = wn_func.to_tree_order(widths)
 
 preset_widths = {
     'l0': [0.002, 0.016],   # [0.002, 0.016]: noise level 0, used for uniform, noise free points in the paper
@@ -79,26 +102,55 @@ if wn_func.is_cuda:
 with torch.no_grad():
     bar = tqdm(range(args.iters)) if args.tqdm else range(args.iters)
 
+    # buffers of the treecode products, reused by all iterations
+    scaled_widths = torch.empty_like(widths)
+    A_mu = torch.empty_like(b)
+    AT_b = torch.empty_like(normals)
+    AT_A_mu = torch.empty_like(normals)
+    r = torch.empty_like(normals)
+    A_r = torch.empty_like(b)
+    G_mu = torch.empty_like(normals)
+
+    width_scales = [wsmin + ((args.iters-1-i) / ((args.iters-1))) * (wsmax - wsmin) for i in range(args.iters)]
+    # width_scales = [args.wsmin + 0.5 * (args.wsmax - args.wsmin) * (1 + math.cos(i/(args.iters-1) * math.pi)) for i in range(args.iters)]
+
+    # b is constant, so AT(b) only depends on the width: that of every iteration in one pass, [N, iters, 3]
+    AT_b_schedule = None
+    if args.cpu and args.expansion_order == 0 and not args.no_precompute_ATb:
+        width_schedule = widths[:, None] * torch.tensor(width_scales, dtype=widths.dtype)[None, :]
+        wn_func.theta = args.theta
+        AT_b_schedule = wn_func.forward_AT_multiwidth(b, width_schedule, in_tree_order=True)
+
     for i in bar:
-        width_scale = wsmin + ((args.iters-1-i) / ((args.iters-1))) * (wsmax - wsmin)
-        # width_scale = args.wsmin + 0.5 * (args.wsmax - args.wsmin) * (1 + math.cos(i/(args.iters-1) * math.pi))
+        width_scale = width_scales[i]
+        torch.mul(widths, width_scale, out=scaled_widths)
+        wn_func.theta = thetas[i]
         
         # grad step
-        A_mu = wn_func.forward_A(normals, widths * width_scale)
-        AT_A_mu = wn_func.forward_AT(A_mu, widths * width_scale)
-        r = wn_func.forward_AT(b, widths * width_scale) - AT_A_mu
-        A_r = wn_func.forward_A(r, widths * width_scale)
+        if AT_b_schedule is not None:
+            wn_func.forward_A(normals, scaled_widths, out=A_mu, in_tree_order=True)
+            AT_b = AT_b_schedule[:, i]
+        elif args.fuse_operators:
+            A_mu, AT_b = wn_func.forward_fused(['A', 'AT'], [normals, b], scaled_widths, in_tree_order=True)
+        else:
+            wn_func.forward_A(normals, scaled_widths, out=A_mu, in_tree_order=True)
+            wn_func.forward_AT(b, scaled_widths, out=AT_b, memoize=True, in_tree_order=True)
+        wn_func.forward_AT(A_mu, scaled_widths, out=AT_A_mu, in_tree_order=True)
+        torch.sub(AT_b, AT_A_mu, out=r)
+        wn_func.forward_A(r, scaled_widths, out=A_r, in_tree_order=True)
         alpha = (r * r).sum() / (A_r * A_r).sum()
         normals = normals + alpha * r
 
         # WNNC step
-        out_normals = wn_func.forward_G(normals, widths * width_scale)
+        out_normals = wn_func.forward_G(normals, scaled_widths, out=G_mu, in_tree_order=True)
 
         # rescale
         out_normals = F.normalize(out_normals, dim=-1).contiguous()
         normals_len = torch.linalg.norm(normals, dim=-1, keepdim=True)
         normals = out_normals.clone() * normals_len
 
+    out_normals = wn_func.from_tree_order(out_normals)
+
 if wn_func.is_cuda:
     torch.cuda.synchronize(device=None)
 time_iter_end = time()